@@ -1046,6 +1046,65 @@ int do_action(struct action* a, struct sip_msg* msg)
 			
 			break;
 
+		case CACHE_ADD_T:
+		case CACHE_SUB_T:
+			if ((a->elem[0].type!=STR_ST) || (a->elem[1].type!=STR_ST) ||
+			(a->elem[2].type!=STR_ST)) {
+				LM_ALERT("BUG in cache_add()/cache_sub() %d\n",
+					a->elem[0].type );
+				ret=E_BUG;
+				break;
+			}
+			int incr, new_val = 0;
+
+			/* parse the name argument */
+			pve = (pv_elem_t *)a->elem[1].u.data;
+			if ( pv_printf_s(msg, pve, &name_s)!=0 ||
+			name_s.len == 0 || name_s.s == NULL) {
+				LM_WARN("cannot get string for value\n");
+				ret=E_BUG;
+				break;
+			}
+
+			/* parse the increment argument */
+			val_s.s = 0; val_s.len = 0;
+			pve = (pv_elem_t *)a->elem[2].u.data;
+			if ( pv_printf_s(msg, pve, &val_s)!=0 ||
+			val_s.len == 0 || val_s.s == NULL ||
+			str2sint(&val_s, &incr) < 0) {
+				LM_ERR("the increment of cache_add()/cache_sub() is not an"
+					" integer [%.*s]\n", val_s.len, val_s.s);
+				ret=E_BUG;
+				break;
+			}
+
+			if (a->type==CACHE_ADD_T)
+				ret = cache_add( &a->elem[0].u.s, &name_s, incr,
+					(unsigned int)a->elem[3].u.number, &new_val);
+			else
+				ret = cache_sub( &a->elem[0].u.s, &name_s, incr,
+					(unsigned int)a->elem[3].u.number, &new_val);
+
+			if(ret > 0 && a->elem[4].type==SCRIPTVAR_ST)
+			{
+				int_str res;
+				int_str avp_name;
+				unsigned short avp_type;
+
+				spec = (pv_spec_t*)a->elem[4].u.data;
+				if (pv_get_avp_name( msg, &(spec->pvp), &avp_name,
+						&avp_type)!=0){
+					LM_CRIT("BUG in getting AVP name\n");
+					return -1;
+				}
+				res.n = new_val;
+				if (add_avp(avp_type, avp_name, res)<0){
+					LM_ERR("cannot add AVP\n");
+					return -1;
+				}
+			}
+			break;
+
 		case XDBG_T:
 			if (a->elem[0].type == SCRIPTVAR_ELEM_ST)
 			{
@@ -100,6 +100,8 @@
 #include "dset.h"
 #include "pvar.h"
 #include "blacklists.h"
+#include "dns_async.h"
+#include "log_async.h"
 #include "xlog.h"
 
 
@@ -276,6 +278,8 @@ extern int line;
 %token CACHE_STORE
 %token CACHE_FETCH
 %token CACHE_REMOVE
+%token CACHE_ADD
+%token CACHE_SUB
 %token XDBG
 %token XLOG
 %token XLOG_BUF_SIZE
@@ -288,6 +292,9 @@ extern int line;
 %token LOGSTDERROR
 %token LOGFACILITY
 %token LOGNAME
+%token LOG_ASYNC
+%token LOG_ASYNC_BUFFER
+%token LOG_ASYNC_FILE
 %token AVP_ALIASES
 %token LISTEN
 %token ALIAS
@@ -299,6 +306,10 @@ extern int line;
 %token DNS_RETR_NO
 %token DNS_SERVERS_NO
 %token DNS_USE_SEARCH
+%token DNS_USE_CACHE
+%token DNS_CACHE_NEG_TTL
+%token DNS_CACHE_MAX_TTL
+%token DNS_ASYNC_PROCS
 %token MAX_WHILE_LOOPS
 %token PORT
 %token CHILDREN
@@ -336,6 +347,9 @@ extern int line;
 %token TCP_POLL_METHOD
 %token TCP_MAX_CONNECTIONS
 %token TCP_OPT_CRLF_PINGPONG
+%token TCP_ASYNC
+%token TCP_ASYNC_MAX_QUEUE
+%token TCP_FD_CACHE_SIZE
 %token DISABLE_TLS
 %token TLSLOG
 %token TLS_PORT_NO
@@ -363,6 +377,9 @@ extern int line;
 %token MCAST_LOOPBACK
 %token MCAST_TTL
 %token TOS
+%token UDP_RCV_BATCH
+%token UDP_REUSE_PORT
+%token UDP_WORKERS_AFFINITY
 %token DISABLE_DNS_FAILOVER
 %token DISABLE_DNS_BLACKLIST
 %token DST_BLACKLIST
@@ -593,6 +610,12 @@ assign_stm: DEBUG EQUAL snumber {
 		| LOGFACILITY EQUAL error { yyerror("ID expected"); }
 		| LOGNAME EQUAL STRING { log_name=$3; }
 		| LOGNAME EQUAL error { yyerror("string value expected"); }
+		| LOG_ASYNC EQUAL NUMBER { log_async=$3; }
+		| LOG_ASYNC EQUAL error { yyerror("boolean value expected"); }
+		| LOG_ASYNC_BUFFER EQUAL NUMBER { log_async_buffer=$3; }
+		| LOG_ASYNC_BUFFER EQUAL error { yyerror("number expected"); }
+		| LOG_ASYNC_FILE EQUAL STRING { log_async_file=$3; }
+		| LOG_ASYNC_FILE EQUAL error { yyerror("string value expected"); }
 		| AVP_ALIASES EQUAL STRING { 
 				if ($3!=0 && $3[0]!=0)
 					if ( add_avp_galias_str($3)!=0 )
@@ -613,6 +636,14 @@ assign_stm: DEBUG EQUAL snumber {
 		| DNS_SERVERS_NO error { yyerror("number expected"); }
 		| DNS_USE_SEARCH EQUAL NUMBER   { dns_search_list=$3; }
 		| DNS_USE_SEARCH error { yyerror("boolean value expected"); }
+		| DNS_USE_CACHE EQUAL NUMBER   { dns_use_cache=$3; }
+		| DNS_USE_CACHE error { yyerror("boolean value expected"); }
+		| DNS_CACHE_NEG_TTL EQUAL NUMBER   { dns_cache_negative_ttl=$3; }
+		| DNS_CACHE_NEG_TTL error { yyerror("number expected"); }
+		| DNS_CACHE_MAX_TTL EQUAL NUMBER   { dns_cache_max_ttl=$3; }
+		| DNS_CACHE_MAX_TTL error { yyerror("number expected"); }
+		| DNS_ASYNC_PROCS EQUAL NUMBER   { dns_async_procs=$3; }
+		| DNS_ASYNC_PROCS error { yyerror("number expected"); }
 		| PORT EQUAL NUMBER   { port_no=$3; }
 		| PORT EQUAL error    { yyerror("number expected"); } 
 		| MAX_WHILE_LOOPS EQUAL NUMBER { max_while_loops=$3; }
@@ -742,6 +773,30 @@ assign_stm: DEBUG EQUAL snumber {
 			#endif
 		}
 		| TCP_OPT_CRLF_PINGPONG EQUAL error { yyerror("boolean value expected"); }
+		| TCP_ASYNC EQUAL NUMBER {
+									#ifdef USE_TCP
+										tcp_async=$3;
+									#else
+										warn("tcp support not compiled in");
+									#endif
+									}
+		| TCP_ASYNC EQUAL error { yyerror("boolean value expected"); }
+		| TCP_ASYNC_MAX_QUEUE EQUAL NUMBER {
+									#ifdef USE_TCP
+										tcp_async_max_queue=$3;
+									#else
+										warn("tcp support not compiled in");
+									#endif
+									}
+		| TCP_ASYNC_MAX_QUEUE EQUAL error { yyerror("number expected"); }
+		| TCP_FD_CACHE_SIZE EQUAL NUMBER {
+									#ifdef USE_TCP
+										tcp_fd_cache_size=$3;
+									#else
+										warn("tcp support not compiled in");
+									#endif
+									}
+		| TCP_FD_CACHE_SIZE EQUAL error { yyerror("number expected"); }
 		| DISABLE_TLS EQUAL NUMBER {
 									#ifdef USE_TLS
 										tls_disable=$3;
@@ -1031,6 +1086,31 @@ assign_stm: DEBUG EQUAL snumber {
 							}
 		 }
 		| TOS EQUAL error { yyerror("number expected"); }
+		| UDP_RCV_BATCH EQUAL NUMBER {
+								#ifdef HAVE_MMSG
+										udp_rcv_batch=$3;
+								#else
+									warn("no recvmmsg support compiled in");
+								#endif
+		  }
+		| UDP_RCV_BATCH EQUAL error { yyerror("number expected"); }
+		| UDP_REUSE_PORT EQUAL NUMBER {
+								#ifdef SO_REUSEPORT
+										udp_reuse_port=$3;
+								#else
+									warn("no SO_REUSEPORT support");
+								#endif
+		  }
+		| UDP_REUSE_PORT EQUAL error { yyerror("boolean value expected"); }
+		| UDP_WORKERS_AFFINITY EQUAL NUMBER {
+								#ifdef HAVE_SCHED_SETAFFINITY
+										udp_workers_affinity=$3;
+								#else
+									warn("no CPU affinity support compiled in");
+								#endif
+		  }
+		| UDP_WORKERS_AFFINITY EQUAL error {
+									yyerror("boolean value expected"); }
 		| MPATH EQUAL STRING { mpath=$3; strcpy(mpath_buf, $3);
 								mpath_len=strlen($3); 
 								if(mpath_buf[mpath_len-1]!='/') {
@@ -2419,6 +2499,58 @@ cmd:	 FORWARD LPAREN STRING RPAREN	{ mk_action2( $$, FORWARD_T,
 													$5,
 													$7);
 							}
+		| CACHE_ADD LPAREN STRING COMMA STRING COMMA STRING COMMA NUMBER
+								RPAREN {
+								elems[0].type = STR_ST;
+								elems[0].u.data = $3;
+								elems[1].type = STR_ST;
+								elems[1].u.data = $5;
+								elems[2].type = STR_ST;
+								elems[2].u.data = $7;
+								elems[3].type = NUMBER_ST;
+								elems[3].u.number = $9;
+								$$ = mk_action(CACHE_ADD_T, 4, elems, line);
+							}
+		| CACHE_ADD LPAREN STRING COMMA STRING COMMA STRING COMMA NUMBER
+								COMMA script_var RPAREN {
+								elems[0].type = STR_ST;
+								elems[0].u.data = $3;
+								elems[1].type = STR_ST;
+								elems[1].u.data = $5;
+								elems[2].type = STR_ST;
+								elems[2].u.data = $7;
+								elems[3].type = NUMBER_ST;
+								elems[3].u.number = $9;
+								elems[4].type = SCRIPTVAR_ST;
+								elems[4].u.data = $11;
+								$$ = mk_action(CACHE_ADD_T, 5, elems, line);
+							}
+		| CACHE_SUB LPAREN STRING COMMA STRING COMMA STRING COMMA NUMBER
+								RPAREN {
+								elems[0].type = STR_ST;
+								elems[0].u.data = $3;
+								elems[1].type = STR_ST;
+								elems[1].u.data = $5;
+								elems[2].type = STR_ST;
+								elems[2].u.data = $7;
+								elems[3].type = NUMBER_ST;
+								elems[3].u.number = $9;
+								$$ = mk_action(CACHE_SUB_T, 4, elems, line);
+							}
+		| CACHE_SUB LPAREN STRING COMMA STRING COMMA STRING COMMA NUMBER
+								COMMA script_var RPAREN {
+								elems[0].type = STR_ST;
+								elems[0].u.data = $3;
+								elems[1].type = STR_ST;
+								elems[1].u.data = $5;
+								elems[2].type = STR_ST;
+								elems[2].u.data = $7;
+								elems[3].type = NUMBER_ST;
+								elems[3].u.number = $9;
+								elems[4].type = SCRIPTVAR_ST;
+								elems[4].u.data = $11;
+								$$ = mk_action(CACHE_SUB_T, 5, elems, line);
+							}
 		| ID LPAREN RPAREN		{
 						 			cmd_tmp=(void*)find_cmd_export_t($1, 0, rt);
 									if (cmd_tmp==0){
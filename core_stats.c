@@ -41,6 +41,7 @@
 #include <sys/types.h>
 #include <signal.h>
 #include "socket_info.h"
+#include "log_async.h"
 
 
 #ifdef STATISTICS
@@ -72,12 +73,17 @@ stat_export_t core_stats[] = {
 	{"unsupported_methods",   0,  &unsupported_methods   },
 	{"bad_msg_hdr",           0,  &bad_msg_hdr           },
 	{"timestamp",  STAT_IS_FUNC, (stat_var**)get_ticks   },
+	{"dropped_logs", STAT_IS_FUNC, (stat_var**)log_async_dropped },
 	{0,0,0}
 };
 
 
 
 /*************************** NET statistics *********************************/
+#ifdef USE_TCP
+stat_var* tcp_async_queued;
+stat_var* tcp_async_drops;
+#endif
 
 static unsigned long net_get_wb_udp(unsigned short foo)
 {
@@ -102,6 +108,8 @@ stat_export_t net_stats[] = {
 	{"waiting_udp" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_udp    },
 #ifdef USE_TCP
 	{"waiting_tcp" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_tcp    },
+	{"tcp_async_queued",  STAT_NO_RESET, &tcp_async_queued           },
+	{"tcp_async_dropped", 0,             &tcp_async_drops            },
 #endif
 #ifdef USE_TLS
 	{"waiting_tls" ,    STAT_IS_FUNC,  (stat_var**)net_get_wb_tls    },
@@ -76,6 +76,14 @@ extern stat_var* unsupported_methods;
 /*! \brief Set in get_hdr_field(). */
 extern stat_var* bad_msg_hdr;
 
+#ifdef USE_TCP
+/*! \brief bytes waiting in the TCP async write queues */
+extern stat_var* tcp_async_queued;
+
+/*! \brief TCP sends refused because of a full async write queue */
+extern stat_var* tcp_async_drops;
+#endif
+
 #ifdef PKG_MALLOC
 int init_pkg_stats(int no_procs);
 
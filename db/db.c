@@ -144,6 +144,10 @@ int db_check_api(db_func_t* dbf, char *mname)
 	if (dbf->insert_update) {
 		dbf->cap |= DB_CAP_INSERT_UPDATE;
 	}
+
+	if (dbf->insert_multi) {
+		dbf->cap |= DB_CAP_MULTIPLE_INSERT;
+	}
 	return 0;
 error:
 	return -1;
@@ -234,6 +238,8 @@ int db_bind_mod(const str* mod, db_func_t* mydbf)
 			"db_last_inserted_id", 1, 0);
 		dbf.insert_update = (db_insert_update_f)find_mod_export(tmp,
 			"db_insert_update", 2, 0);
+		dbf.insert_multi = (db_insert_multi_f)find_mod_export(tmp,
+			"db_insert_multi", 2, 0);
 	}
 	if(db_check_api(&dbf, tmp)!=0)
 		goto error;
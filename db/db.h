@@ -276,6 +276,22 @@ typedef int (*db_insert_update_f) (const db_con_t* _h, const db_key_t* _k,
 				const db_val_t* _v, const int _n);
 
 
+/**
+ * \brief Insert several rows into the specified table.
+ *
+ * Same as db_insert_f, but the rows are inserted with as few queries as
+ * possible (multi-row INSERT statements).
+ * \param _h database connection handle
+ * \param _k array of keys (column names), the same for all the rows
+ * \param _v array of values, the _n values of each row one after another
+ * \param _n number of key=value pairs of a row
+ * \param _nr number of rows
+ * \return returns 0 if everything is OK, otherwise returns value < 0
+ */
+typedef int (*db_insert_multi_f) (const db_con_t* _h, const db_key_t* _k,
+				const db_val_t* _v, const int _n, const int _nr);
+
+
 /**
  * \brief Database module callbacks
  * 
@@ -299,6 +315,7 @@ typedef struct db_func {
 	db_last_inserted_id_f  last_inserted_id;  /* Retrieve the last inserted ID
 	                                            in a table */
 	db_insert_update_f insert_update; /* Insert into table, update on duplicate key */ 
+	db_insert_multi_f insert_multi;  /* Insert several rows into table */
 } db_func_t;
 
 
@@ -46,14 +46,16 @@ typedef enum db_cap {
 	DB_CAP_REPLACE =   1 << 5,  /**< driver can replace (also known as INSERT OR UPDATE) data       */
 	DB_CAP_FETCH   =   1 << 6,  /**< driver supports fetch result queries                           */
 	DB_CAP_LAST_INSERTED_ID = 1 << 7,  /**< driver can return the ID of the last insert operation   */
- 	DB_CAP_INSERT_UPDATE = 1 << 8 /**< driver can insert data into database and update on duplicate */
+ 	DB_CAP_INSERT_UPDATE = 1 << 8, /**< driver can insert data into database and update on duplicate */
+	DB_CAP_MULTIPLE_INSERT = 1 << 9 /**< driver can insert several rows with one query               */
 
 } db_cap_t;
 
 
 /**
- * All database capabilities except raw_query, replace, insert_update and 
- * last_inserted_id which should be checked separately when needed
+ * All database capabilities except raw_query, replace, insert_update,
+ * multiple_insert and last_inserted_id which should be checked separately
+ * when needed
  */
 #define DB_CAP_ALL (DB_CAP_QUERY | DB_CAP_INSERT | DB_CAP_DELETE | DB_CAP_UPDATE)
 
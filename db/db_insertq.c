@@ -0,0 +1,362 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file db/db_insertq.c
+ * \brief Buffered (multi-row) inserts
+ *
+ * Each queued row is a single shm chunk holding the values and the
+ * strings they point to. The rows of a table are detached from the queue
+ * under the lock and written outside of it, so the other processes are
+ * not kept waiting for the database.
+ */
+
+#include <string.h>
+
+#include "../dprint.h"
+#include "../mem/mem.h"
+#include "../mem/shm_mem.h"
+#include "../locking.h"
+#include "../timer.h"
+#include "db_insertq.h"
+
+
+struct db_insert_list {
+	str table;                    /**< table the rows go to */
+	db_val_t** rows;              /**< queued rows */
+	int nr;                       /**< number of queued rows */
+	utime_t first;                /**< when the oldest row was queued */
+	struct db_insert_list* next;
+};
+
+struct db_insert_queue {
+	gen_lock_t lock;
+	db_key_t* keys;               /**< columns of the rows */
+	int n;                        /**< number of columns */
+	int max_rows;
+	utime_t max_age;              /**< microseconds */
+	struct db_insert_list* lists; /**< one per table */
+};
+
+
+db_insert_queue_t* db_insert_queue_new(const db_key_t* _k, const int _n,
+		const int max_rows, const unsigned int max_ms)
+{
+	db_insert_queue_t* q;
+
+	if (!_k || _n <= 0 || max_rows <= 0) {
+		LM_ERR("invalid parameter value\n");
+		return 0;
+	}
+
+	q = (db_insert_queue_t*)shm_malloc(sizeof(db_insert_queue_t) +
+		_n * sizeof(db_key_t));
+	if (!q) {
+		LM_ERR("no more shm memory\n");
+		return 0;
+	}
+	memset(q, 0, sizeof(db_insert_queue_t));
+
+	q->keys = (db_key_t*)(q + 1);
+	memcpy(q->keys, _k, _n * sizeof(db_key_t));
+	q->n = _n;
+	q->max_rows = max_rows;
+	q->max_age = (utime_t)max_ms * 1000;
+
+	if (!lock_init(&q->lock)) {
+		LM_ERR("failed to init lock\n");
+		shm_free(q);
+		return 0;
+	}
+
+	return q;
+}
+
+
+db_val_t* db_insert_row_dup(const db_val_t* _v, const int _n)
+{
+	db_val_t* row;
+	char* p;
+	int i, len;
+
+	len = _n * sizeof(db_val_t);
+	for (i = 0; i < _n; i++) {
+		if (VAL_NULL(_v + i))
+			continue;
+		switch (VAL_TYPE(_v + i)) {
+		case DB_STRING:
+			len += strlen(VAL_STRING(_v + i)) + 1;
+			break;
+		case DB_STR:
+		case DB_BLOB:
+			len += VAL_STR(_v + i).len;
+			break;
+		default:
+			break;
+		}
+	}
+
+	row = (db_val_t*)shm_malloc(len);
+	if (!row) {
+		LM_ERR("no more shm memory\n");
+		return 0;
+	}
+	memcpy(row, _v, _n * sizeof(db_val_t));
+	p = (char*)(row + _n);
+
+	for (i = 0; i < _n; i++) {
+		row[i].free = 0;
+		if (VAL_NULL(row + i))
+			continue;
+		switch (VAL_TYPE(row + i)) {
+		case DB_STRING:
+			len = strlen(VAL_STRING(_v + i)) + 1;
+			memcpy(p, VAL_STRING(_v + i), len);
+			VAL_STRING(row + i) = p;
+			p += len;
+			break;
+		case DB_STR:
+		case DB_BLOB:
+			memcpy(p, VAL_STR(_v + i).s, VAL_STR(_v + i).len);
+			VAL_STR(row + i).s = p;
+			p += VAL_STR(_v + i).len;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return row;
+}
+
+
+static struct db_insert_list* db_insert_list_get(db_insert_queue_t* q,
+		const str* table)
+{
+	struct db_insert_list* l;
+
+	for (l = q->lists; l; l = l->next)
+		if (l->table.len == table->len &&
+		memcmp(l->table.s, table->s, table->len) == 0)
+			return l;
+
+	l = (struct db_insert_list*)shm_malloc(sizeof(struct db_insert_list) +
+		q->max_rows * sizeof(db_val_t*) + table->len);
+	if (!l) {
+		LM_ERR("no more shm memory\n");
+		return 0;
+	}
+	memset(l, 0, sizeof(struct db_insert_list));
+
+	l->rows = (db_val_t**)(l + 1);
+	l->table.s = (char*)(l->rows + q->max_rows);
+	memcpy(l->table.s, table->s, table->len);
+	l->table.len = table->len;
+
+	l->next = q->lists;
+	q->lists = l;
+
+	return l;
+}
+
+
+int db_insert_rows(const db_func_t* dbf, db_con_t* _h, const str* table,
+		const db_key_t* _k, const int _n, db_val_t** rows, const int nr)
+{
+	db_val_t* vals;
+	int i, ret;
+
+	ret = -1;
+	if (!_h) {
+		LM_ERR("no database connection, %d rows lost\n", nr);
+		goto done;
+	}
+
+	if (dbf->use_table(_h, table) < 0) {
+		LM_ERR("failed to use table %.*s, %d rows lost\n",
+			table->len, table->s, nr);
+		goto done;
+	}
+
+	if (!dbf->insert_multi || nr == 1) {
+		for (i = 0, ret = 0; i < nr; i++)
+			if (dbf->insert(_h, _k, rows[i], _n) < 0)
+				ret = -1;
+		if (ret < 0)
+			LM_ERR("failed to insert rows into %.*s\n", table->len, table->s);
+		goto done;
+	}
+
+	vals = (db_val_t*)pkg_malloc(nr * _n * sizeof(db_val_t));
+	if (!vals) {
+		LM_ERR("no more pkg memory, %d rows lost\n", nr);
+		goto done;
+	}
+	for (i = 0; i < nr; i++)
+		memcpy(vals + i * _n, rows[i], _n * sizeof(db_val_t));
+
+	ret = dbf->insert_multi(_h, _k, vals, _n, nr);
+	if (ret < 0)
+		LM_ERR("failed to insert %d rows into %.*s\n",
+			nr, table->len, table->s);
+
+	pkg_free(vals);
+
+done:
+	for (i = 0; i < nr; i++)
+		shm_free(rows[i]);
+	return ret;
+}
+
+
+/*
+ * Detach the rows of a list; must be called with the lock held
+ */
+static inline int db_insert_list_detach(struct db_insert_list* l,
+		db_val_t** rows)
+{
+	int nr;
+
+	nr = l->nr;
+	memcpy(rows, l->rows, nr * sizeof(db_val_t*));
+	l->nr = 0;
+
+	return nr;
+}
+
+
+int db_insert_queue_add(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h, const str* table, const db_val_t* _v)
+{
+	struct db_insert_list* l;
+	db_val_t** rows;
+	db_val_t* row;
+	int nr;
+
+	if (!q || !dbf || !table || !_v) {
+		LM_ERR("invalid parameter value\n");
+		return -1;
+	}
+
+	row = db_insert_row_dup(_v, q->n);
+	if (!row)
+		return -1;
+
+	lock_get(&q->lock);
+
+	l = db_insert_list_get(q, table);
+	if (!l) {
+		lock_release(&q->lock);
+		shm_free(row);
+		return -1;
+	}
+
+	if (l->nr == 0)
+		l->first = get_uticks();
+	l->rows[l->nr++] = row;
+
+	if (l->nr < q->max_rows) {
+		lock_release(&q->lock);
+		return 0;
+	}
+
+	/* full -> write it from this process */
+	rows = (db_val_t**)pkg_malloc(q->max_rows * sizeof(db_val_t*));
+	if (!rows) {
+		/* keep the other rows, the timer will write them */
+		l->nr--;
+		lock_release(&q->lock);
+		shm_free(row);
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+	nr = db_insert_list_detach(l, rows);
+
+	lock_release(&q->lock);
+
+	nr = db_insert_rows(dbf, _h, &l->table, q->keys, q->n, rows, nr);
+	pkg_free(rows);
+
+	return nr;
+}
+
+
+int db_insert_queue_flush(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h, const int all)
+{
+	struct db_insert_list* l;
+	db_val_t** rows;
+	utime_t now;
+	int nr, ret;
+
+	if (!q || !dbf) {
+		LM_ERR("invalid parameter value\n");
+		return -1;
+	}
+
+	rows = (db_val_t**)pkg_malloc(q->max_rows * sizeof(db_val_t*));
+	if (!rows) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+
+	ret = 0;
+	now = get_uticks();
+
+	/* the lists are never removed, so they can be walked unlocked */
+	for (l = q->lists; l; l = l->next) {
+		if (l->nr == 0 || (!all && now - l->first < q->max_age))
+			continue;
+
+		lock_get(&q->lock);
+		nr = db_insert_list_detach(l, rows);
+		lock_release(&q->lock);
+
+		if (nr && db_insert_rows(dbf, _h, &l->table, q->keys, q->n, rows, nr) < 0)
+			ret = -1;
+	}
+
+	pkg_free(rows);
+	return ret;
+}
+
+
+void db_insert_queue_destroy(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h)
+{
+	struct db_insert_list* l;
+
+	if (!q)
+		return;
+
+	/* no other process left, the lock may be held by a dead one */
+	while (q->lists) {
+		l = q->lists;
+		q->lists = l->next;
+		if (l->nr)
+			db_insert_rows(dbf, _h, &l->table, q->keys, q->n, l->rows, l->nr);
+		shm_free(l);
+	}
+
+	lock_destroy(&q->lock);
+	shm_free(q);
+}
@@ -0,0 +1,132 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file db/db_insertq.h
+ * \brief Buffered (multi-row) inserts
+ *
+ * The rows added to an insert queue are copied in shared memory and
+ * written later, all at once, with the multiple insert function of the
+ * database driver: when the queue of the table is full (by the process
+ * adding the row), when the oldest queued row is too old (from a timer
+ * of the module) and at shutdown. All the rows of a queue have the same
+ * columns; there is a list of rows per table.
+ */
+
+#ifndef DB_INSERTQ_H
+#define DB_INSERTQ_H
+
+#include "../str.h"
+#include "db.h"
+
+
+typedef struct db_insert_queue db_insert_queue_t;
+
+
+/**
+ * \brief Create a new insert queue
+ *
+ * Must be called before forking, the keys must be valid in all the
+ * processes (static or allocated before forking).
+ * \param _k column names of the queued rows
+ * \param _n number of columns
+ * \param max_rows number of rows of a table written at once
+ * \param max_ms milliseconds a row may wait in the queue
+ * \return the new queue or NULL on error
+ */
+db_insert_queue_t* db_insert_queue_new(const db_key_t* _k, const int _n,
+		const int max_rows, const unsigned int max_ms);
+
+
+/**
+ * \brief Queue a row for insertion into a table
+ *
+ * The row is written (together with the rows already queued for the
+ * table) over the given connection if the queue of the table gets full.
+ * \param q insert queue
+ * \param dbf database functions
+ * \param _h database connection
+ * \param table name of the table
+ * \param _v values of the row
+ * \return zero on success, negative on errors
+ */
+int db_insert_queue_add(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h, const str* table, const db_val_t* _v);
+
+
+/**
+ * \brief Write the queued rows
+ *
+ * Intended to be called from a timer of the module, with its own
+ * connection.
+ * \param q insert queue
+ * \param dbf database functions
+ * \param _h database connection
+ * \param all if zero, only the tables whose oldest row is too old are
+ * written
+ * \return zero on success, negative on errors
+ */
+int db_insert_queue_flush(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h, const int all);
+
+
+/**
+ * \brief Write the remaining rows and free the queue
+ *
+ * To be called at shutdown, when there is no other process using the
+ * queue. If there is no connection the rows are discarded.
+ * \param q insert queue
+ * \param dbf database functions
+ * \param _h database connection, may be NULL
+ */
+void db_insert_queue_destroy(db_insert_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h);
+
+
+/**
+ * \brief Copy a row, with its strings, in a single shm chunk
+ * \param _v values of the row
+ * \param _n number of values
+ * \return the copy (to be released with shm_free) or NULL on error
+ */
+db_val_t* db_insert_row_dup(const db_val_t* _v, const int _n);
+
+
+/**
+ * \brief Write rows (copied with db_insert_row_dup) and free them
+ *
+ * The rows are written with the multiple insert function of the driver,
+ * if it has one.
+ * \param dbf database functions
+ * \param _h database connection, if NULL the rows are discarded
+ * \param table name of the table
+ * \param _k column names
+ * \param _n number of columns
+ * \param rows rows to write
+ * \param nr number of rows
+ * \return zero on success, negative on errors
+ */
+int db_insert_rows(const db_func_t* dbf, db_con_t* _h, const str* table,
+		const db_key_t* _k, const int _n, db_val_t** rows, const int nr);
+
+
+#endif /* DB_INSERTQ_H */
@@ -32,6 +32,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "../dprint.h"
 #include "db_ut.h"
 #include "db_query.h"
@@ -186,6 +187,77 @@ error:
 }
 
 
+int db_do_insert_multi(const db_con_t* _h, const db_key_t* _k,
+	const db_val_t* _v, const int _n, const int _nr,
+	int (*val2str) (const db_con_t*, const db_val_t*, char*, int*),
+	int (*submit_query)(const db_con_t* _h, const str* _c))
+{
+	static char row_buf[SQL_BUF_LEN];
+	int off, head, ret, r, rows;
+
+	if (!_h || !_k || !_v || !_n || _nr<=0 || !val2str || !submit_query) {
+		LM_ERR("invalid parameter value\n");
+		return -1;
+	}
+
+	ret = snprintf(sql_buf, SQL_BUF_LEN, "insert into %.*s (", CON_TABLE(_h)->len, CON_TABLE(_h)->s);
+	if (ret < 0 || ret >= SQL_BUF_LEN) goto error;
+	off = ret;
+
+	ret = db_print_columns(sql_buf + off, SQL_BUF_LEN - off, _k, _n);
+	if (ret < 0) return -1;
+	off += ret;
+
+	ret = snprintf(sql_buf + off, SQL_BUF_LEN - off, ") values ");
+	if (ret < 0 || ret >= (SQL_BUF_LEN - off)) goto error;
+	off += ret;
+	/* the statement header is reused for all the queries */
+	head = off;
+
+	for (r = 0, rows = 0; r < _nr; r++) {
+		/* print the row aside, so a full statement can be sent first */
+		row_buf[0] = '(';
+		ret = db_print_values(_h, row_buf + 1, SQL_BUF_LEN - 2, _v + r*_n, _n, val2str);
+		if (ret < 0) return -1;
+		row_buf[++ret] = ')';
+		ret++;
+
+		if (off + ret + 2 > SQL_BUF_LEN) {
+			if (rows == 0) goto error;
+			sql_buf[off] = '\0';
+			sql_str.s = sql_buf;
+			sql_str.len = off;
+			if (submit_query(_h, &sql_str) < 0) {
+				LM_ERR("error while submitting query\n");
+				return -2;
+			}
+			off = head;
+			rows = 0;
+		}
+
+		if (rows)
+			sql_buf[off++] = ',';
+		memcpy(sql_buf + off, row_buf, ret);
+		off += ret;
+		rows++;
+	}
+
+	sql_buf[off] = '\0';
+	sql_str.s = sql_buf;
+	sql_str.len = off;
+
+	if (submit_query(_h, &sql_str) < 0) {
+		LM_ERR("error while submitting query\n");
+		return -2;
+	}
+	return 0;
+
+error:
+	LM_ERR("error while preparing multiple insert operation\n");
+	return -1;
+}
+
+
 int db_do_delete(const db_con_t* _h, const db_key_t* _k, const db_op_t* _o,
 	const db_val_t* _v, const int _n, int (*val2str) (const db_con_t*,
 	const db_val_t*, char*, int*), int (*submit_query)(const db_con_t* _h,
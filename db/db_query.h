@@ -113,6 +113,28 @@ int db_do_insert(const db_con_t* _h, const db_key_t* _k, const db_val_t* _v,
 	int (*submit_query)(const db_con_t* _h, const str* _c));
 
 
+/**
+ * \brief Helper function for db multiple insert operations
+ *
+ * Same as db_do_insert, but inserts _nr rows with a single statement.
+ * If the rows do not fit in the query buffer, the statement is split
+ * and submitted in several queries.
+ *
+ * \param _h structure representing database connection
+ * \param _k key names
+ * \param _v values of the keys, the _n values of each row one after another
+ * \param _n number of key/value pairs of a row
+ * \param _nr number of rows
+ * \param (*val2str) function pointer to the db specific val conversion function
+ * \param (*submit_query) function pointer to the db specific query submit function
+ * \return zero on success, negative on errors
+ */
+int db_do_insert_multi(const db_con_t* _h, const db_key_t* _k,
+	const db_val_t* _v, const int _n, const int _nr,
+	int (*val2str) (const db_con_t*, const db_val_t*, char*, int*),
+	int (*submit_query)(const db_con_t* _h, const str* _c));
+
+
 /**
  * \brief Helper function for db delete operations
  *
@@ -0,0 +1,440 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file db/db_writeq.c
+ * \brief Asynchronous inserts, done by dedicated writer processes
+ *
+ * The queue is a FIFO list of rows, each row with the name of its table.
+ * A writer takes up to a batch of rows at once and writes the consecutive
+ * rows of the same table with a single (multi-row) insert.
+ *
+ * The spilled rows are appended to the spill file one per line: the table
+ * name followed by the values, TAB separated, with \N for NULL and the
+ * TAB, newline and backslash characters escaped with a backslash (the
+ * default format of LOAD DATA INFILE / COPY).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../dprint.h"
+#include "../mem/mem.h"
+#include "../mem/shm_mem.h"
+#include "../locking.h"
+#include "db_insertq.h"
+#include "db_writeq.h"
+
+
+struct db_write_item {
+	str table;
+	db_val_t* row;
+	struct db_write_item* next;
+};
+
+struct db_write_queue {
+	gen_lock_t lock;
+	db_key_t* keys;               /**< columns of the rows */
+	int n;                        /**< number of columns */
+	int max_rows;
+	int batch;
+	int policy;
+	char* spill_file;
+	struct db_write_item* first;
+	struct db_write_item* last;
+	unsigned long nr;             /**< rows in the queue */
+	unsigned long dropped;
+	unsigned long spilled;
+};
+
+/* per process */
+static int spill_fd = -1;
+static volatile int writer_stop = 0;
+
+
+db_write_queue_t* db_write_queue_new(const db_key_t* _k, const int _n,
+		const int max_rows, const int batch, const int policy,
+		const char* spill_file)
+{
+	db_write_queue_t* q;
+	int len;
+
+	if (!_k || _n <= 0 || max_rows <= 0 || batch <= 0 ||
+	(policy == DB_WQ_SPILL && !spill_file)) {
+		LM_ERR("invalid parameter value\n");
+		return 0;
+	}
+
+	len = (policy == DB_WQ_SPILL) ? strlen(spill_file) + 1 : 0;
+	q = (db_write_queue_t*)shm_malloc(sizeof(db_write_queue_t) +
+		_n * sizeof(db_key_t) + len);
+	if (!q) {
+		LM_ERR("no more shm memory\n");
+		return 0;
+	}
+	memset(q, 0, sizeof(db_write_queue_t));
+
+	q->keys = (db_key_t*)(q + 1);
+	memcpy(q->keys, _k, _n * sizeof(db_key_t));
+	q->n = _n;
+	q->max_rows = max_rows;
+	q->batch = batch;
+	q->policy = policy;
+	if (len) {
+		q->spill_file = (char*)(q->keys + _n);
+		memcpy(q->spill_file, spill_file, len);
+	}
+
+	if (!lock_init(&q->lock)) {
+		LM_ERR("failed to init lock\n");
+		shm_free(q);
+		return 0;
+	}
+
+	return q;
+}
+
+
+int db_write_queue_policy(const char* name)
+{
+	if (strcasecmp(name, "drop") == 0)
+		return DB_WQ_DROP;
+	if (strcasecmp(name, "block") == 0)
+		return DB_WQ_BLOCK;
+	if (strcasecmp(name, "spill") == 0)
+		return DB_WQ_SPILL;
+	return -1;
+}
+
+
+static inline char* spill_str(char* p, const char* s, int len)
+{
+	for (; len > 0; len--, s++) {
+		switch (*s) {
+		case '\t': *(p++) = '\\'; *(p++) = 't'; break;
+		case '\n': *(p++) = '\\'; *(p++) = 'n'; break;
+		case '\r': *(p++) = '\\'; *(p++) = 'r'; break;
+		case '\\': *(p++) = '\\'; *(p++) = '\\'; break;
+		case '\0': *(p++) = '\\'; *(p++) = '0'; break;
+		default: *(p++) = *s;
+		}
+	}
+	return p;
+}
+
+
+/*
+ * Append a row to the spill file, with a single write
+ */
+static int db_write_queue_spill(db_write_queue_t* q, const str* table,
+		const db_val_t* _v)
+{
+	char *buf, *p;
+	struct tm* t;
+	int i, len, n;
+
+	if (spill_fd < 0) {
+		spill_fd = open(q->spill_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if (spill_fd < 0) {
+			LM_ERR("failed to open %s: %s\n", q->spill_file, strerror(errno));
+			return -1;
+		}
+	}
+
+	/* escaping at most doubles the strings */
+	len = 2 * table->len + 1;
+	for (i = 0; i < q->n; i++) {
+		len += 32;
+		if (VAL_NULL(_v + i))
+			continue;
+		if (VAL_TYPE(_v + i) == DB_STRING)
+			len += 2 * strlen(VAL_STRING(_v + i));
+		else if (VAL_TYPE(_v + i) == DB_STR || VAL_TYPE(_v + i) == DB_BLOB)
+			len += 2 * VAL_STR(_v + i).len;
+	}
+
+	buf = (char*)pkg_malloc(len);
+	if (!buf) {
+		LM_ERR("no more pkg memory\n");
+		return -1;
+	}
+
+	p = spill_str(buf, table->s, table->len);
+	for (i = 0; i < q->n; i++) {
+		*(p++) = '\t';
+		if (VAL_NULL(_v + i)) {
+			*(p++) = '\\';
+			*(p++) = 'N';
+			continue;
+		}
+		switch (VAL_TYPE(_v + i)) {
+		case DB_INT:
+			p += sprintf(p, "%d", VAL_INT(_v + i));
+			break;
+		case DB_BITMAP:
+			p += sprintf(p, "%u", VAL_BITMAP(_v + i));
+			break;
+		case DB_DOUBLE:
+			p += sprintf(p, "%.6f", VAL_DOUBLE(_v + i));
+			break;
+		case DB_DATETIME:
+			t = localtime(&VAL_TIME(_v + i));
+			p += strftime(p, 32, "%Y-%m-%d %H:%M:%S", t);
+			break;
+		case DB_STRING:
+			p = spill_str(p, VAL_STRING(_v + i), strlen(VAL_STRING(_v + i)));
+			break;
+		case DB_STR:
+		case DB_BLOB:
+			p = spill_str(p, VAL_STR(_v + i).s, VAL_STR(_v + i).len);
+			break;
+		}
+	}
+	*(p++) = '\n';
+
+	do {
+		n = write(spill_fd, buf, p - buf);
+	} while (n < 0 && errno == EINTR);
+	pkg_free(buf);
+
+	if (n < 0) {
+		LM_ERR("failed to write to %s: %s\n", q->spill_file, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+int db_write_queue_add(db_write_queue_t* q, const str* table,
+		const db_val_t* _v)
+{
+	struct db_write_item* it;
+
+	if (!q || !table || !_v) {
+		LM_ERR("invalid parameter value\n");
+		return -1;
+	}
+
+	/* the copy is done unlocked */
+	it = (struct db_write_item*)shm_malloc(sizeof(struct db_write_item) +
+		table->len);
+	if (!it) {
+		LM_ERR("no more shm memory\n");
+		goto error;
+	}
+	it->row = db_insert_row_dup(_v, q->n);
+	if (!it->row) {
+		shm_free(it);
+		goto error;
+	}
+	it->table.s = (char*)(it + 1);
+	memcpy(it->table.s, table->s, table->len);
+	it->table.len = table->len;
+	it->next = 0;
+
+	lock_get(&q->lock);
+	while (q->nr >= q->max_rows) {
+		if (q->policy == DB_WQ_BLOCK) {
+			lock_release(&q->lock);
+			usleep(DB_WQ_WAIT);
+			lock_get(&q->lock);
+			continue;
+		}
+		if (q->policy == DB_WQ_SPILL)
+			q->spilled++;
+		else
+			q->dropped++;
+		lock_release(&q->lock);
+
+		shm_free(it->row);
+		shm_free(it);
+		if (q->policy == DB_WQ_SPILL)
+			return db_write_queue_spill(q, table, _v);
+		return -1;
+	}
+
+	if (q->last)
+		q->last->next = it;
+	else
+		q->first = it;
+	q->last = it;
+	q->nr++;
+	lock_release(&q->lock);
+
+	return 0;
+error:
+	lock_get(&q->lock);
+	q->dropped++;
+	lock_release(&q->lock);
+	return -1;
+}
+
+
+/*
+ * Write a list of items, the consecutive rows of a table at once
+ */
+static void db_write_items(db_write_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h, struct db_write_item* it, db_val_t** rows)
+{
+	struct db_write_item *first, *next;
+	int nr;
+
+	while (it) {
+		first = it;
+		for (nr = 0; it && it->table.len == first->table.len &&
+		memcmp(it->table.s, first->table.s, first->table.len) == 0;
+		it = it->next)
+			rows[nr++] = it->row;
+
+		db_insert_rows(dbf, _h, &first->table, q->keys, q->n, rows, nr);
+
+		for (; first != it; first = next) {
+			next = first->next;
+			shm_free(first);
+		}
+	}
+}
+
+
+/*
+ * Detach up to a batch of items from the queue
+ */
+static struct db_write_item* db_write_queue_take(db_write_queue_t* q)
+{
+	struct db_write_item *first, *it;
+	int nr;
+
+	lock_get(&q->lock);
+	first = q->first;
+	for (it = first, nr = 1; it && it->next && nr < q->batch; nr++)
+		it = it->next;
+	if (it) {
+		q->first = it->next;
+		if (q->first == 0)
+			q->last = 0;
+		it->next = 0;
+		q->nr -= nr;
+	}
+	lock_release(&q->lock);
+
+	return first;
+}
+
+
+static void db_writer_sig(int signo)
+{
+	writer_stop = 1;
+}
+
+
+void db_write_queue_run(db_write_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h)
+{
+	struct db_write_item* it;
+	db_val_t** rows;
+
+	rows = (db_val_t**)pkg_malloc(q->batch * sizeof(db_val_t*));
+	if (!rows) {
+		LM_ERR("no more pkg memory\n");
+		exit(-1);
+	}
+
+	/* finish the current batch before exiting */
+	signal(SIGTERM, db_writer_sig);
+
+	for (;;) {
+		it = db_write_queue_take(q);
+		if (it)
+			db_write_items(q, dbf, _h, it, rows);
+
+		if (writer_stop)
+			exit(0);
+		if (!it)
+			usleep(DB_WQ_IDLE);
+	}
+}
+
+
+void db_write_queue_destroy(db_write_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h)
+{
+	struct db_write_item *it, *last;
+	db_val_t** rows;
+	int nr;
+
+	if (!q)
+		return;
+
+	rows = (db_val_t**)pkg_malloc(q->batch * sizeof(db_val_t*));
+	if (!rows)
+		LM_ERR("no more pkg memory, %lu rows lost\n", q->nr);
+
+	/* no other process left, the lock may be held by a dead one */
+	while ((it = q->first) != 0) {
+		for (last = it, nr = 1; last->next && nr < q->batch; nr++)
+			last = last->next;
+		q->first = last->next;
+		last->next = 0;
+
+		if (rows) {
+			db_write_items(q, dbf, _h, it, rows);
+			continue;
+		}
+		for (; it; it = last) {
+			last = it->next;
+			shm_free(it->row);
+			shm_free(it);
+		}
+	}
+	if (rows)
+		pkg_free(rows);
+
+	if (spill_fd >= 0)
+		close(spill_fd);
+
+	lock_destroy(&q->lock);
+	shm_free(q);
+}
+
+
+unsigned long db_write_queue_depth(db_write_queue_t* q)
+{
+	return q ? q->nr : 0;
+}
+
+
+unsigned long db_write_queue_dropped(db_write_queue_t* q)
+{
+	return q ? q->dropped : 0;
+}
+
+
+unsigned long db_write_queue_spilled(db_write_queue_t* q)
+{
+	return q ? q->spilled : 0;
+}
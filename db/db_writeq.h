@@ -0,0 +1,130 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * \file db/db_writeq.h
+ * \brief Asynchronous inserts, done by dedicated writer processes
+ *
+ * The processes producing rows only copy them in a shared memory queue;
+ * the rows are written to the database by a pool of writer processes
+ * (exported by the module as extra processes), in batches if the driver
+ * supports multiple inserts. When the queue is full the new rows are
+ * dropped, the producer waits for space or the rows are appended to a
+ * spill file, according to the policy of the queue.
+ */
+
+#ifndef DB_WRITEQ_H
+#define DB_WRITEQ_H
+
+#include "../str.h"
+#include "db.h"
+
+
+/** what to do with a row when the queue is full */
+enum db_writeq_policy {
+	DB_WQ_DROP = 0,   /**< discard the row */
+	DB_WQ_BLOCK,      /**< wait for a writer to make space */
+	DB_WQ_SPILL       /**< append the row to the spill file */
+};
+
+/** sleep (us) of an idle writer */
+#define DB_WQ_IDLE    10000
+/** sleep (us) of a producer waiting for space */
+#define DB_WQ_WAIT    1000
+
+
+typedef struct db_write_queue db_write_queue_t;
+
+
+/**
+ * \brief Create a new write queue
+ *
+ * Must be called before forking, the keys must be valid in all the
+ * processes (static or allocated before forking).
+ * \param _k column names of the queued rows
+ * \param _n number of columns
+ * \param max_rows maximum number of rows in the queue
+ * \param batch maximum number of rows of a table written at once
+ * \param policy what to do with the rows when the queue is full
+ * \param spill_file file the rows are spilled to (DB_WQ_SPILL only)
+ * \return the new queue or NULL on error
+ */
+db_write_queue_t* db_write_queue_new(const db_key_t* _k, const int _n,
+		const int max_rows, const int batch, const int policy,
+		const char* spill_file);
+
+
+/**
+ * \brief Parse the name of a policy ("drop", "block" or "spill")
+ * \return the policy or -1 if unknown
+ */
+int db_write_queue_policy(const char* name);
+
+
+/**
+ * \brief Queue a row for insertion into a table
+ * \param q write queue
+ * \param table name of the table
+ * \param _v values of the row
+ * \return zero if the row was queued (or spilled), negative otherwise
+ */
+int db_write_queue_add(db_write_queue_t* q, const str* table,
+		const db_val_t* _v);
+
+
+/**
+ * \brief Main loop of a writer process, never returns
+ *
+ * The process exits (after writing the rows it took from the queue)
+ * on SIGTERM.
+ * \param q write queue
+ * \param dbf database functions
+ * \param _h database connection of the process
+ */
+void db_write_queue_run(db_write_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h);
+
+
+/**
+ * \brief Write the remaining rows and free the queue
+ *
+ * To be called at shutdown, when there is no other process using the
+ * queue. If there is no connection the rows are discarded.
+ * \param q write queue
+ * \param dbf database functions
+ * \param _h database connection, may be NULL
+ */
+void db_write_queue_destroy(db_write_queue_t* q, const db_func_t* dbf,
+		db_con_t* _h);
+
+
+/** \brief number of rows waiting in the queue */
+unsigned long db_write_queue_depth(db_write_queue_t* q);
+
+/** \brief number of rows dropped because the queue was full */
+unsigned long db_write_queue_dropped(db_write_queue_t* q);
+
+/** \brief number of rows spilled to file because the queue was full */
+unsigned long db_write_queue_spilled(db_write_queue_t* q);
+
+
+#endif /* DB_WRITEQ_H */
@@ -0,0 +1,208 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Pool of processes doing DNS lookups on behalf of the SIP workers
+ *
+ * The workers pass the lookups (as pointers to shm jobs) over a pipe
+ * shared by all the resolver processes. A resolver process does the
+ * lookup, so the answer lands in the DNS cache, and runs the callback
+ * of the job - this is where the caller resumes its processing.
+ */
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include "mem/shm_mem.h"
+#include "dprint.h"
+#include "globals.h"
+#include "sr_module.h"
+#include "resolve.h"
+#include "dns_cache.h"
+#include "dns_async.h"
+#include "pt.h"
+
+
+struct dns_async_job {
+	str name;
+	unsigned short port;
+	unsigned short proto;
+	int is_sips;
+	dns_async_cb *cb;
+	void *param;
+};
+
+int dns_async_procs = 0;
+
+static int dns_async_pipe[2] = {-1, -1};
+/* set in the resolver processes */
+static int dns_async_resolver = 0;
+
+
+
+int init_dns_async(void)
+{
+	int flags;
+
+	if (dont_fork)
+		dns_async_procs = 0;
+	if (dns_async_procs<=0)
+		return 0;
+
+	/* the processes hand the answers back via the cache */
+	if (!dns_use_cache) {
+		LM_NOTICE("enabling DNS cache, needed by the async DNS processes\n");
+		dns_use_cache = 1;
+	}
+
+	if (pipe(dns_async_pipe)<0) {
+		LM_ERR("failed to create pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	/* never block the SIP workers - if full, they do the lookup */
+	flags = fcntl(dns_async_pipe[1], F_GETFL);
+	if (flags==-1 ||
+	fcntl(dns_async_pipe[1], F_SETFL, flags|O_NONBLOCK)==-1) {
+		LM_ERR("fcntl failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+int count_dns_async_procs(void)
+{
+	return dns_async_procs;
+}
+
+
+
+static void dns_async_loop(void)
+{
+	struct dns_async_job *job;
+	unsigned short port;
+	unsigned short proto;
+	int n;
+
+	for(;;) {
+		n = read(dns_async_pipe[0], &job, sizeof(job));
+		if (n!=sizeof(job)) {
+			if (n<0 && errno==EINTR)
+				continue;
+			LM_ERR("failed to read job (%d): %s\n", n,
+				(n<0)?strerror(errno):"short read");
+			continue;
+		}
+
+		port = job->port;
+		proto = job->proto;
+		if (sip_resolvehost( &job->name, &port, &proto, job->is_sips, 0)==0)
+			LM_DBG("failed to resolve %.*s\n", job->name.len, job->name.s);
+
+		job->cb( job->param );
+		shm_free(job);
+	}
+}
+
+
+
+int start_dns_async_procs(void)
+{
+	pid_t pid;
+	int i;
+
+	for( i=0 ; i<dns_async_procs ; i++ ) {
+		if ( (pid=internal_fork("DNS resolver"))<0 ) {
+			LM_CRIT("cannot fork DNS resolver process\n");
+			return -1;
+		} else if (pid==0) {
+			/* new process */
+			dns_async_resolver = 1;
+			if (init_child(PROC_MODULE)<0) {
+				LM_ERR("init_child failed for DNS resolver\n");
+				exit(-1);
+			}
+			dns_async_loop();
+			exit(-1);
+		}
+	}
+
+	return 0;
+}
+
+
+
+int dns_async_needed(str *name, unsigned short port, unsigned short proto,
+															int is_sips)
+{
+	if (dns_async_procs<=0 || dns_async_resolver)
+		return 0;
+
+	/* do the resolving, but with answers only from the cache */
+	dns_cache_only = 1;
+	dns_cache_missed = 0;
+	sip_resolvehost( name, &port, &proto, is_sips, 0);
+	dns_cache_only = 0;
+
+	return dns_cache_missed;
+}
+
+
+
+int dns_async_resolve(str *name, unsigned short port, unsigned short proto,
+							int is_sips, dns_async_cb *cb, void *param)
+{
+	struct dns_async_job *job;
+
+	if (dns_async_procs<=0 || dns_async_resolver)
+		return -1;
+
+	job = (struct dns_async_job*)shm_malloc
+		(sizeof(struct dns_async_job) + name->len);
+	if (job==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	job->name.s = (char*)(job+1);
+	job->name.len = name->len;
+	memcpy( job->name.s, name->s, name->len);
+	job->port = port;
+	job->proto = proto;
+	job->is_sips = is_sips;
+	job->cb = cb;
+	job->param = param;
+
+	if (write(dns_async_pipe[1], &job, sizeof(job))!=sizeof(job)) {
+		LM_DBG("failed to queue lookup for %.*s: %s\n",
+			name->len, name->s, strerror(errno));
+		shm_free(job);
+		return -1;
+	}
+
+	return 0;
+}
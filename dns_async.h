@@ -0,0 +1,57 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Pool of processes doing DNS lookups on behalf of the SIP workers
+ */
+
+
+#ifndef _DNS_ASYNC_H_
+#define _DNS_ASYNC_H_
+
+#include "str.h"
+
+/*! \brief function called (in a resolver process) after the lookup */
+typedef void (dns_async_cb)(void *param);
+
+extern int dns_async_procs;
+
+
+int init_dns_async(void);
+
+int count_dns_async_procs(void);
+
+int start_dns_async_procs(void);
+
+/*! \brief checks if resolving the name needs a DNS query (the answer is
+ * not already in the DNS cache); returns 1 if so, 0 otherwise */
+int dns_async_needed(str *name, unsigned short port, unsigned short proto,
+		int is_sips);
+
+/*! \brief passes the lookup of name to the resolver processes; when done,
+ * the cb is run in the resolver process, with the answer available in
+ * the DNS cache; returns 0 on success, -1 if the lookup was not queued */
+int dns_async_resolve(str *name, unsigned short port, unsigned short proto,
+		int is_sips, dns_async_cb *cb, void *param);
+
+#endif
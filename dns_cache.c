@@ -0,0 +1,637 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Shared memory cache for the DNS resolver
+ *
+ * The parsed answers of get_record() are kept in shm, keyed by name and
+ * type, for as long as their smallest TTL says (capped by
+ * dns_cache_max_ttl). Failed lookups (no such name or no records of the
+ * type) are cached for dns_cache_negative_ttl seconds. The lookups
+ * return pkg copies of the records, so the callers may sort and free
+ * them as they do with the get_record() output.
+ */
+
+
+#include <string.h>
+#include <ctype.h>
+
+#include "mem/mem.h"
+#include "mem/shm_mem.h"
+#include "mi/mi.h"
+#include "dprint.h"
+#include "locking.h"
+#include "timer.h"
+#include "ut.h"
+#include "ip_addr.h"
+#include "resolve.h"
+#include "dns_cache.h"
+
+
+int dns_use_cache = 0;
+int dns_cache_negative_ttl = 60;
+int dns_cache_max_ttl = 3600;
+
+int dns_cache_only = 0;
+int dns_cache_missed = 0;
+
+static struct dns_cache_entry **dns_cache = 0;
+static gen_lock_set_t *dns_cache_locks = 0;
+
+#define DNS_ALIGN(_s) \
+	(((_s)+sizeof(long)-1)&~(sizeof(long)-1))
+
+#define dns_cache_lock(_h) \
+	lock_set_get( dns_cache_locks, (_h)&(DNS_CACHE_LOCKS-1))
+#define dns_cache_unlock(_h) \
+	lock_set_release( dns_cache_locks, (_h)&(DNS_CACHE_LOCKS-1))
+
+static void dns_cache_timer(unsigned int ticks, void* param);
+static struct mi_root* mi_dns_cache_dump(struct mi_root *cmd, void *param);
+static struct mi_root* mi_dns_cache_flush(struct mi_root *cmd, void *param);
+
+
+static mi_export_t mi_dns_cache_cmds[] = {
+	{ "dns_cache_dump",  mi_dns_cache_dump,  MI_NO_INPUT_FLAG,  0,  0 },
+	{ "dns_cache_flush", mi_dns_cache_flush,                0,  0,  0 },
+	{ 0, 0, 0, 0, 0}
+};
+
+
+
+int init_dns_cache(void)
+{
+	if (!dns_use_cache)
+		return 0;
+
+	dns_cache = (struct dns_cache_entry**)shm_malloc
+		(DNS_CACHE_SIZE*sizeof(struct dns_cache_entry*));
+	if (dns_cache==NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset( dns_cache, 0, DNS_CACHE_SIZE*sizeof(struct dns_cache_entry*));
+
+	if ( (dns_cache_locks=lock_set_alloc(DNS_CACHE_LOCKS))==NULL ) {
+		LM_ERR("failed to alloc locks\n");
+		goto error;
+	}
+	if ( lock_set_init(dns_cache_locks)==NULL ) {
+		LM_ERR("failed to init locks\n");
+		lock_set_dealloc(dns_cache_locks);
+		dns_cache_locks = 0;
+		goto error;
+	}
+
+	/* register timer routine  */
+	if (register_timer( dns_cache_timer, 0, DNS_CACHE_TIMER)<0) {
+		LM_ERR("failed to register timer\n");
+		goto error;
+	}
+
+	/* register MI commands */
+	if (register_mi_mod( "dns_cache", mi_dns_cache_cmds)<0) {
+		LM_ERR("unable to register MI cmds\n");
+		goto error;
+	}
+
+	return 0;
+error:
+	destroy_dns_cache();
+	return -1;
+}
+
+
+
+void destroy_dns_cache(void)
+{
+	struct dns_cache_entry *e, *e1;
+	unsigned int i;
+
+	if (dns_cache==NULL)
+		return;
+
+	for( i=0 ; i<DNS_CACHE_SIZE ; i++ ) {
+		for( e=dns_cache[i] ; e ; e=e1 ) {
+			e1 = e->next;
+			shm_free(e);
+		}
+	}
+	shm_free(dns_cache);
+	dns_cache = 0;
+
+	if (dns_cache_locks) {
+		lock_set_destroy(dns_cache_locks);
+		lock_set_dealloc(dns_cache_locks);
+		dns_cache_locks = 0;
+	}
+}
+
+
+
+static inline unsigned int dns_cache_hash(char *name, int len, int type)
+{
+	unsigned int h;
+	int i;
+
+	h = type;
+	for( i=0 ; i<len ; i++ )
+		h = h*31 + tolower((unsigned char)name[i]);
+	return (h^(h>>16)) & (DNS_CACHE_SIZE-1);
+}
+
+
+/*! \brief size of the parsed rdata for each type of record */
+static inline unsigned int dns_rdata_size(int type)
+{
+	switch (type) {
+		case T_A:     return sizeof(struct a_rdata);
+		case T_AAAA:  return sizeof(struct aaaa_rdata);
+		case T_SRV:   return sizeof(struct srv_rdata);
+		case T_NAPTR: return sizeof(struct naptr_rdata);
+		case T_CNAME: return sizeof(struct cname_rdata);
+		case T_TXT:   return sizeof(struct txt_rdata);
+		case T_EBL:   return sizeof(struct ebl_rdata);
+	}
+	return 0;
+}
+
+
+static inline int dns_cache_match(struct dns_cache_entry *e,
+												char *name, int len, int type)
+{
+	return (e->type==type && e->name.len==len &&
+		strncasecmp(e->name.s, name, len)==0);
+}
+
+
+/*! \brief builds a pkg copy of a cached list of records */
+static struct rdata* dns_cache_clone(struct rdata *head)
+{
+	struct rdata *rd;
+	struct rdata *first;
+	struct rdata **last;
+	unsigned int size;
+
+	first = 0;
+	last = &first;
+	for( ; head ; head=head->next ) {
+		rd = (struct rdata*)pkg_malloc(sizeof(struct rdata));
+		if (rd==NULL)
+			goto error;
+		memcpy( rd, head, sizeof(struct rdata));
+		rd->next = 0;
+		rd->rdata = 0;
+		*last = rd;
+		last = &rd->next;
+		if (head->rdata) {
+			size = dns_rdata_size(head->type);
+			if ( (rd->rdata=pkg_malloc(size))==NULL )
+				goto error;
+			memcpy( rd->rdata, head->rdata, size);
+		}
+	}
+	return first;
+error:
+	LM_ERR("no more pkg memory\n");
+	free_rdata_list(first);
+	return 0;
+}
+
+
+
+struct rdata* dns_cache_get(char *name, int type, int *found)
+{
+	struct dns_cache_entry *e, *prev;
+	struct rdata *rd;
+	unsigned int h;
+	int len;
+
+	*found = 0;
+	if (dns_cache==NULL)
+		return 0;
+
+	len = strlen(name);
+	h = dns_cache_hash( name, len, type);
+	rd = 0;
+
+	dns_cache_lock(h);
+	for( prev=0,e=dns_cache[h] ; e ; prev=e,e=e->next ) {
+		if (!dns_cache_match( e, name, len, type))
+			continue;
+		if (e->expires<=get_ticks()) {
+			/* expired -> drop it now */
+			if (prev) prev->next = e->next;
+			else dns_cache[h] = e->next;
+			break;
+		}
+		if (e->rd==NULL || (rd=dns_cache_clone(e->rd))!=NULL)
+			*found = 1;
+		LM_DBG("%s:%d found in cache (%s)\n", name, type,
+			e->rd?"positive":"negative");
+		dns_cache_unlock(h);
+		return rd;
+	}
+	dns_cache_unlock(h);
+
+	if (e)
+		shm_free(e);
+	return 0;
+}
+
+
+
+void dns_cache_put(char *name, int type, struct rdata *head)
+{
+	struct dns_cache_entry *e, *old, *prev;
+	struct rdata *rd, *it;
+	struct rdata **last;
+	unsigned int ttl;
+	unsigned int size;
+	unsigned int h;
+	char *p;
+	int len;
+
+	if (dns_cache==NULL)
+		return;
+
+	/* get the TTL of the entry */
+	if (head==NULL) {
+		if (dns_cache_negative_ttl<=0)
+			return;
+		ttl = dns_cache_negative_ttl;
+	} else {
+		ttl = head->ttl;
+		for( it=head->next ; it ; it=it->next )
+			if (it->ttl<ttl) ttl = it->ttl;
+	}
+	if (dns_cache_max_ttl>0 && ttl>(unsigned int)dns_cache_max_ttl)
+		ttl = dns_cache_max_ttl;
+	if (ttl==0)
+		return;
+
+	/* everything goes in a single chunk */
+	len = strlen(name);
+	size = DNS_ALIGN(sizeof(struct dns_cache_entry)) + DNS_ALIGN(len+1);
+	for( it=head ; it ; it=it->next )
+		size += DNS_ALIGN(sizeof(struct rdata)) +
+			(it->rdata?DNS_ALIGN(dns_rdata_size(it->type)):0);
+
+	e = (struct dns_cache_entry*)shm_malloc(size);
+	if (e==NULL) {
+		LM_ERR("no more shm memory (%d)\n", size);
+		return;
+	}
+	p = (char*)e + DNS_ALIGN(sizeof(struct dns_cache_entry));
+	e->name.s = p;
+	e->name.len = len;
+	memcpy( p, name, len+1);
+	p += DNS_ALIGN(len+1);
+	e->type = type;
+	e->expires = get_ticks() + ttl;
+	e->rd = 0;
+	last = &e->rd;
+	for( it=head ; it ; it=it->next ) {
+		rd = (struct rdata*)p;
+		p += DNS_ALIGN(sizeof(struct rdata));
+		memcpy( rd, it, sizeof(struct rdata));
+		rd->next = 0;
+		if (it->rdata) {
+			rd->rdata = p;
+			memcpy( p, it->rdata, dns_rdata_size(it->type));
+			p += DNS_ALIGN(dns_rdata_size(it->type));
+		}
+		*last = rd;
+		last = &rd->next;
+	}
+
+	h = dns_cache_hash( name, len, type);
+
+	dns_cache_lock(h);
+	/* replace any older entry for the same name:type */
+	for( prev=0,old=dns_cache[h] ; old ; prev=old,old=old->next )
+		if (dns_cache_match( old, name, len, type)) {
+			if (prev) prev->next = old->next;
+			else dns_cache[h] = old->next;
+			break;
+		}
+	e->next = dns_cache[h];
+	dns_cache[h] = e;
+	dns_cache_unlock(h);
+
+	if (old)
+		shm_free(old);
+
+	LM_DBG("%s:%d cached for %d seconds\n", name, type, ttl);
+}
+
+
+
+/*! \brief removes from the cache the expired entries or, if flush is set,
+ * all the entries matching the name (all entries if name is NULL) */
+static void dns_cache_remove(unsigned int ticks, int flush, str *name)
+{
+	struct dns_cache_entry *e, *e1, *prev;
+	struct dns_cache_entry *del;
+	unsigned int i;
+
+	for( i=0 ; i<DNS_CACHE_SIZE ; i++ ) {
+		if (dns_cache[i]==NULL)
+			continue;
+		del = 0;
+		dns_cache_lock(i);
+		for( prev=0,e=dns_cache[i] ; e ; e=e1 ) {
+			e1 = e->next;
+			if ( flush ? (name==NULL || (e->name.len==name->len &&
+			strncasecmp(e->name.s, name->s, name->len)==0)) :
+			(e->expires<=ticks) ) {
+				if (prev) prev->next = e1;
+				else dns_cache[i] = e1;
+				e->next = del;
+				del = e;
+			} else {
+				prev = e;
+			}
+		}
+		dns_cache_unlock(i);
+
+		for( ; del ; del=e1 ) {
+			e1 = del->next;
+			shm_free(del);
+		}
+	}
+}
+
+
+static void dns_cache_timer(unsigned int ticks, void* param)
+{
+	dns_cache_remove( ticks, 0, NULL);
+}
+
+
+
+/*! \brief fills in a static hostent with the A/AAAA records of a list;
+ * only the addresses of the first family found are used */
+static struct hostent* rdata2he(char *name, struct rdata *head)
+{
+	static struct hostent he;
+	static char hostname[MAX_DNS_NAME];
+	static char* p_aliases[1];
+	static char* p_addr[DNS_CACHE_MAX_IPS+1];
+	static char addresses[DNS_CACHE_MAX_IPS][16];
+	struct rdata *rd;
+	int type;
+	int n;
+
+	type = 0;
+	for( rd=head,n=0 ; rd && n<DNS_CACHE_MAX_IPS ; rd=rd->next ) {
+		if ((rd->type!=T_A && rd->type!=T_AAAA) || rd->rdata==NULL)
+			continue;
+		if (type==0)
+			type = rd->type;
+		else if (rd->type!=type)
+			continue;
+		if (type==T_A)
+			memcpy( addresses[n], ((struct a_rdata*)rd->rdata)->ip, 4);
+		else
+			memcpy( addresses[n], ((struct aaaa_rdata*)rd->rdata)->ip6, 16);
+		p_addr[n] = addresses[n];
+		n++;
+	}
+	if (n==0)
+		return 0;
+	p_addr[n] = 0;
+	p_aliases[0] = 0;
+
+	strncpy( hostname, name, MAX_DNS_NAME-1);
+	hostname[MAX_DNS_NAME-1] = 0;
+
+	he.h_addrtype = (type==T_A) ? AF_INET : AF_INET6;
+	he.h_length = (type==T_A) ? 4 : 16;
+	he.h_addr_list = p_addr;
+	he.h_aliases = p_aliases;
+	he.h_name = hostname;
+	return &he;
+}
+
+
+/*! \brief builds the list of records matching a system resolver answer */
+static struct rdata* he2rdata(struct hostent *he)
+{
+	struct rdata *head;
+	struct rdata *rd;
+	int i;
+
+	head = 0;
+	/* add in reverse order, so the list keeps the order of the IPs */
+	for( i=0 ; he->h_addr_list[i] ; i++ );
+	for( i-- ; i>=0 ; i-- ) {
+		rd = (struct rdata*)pkg_malloc(sizeof(struct rdata));
+		if (rd==NULL)
+			goto error;
+		memset( rd, 0, sizeof(struct rdata));
+		rd->next = head;
+		head = rd;
+		rd->class = C_IN;
+		rd->ttl = dns_cache_negative_ttl;
+		rd->type = (he->h_addrtype==AF_INET) ? T_A : T_AAAA;
+		rd->rdata = pkg_malloc(dns_rdata_size(rd->type));
+		if (rd->rdata==NULL)
+			goto error;
+		memcpy( rd->rdata, he->h_addr_list[i], (rd->type==T_A)?4:16);
+	}
+	return head;
+error:
+	LM_ERR("no more pkg memory\n");
+	free_rdata_list(head);
+	return 0;
+}
+
+
+struct hostent* dns_cache_resolvehost(char *name)
+{
+	struct hostent *he;
+	struct rdata *head;
+	int found;
+
+	head = get_record( name, T_A);
+	he = rdata2he( name, head);
+	if (head)
+		free_rdata_list(head);
+#ifdef USE_IPV6
+	if (he==NULL && dns_try_ipv6) {
+		head = get_record( name, T_AAAA);
+		he = rdata2he( name, head);
+		if (head)
+			free_rdata_list(head);
+	}
+#endif
+	if (he)
+		return he;
+
+	/* no DNS records, still the system resolver may know the name
+	 * (/etc/hosts) - its answers are also cached, as pseudo-records */
+	head = dns_cache_get( name, DNS_CACHE_T_HOSTS, &found);
+	if (!found) {
+		if (dns_cache_only) {
+			dns_cache_missed = 1;
+			return 0;
+		}
+		he = sys_resolvehost(name);
+		if (he && he->h_addr_list[0]) {
+			head = he2rdata(he);
+			if (head==NULL)
+				return he;
+		}
+		dns_cache_put( name, DNS_CACHE_T_HOSTS, head);
+	}
+	he = rdata2he( name, head);
+	if (head)
+		free_rdata_list(head);
+	return he;
+}
+
+
+
+static inline int mi_add_rdata(struct mi_node *node, struct rdata *rd)
+{
+	struct ip_addr ip;
+	struct srv_rdata *srv;
+	struct naptr_rdata *naptr;
+	struct mi_node *kid;
+	char *p;
+
+	if (rd->rdata==NULL)
+		return 0;
+
+	switch (rd->type) {
+		case T_A:
+		case T_AAAA:
+			memset( &ip, 0, sizeof(ip));
+			ip.af = (rd->type==T_A) ? AF_INET : AF_INET6;
+			ip.len = (rd->type==T_A) ? 4 : 16;
+			memcpy( ip.u.addr, rd->rdata, ip.len);
+			p = ip_addr2a(&ip);
+			kid = add_mi_node_child( node, MI_DUP_VALUE,
+				(rd->type==T_A)?"A":"AAAA", (rd->type==T_A)?1:4,
+				p, p?strlen(p):0);
+			break;
+		case T_SRV:
+			srv = (struct srv_rdata*)rd->rdata;
+			kid = addf_mi_node_child( node, 0, "SRV", 3, "%d %d %d %s",
+				srv->priority, srv->weight, srv->port, srv->name);
+			break;
+		case T_NAPTR:
+			naptr = (struct naptr_rdata*)rd->rdata;
+			kid = addf_mi_node_child( node, 0, "NAPTR", 5,
+				"%d %d \"%.*s\" \"%.*s\" \"%.*s\" %s",
+				naptr->order, naptr->pref,
+				naptr->flags_len, naptr->flags,
+				naptr->services_len, naptr->services,
+				naptr->regexp_len, naptr->regexp, naptr->repl);
+			break;
+		case T_CNAME:
+			p = ((struct cname_rdata*)rd->rdata)->name;
+			kid = add_mi_node_child( node, MI_DUP_VALUE, "CNAME", 5,
+				p, strlen(p));
+			break;
+		case T_TXT:
+			p = ((struct txt_rdata*)rd->rdata)->txt;
+			kid = add_mi_node_child( node, MI_DUP_VALUE, "TXT", 3,
+				p, strlen(p));
+			break;
+		default:
+			kid = addf_mi_node_child( node, 0, "RR", 2, "type %d",
+				rd->type);
+	}
+	if (kid==NULL)
+		return -1;
+	if (addf_mi_attr( kid, 0, "ttl", 3, "%u", rd->ttl)==NULL)
+		return -1;
+	return 0;
+}
+
+
+static struct mi_root* mi_dns_cache_dump(struct mi_root *cmd, void *param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node;
+	struct dns_cache_entry *e;
+	struct rdata *rd;
+	unsigned int ticks;
+	unsigned int i;
+
+	rpl_tree = init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree==NULL)
+		return 0;
+
+	ticks = get_ticks();
+	for( i=0 ; i<DNS_CACHE_SIZE ; i++ ) {
+		if (dns_cache[i]==NULL)
+			continue;
+		dns_cache_lock(i);
+		for( e=dns_cache[i] ; e ; e=e->next ) {
+			if (e->expires<=ticks)
+				continue;
+			node = add_mi_node_child( &rpl_tree->node, MI_DUP_VALUE,
+				"Entry", 5, e->name.s, e->name.len);
+			if (node==NULL)
+				goto error;
+			if (addf_mi_attr( node, 0, "type", 4, "%d", e->type)==NULL ||
+			addf_mi_attr( node, 0, "expires", 7, "%u", e->expires-ticks)==NULL
+			|| (e->rd==NULL &&
+			add_mi_attr( node, 0, "negative", 8, "yes", 3)==NULL) )
+				goto error;
+			for( rd=e->rd ; rd ; rd=rd->next )
+				if (mi_add_rdata( node, rd)<0)
+					goto error;
+		}
+		dns_cache_unlock(i);
+	}
+
+	return rpl_tree;
+error:
+	dns_cache_unlock(i);
+	LM_ERR("failed to add node\n");
+	free_mi_tree(rpl_tree);
+	return 0;
+}
+
+
+static struct mi_root* mi_dns_cache_flush(struct mi_root *cmd, void *param)
+{
+	struct mi_node *node;
+
+	node = cmd->node.kids;
+	if (node==NULL) {
+		dns_cache_remove( 0, 1, NULL);
+	} else {
+		if (node->next!=NULL)
+			return init_mi_tree( 400, MI_MISSING_PARM_S, MI_MISSING_PARM_LEN);
+		if (node->value.s==NULL || node->value.len==0)
+			return init_mi_tree( 400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+		dns_cache_remove( 0, 1, &node->value);
+	}
+
+	return init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+}
@@ -0,0 +1,83 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Shared memory cache for the DNS resolver
+ */
+
+
+#ifndef _DNS_CACHE_H_
+#define _DNS_CACHE_H_
+
+#include <netdb.h>
+
+#include "str.h"
+
+/*! \brief number of hash entries (power of 2) */
+#define DNS_CACHE_SIZE        256
+/*! \brief number of locks protecting the hash entries (power of 2) */
+#define DNS_CACHE_LOCKS       16
+/*! \brief interval (seconds) of the timer removing the expired entries */
+#define DNS_CACHE_TIMER       5
+/*! \brief max IPs returned in a hostent built from the cache */
+#define DNS_CACHE_MAX_IPS     16
+
+/*! \brief pseudo-type for the answers not coming from DNS (/etc/hosts) */
+#define DNS_CACHE_T_HOSTS     0
+
+struct rdata;
+
+struct dns_cache_entry {
+	str name;
+	int type;
+	unsigned int expires;      /*!< in ticks */
+	struct rdata *rd;          /*!< NULL for negative entries */
+	struct dns_cache_entry *next;
+};
+
+extern int dns_use_cache;
+extern int dns_cache_negative_ttl;
+extern int dns_cache_max_ttl;
+
+/*! \brief if set, a cache miss does not query DNS, but sets
+ * dns_cache_missed (see dns_async_needed()) */
+extern int dns_cache_only;
+extern int dns_cache_missed;
+
+
+int init_dns_cache(void);
+
+void destroy_dns_cache(void);
+
+/*! \brief returns a pkg copy of the cached records for name:type;
+ * found is set to 1 if there is a (maybe negative) entry */
+struct rdata* dns_cache_get(char *name, int type, int *found);
+
+/*! \brief adds the records for name:type to the cache; an empty list
+ * adds a negative entry */
+void dns_cache_put(char *name, int type, struct rdata *head);
+
+/*! \brief gethostbyname() replacement going through the cache */
+struct hostent* dns_cache_resolvehost(char *name);
+
+#endif
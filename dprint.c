@@ -31,6 +31,7 @@
 #include "dprint.h"
 #include "globals.h"
 #include "pt.h"
+#include "log_async.h"
  
 #include <stdarg.h>
 #include <stdio.h>
@@ -82,8 +83,25 @@ void dprint(char * format, ...)
 
 	//fprintf(stderr, "%2d(%d) ", process_no, my_pid());
 	va_start(ap, format);
-	vfprintf(stderr,format,ap);
-	fflush(stderr);
+	if (log_async_on && !is_main) {
+		log_async_vprint(LOG_ASYNC_STDERR, format, ap);
+	} else {
+		vfprintf(stderr,format,ap);
+		fflush(stderr);
+	}
+	va_end(ap);
+}
+
+
+void dp_syslog(int priority, char * format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	if (log_async_on && !is_main)
+		log_async_vprint(priority, format, ap);
+	else
+		vsyslog(priority, format, ap);
 	va_end(ap);
 }
 
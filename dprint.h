@@ -112,6 +112,9 @@ int dp_my_pid(void);
 
 void dprint (char* format, ...);
 
+/*! \brief syslog() replacement, going via the logging process if enabled */
+void dp_syslog (int priority, char* format, ...);
+
 int str2facility(char *s);
 
 void set_proc_debug_level(int level);
@@ -180,7 +183,7 @@ inline static char* dp_time(void)
 				dprint( LOG_PREFIX __VA_ARGS__ ) \
 
 		#define MY_SYSLOG( _log_level, ...) \
-				syslog( (_log_level)|log_facility, \
+				dp_syslog( (_log_level)|log_facility, \
 							LOG_PREFIX __VA_ARGS__);\
 
 		#define LM_GEN1(_lev, ...) \
@@ -193,25 +196,25 @@ inline static char* dp_time(void)
 					else { \
 						switch(_lev){ \
 							case L_CRIT: \
-								syslog(LOG_CRIT|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_CRIT|_facility, __VA_ARGS__); \
 								break; \
 							case L_ALERT: \
-								syslog(LOG_ALERT|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_ALERT|_facility, __VA_ARGS__); \
 								break; \
 							case L_ERR: \
-								syslog(LOG_ERR|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_ERR|_facility, __VA_ARGS__); \
 								break; \
 							case L_WARN: \
-								syslog(LOG_WARNING|_facility, __VA_ARGS__);\
+								dp_syslog(LOG_WARNING|_facility, __VA_ARGS__);\
 								break; \
 							case L_NOTICE: \
-								syslog(LOG_NOTICE|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_NOTICE|_facility, __VA_ARGS__); \
 								break; \
 							case L_INFO: \
-								syslog(LOG_INFO|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_INFO|_facility, __VA_ARGS__); \
 								break; \
 							case L_DBG: \
-								syslog(LOG_DEBUG|_facility, __VA_ARGS__); \
+								dp_syslog(LOG_DEBUG|_facility, __VA_ARGS__); \
 								break; \
 						} \
 					} \
@@ -301,7 +304,7 @@ inline static char* dp_time(void)
 					dp_my_pid(), __DP_FUNC, ## args) \
 
 		#define MY_SYSLOG( _log_level, _prefix, _fmt, args...) \
-				syslog( (_log_level)|log_facility, \
+				dp_syslog( (_log_level)|log_facility, \
 							_prefix LOG_PREFIX _fmt, __DP_FUNC, ##args);\
 
 		#define LM_GEN1(_lev, args...) \
@@ -314,25 +317,25 @@ inline static char* dp_time(void)
 					else { \
 						switch(_lev){ \
 							case L_CRIT: \
-								syslog(LOG_CRIT|_facility, fmt, ##args); \
+								dp_syslog(LOG_CRIT|_facility, fmt, ##args); \
 								break; \
 							case L_ALERT: \
-								syslog(LOG_ALERT|_facility, fmt, ##args); \
+								dp_syslog(LOG_ALERT|_facility, fmt, ##args); \
 								break; \
 							case L_ERR: \
-								syslog(LOG_ERR|_facility, fmt, ##args); \
+								dp_syslog(LOG_ERR|_facility, fmt, ##args); \
 								break; \
 							case L_WARN: \
-								syslog(LOG_WARNING|_facility, fmt, ##args);\
+								dp_syslog(LOG_WARNING|_facility, fmt, ##args);\
 								break; \
 							case L_NOTICE: \
-								syslog(LOG_NOTICE|_facility, fmt, ##args); \
+								dp_syslog(LOG_NOTICE|_facility, fmt, ##args); \
 								break; \
 							case L_INFO: \
-								syslog(LOG_INFO|_facility, fmt, ##args); \
+								dp_syslog(LOG_INFO|_facility, fmt, ##args); \
 								break; \
 							case L_DBG: \
-								syslog(LOG_DEBUG|_facility, fmt, ##args); \
+								dp_syslog(LOG_DEBUG|_facility, fmt, ##args); \
 								break; \
 						} \
 					} \
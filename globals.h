@@ -76,6 +76,9 @@ extern enum poll_types tcp_poll_method;
 extern int tcp_max_fd_no;
 extern int tcp_max_connections;
 extern int tcp_crlf_pingpong;
+extern int tcp_async;
+extern int tcp_async_max_queue;
+extern int tcp_fd_cache_size;
 #endif
 #ifdef USE_TLS
 extern int tls_disable;
@@ -136,6 +139,9 @@ extern str default_global_port; /*!< pre-ser ports */
 
 extern int disable_core_dump; /*!< core dump limits */
 extern int open_files_limit; /*!< file limits */
+extern int udp_rcv_batch; /*!< datagrams read per syscall by UDP listeners */
+extern int udp_reuse_port; /*!< one SO_REUSEPORT socket per UDP process */
+extern int udp_workers_affinity; /*!< pin the UDP processes on CPUs */
 
 extern int dns_retr_time; /*!< DNS resolver: Retry time */
 extern int dns_retr_no; /*!< DNS resolver : Retry # */
@@ -103,12 +103,17 @@ typedef int fd_type;
 #define FD_TYPE_DEFINED
 #endif
 
+/*! \brief what a fd is watched for (only one of them) */
+#define IO_WATCH_READ   1
+#define IO_WATCH_WRITE  2
+
 /*! \brief maps a fd to some other structure; used in almost all cases
  * except epoll and maybe kqueue or /dev/poll */
 struct fd_map{
 	int fd;               /* fd no */
 	fd_type type;         /* "data" type */
 	void* data;           /* pointer to the corresponding structure */
+	int events;           /* IO_WATCH_READ or IO_WATCH_WRITE */
 };
 
 
@@ -148,6 +153,7 @@ struct io_wait_handler{
 #endif
 #ifdef HAVE_SELECT
 	fd_set master_set;
+	fd_set master_wset; /* fds watched for writing */
 	int max_fd_select; /* maximum select used fd */
 #endif
 	/* common stuff for POLL, SIGIO_RT and SELECT
@@ -174,17 +180,20 @@ typedef struct io_wait_handler io_wait_h;
 	do{ \
 		(pfm)->type=0 /*F_NONE */; \
 		(pfm)->fd=-1; \
+		(pfm)->events=0; \
 	}while(0)
 
 /*! \brief add a fd_map structure to the fd hash */
 static inline struct fd_map* hash_fd_map(	io_wait_h* h,
 						int fd,
 						fd_type type,
-						void* data)
+						void* data,
+						int events)
 {
 	h->fd_hash[fd].fd=fd;
 	h->fd_hash[fd].type=type;
 	h->fd_hash[fd].data=data;
+	h->fd_hash[fd].events=events;
 	return &h->fd_hash[fd];
 }
 
@@ -251,23 +260,25 @@ again:
 
 
 /*! \brief generic io_watch_add function
+ * \param ev  IO_WATCH_READ or IO_WATCH_WRITE
  * \return 0 on success, -1 on error
  *
  * this version should be faster than pointers to poll_method specific
  * functions (it avoids functions calls, the overhead being only an extra
  *  switch())
 */
-inline static int io_watch_add(	io_wait_h* h,
+inline static int io_watch_add_ev(	io_wait_h* h,
 								int fd,
 								fd_type type,
-								void* data)
+								void* data,
+								int ev)
 {
 
 	/* helper macros */
 #define fd_array_setup \
 	do{ \
 		h->fd_array[h->fd_no].fd=fd; \
-		h->fd_array[h->fd_no].events=POLLIN; /* useless for select */ \
+		h->fd_array[h->fd_no].events=poll_ev; /* useless for select */ \
 		h->fd_array[h->fd_no].revents=0;     /* useless for select */ \
 	}while(0)
 	
@@ -289,6 +300,7 @@ inline static int io_watch_add(	io_wait_h* h,
 	
 	struct fd_map* e;
 	int flags;
+	short poll_ev;
 #ifdef HAVE_EPOLL
 	struct epoll_event ep_event;
 #endif
@@ -306,6 +318,7 @@ inline static int io_watch_add(	io_wait_h* h,
 	idx=-1;
 #endif
 	e=0;
+	poll_ev=(ev==IO_WATCH_WRITE)?POLLOUT:POLLIN;
 	if (fd==-1){
 		LM_CRIT("fd is -1!\n");
 		goto error;
@@ -327,7 +340,7 @@ inline static int io_watch_add(	io_wait_h* h,
 		goto error;
 	}
 	
-	if ((e=hash_fd_map(h, fd, type, data))==0){
+	if ((e=hash_fd_map(h, fd, type, data, ev))==0){
 		LM_ERR("failed to hash the fd %d\n", fd);
 		goto error;
 	}
@@ -339,7 +352,7 @@ inline static int io_watch_add(	io_wait_h* h,
 #ifdef HAVE_SELECT
 		case POLL_SELECT:
 			fd_array_setup;
-			FD_SET(fd, &h->master_set);
+			FD_SET(fd, (ev==IO_WATCH_WRITE)?&h->master_wset:&h->master_set);
 			if (h->max_fd_select<fd) h->max_fd_select=fd;
 			break;
 #endif
@@ -379,7 +392,7 @@ inline static int io_watch_add(	io_wait_h* h,
 #endif
 #ifdef HAVE_EPOLL
 		case POLL_EPOLL_LT:
-			ep_event.events=EPOLLIN;
+			ep_event.events=(ev==IO_WATCH_WRITE)?EPOLLOUT:EPOLLIN;
 			ep_event.data.ptr=e;
 again1:
 			n=epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ep_event);
@@ -392,7 +405,7 @@ again1:
 			break;
 		case POLL_EPOLL_ET:
 			set_fd_flags(O_NONBLOCK);
-			ep_event.events=EPOLLIN|EPOLLET;
+			ep_event.events=((ev==IO_WATCH_WRITE)?EPOLLOUT:EPOLLIN)|EPOLLET;
 			ep_event.data.ptr=e;
 again2:
 			n=epoll_ctl(h->epfd, EPOLL_CTL_ADD, fd, &ep_event);
@@ -408,14 +421,15 @@ again2:
 #endif
 #ifdef HAVE_KQUEUE
 		case POLL_KQUEUE:
-			if (kq_ev_change(h, fd, EVFILT_READ, EV_ADD, e)==-1)
+			if (kq_ev_change(h, fd,
+			(ev==IO_WATCH_WRITE)?EVFILT_WRITE:EVFILT_READ, EV_ADD, e)==-1)
 				goto error;
 			break;
 #endif
 #ifdef HAVE_DEVPOLL
 		case POLL_DEVPOLL:
 			pfd.fd=fd;
-			pfd.events=POLLIN;
+			pfd.events=poll_ev;
 			pfd.revents=0;
 again_devpoll:
 			if (write(h->dpoll_fd, &pfd, sizeof(pfd))==-1){
@@ -440,7 +454,7 @@ again_devpoll:
 	if (check_io){
 		/* handle possible pre-existing events */
 		pf.fd=fd;
-		pf.events=POLLIN;
+		pf.events=poll_ev;
 check_io_again:
 		while( ((n=poll(&pf, 1, 0))>0) && (handle_io(e, idx)>0));
 		if (n==-1){
@@ -458,6 +472,10 @@ error:
 #undef set_fd_flags 
 }
 
+/*! \brief watches fd for reading */
+#define io_watch_add(h, fd, type, data) \
+	io_watch_add_ev(h, fd, type, data, IO_WATCH_READ)
+
 
 
 #define IO_FD_CLOSING 16
@@ -493,6 +511,7 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 	}while(0)
 	
 	struct fd_map* e;
+	int ev;
 #ifdef HAVE_EPOLL
 	int n;
 	struct epoll_event ep_event;
@@ -523,6 +542,7 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 		goto error;
 	}
 	
+	ev=e->events;
 	unhash_fd_map(e);
 	
 	switch(h->poll_method){
@@ -532,7 +552,7 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 #ifdef HAVE_SELECT
 		case POLL_SELECT:
 			fix_fd_array;
-			FD_CLR(fd, &h->master_set);
+			FD_CLR(fd, (ev==IO_WATCH_WRITE)?&h->master_wset:&h->master_set);
 			if (h->max_fd_select && (h->max_fd_select==fd))
 				/* we don't know the prev. max, so we just decrement it */
 				h->max_fd_select--; 
@@ -587,7 +607,8 @@ inline static int io_watch_del(io_wait_h* h, int fd, int idx, int flags)
 #ifdef HAVE_KQUEUE
 		case POLL_KQUEUE:
 			if (!(flags & IO_FD_CLOSING)){
-				if (kq_ev_change(h, fd, EVFILT_READ, EV_DELETE, 0)==-1)
+				if (kq_ev_change(h, fd,
+				(ev==IO_WATCH_WRITE)?EVFILT_WRITE:EVFILT_READ, EV_DELETE, 0)==-1)
 					goto error;
 			}
 			break;
@@ -643,7 +664,7 @@ again:
 			}
 		}
 		for (r=0; (r<h->fd_no) && n; r++){
-			if (h->fd_array[r].revents & (POLLIN|POLLERR|POLLHUP)){
+			if (h->fd_array[r].revents & (POLLIN|POLLOUT|POLLERR|POLLHUP)){
 				n--;
 				/* sanity checks */
 				if ((h->fd_array[r].fd >= h->max_fd_no)||
@@ -669,15 +690,17 @@ error:
 inline static int io_wait_loop_select(io_wait_h* h, int t, int repeat)
 {
 	fd_set sel_set;
+	fd_set sel_wset;
 	int n, ret;
 	struct timeval timeout;
 	int r;
 	
 again:
 		sel_set=h->master_set;
+		sel_wset=h->master_wset;
 		timeout.tv_sec=t;
 		timeout.tv_usec=0;
-		ret=n=select(h->max_fd_select+1, &sel_set, 0, 0, &timeout);
+		ret=n=select(h->max_fd_select+1, &sel_set, &sel_wset, 0, &timeout);
 		if (n<0){
 			if (errno==EINTR) goto again; /* just a signal */
 			LM_ERR("select: %s [%d]\n", strerror(errno), errno);
@@ -686,7 +709,8 @@ again:
 		}
 		/* use poll fd array */
 		for(r=0; (r<h->max_fd_no) && n; r++){
-			if (FD_ISSET(h->fd_array[r].fd, &sel_set)){
+			if (FD_ISSET(h->fd_array[r].fd, &sel_set) ||
+			FD_ISSET(h->fd_array[r].fd, &sel_wset)){
 				while((handle_io(get_fd_map(h, h->fd_array[r].fd), r)>0)
 						&& repeat);
 				n--;
@@ -723,7 +747,7 @@ again:
 		}
 #endif
 		for (r=0; r<n; r++){
-			if (h->ep_array[r].events & (EPOLLIN|EPOLLERR|EPOLLHUP)){
+			if (h->ep_array[r].events & (EPOLLIN|EPOLLOUT|EPOLLERR|EPOLLHUP)){
 				while((handle_io((struct fd_map*)h->ep_array[r].data.ptr,-1)>0)
 					&& repeat);
 			}else{
@@ -100,6 +100,7 @@ struct socket_info {
 	str adv_port_str; /* Advertised port of this interface */
 	struct ip_addr adv_address; /* Advertised address in ip_addr form (for find_si) */
 	unsigned short adv_port;    /* optimization for grep_sock_info() */
+	int *rcv_socks; /*!< per process receive sockets (udp_reuse_port) */
 	struct socket_info* next;
 	struct socket_info* prev;
 };
@@ -0,0 +1,317 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Logging through a dedicated process
+ *
+ * Each process has its own ring buffer in shm, where it writes the
+ * formatted log records. There is a single writer (the owner process)
+ * and a single reader (the logging process) per ring, so no locking is
+ * needed - only the positions are published after the data. The logging
+ * process drains the rings to syslog or, in batches, to the log file
+ * (or stderr). When a ring is full the records are dropped and counted.
+ */
+
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <syslog.h>
+
+#include "mem/mem.h"
+#include "mem/shm_mem.h"
+#include "dprint.h"
+#include "globals.h"
+#include "sr_module.h"
+#include "log_async.h"
+#include "pt.h"
+
+
+#define log_async_membar() __sync_synchronize()
+
+struct log_async_ring {
+	volatile unsigned int head;     /*!< bytes written, by the owner */
+	volatile unsigned int tail;     /*!< bytes read, by the logging process */
+	volatile unsigned int dropped;  /*!< records which did not fit */
+	char buf[1];
+};
+
+struct log_async_rec {
+	int priority;
+	unsigned int len;
+};
+
+int log_async = 0;
+int log_async_buffer = LOG_ASYNC_DEFAULT_BUFFER;
+char *log_async_file = 0;
+
+int log_async_on = 0;
+
+static char *log_async_mem = 0;
+static unsigned int log_async_size = 0;    /* ring size, power of 2 */
+static unsigned int log_async_stride = 0;  /* bytes between rings */
+static int log_async_rings = 0;
+
+/* logging process only */
+static int log_async_fd = -1;
+static char *log_async_batch = 0;
+static unsigned int log_async_batch_len = 0;
+static volatile int log_async_stop = 0;
+
+#define log_async_ring(_i) \
+	((struct log_async_ring*)(log_async_mem + (_i)*log_async_stride))
+
+
+
+int count_log_async_procs(void)
+{
+	return (log_async && !dont_fork) ? 1 : 0;
+}
+
+
+
+static inline void ring_write(struct log_async_ring *r, unsigned int pos,
+												void *data, unsigned int len)
+{
+	unsigned int idx, n;
+
+	idx = pos & (log_async_size-1);
+	n = log_async_size - idx;
+	if (n>=len) {
+		memcpy( r->buf+idx, data, len);
+	} else {
+		memcpy( r->buf+idx, data, n);
+		memcpy( r->buf, (char*)data+n, len-n);
+	}
+}
+
+
+
+static inline void ring_read(struct log_async_ring *r, unsigned int pos,
+												void *data, unsigned int len)
+{
+	unsigned int idx, n;
+
+	idx = pos & (log_async_size-1);
+	n = log_async_size - idx;
+	if (n>=len) {
+		memcpy( data, r->buf+idx, len);
+	} else {
+		memcpy( data, r->buf+idx, n);
+		memcpy( (char*)data+n, r->buf, len-n);
+	}
+}
+
+
+
+void log_async_vprint(int priority, const char *format, va_list ap)
+{
+	static char line[LOG_ASYNC_MAX_LINE];
+	struct log_async_ring *r;
+	struct log_async_rec rec;
+	unsigned int head;
+	int len;
+
+	if (process_no>=log_async_rings)
+		return;
+	r = log_async_ring(process_no);
+
+	len = vsnprintf( line, LOG_ASYNC_MAX_LINE, format, ap);
+	if (len<0)
+		return;
+	if (len>=LOG_ASYNC_MAX_LINE)
+		len = LOG_ASYNC_MAX_LINE-1;
+
+	head = r->head;
+	if (sizeof(rec)+len > log_async_size - (head - r->tail)) {
+		r->dropped++;
+		return;
+	}
+
+	rec.priority = priority;
+	rec.len = len;
+	ring_write( r, head, &rec, sizeof(rec));
+	ring_write( r, head+sizeof(rec), line, len);
+	/* publish the record only after its data */
+	log_async_membar();
+	r->head = head + sizeof(rec) + len;
+}
+
+
+
+unsigned long log_async_dropped(void)
+{
+	unsigned long n;
+	int i;
+
+	n = 0;
+	for( i=0 ; i<log_async_rings ; i++ )
+		n += log_async_ring(i)->dropped;
+
+	return n;
+}
+
+
+
+static void log_async_flush(void)
+{
+	unsigned int done;
+	int n;
+
+	for( done=0 ; done<log_async_batch_len ; ) {
+		n = write( log_async_fd, log_async_batch+done,
+			log_async_batch_len-done);
+		if (n<0) {
+			if (errno==EINTR)
+				continue;
+			break; /* nowhere to report it */
+		}
+		done += n;
+	}
+	log_async_batch_len = 0;
+}
+
+
+
+static int log_async_drain(struct log_async_ring *r)
+{
+	static char line[LOG_ASYNC_MAX_LINE];
+	struct log_async_rec rec;
+	unsigned int head, tail;
+	int n;
+
+	head = r->head;
+	/* read the data only after the position */
+	log_async_membar();
+
+	for( n=0,tail=r->tail ; tail!=head ; n++ ) {
+		ring_read( r, tail, &rec, sizeof(rec));
+		tail += sizeof(rec);
+
+		if (rec.priority==LOG_ASYNC_STDERR) {
+			if (log_async_batch_len+rec.len > LOG_ASYNC_BATCH)
+				log_async_flush();
+			ring_read( r, tail, log_async_batch+log_async_batch_len, rec.len);
+			log_async_batch_len += rec.len;
+		} else {
+			ring_read( r, tail, line, rec.len);
+			syslog( rec.priority, "%.*s", (int)rec.len, line);
+		}
+		tail += rec.len;
+	}
+
+	/* release the space only after the data was read */
+	log_async_membar();
+	r->tail = tail;
+
+	return n;
+}
+
+
+
+static void log_async_sig(int signo)
+{
+	log_async_stop = 1;
+}
+
+
+
+static void log_async_loop(void)
+{
+	int i, n;
+
+	for(;;) {
+		n = 0;
+		for( i=0 ; i<log_async_rings ; i++ )
+			n += log_async_drain( log_async_ring(i) );
+		if (log_async_batch_len)
+			log_async_flush();
+
+		if (log_async_stop)
+			exit(0);
+		if (n==0)
+			usleep(LOG_ASYNC_IDLE);
+	}
+}
+
+
+
+int start_log_async_proc(void)
+{
+	unsigned int size;
+	pid_t pid;
+	int i;
+
+	if (count_log_async_procs()==0)
+		return 0;
+
+	for( size=1024 ; size<(unsigned int)log_async_buffer ; size<<=1 );
+	log_async_size = size;
+	log_async_stride = (sizeof(struct log_async_ring) + size + 7) & ~7;
+
+	log_async_mem = shm_malloc( counted_processes * log_async_stride );
+	if (log_async_mem==NULL) {
+		LM_ERR("no more shm memory for %d log buffers of %u bytes\n",
+			counted_processes, size);
+		return -1;
+	}
+	for( i=0 ; i<counted_processes ; i++ )
+		memset( log_async_ring(i), 0, sizeof(struct log_async_ring));
+	log_async_rings = counted_processes;
+
+	if ( (pid=internal_fork("logger"))<0 ) {
+		LM_CRIT("cannot fork logger process\n");
+		return -1;
+	} else if (pid==0) {
+		/* new process, logs directly */
+		log_async_on = 0;
+		log_async_fd = STDERR_FILENO;
+		if (log_async_file) {
+			log_async_fd = open( log_async_file,
+				O_WRONLY|O_APPEND|O_CREAT, 0644);
+			if (log_async_fd<0) {
+				LM_ERR("failed to open %s: %s, using stderr\n",
+					log_async_file, strerror(errno));
+				log_async_fd = STDERR_FILENO;
+			}
+		}
+		log_async_batch = pkg_malloc(LOG_ASYNC_BATCH);
+		if (log_async_batch==NULL) {
+			LM_ERR("no more pkg memory\n");
+			exit(-1);
+		}
+		/* drain what is left before exiting */
+		signal( SIGTERM, log_async_sig);
+		signal( SIGINT, log_async_sig);
+		log_async_loop();
+		exit(-1);
+	}
+
+	/* the processes forked from now on log via their buffers */
+	log_async_on = 1;
+
+	return 0;
+}
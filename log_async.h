@@ -0,0 +1,65 @@
+/*
+ * $Id$
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/*!
+ * \file
+ * \brief Logging through a dedicated process
+ */
+
+
+#ifndef _LOG_ASYNC_H_
+#define _LOG_ASYNC_H_
+
+#include <stdarg.h>
+
+/*! \brief default size (bytes) of the log buffer of each process */
+#define LOG_ASYNC_DEFAULT_BUFFER  65536
+/*! \brief longer log lines are truncated */
+#define LOG_ASYNC_MAX_LINE    4096
+/*! \brief bytes written at once to the log file / stderr */
+#define LOG_ASYNC_BATCH       65536
+/*! \brief sleep (us) of the logging process when there is nothing to log */
+#define LOG_ASYNC_IDLE        10000
+
+/*! \brief pseudo-priority of the records going to the file / stderr */
+#define LOG_ASYNC_STDERR      -1
+
+extern int log_async;
+extern int log_async_buffer;
+extern char *log_async_file;
+
+/*! \brief set if the process writes its logs into its buffer */
+extern int log_async_on;
+
+
+int count_log_async_procs(void);
+
+int start_log_async_proc(void);
+
+/*! \brief queues a log record in the buffer of the process (the record
+ * is dropped if there is no space left) */
+void log_async_vprint(int priority, const char *format, va_list ap);
+
+/*! \brief number of records dropped so far (all processes) */
+unsigned long log_async_dropped(void);
+
+#endif
@@ -123,6 +123,9 @@
 #include "pt.h"
 #include "script_cb.h"
 #include "blacklists.h"
+#include "dns_cache.h"
+#include "dns_async.h"
+#include "log_async.h"
 
 #include "pt.h"
 #include "ut.h"
@@ -260,6 +263,13 @@ int mcast_ttl = -1; /* if -1, don't touch it, use the default (usually 1) */
 
 int tos = IPTOS_LOWDELAY;
 
+/* max number of datagrams a UDP process reads with one syscall */
+int udp_rcv_batch = 0;
+/* each UDP process gets its own SO_REUSEPORT receive socket */
+int udp_reuse_port = 0;
+/* pin the UDP processes of an interface on different CPUs */
+int udp_workers_affinity = 0;
+
 struct socket_info* udp_listen=0;
 #ifdef USE_TCP
 struct socket_info* tcp_listen=0;
@@ -352,6 +362,7 @@ void cleanup(int show_status)
 	pv_free_extra_list();
 	destroy_argv_list();
 	destroy_black_lists();
+	destroy_dns_cache();
 #ifdef CHANGEABLE_DEBUG_LEVEL
 	if (debug!=&debug_init) {
 		reset_proc_debug_level();
@@ -795,6 +806,12 @@ static int main_loop(void)
 		 * so we open all first*/
 		if (do_suid(uid, gid)==-1) goto error; /* try to drop privileges */
 
+		/* first the logger, so all the other processes may use it */
+		if (start_log_async_proc()!=0) {
+			LM_CRIT("cannot start the logger process\n");
+			goto error;
+		}
+
 		if (start_module_procs()!=0) {
 			LM_ERR("failed to fork module processes\n");
 			goto error;
@@ -833,6 +850,10 @@ static int main_loop(void)
 						set_proc_attrs("SIP receiver %.*s ",
 							si->sock_str.len, si->sock_str.s);
 						bind_address=si; /* shortcut */
+						if (udp_init_worker(i) < 0) {
+							LM_ERR("failed to init UDP listener %d\n", i);
+							exit(-1);
+						}
 						if (init_child(chd_rank) < 0) {
 							LM_ERR("init_child failed for UDP listener\n");
 							exit(-1);
@@ -903,6 +924,12 @@ static int main_loop(void)
 		goto error;
 	}
 
+	/* fork the DNS resolver processes */
+	if (start_dns_async_procs()!=0) {
+		LM_CRIT("cannot start DNS resolver process(es)\n");
+		goto error;
+	}
+
 	#ifdef USE_TCP
 	if (!tcp_disable){
 		/* start tcp  & tls receivers */
@@ -1379,6 +1406,16 @@ try_again:
 		LM_CRIT("failed to create DNS blacklist\n");
 		goto error;
 	}
+	/* init resolver's process pool (before the cache, as it needs it) */
+	if (init_dns_async()!=0) {
+		LM_CRIT("failed to init async DNS\n");
+		goto error;
+	}
+	/* init resolver's cache */
+	if (init_dns_cache()!=0) {
+		LM_CRIT("failed to init DNS cache\n");
+		goto error;
+	}
 
 	/* init modules */
 	if (init_modules() != 0) {
@@ -1411,6 +1448,12 @@ try_again:
 	}
 	#endif
 
+	/* init the per-process statistics counters */
+	if (init_stats_shards(counted_processes)!=0) {
+		LM_ERR("failed to init per-process statistics\n");
+		goto error;
+	}
+
 	/* fix routing lists */
 	if ( (r=fix_rls())!=0){
 		LM_ERR("failed to fix configuration with err code %d\n", r);
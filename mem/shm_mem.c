@@ -36,6 +36,9 @@
 #include "shm_mem.h"
 #include "../config.h"
 #include "../globals.h"
+#ifdef SHM_CACHE
+#include "../pt.h"
+#endif
 
 #ifdef  SHM_MMAP
 
@@ -56,6 +59,11 @@ stat_export_t shm_stats[] = {
 	{"max_used_size" ,  STAT_IS_FUNC,    (stat_var**)shm_get_mused    },
 	{"free_size" ,      STAT_IS_FUNC,    (stat_var**)shm_get_free     },
 	{"fragments" ,      STAT_IS_FUNC,    (stat_var**)shm_get_frags    },
+#ifdef SHM_CACHE
+	{"cache_hits" ,     STAT_IS_FUNC,    (stat_var**)shm_get_cache_hits   },
+	{"cache_misses" ,   STAT_IS_FUNC,    (stat_var**)shm_get_cache_misses },
+	{"cache_size" ,     STAT_IS_FUNC,    (stat_var**)shm_get_cache_size   },
+#endif
 	{0,0,0}
 };
 #endif
@@ -78,6 +86,145 @@ static void* shm_mempool=(void*)-1;
 #endif
 
 
+#ifdef SHM_CACHE
+static struct shm_cache_class shm_cache_classes[SHM_CACHE_CLASSES];
+struct shm_cache_class *shm_cache = 0;
+struct shm_cache_stats shm_cache_st;
+
+
+/* the stats are kept in private memory (no shared cache lines on the
+ * fast path) and published in the process table each time the cache
+ * goes to the arena */
+#define shm_cache_publish() \
+	(pt[process_no].shm_cache = shm_cache_st)
+
+
+/* to be called by a process only after it was forked and after it
+ * finished its initialization (some modules fork their own processes
+ * from child_init and a cache must never be inherited by a fork) */
+void shm_cache_enable(void)
+{
+	memset( shm_cache_classes, 0, sizeof(shm_cache_classes));
+	memset( &shm_cache_st, 0, sizeof(shm_cache_st));
+	shm_cache = shm_cache_classes;
+}
+
+
+/* returns all the cached fragments to the arena; shm must be locked */
+static void shm_cache_flush_unsafe(void)
+{
+	struct shm_cache_class *c;
+	void *p;
+
+	for( c=shm_cache ; c<shm_cache+SHM_CACHE_CLASSES ; c++ ) {
+		while (c->first) {
+			p = c->first;
+			c->first = *(void**)p;
+			shm_cache_st.size -= MY_FRAG_SIZE(p);
+			shm_free_unsafe(p);
+		}
+		c->no = 0;
+	}
+}
+
+
+/* the class is empty - get a batch of fragments from the arena and
+ * return one of them */
+void* shm_cache_refill(struct shm_cache_class *c)
+{
+	unsigned long size;
+	int i, flushed;
+	void *p;
+
+	size = (c - shm_cache + 1) * SHM_CACHE_STEP;
+	flushed = 0;
+
+	shm_lock();
+again:
+	for( i=0 ; i<SHM_CACHE_BATCH ; i++ ) {
+		p = shm_malloc_unsafe(size);
+		if (p==NULL)
+			break;
+		*(void**)p = c->first;
+		c->first = p;
+		c->no++;
+		shm_cache_st.size += MY_FRAG_SIZE(p);
+	}
+	/* low on memory - give back what is cached by the other classes */
+	if (c->first==NULL && !flushed) {
+		shm_cache_flush_unsafe();
+		flushed = 1;
+		goto again;
+	}
+	shm_unlock();
+
+	shm_cache_st.misses++;
+	shm_cache_publish();
+
+	if (c->first==NULL)
+		return NULL;
+	p = c->first;
+	c->first = *(void**)p;
+	c->no--;
+	shm_cache_st.size -= MY_FRAG_SIZE(p);
+	return p;
+}
+
+
+/* the class is over its limit - return a batch of fragments */
+void shm_cache_drain(struct shm_cache_class *c)
+{
+	void *p;
+
+	shm_lock();
+	while (c->no > SHM_CACHE_LIMIT-SHM_CACHE_BATCH) {
+		p = c->first;
+		c->first = *(void**)p;
+		c->no--;
+		shm_cache_st.size -= MY_FRAG_SIZE(p);
+		shm_free_unsafe(p);
+	}
+	shm_unlock();
+
+	shm_cache_publish();
+}
+
+
+#ifdef STATISTICS
+unsigned long shm_get_cache_hits(unsigned short foo)
+{
+	unsigned long n;
+	unsigned int i;
+
+	for( i=0,n=0 ; i<counted_processes ; i++ )
+		n += pt[i].shm_cache.hits;
+	return n;
+}
+
+unsigned long shm_get_cache_misses(unsigned short foo)
+{
+	unsigned long n;
+	unsigned int i;
+
+	for( i=0,n=0 ; i<counted_processes ; i++ )
+		n += pt[i].shm_cache.misses;
+	return n;
+}
+
+unsigned long shm_get_cache_size(unsigned short foo)
+{
+	unsigned long n;
+	unsigned int i;
+
+	for( i=0,n=0 ; i<counted_processes ; i++ )
+		n += pt[i].shm_cache.size;
+	return n;
+}
+#endif /* STATISTICS */
+
+#endif /* SHM_CACHE */
+
+
 inline static void* sh_realloc(void* p, unsigned int size)
 {
 	void *r;
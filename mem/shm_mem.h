@@ -92,6 +92,8 @@
 #		define MY_SHM_GET_FRAGS	fm_get_frags
 #	endif
 #	define  shm_malloc_init fm_malloc_init
+#	define MY_FRAG_SIZE(_p) \
+		(((struct fm_frag*)((char*)(_p)-sizeof(struct fm_frag)))->size)
 #else
 #	include "q_malloc.h"
 	extern struct qm_block* shm_block;
@@ -109,6 +111,45 @@
 #		define MY_SHM_GET_FRAGS	qm_get_frags
 #	endif
 #	define  shm_malloc_init qm_malloc_init
+#	define MY_FRAG_SIZE(_p) \
+		(((struct qm_frag*)((char*)(_p)-sizeof(struct qm_frag)))->size)
+#endif
+
+#ifdef SHM_CACHE
+#if defined(DBG_QM_MALLOC) || defined(VQ_MALLOC)
+#error "SHM_CACHE cannot be used with DBG_QM_MALLOC or VQ_MALLOC"
+#endif
+
+/* per-process cache of small shm fragments: the fragments are kept in
+ * size classes of SHM_CACHE_STEP bytes and are moved from/to the shared
+ * arena in batches, so most of the shm_malloc/shm_free calls for small
+ * sizes do not take the global memory lock */
+#define SHM_CACHE_STEP      16
+#define SHM_CACHE_CLASSES   32
+#define SHM_CACHE_MAX_SIZE  (SHM_CACHE_STEP*SHM_CACHE_CLASSES)
+/* fragments kept per class before returning a batch to the arena */
+#define SHM_CACHE_LIMIT     32
+/* fragments moved at once between the cache and the arena */
+#define SHM_CACHE_BATCH     16
+
+struct shm_cache_class {
+	void *first;
+	unsigned int no;
+};
+
+struct shm_cache_stats {
+	unsigned long hits;   /* requests served from the cache */
+	unsigned long misses; /* requests that had to refill the cache */
+	unsigned long size;   /* bytes held by the cache */
+};
+
+/* NULL if the process does not use a cache */
+extern struct shm_cache_class *shm_cache;
+extern struct shm_cache_stats shm_cache_st;
+
+void  shm_cache_enable(void);
+void* shm_cache_refill(struct shm_cache_class *c);
+void  shm_cache_drain(struct shm_cache_class *c);
 #endif
 
 	
@@ -194,10 +235,33 @@ void* _shm_resize(void* ptr, unsigned int size, const char* f, const char* fn,
 
 #define shm_malloc_unsafe(_size) MY_MALLOC(shm_block, (_size))
 
+#ifdef SHM_CACHE
+inline static void* shm_cache_malloc(unsigned int size)
+{
+	struct shm_cache_class *c;
+	void *p;
+
+	c = &shm_cache[ size ? (size-1)/SHM_CACHE_STEP : 0 ];
+	if (c->first==NULL)
+		return shm_cache_refill(c);
+
+	p = c->first;
+	c->first = *(void**)p;
+	c->no--;
+	shm_cache_st.hits++;
+	shm_cache_st.size -= MY_FRAG_SIZE(p);
+	return p;
+}
+#endif
+
 inline static void* shm_malloc(unsigned int size)
 {
 	void *p;
-	
+
+#ifdef SHM_CACHE
+	if (shm_cache && size<=SHM_CACHE_MAX_SIZE)
+		return shm_cache_malloc(size);
+#endif
 	shm_lock();
 	p=shm_malloc_unsafe(size);
 	shm_unlock();
@@ -218,12 +282,41 @@ inline static void* shm_realloc(void *ptr, unsigned int size)
 
 #define shm_free_unsafe( _p ) MY_FREE(shm_block, (_p))
 
+#ifdef SHM_CACHE
+inline static void shm_cache_free(void *p)
+{
+	struct shm_cache_class *c;
+	unsigned long size;
+
+	if (shm_cache && p) {
+		size = MY_FRAG_SIZE(p);
+		if (size>=SHM_CACHE_STEP && size<=SHM_CACHE_MAX_SIZE) {
+			/* a class only holds fragments at least as big as its size */
+			c = &shm_cache[ size/SHM_CACHE_STEP - 1 ];
+			*(void**)p = c->first;
+			c->first = p;
+			c->no++;
+			shm_cache_st.size += size;
+			if (c->no > SHM_CACHE_LIMIT)
+				shm_cache_drain(c);
+			return;
+		}
+	}
+
+	shm_lock();
+	shm_free_unsafe( p );
+	shm_unlock();
+}
+
+#define shm_free(_p) shm_cache_free(_p)
+#else
 #define shm_free(_p) \
 do { \
 		shm_lock(); \
 		shm_free_unsafe( _p ); \
 		shm_unlock(); \
 }while(0)
+#endif
 
 
 
@@ -272,6 +365,11 @@ inline static unsigned long shm_get_free(unsigned short foo) {
 inline static unsigned long shm_get_frags(unsigned short foo) {
 	return MY_SHM_GET_FRAGS(shm_block);
 }
+#ifdef SHM_CACHE
+unsigned long shm_get_cache_hits(unsigned short foo);
+unsigned long shm_get_cache_misses(unsigned short foo);
+unsigned long shm_get_cache_size(unsigned short foo);
+#endif
 #endif /*STATISTICS*/
 
 #endif
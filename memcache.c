@@ -23,6 +23,7 @@
  * History:
  * ---------
  *  2009-01-29  first version (Anca Vamanu)
+ *  2011-06-24  atomic counter operations (add/sub)
  */
 
 /*
@@ -102,6 +103,8 @@ int register_memcache(memcache_t* cs_entry)
 	cs_node->cs.store = cs_entry->store;
 	cs_node->cs.remove = cs_entry->remove;
 	cs_node->cs.fetch = cs_entry->fetch;
+	cs_node->cs.add = cs_entry->add;
+	cs_node->cs.sub = cs_entry->sub;
 	cs_node->cs.data = cs_entry -> data;
 
 	cs_node->next = memcache_list;
@@ -183,3 +186,56 @@ int cache_fetch(str* memcache_system, str* attr, str* val)
 	return cs->fetch(attr, val,cs->data);
 }
 
+static inline memcache_t* lookup_counter_memcache(str* memcache_system,
+		str* attr, int sub)
+{
+	memcache_t* cs;
+
+	if(memcache_system == NULL || attr == NULL)
+	{
+		LM_ERR("null arguments\n");
+		return 0;
+	}
+
+	cs = lookup_memcache(*memcache_system);
+	if(cs == NULL)
+	{
+		LM_ERR("Wrong argument <%.*s> - no memory memcache system with"
+				" this name registered\n",
+				memcache_system->len,memcache_system->s);
+		return 0;
+	}
+
+	if((sub && cs->sub == NULL) || (!sub && cs->add == NULL))
+	{
+		LM_ERR("memcache system <%.*s> does not support counters\n",
+				memcache_system->len,memcache_system->s);
+		return 0;
+	}
+
+	return cs;
+}
+
+int cache_add(str* memcache_system, str* attr, int val, unsigned int expires,
+		int* new_val)
+{
+	memcache_t* cs;
+
+	cs = lookup_counter_memcache(memcache_system, attr, 0);
+	if(cs == NULL)
+		return -1;
+
+	return cs->add(attr, val, expires, new_val, cs->data);
+}
+
+int cache_sub(str* memcache_system, str* attr, int val, unsigned int expires,
+		int* new_val)
+{
+	memcache_t* cs;
+
+	cs = lookup_counter_memcache(memcache_system, attr, 1);
+	if(cs == NULL)
+		return -1;
+
+	return cs->sub(attr, val, expires, new_val, cs->data);
+}
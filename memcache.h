@@ -23,6 +23,7 @@
  * History:
  * ---------
  *  2009-01-29  first version (Anca Vamanu)
+ *  2011-06-24  atomic counter operations (add/sub)
  */
 #ifndef _MEM_CACHE_H_
 #define _MEM_CACHE_H_
@@ -32,12 +33,20 @@
 typedef int (memcache_store_f)(str* name, str* value, unsigned int expires,void *data);
 typedef void (memcache_remove_f)(str* name,void *data);
 typedef int (memcache_fetch_f)(str* name, str* val,void *data);
+/* adds val to the integer value of name (created with expires if missing)
+ * and returns the result in new_val, in one atomic operation */
+typedef int (memcache_add_f)(str* name, int val, unsigned int expires,
+		int* new_val, void *data);
+typedef int (memcache_sub_f)(str* name, int val, unsigned int expires,
+		int* new_val, void *data);
 
 typedef struct memcache {
 	str name;
 	memcache_store_f* store;
 	memcache_remove_f* remove;
 	memcache_fetch_f* fetch;
+	memcache_add_f* add;   /* optional */
+	memcache_sub_f* sub;   /* optional */
 	void *data;
 }memcache_t;
 
@@ -48,5 +57,9 @@ int register_memcache(memcache_t* cs);
 int cache_store(str* memcache, str* attr, str* val, unsigned int expires);
 int cache_remove(str* memcache, str* attr);
 int cache_fetch(str* memcache, str* attr, str* val);
+int cache_add(str* memcache, str* attr, int val, unsigned int expires,
+		int* new_val);
+int cache_sub(str* memcache, str* attr, int val, unsigned int expires,
+		int* new_val);
 
 #endif
@@ -43,6 +43,9 @@
 #include "../../mem/mem.h"
 #include "../../usr_avp.h"
 #include "../../db/db.h"
+#include "../../db/db_insertq.h"
+#include "../../db/db_writeq.h"
+#include "../../timer.h"
 #include "../../parser/hf.h"
 #include "../../parser/msg_parser.h"
 #include "../../parser/parse_from.h"
@@ -374,6 +377,26 @@ int store_log_extra_values(struct dlg_cell *dlg, struct sip_msg *req,
 /* caution: keys need to be aligned to core format */
 static db_key_t db_keys[ACC_CORE_LEN+1+ACC_DLG_LEN+MAX_ACC_EXTRA+MAX_ACC_LEG];
 static db_val_t db_vals[ACC_CORE_LEN+1+ACC_DLG_LEN+MAX_ACC_EXTRA+MAX_ACC_LEG];
+/* number of columns of the acc_db_request() rows */
+static int db_row_len = 0;
+/* buffered inserts of the acc_db_request() rows, if enabled */
+static db_insert_queue_t* db_insq = 0;
+/* or asynchronous inserts, by the DB writer processes */
+static db_write_queue_t* db_wq = 0;
+
+
+static void acc_db_flush_timer(utime_t uticks, void *param)
+{
+	/* the timer process does not run child_init() */
+	if (db_handle==0) {
+		db_handle = acc_dbf.init((str*)param);
+		if (db_handle==0) {
+			LM_ERR("unable to connect to the database, rows kept\n");
+			return;
+		}
+	}
+	db_insert_queue_flush(db_insq, &acc_dbf, db_handle, 0);
+}
 
 
 static void acc_db_init_keys(void)
@@ -409,7 +432,10 @@ static void acc_db_init_keys(void)
 		VAL_NULL(db_vals + i)=0;
 	}
 	VAL_TYPE(db_vals+time_idx)=DB_DATETIME;
-	
+
+	/* the rows of acc_db_request() have all these columns */
+	db_row_len = n;
+
 	if (dlg_api.get_dlg) {
 		db_keys[n++] = &acc_duration_col;
 		db_keys[n++] = &acc_setuptime_col;
@@ -426,6 +452,58 @@ static void acc_db_init_keys(void)
 }
 
 
+/* sets up the buffering of the acc_db_request() rows, if enabled */
+static int acc_db_init_queues(const str* db_url)
+{
+	unsigned int interval;
+	int batch, policy;
+
+	batch = 1;
+	if (db_insert_buffer > 0) {
+		if (!DB_CAPABILITY(acc_dbf, DB_CAP_MULTIPLE_INSERT))
+			LM_WARN("database module does not support multiple inserts, "
+				"db_insert_buffer ignored\n");
+		else
+			batch = db_insert_buffer;
+	}
+
+	if (db_writers > 0) {
+		/* the writer processes do the batching */
+		policy = db_write_queue_policy(db_queue_policy);
+		if (policy<0) {
+			LM_ERR("unknown db_queue_policy <%s>\n", db_queue_policy);
+			return -1;
+		}
+		if (policy==DB_WQ_SPILL && db_spill_file==0) {
+			LM_ERR("db_spill_file is required by the spill policy\n");
+			return -1;
+		}
+		db_wq = db_write_queue_new(db_keys, db_row_len, db_queue_size,
+			batch, policy, db_spill_file);
+		return (db_wq==0) ? -1 : 0;
+	}
+
+	if (batch == 1)
+		return 0;
+
+	db_insq = db_insert_queue_new(db_keys, db_row_len, batch,
+		db_flush_interval);
+	if (db_insq==0)
+		return -1;
+
+	/* check twice per interval for the rows waiting too long */
+	interval = db_flush_interval*500;
+	if (interval < UTIMER_TICK)
+		interval = UTIMER_TICK;
+	if (register_utimer(acc_db_flush_timer, (void*)db_url, interval)<0) {
+		LM_ERR("failed to register the flush timer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 /* binds to the corresponding database module
  * returns 0 on success, -1 on error */
 int acc_db_init(const str* db_url)
@@ -458,6 +536,9 @@ int acc_db_init(const str* db_url)
 
 	acc_db_init_keys();
 
+	if (acc_db_init_queues(db_url)<0)
+		return -1;
+
 	return 0;
 }
 
@@ -485,6 +566,61 @@ void acc_db_close(void)
 }
 
 
+/* write the rows left in the insert buffer / write queue */
+void acc_db_flush(const str *db_url)
+{
+	if (db_insq==0 && db_wq==0)
+		return;
+
+	if (db_handle==0)
+		db_handle = acc_dbf.init(db_url);
+	if (db_insq) {
+		db_insert_queue_destroy(db_insq, &acc_dbf, db_handle);
+		db_insq = 0;
+	}
+	if (db_wq) {
+		db_write_queue_destroy(db_wq, &acc_dbf, db_handle);
+		db_wq = 0;
+	}
+}
+
+
+/* main loop of the DB writer processes */
+void acc_db_writer(int rank)
+{
+	db_write_queue_run(db_wq, &acc_dbf, db_handle);
+}
+
+
+unsigned long acc_db_queue_depth(void)
+{
+	return db_write_queue_depth(db_wq);
+}
+
+
+unsigned long acc_db_queue_dropped(void)
+{
+	return db_write_queue_dropped(db_wq);
+}
+
+
+unsigned long acc_db_queue_spilled(void)
+{
+	return db_write_queue_spilled(db_wq);
+}
+
+
+static inline int acc_db_insert(int n)
+{
+	if (db_wq)
+		return db_write_queue_add(db_wq, &acc_env.text/*table*/, db_vals);
+	if (db_insq)
+		return db_insert_queue_add(db_insq, &acc_dbf, db_handle,
+			&acc_env.text/*table*/, db_vals);
+	return acc_dbf.insert(db_handle, db_keys, db_vals, n);
+}
+
+
 int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl)
 {
 	static db_ps_t my_ps = NULL;
@@ -506,12 +642,14 @@ int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl)
 	for( i++; i < m; i++)
 		VAL_STR(db_vals+i) = val_arr[i];
 
-	acc_dbf.use_table(db_handle, &acc_env.text/*table*/);
-	CON_PS_REFERENCE(db_handle) = &my_ps;
+	if (db_insq==0 && db_wq==0) {
+		acc_dbf.use_table(db_handle, &acc_env.text/*table*/);
+		CON_PS_REFERENCE(db_handle) = &my_ps;
+	}
 
 	/* multi-leg columns */
 	if ( !leg_info ) {
-		if (acc_dbf.insert(db_handle, db_keys, db_vals, m) < 0) {
+		if (acc_db_insert(m) < 0) {
 			LM_ERR("failed to insert into database\n");
 			return -1;
 		}
@@ -520,7 +658,7 @@ int acc_db_request( struct sip_msg *rq, struct sip_msg *rpl)
 		do {
 			for ( i = m; i < m + n; i++)
 				VAL_STR(db_vals+i)=val_arr[i];
-			if (acc_dbf.insert(db_handle, db_keys, db_vals, m+n) < 0) {
+			if (acc_db_insert(m+n) < 0) {
 				LM_ERR("failed to insert into database\n");
 				return -1;
 			}
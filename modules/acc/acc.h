@@ -88,6 +88,11 @@ int  store_log_extra_values(struct dlg_cell *dlg, struct sip_msg *req,
 int  acc_db_init(const str* db_url);
 int  acc_db_init_child(const str* db_url);
 void acc_db_close();
+void acc_db_flush(const str* db_url);
+void acc_db_writer(int rank);
+unsigned long acc_db_queue_depth(void);
+unsigned long acc_db_queue_dropped(void);
+unsigned long acc_db_queue_spilled(void);
 int  acc_db_request( struct sip_msg *req, struct sip_msg *rpl);
 int  acc_db_cdrs_request(struct dlg_cell *dlg);
 int  store_db_extra_values(struct dlg_cell *dlg, struct sip_msg *req,
@@ -50,6 +50,7 @@
 #include "../../sr_module.h"
 #include "../../dprint.h"
 #include "../../mem/mem.h"
+#include "../../statistics.h"
 #include "../tm/tm_load.h"
 #include "../rr/api.h"
 
@@ -141,6 +142,17 @@ int diameter_client_port=3000;
 
 int db_flag = -1;
 int db_missed_flag = -1;
+/* rows written at once (multiple insert), 0 - disabled */
+int db_insert_buffer = 0;
+/* milliseconds a row may wait in the insert buffer */
+int db_flush_interval = 1000;
+/* DB writer processes, 0 - the rows are written by the SIP workers */
+int db_writers = 0;
+/* rows waiting for the DB writers */
+int db_queue_size = 10000;
+/* what to do with a row when the queue is full: drop, block or spill */
+char *db_queue_policy = "drop";
+char *db_spill_file = 0;
 /* db extra variables */
 static char *db_extra_str = 0;
 struct acc_extra *db_extra = 0;
@@ -186,6 +198,20 @@ static cmd_export_t cmds[] = {
 
 
 
+static proc_export_t procs[] = {
+	{"acc DB writer",  0,  0, acc_db_writer, 0, PROC_FLAG_INITCHILD},
+	{0,0,0,0,0,0}
+};
+
+
+static stat_export_t acc_stats[] = {
+	{"db_queue_depth",   STAT_IS_FUNC, (stat_var**)acc_db_queue_depth   },
+	{"db_queue_dropped", STAT_IS_FUNC, (stat_var**)acc_db_queue_dropped },
+	{"db_queue_spilled", STAT_IS_FUNC, (stat_var**)acc_db_queue_spilled },
+	{0,0,0}
+};
+
+
 static param_export_t params[] = {
 	{"early_media",             INT_PARAM, &early_media             },
 	{"failed_transaction_flag", INT_PARAM, &failed_transaction_flag },
@@ -219,6 +245,12 @@ static param_export_t params[] = {
 	{"db_missed_flag",       INT_PARAM, &db_missed_flag       },
 	{"db_extra",             STR_PARAM, &db_extra_str         },
 	{"db_url",               STR_PARAM, &db_url.s             },
+	{"db_insert_buffer",     INT_PARAM, &db_insert_buffer     },
+	{"db_flush_interval",    INT_PARAM, &db_flush_interval    },
+	{"db_writers",           INT_PARAM, &db_writers           },
+	{"db_queue_size",        INT_PARAM, &db_queue_size        },
+	{"db_queue_policy",      STR_PARAM, &db_queue_policy      },
+	{"db_spill_file",        STR_PARAM, &db_spill_file        },
 	{"db_table_acc",         STR_PARAM, &db_table_acc.s       },
 	{"db_table_missed_calls",STR_PARAM, &db_table_mc.s        },
 	{"acc_method_column",    STR_PARAM, &acc_method_col.s     },
@@ -238,10 +270,10 @@ struct module_exports exports= {
 	DEFAULT_DLFLAGS, /* dlopen flags */
 	cmds,       /* exported functions */
 	params,     /* exported params */
-	0,          /* exported statistics */
+	acc_stats,  /* exported statistics */
 	0,          /* exported MI functions */
 	0,          /* exported pseudo-variables */
-	0,          /* extra processes */
+	procs,      /* extra processes */
 	mod_init,   /* initialization module */
 	0,          /* response function */
 	destroy,    /* destroy function */
@@ -415,6 +447,16 @@ static int mod_init( void )
 			LM_ERR("failed to parse db_extra param\n");
 			return -1;
 		}
+		if (db_flush_interval <= 0) {
+			LM_ERR("invalid db_flush_interval %d\n", db_flush_interval);
+			return -1;
+		}
+		if (db_writers < 0 || (db_writers > 0 && db_queue_size <= 0)) {
+			LM_ERR("invalid db_writers %d / db_queue_size %d\n",
+				db_writers, db_queue_size);
+			return -1;
+		}
+		procs[0].no = db_writers;
 		if (acc_db_init(&db_url)<0){
 			LM_ERR("failed...did you load a database module?\n");
 			return -1;
@@ -517,6 +559,7 @@ static void destroy(void)
 {
 	if (log_extra)
 		destroy_extras( log_extra);
+	acc_db_flush(&db_url);
 	acc_db_close();
 	if (db_extra)
 		destroy_extras( db_extra);
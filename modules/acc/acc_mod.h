@@ -63,6 +63,12 @@ extern int diameter_missed_flag;
 
 extern int db_flag;
 extern int db_missed_flag;
+extern int db_insert_buffer;
+extern int db_flush_interval;
+extern int db_writers;
+extern int db_queue_size;
+extern char *db_queue_policy;
+extern char *db_spill_file;
 
 extern str db_table_acc;
 extern str db_table_mc;
@@ -225,6 +225,28 @@ auth_result_t pre_auth(struct sip_msg* _m, str* _realm, hdr_types_t _hftype,
 }
 
 
+/*
+ * Nonce count from the credentials, 0 if missing or invalid
+ */
+static inline unsigned int get_nonce_count(dig_cred_t* _cred)
+{
+	unsigned int nc;
+	int i, h;
+
+	if (_cred->qop.qop_parsed == QOP_UNSPEC || _cred->nc.len == 0 ||
+	_cred->nc.len > 8)
+		return 0;
+
+	for (nc = 0, i = 0; i < _cred->nc.len; i++) {
+		if ((h = hex2int(_cred->nc.s[i])) < 0)
+			return 0;
+		nc = (nc << 4) + h;
+	}
+
+	return nc;
+}
+
+
 /*
  * Purpose of this function is to do post authentication steps like
  * marking authorized credentials and so on.
@@ -233,6 +255,7 @@ auth_result_t post_auth(struct sip_msg* _m, struct hdr_field* _h)
 {
 	auth_body_t* c;
 	int index;
+	unsigned int nc;
 
 	c = (auth_body_t*)((_h)->parsed);
 
@@ -252,9 +275,10 @@ auth_result_t post_auth(struct sip_msg* _m, struct hdr_field* _h)
 				LM_ERR("failed to extract nonce index\n");
 				return ERROR;
 			}
-			LM_DBG("nonce index= %d\n", index);
+			nc = nonce_nc_buf ? get_nonce_count(&c->digest) : 0;
+			LM_DBG("nonce index= %d, nc= %u\n", index, nc);
 
-			if(!is_nonce_index_valid(index)) {
+			if(!is_nonce_index_valid(index, nc)) {
 				LM_DBG("nonce index not valid\n");
 				c->stale = 1;
 				return STALE_NONCE;
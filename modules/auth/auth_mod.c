@@ -30,6 +30,7 @@
  * 2003-04-28 rpid contributed by Juha Heinanen added (janakj) 
  * 2005-05-31 general avp specification added for rpid (bogdan)
  * 2006-03-01 pseudo variables support for domain name (bogdan)
+ * 2011-07-11 nonce_index_size and nonce_count_check parameters
  */
 
 
@@ -115,6 +116,9 @@ int* sec_monit= NULL;
 int* second= NULL;
 int* next_index= NULL;
 int disable_nonce_check = 0;
+int max_nonce_index = 100000;
+static int nonce_count_check = 0;
+unsigned int* nonce_nc_buf= NULL; /* last nc received for each index */
 
 /*
  * Exported functions 
@@ -157,6 +161,8 @@ static param_export_t params[] = {
 	{"password_spec",       STR_PARAM, &passwd_spec_param  },
 	{"calculate_ha1",       INT_PARAM, &auth_calc_ha1      },
 	{"disable_nonce_check", INT_PARAM, &disable_nonce_check},
+	{"nonce_index_size",    INT_PARAM, &max_nonce_index    },
+	{"nonce_count_check",   INT_PARAM, &nonce_count_check  },
 	{0, 0, 0}
 };
 
@@ -284,6 +290,12 @@ static int mod_init(void)
 
 	if(!disable_nonce_check)
 	{
+		if(max_nonce_index <= 0)
+		{
+			LM_ERR("invalid nonce_index_size %d\n", max_nonce_index);
+			return -1;
+		}
+
 		nonce_lock = (gen_lock_t*)lock_alloc();
 		if(nonce_lock== NULL)
 		{
@@ -305,6 +317,18 @@ static int mod_init(void)
 			return -10;
 		}
 		memset(nonce_buf, 255, NBUF_LEN);
+
+		if(nonce_count_check)
+		{
+			nonce_nc_buf= (unsigned int*)shm_malloc(max_nonce_index*
+					sizeof(unsigned int));
+			if(nonce_nc_buf== NULL)
+			{
+				LM_ERR("no more share memory\n");
+				return -10;
+			}
+			memset(nonce_nc_buf, 255, max_nonce_index* sizeof(unsigned int));
+		}
 	   
 		sec_monit= (int*)shm_malloc((nonce_expire +1)* sizeof(int));
 		if(sec_monit== NULL)
@@ -342,6 +366,8 @@ static void destroy(void)
 
 		if(nonce_buf)
 			shm_free(nonce_buf);
+		if(nonce_nc_buf)
+			shm_free(nonce_nc_buf);
 		if(second)
 			shm_free(second);
 		if(sec_monit)
@@ -34,8 +34,7 @@
 #include "../signaling/signaling.h"
 #include "../../lock_ops.h"
 
-#define MAX_NONCE_INDEX     100000
-#define NBUF_LEN            (MAX_NONCE_INDEX>>3)
+#define NBUF_LEN            ((max_nonce_index+7)>>3)
 
 /*
  * Module parameters variables
@@ -56,5 +55,7 @@ extern int* sec_monit;
 extern int* second;
 extern int* next_index;
 extern int disable_nonce_check;
+extern int max_nonce_index;
+extern unsigned int* nonce_nc_buf;
 
 #endif /* AUTH_MOD_H */
@@ -24,6 +24,7 @@
  * History:
  * --------
  *  2008-05-29  initial version (anca)
+ *  2011-07-11  lock-free check of the used nonces, nonce count check
  */
 
 #include <stdio.h>
@@ -32,17 +33,17 @@
 #include "index.h"
 #include "auth_mod.h"
 
-#define set_buf_bit(index)    \
-    do{\
-        nonce_buf[index>>3] |=  (1<<(index%8));\
-    }while(0)
-
+/* atomic - the bits of the same byte are set by different processes */
 #define unset_buf_bit(index)    \
-    do{\
-        nonce_buf[index>>3] &=  ~(1<<(index%8));\
-    }while(0)
+    __sync_fetch_and_and(&nonce_buf[(index)>>3], ~(1<<((index)%8)))
+
+/* sets the bit and returns its previous value */
+#define test_set_buf_bit(index)  \
+    (__sync_fetch_and_or(&nonce_buf[(index)>>3], 1<<((index)%8)) & \
+        (1<<((index)%8)))
 
-#define check_buf_bit(index)  ( nonce_buf[index>>3] & (1<<(index%8)) )
+/* last nonce count of an index - NC_UNUSED until the index is reserved */
+#define NC_UNUSED   ((unsigned int)-1)
 
 /*
  *  Get a valid index for the new nonce
@@ -68,7 +69,7 @@ int reserve_nonce_index(void)
         if(*second!= curr_sec)
         {
             /* get the index for the next nonce */
-			index= (*next_index==MAX_NONCE_INDEX)?MAX_NONCE_INDEX-1:*next_index -1;
+			index= (*next_index==max_nonce_index)?max_nonce_index-1:*next_index -1;
 
 			/* set the interval in sec_monit vector */
             if(curr_sec> *second)
@@ -90,7 +91,7 @@ int reserve_nonce_index(void)
 
     if(sec_monit[curr_sec]== -1) /* if in the first second*/
     {
-        if(*next_index == MAX_NONCE_INDEX)
+        if(*next_index == max_nonce_index)
         {
             lock_release(nonce_lock);
             return -1;
@@ -102,7 +103,7 @@ int reserve_nonce_index(void)
     if(*next_index> sec_monit[curr_sec]) /* if at the end of the buffer */
     {
         /* if at the end of the buffer */
-        if(*next_index == MAX_NONCE_INDEX)
+        if(*next_index == max_nonce_index)
         {
             *next_index = 0;
             goto index_smaller;
@@ -119,7 +120,10 @@ index_smaller:
     }
 
 done:
-	unset_buf_bit(*next_index);
+	if(nonce_nc_buf)
+		nonce_nc_buf[*next_index]= 0;
+	else
+		unset_buf_bit(*next_index);
     index= *next_index;
     *next_index = *next_index + 1;
     LM_DBG("second= %d, sec_monit= %d,  index= %d\n", *second, sec_monit[curr_sec], index);
@@ -128,71 +132,79 @@ done:
 }
 
 /*
- *  Check if the nonce has been used before
+ *  Mark the nonce index as used - a nonce count greater than 0 (qop
+ *  present) may reuse the index, but only increasing
  */
+static inline int use_nonce_index(int index, unsigned int nc)
+{
+    unsigned int last;
+
+    if(nonce_nc_buf== NULL)
+        return test_set_buf_bit(index) ? 0 : 1;
+
+    do {
+        last= nonce_nc_buf[index];
+        if(last== NC_UNUSED || (nc== 0 && last!= 0) || (nc && nc<= last))
+            return 0;
+    } while(!__sync_bool_compare_and_swap(&nonce_nc_buf[index], last,
+                (nc== 0)?NC_UNUSED:nc));
 
+    return 1;
+}
 
-int is_nonce_index_valid(int index)
+/*
+ *  Check if the nonce has been used before
+ *  No lock - the window of valid indexes is only read here, and an
+ *  update racing with the check may make an index at its edges be
+ *  refused or accepted once more; a replay is still caught by the atomic
+ *  marking of the index, done in any case.
+ */
+int is_nonce_index_valid(int index, unsigned int nc)
 {
-    /* if greater than MAX_NONCE_INDEX ->error */
-    
-    if(index>= MAX_NONCE_INDEX )
+    int start, end;
+
+    /* if greater than max_nonce_index ->error */
+    if(index< 0 || index>= max_nonce_index)
     {
         LM_ERR("index greater than buffer length\n");
         return 0;
     }
 
-    lock_get(nonce_lock);
+    start= sec_monit[*second];
+    end= *next_index;
 
-    /* if in the first 30 seconds */
-    if(sec_monit[*second]== -1)
+    if(start== -1)
     {
-        if(index>= *next_index)
+        /* if in the first nonce_expire seconds */
+        if(index>= end)
         {
             LM_DBG("index out of range\n");
-            lock_release(nonce_lock);
             return 0;
         }
-        else
-        {
-            set_buf_bit(index);
-            lock_release(nonce_lock);
-            return 1;
-        }
     }
-
-    /* check if right interval */
-    if(*next_index < sec_monit[*second])
+    else if(end < start)
     {
-        if(!(index>= sec_monit[*second] || index<= *next_index))
+        if(!(index>= start || index<= end))
         {
             LM_DBG("index out of the permitted interval\n");
-            goto error;
+            return 0;
         }
     }
     else
     {
-        if(!(index >= sec_monit[*second] && index<=*next_index))
+        if(!(index >= start && index<= end))
         {
             LM_DBG("index out of the permitted interval\n");
-            goto error;
+            return 0;
         }
     }
 
     /* check if the first time used */
-    if(check_buf_bit(index))
+    if(!use_nonce_index(index, nc))
     {
         LM_DBG("nonce already used\n");
-        goto error;
+        return 0;
     }
-    
-    set_buf_bit(index);
-    lock_release(nonce_lock);
-    return 1;
-
-error:
-    lock_release(nonce_lock);
-    return 0;
 
+    return 1;
 }
-
@@ -35,8 +35,9 @@
 int reserve_nonce_index(void);
 
 /*
- * Check index validity
+ * Check index validity - nc is the nonce count of the credentials,
+ * 0 if they have no qop
  */
-int is_nonce_index_valid(int index);
+int is_nonce_index_valid(int index, unsigned int nc);
 
 #endif
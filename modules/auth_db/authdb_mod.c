@@ -32,6 +32,7 @@
  * 2005-05-31  general definition of AVPs in credentials now accepted - ID AVP,
  *             STRING AVP, AVP aliases (bogdan)
  * 2006-03-01 pseudo variables support for domain name (bogdan)
+ * 2011-07-08 credentials cache, with MI commands to drop entries
  */
 
 #include <stdio.h>
@@ -42,10 +43,12 @@
 #include "../../error.h"
 #include "../../mod_fix.h"
 #include "../../mem/mem.h"
+#include "../../timer.h"
 #include "../auth/api.h"
 #include "../signaling/signaling.h"
 #include "aaa_avps.h"
 #include "authorize.h"
+#include "cred_cache.h"
 
 
 
@@ -88,6 +91,8 @@ struct sig_binds sigb;
 
 #define DEFAULT_CRED_LIST "rpid"
 
+#define CACHE_CLEAN_INTERVAL 60
+
 /*
  * Module parameter variables
  */
@@ -108,6 +113,8 @@ auth_api_t auth_api;
 char *credentials_list      = DEFAULT_CRED_LIST;
 struct aaa_avp *credentials = 0; /* Parsed list of credentials to load */
 int credentials_n           = 0; /* Number of credentials in the list */
+static int cache_size       = 0; /* max cached users, 0 - no limit */
+static int cache_table_size = 1024;
 
 /*
  * Exported functions
@@ -131,10 +138,24 @@ static param_export_t params[] = {
 	{"calculate_ha1",     INT_PARAM, &calc_ha1           },
 	{"use_domain",        INT_PARAM, &use_domain         },
 	{"load_credentials",  STR_PARAM, &credentials_list   },
+	{"cache_ttl",         INT_PARAM, &cred_cache_ttl     },
+	{"cache_negative_ttl",INT_PARAM, &cred_cache_negative_ttl },
+	{"cache_size",        INT_PARAM, &cache_size         },
+	{"cache_table_size",  INT_PARAM, &cache_table_size   },
 	{0, 0, 0}
 };
 
 
+/*
+ * Exported MI functions
+ */
+static mi_export_t mi_cmds[] = {
+	{"auth_cache_invalidate", mi_cache_invalidate, 0,                0, 0},
+	{"auth_cache_flush",      mi_cache_flush,      MI_NO_INPUT_FLAG, 0, 0},
+	{0, 0, 0, 0, 0}
+};
+
+
 /*
  * Module interface
  */
@@ -145,7 +166,7 @@ struct module_exports exports = {
 	cmds,       /* Exported functions */
 	params,     /* Exported parameters */
 	0,          /* exported statistics */
-	0,          /* exported MI functions */
+	mi_cmds,    /* exported MI functions */
 	0,          /* exported pseudo-variables */
 	0,          /* extra processes */
 	mod_init,   /* module initialization function */
@@ -209,6 +230,18 @@ static int mod_init(void)
 		return -5;
 	}
 
+	if (cred_cache_ttl > 0 || cred_cache_negative_ttl > 0) {
+		if (cache_table_size <= 0 || cache_size < 0) {
+			LM_ERR("invalid cache_table_size or cache_size\n");
+			return -1;
+		}
+		if (cred_cache_init(cache_table_size, cache_size) < 0) {
+			LM_ERR("failed to init the credentials cache\n");
+			return -1;
+		}
+		register_timer(cred_cache_clean, 0, CACHE_CLEAN_INTERVAL);
+	}
+
 	return 0;
 }
 
@@ -224,6 +257,7 @@ static void destroy(void)
 		credentials = 0;
 		credentials_n = 0;
 	}
+	cred_cache_destroy();
 }
 
 
@@ -32,6 +32,7 @@
  * 2006-03-01 pseudo variables support for domain name (bogdan)
  * 2009-01-25 added prepared statements support in running the DB queries
  *             (bogdan)
+ * 2011-07-08 credentials cache
  */
 
 
@@ -48,22 +49,42 @@
 #include "../../mem/mem.h"
 #include "aaa_avps.h"
 #include "authdb_mod.h"
+#include "cred_cache.h"
 
 
 static str auth_500_err = str_init("Server Internal Error");
 
 
 static inline int get_ha1(struct username* _username, str* _domain,
-			  const str* _table, char* _ha1, db_res_t** res)
+			  const str* _table, char* _ha1, db_res_t** res, cred_entry_t** ce)
 {
 	struct aaa_avp *cred;
 	db_key_t keys[2];
 	db_val_t vals[2];
 	db_key_t *col;
-	str result;
+	str result, cdomain;
 	static db_ps_t auth_ps = NULL;
 
-	int n, nc;
+	int n, nc, flags;
+
+	/* the key of the user in the cache - as for the query */
+	flags = (_username->domain.len && !calc_ha1) ? CRED_PASS_2 : 0;
+	cdomain.s = NULL;
+	cdomain.len = 0;
+	if (use_domain)
+		cdomain = _username->domain.len ? _username->domain : *_domain;
+
+	*ce = cred_cache_get(&_username->user, &cdomain, (str*)_table, flags);
+	if (*ce) {
+		if ((*ce)->flags & CRED_NEGATIVE) {
+			LM_DBG("cached as unknown user \'%.*s@%.*s\'\n",
+				_username->user.len, ZSW(_username->user.s),
+				cdomain.len, ZSW(cdomain.s));
+			return 1;
+		}
+		result = (*ce)->pass;
+		goto found;
+	}
 
 	col = pkg_malloc(sizeof(*col) * (credentials_n + 1));
 	if (col == NULL) {
@@ -115,12 +136,18 @@ static inline int get_ha1(struct username* _username, str* _domain,
 		LM_DBG("no result for user \'%.*s@%.*s\'\n",
 				_username->user.len, ZSW(_username->user.s),
 			(use_domain ? (_domain->len) : 0), ZSW(_domain->s));
+		cred_cache_put(&_username->user, &cdomain, (str*)_table, flags,
+			NULL, NULL, NULL, 0);
 		return 1;
 	}
 
 	result.s = (char*)ROW_VALUES(RES_ROWS(*res))[0].val.string_val;
 	result.len = strlen(result.s);
 
+	cred_cache_put(&_username->user, &cdomain, (str*)_table, flags, &result,
+		RES_TYPES(*res) + 1, ROW_VALUES(RES_ROWS(*res)) + 1, credentials_n);
+
+found:
 	if (calc_ha1) {
 		/* Only plaintext passwords are stored in database,
 		 * we have to calculate HA1 */
@@ -137,20 +164,21 @@ static inline int get_ha1(struct username* _username, str* _domain,
 
 
 /*
- * Generate AVPs from the database result
+ * Generate AVPs from the loaded credentials (from the database result
+ * or from the cache)
  */
-static int generate_avps(db_res_t* result)
+static int generate_avps(db_type_t* types, db_val_t* values)
 {
 	struct aaa_avp *cred;
 	int_str ivalue;
 	int i;
 
-	for (cred=credentials, i=1; cred; cred=cred->next, i++) {
-		switch (result->col.types[i]) {
+	for (cred=credentials, i=0; cred; cred=cred->next, i++) {
+		switch (types[i]) {
 		case DB_STR:
-			ivalue.s = VAL_STR(&(result->rows[0].values[i]));
+			ivalue.s = VAL_STR(&values[i]);
 
-			if (VAL_NULL(&(result->rows[0].values[i])) ||
+			if (VAL_NULL(&values[i]) ||
 			ivalue.s.s == NULL || ivalue.s.len==0)
 				continue;
 
@@ -165,9 +193,9 @@ static int generate_avps(db_res_t* result)
 				ivalue.s.len, ZSW(ivalue.s.s));
 			break;
 		case DB_STRING:
-			ivalue.s.s = (char*)VAL_STRING(&(result->rows[0].values[i]));
+			ivalue.s.s = (char*)VAL_STRING(&values[i]);
 
-			if (VAL_NULL(&(result->rows[0].values[i])) ||
+			if (VAL_NULL(&values[i]) ||
 			ivalue.s.s == NULL || (ivalue.s.len=strlen(ivalue.s.s))==0 )
 				continue;
 
@@ -182,10 +210,10 @@ static int generate_avps(db_res_t* result)
 				ivalue.s.len, ZSW(ivalue.s.s));
 			break;
 		case DB_INT:
-			if (VAL_NULL(&(result->rows[0].values[i])))
+			if (VAL_NULL(&values[i]))
 				continue;
 
-			ivalue.n = (int)VAL_INT(&(result->rows[0].values[i]));
+			ivalue.n = (int)VAL_INT(&values[i]);
 
 			if (add_avp(cred->avp_type, cred->avp_name, ivalue)!=0) {
 				LM_ERR("failed to add AVP\n");
@@ -200,8 +228,8 @@ static int generate_avps(db_res_t* result)
 		default:
 			LM_ERR("subscriber table column %d `%.*s' has unsuported type. "
 				"Only string/str or int columns are supported by"
-				"load_credentials.\n", i,
-				result->col.names[i]->len, result->col.names[i]->s);
+				"load_credentials.\n", i + 1,
+				cred->attr_name.len, cred->attr_name.s);
 			break;
 		}
 	}
@@ -223,6 +251,7 @@ static inline int authorize(struct sip_msg* _m, gparam_p _realm,
 	auth_result_t ret;
 	str domain, table;
 	db_res_t* result = NULL;
+	cred_entry_t* ce = NULL;
 
 	if(!_table) {
 		LM_ERR("invalid table parameter\n");
@@ -248,7 +277,7 @@ static inline int authorize(struct sip_msg* _m, gparam_p _realm,
 
 	cred = (auth_body_t*)h->parsed;
 
-	res = get_ha1(&cred->digest.username, &domain, &table, ha1, &result);
+	res = get_ha1(&cred->digest.username, &domain, &table, ha1, &result, &ce);
 	if (res < 0) {
 		/* Error while accessing the database */
 		if (sigb.reply(_m, 500, &auth_500_err, NULL) == -1) {
@@ -258,22 +287,31 @@ static inline int authorize(struct sip_msg* _m, gparam_p _realm,
 	}
 	if (res > 0) {
 		/* Username not found in the database */
-		auth_dbf.free_result(auth_db_handle, result);
-		return USER_UNKNOWN;
+		ret = USER_UNKNOWN;
+		goto done;
 	}
 
 	/* Recalculate response, it must be same to authorize successfully */
 	if (!auth_api.check_response(&(cred->digest),
 				&_m->first_line.u.request.method, ha1)) {
 		ret = auth_api.post_auth(_m, h);
-		if (ret == AUTHORIZED)
-			generate_avps(result);
-		auth_dbf.free_result(auth_db_handle, result);
-		return ret;
+		if (ret == AUTHORIZED) {
+			if (ce)
+				generate_avps(ce->types, ce->vals);
+			else
+				generate_avps(RES_TYPES(result) + 1,
+					ROW_VALUES(RES_ROWS(result)) + 1);
+		}
+		goto done;
 	}
 
-	auth_dbf.free_result(auth_db_handle, result);
-	return INVALID_PASSWORD;
+	ret = INVALID_PASSWORD;
+done:
+	if (ce)
+		pkg_free(ce);
+	if (result)
+		auth_dbf.free_result(auth_db_handle, result);
+	return ret;
 }
 
 
@@ -0,0 +1,447 @@
+/*
+ * $Id$
+ *
+ * Digest Authentication - cache of the subscriber credentials
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-08  first version
+ */
+
+/*
+ * The credentials loaded from the subscriber table (the password column
+ * and the load_credentials columns) are kept in a shm hash table, by
+ * user and domain, for cache_ttl seconds - the REGISTER refreshes of a
+ * user do not hit the database anymore. The users not found in the table
+ * are cached too, for cache_negative_ttl seconds, so scans for valid
+ * user names do not hit the database either. A change in the table is
+ * seen only after the entry expires or is dropped via MI.
+ */
+
+#include <string.h>
+
+#include "../../dprint.h"
+#include "../../hash_func.h"
+#include "../../timer.h"
+#include "../../ut.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "authdb_mod.h"
+#include "cred_cache.h"
+
+
+int cred_cache_ttl = 0;
+int cred_cache_negative_ttl = 0;
+
+static cred_bucket_t *cred_htable = NULL;
+static unsigned int cred_htable_size = 0;
+static unsigned int cred_max_entries = 0;
+static unsigned int *cred_entries = NULL;
+
+
+int cred_cache_init(unsigned int size, unsigned int max_entries)
+{
+	unsigned int i;
+
+	/* power of 2, for masking */
+	for (cred_htable_size = 1; cred_htable_size < size; cred_htable_size <<= 1);
+
+	cred_entries = (unsigned int*)shm_malloc(sizeof(unsigned int));
+	cred_htable = (cred_bucket_t*)shm_malloc(cred_htable_size *
+		sizeof(cred_bucket_t));
+	if (cred_htable == NULL || cred_entries == NULL) {
+		LM_ERR("no more shm memory\n");
+		goto error;
+	}
+	memset(cred_htable, 0, cred_htable_size * sizeof(cred_bucket_t));
+	*cred_entries = 0;
+
+	for (i = 0; i < cred_htable_size; i++) {
+		if (lock_init(&cred_htable[i].lock) == 0) {
+			LM_ERR("failed to init lock %u\n", i);
+			for (; i > 0; i--)
+				lock_destroy(&cred_htable[i-1].lock);
+			goto error;
+		}
+	}
+
+	cred_max_entries = max_entries;
+
+	return 0;
+error:
+	if (cred_htable)
+		shm_free(cred_htable);
+	if (cred_entries)
+		shm_free(cred_entries);
+	cred_htable = NULL;
+	cred_entries = NULL;
+	return -1;
+}
+
+void cred_cache_destroy(void)
+{
+	cred_entry_t *e, *next;
+	unsigned int i;
+
+	if (cred_htable == NULL)
+		return;
+
+	for (i = 0; i < cred_htable_size; i++) {
+		for (e = cred_htable[i].entries; e; e = next) {
+			next = e->next;
+			shm_free(e);
+		}
+		lock_destroy(&cred_htable[i].lock);
+	}
+	shm_free(cred_htable);
+	shm_free(cred_entries);
+	cred_htable = NULL;
+	cred_entries = NULL;
+}
+
+
+/*
+ * builds an entry in a single chunk of memory - the strings of the
+ * values are copied, so the entry does not depend on the DB result
+ */
+static cred_entry_t* cred_entry_new(str *user, str *domain, str *table,
+		int flags, str *pass, db_type_t *types, db_val_t *vals, int n, int shm)
+{
+	cred_entry_t *e;
+	unsigned int size;
+	char *p;
+	int i, len;
+
+	size = sizeof(cred_entry_t) + n * (sizeof(db_val_t) + sizeof(db_type_t))
+		+ user->len + domain->len + table->len + (pass ? pass->len + 1 : 0);
+	for (i = 0; i < n; i++) {
+		if (VAL_NULL(&vals[i]))
+			continue;
+		if (types[i] == DB_STR)
+			size += VAL_STR(&vals[i]).len + 1;
+		else if (types[i] == DB_STRING && VAL_STRING(&vals[i]))
+			size += strlen(VAL_STRING(&vals[i])) + 1;
+	}
+
+	e = (cred_entry_t*)(shm ? shm_malloc(size) : pkg_malloc(size));
+	if (e == NULL) {
+		LM_ERR("no more %s memory\n", shm ? "shm" : "pkg");
+		return NULL;
+	}
+	memset(e, 0, sizeof(cred_entry_t));
+
+	e->vals = (db_val_t*)(e + 1);
+	e->types = (db_type_t*)(e->vals + n);
+	e->n = n;
+	p = (char*)(e->types + n);
+
+	e->user.s = p;
+	e->user.len = user->len;
+	memcpy(p, user->s, user->len);
+	p += user->len;
+
+	e->domain.s = p;
+	e->domain.len = domain->len;
+	memcpy(p, domain->s, domain->len);
+	p += domain->len;
+
+	e->table.s = p;
+	e->table.len = table->len;
+	memcpy(p, table->s, table->len);
+	p += table->len;
+
+	if (pass) {
+		e->pass.s = p;
+		e->pass.len = pass->len;
+		memcpy(p, pass->s, pass->len);
+		p[pass->len] = '\0';
+		p += pass->len + 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		e->types[i] = types[i];
+		e->vals[i] = vals[i];
+		VAL_FREE(&e->vals[i]) = 0;
+		if (VAL_NULL(&vals[i]))
+			continue;
+
+		switch (types[i]) {
+		case DB_STR:
+			len = VAL_STR(&vals[i]).len;
+			memcpy(p, VAL_STR(&vals[i]).s, len);
+			p[len] = '\0';
+			VAL_STR(&e->vals[i]).s = p;
+			p += len + 1;
+			break;
+		case DB_STRING:
+			if (VAL_STRING(&vals[i]) == NULL)
+				break;
+			len = strlen(VAL_STRING(&vals[i]));
+			memcpy(p, VAL_STRING(&vals[i]), len + 1);
+			VAL_STRING(&e->vals[i]) = p;
+			p += len + 1;
+			break;
+		case DB_BLOB:
+			/* not loaded as AVP anyhow */
+			VAL_NULL(&e->vals[i]) = 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return e;
+}
+
+static inline int cred_entry_match(cred_entry_t *e, str *user, str *domain)
+{
+	return e->user.len == user->len && e->domain.len == domain->len &&
+		memcmp(e->user.s, user->s, user->len) == 0 &&
+		memcmp(e->domain.s, domain->s, domain->len) == 0;
+}
+
+static inline void cred_entry_free(cred_entry_t *e)
+{
+	shm_free(e);
+	__sync_fetch_and_sub(cred_entries, 1);
+}
+
+
+cred_entry_t* cred_cache_get(str *user, str *domain, str *table, int flags)
+{
+	cred_bucket_t *b;
+	cred_entry_t *e, **prev, *ret;
+	unsigned int now;
+
+	if (cred_htable == NULL)
+		return NULL;
+
+	b = &cred_htable[core_hash(user, domain, cred_htable_size)];
+	now = get_ticks();
+	ret = NULL;
+
+	lock_get(&b->lock);
+	for (prev = &b->entries; (e = *prev) != NULL; ) {
+		if (e->expires <= now) {
+			*prev = e->next;
+			cred_entry_free(e);
+			continue;
+		}
+		if (cred_entry_match(e, user, domain) &&
+		(e->flags & CRED_PASS_2) == (flags & CRED_PASS_2) &&
+		e->table.len == table->len &&
+		memcmp(e->table.s, table->s, table->len) == 0) {
+			ret = cred_entry_new(&e->user, &e->domain, &e->table, e->flags,
+				(e->flags & CRED_NEGATIVE) ? NULL : &e->pass,
+				e->types, e->vals, e->n, 0);
+			if (ret)
+				ret->flags = e->flags;
+			break;
+		}
+		prev = &e->next;
+	}
+	lock_release(&b->lock);
+
+	return ret;
+}
+
+/*
+ * picks the entry of the bucket to be dropped for a new one when the cache
+ * is full: an expired entry, else the unknown user expiring first, else
+ * (only for a known user) the user expiring first - so the scans for user
+ * names do not push the real users out of the cache
+ */
+static cred_entry_t** cred_cache_victim(cred_bucket_t *b, int negative,
+		unsigned int now)
+{
+	cred_entry_t *e, **prev, **neg, **pos;
+
+	neg = pos = NULL;
+	for (prev = &b->entries; (e = *prev) != NULL; prev = &e->next) {
+		if (e->expires <= now)
+			return prev;
+		if (e->flags & CRED_NEGATIVE) {
+			if (neg == NULL || e->expires < (*neg)->expires)
+				neg = prev;
+		} else if (pos == NULL || e->expires < (*pos)->expires) {
+			pos = prev;
+		}
+	}
+
+	if (neg)
+		return neg;
+	return negative ? NULL : pos;
+}
+
+void cred_cache_put(str *user, str *domain, str *table, int flags,
+		str *pass, db_type_t *types, db_val_t *vals, int n)
+{
+	cred_bucket_t *b;
+	cred_entry_t *e, *old, **prev;
+	unsigned int now;
+	int ttl;
+
+	if (cred_htable == NULL)
+		return;
+
+	ttl = pass ? cred_cache_ttl : cred_cache_negative_ttl;
+	if (ttl <= 0)
+		return;
+
+	if (pass == NULL) {
+		flags |= CRED_NEGATIVE;
+		n = 0;
+	}
+	e = cred_entry_new(user, domain, table, flags, pass, types, vals, n, 1);
+	if (e == NULL)
+		return;
+	e->flags = flags;
+	now = get_ticks();
+	e->expires = now + ttl;
+
+	b = &cred_htable[core_hash(user, domain, cred_htable_size)];
+
+	lock_get(&b->lock);
+	/* another process may have cached it meanwhile */
+	for (prev = &b->entries; (old = *prev) != NULL; prev = &old->next) {
+		if (cred_entry_match(old, user, domain) &&
+		(old->flags & CRED_PASS_2) == (flags & CRED_PASS_2) &&
+		old->table.len == table->len &&
+		memcmp(old->table.s, table->s, table->len) == 0) {
+			*prev = old->next;
+			cred_entry_free(old);
+			break;
+		}
+	}
+	/* full -> make room in this bucket; a known user gets in even if the
+	 * bucket is empty, so the limit may be exceeded by one entry per
+	 * bucket (it is a dirty read anyhow) */
+	if (old == NULL && cred_max_entries && *cred_entries >= cred_max_entries) {
+		prev = cred_cache_victim(b, flags & CRED_NEGATIVE, now);
+		if (prev) {
+			old = *prev;
+			*prev = old->next;
+			cred_entry_free(old);
+		} else if (flags & CRED_NEGATIVE) {
+			lock_release(&b->lock);
+			LM_DBG("cache full, %.*s not cached\n", user->len, user->s);
+			shm_free(e);
+			return;
+		}
+	}
+	e->next = b->entries;
+	b->entries = e;
+	__sync_fetch_and_add(cred_entries, 1);
+	lock_release(&b->lock);
+}
+
+void cred_cache_clean(unsigned int ticks, void *param)
+{
+	cred_bucket_t *b;
+	cred_entry_t *e, **prev;
+	unsigned int i;
+
+	for (i = 0; i < cred_htable_size; i++) {
+		b = &cred_htable[i];
+		if (b->entries == NULL)
+			continue;
+
+		lock_get(&b->lock);
+		for (prev = &b->entries; (e = *prev) != NULL; ) {
+			if (e->expires <= ticks) {
+				*prev = e->next;
+				cred_entry_free(e);
+			} else {
+				prev = &e->next;
+			}
+		}
+		lock_release(&b->lock);
+	}
+}
+
+
+/*
+ * MI: drops the cached credentials of a user (from all the tables)
+ * params: user [domain]
+ */
+struct mi_root* mi_cache_invalidate(struct mi_root *cmd, void *param)
+{
+	struct mi_node *node;
+	cred_bucket_t *b;
+	cred_entry_t *e, **prev;
+	str user, domain;
+
+	node = cmd->node.kids;
+	if (node == NULL || node->value.s == NULL || node->value.len == 0)
+		return init_mi_tree( 400, MI_MISSING_PARM_S, MI_MISSING_PARM_LEN);
+	user = node->value;
+
+	domain.s = NULL;
+	domain.len = 0;
+	if (node->next) {
+		if (node->next->next)
+			return init_mi_tree( 400, MI_MISSING_PARM_S, MI_MISSING_PARM_LEN);
+		/* the domain is part of the key only if used in the query */
+		if (use_domain)
+			domain = node->next->value;
+	} else if (use_domain) {
+		return init_mi_tree( 400, MI_MISSING_PARM_S, MI_MISSING_PARM_LEN);
+	}
+
+	if (cred_htable == NULL)
+		return init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+
+	b = &cred_htable[core_hash(&user, &domain, cred_htable_size)];
+
+	lock_get(&b->lock);
+	for (prev = &b->entries; (e = *prev) != NULL; ) {
+		if (cred_entry_match(e, &user, &domain)) {
+			*prev = e->next;
+			cred_entry_free(e);
+		} else {
+			prev = &e->next;
+		}
+	}
+	lock_release(&b->lock);
+
+	return init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+}
+
+/*
+ * MI: drops all the cached credentials
+ */
+struct mi_root* mi_cache_flush(struct mi_root *cmd, void *param)
+{
+	cred_entry_t *e, *next;
+	unsigned int i;
+
+	for (i = 0; cred_htable && i < cred_htable_size; i++) {
+		lock_get(&cred_htable[i].lock);
+		for (e = cred_htable[i].entries; e; e = next) {
+			next = e->next;
+			cred_entry_free(e);
+		}
+		cred_htable[i].entries = NULL;
+		lock_release(&cred_htable[i].lock);
+	}
+
+	return init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+}
@@ -0,0 +1,79 @@
+/*
+ * $Id$
+ *
+ * Digest Authentication - cache of the subscriber credentials
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-08  first version
+ */
+
+#ifndef CRED_CACHE_H
+#define CRED_CACHE_H
+
+#include "../../str.h"
+#include "../../db/db.h"
+#include "../../locking.h"
+#include "../../mi/mi.h"
+
+#define CRED_NEGATIVE   (1<<0)   /* user not found in the table */
+#define CRED_PASS_2     (1<<1)   /* password taken from password_column_2 */
+
+typedef struct cred_entry {
+	str user;
+	str domain;                  /* empty if use_domain is not set */
+	str table;
+	int flags;
+	str pass;                    /* the password column, as in the table */
+	int n;                       /* the load_credentials columns */
+	db_type_t *types;
+	db_val_t *vals;
+	unsigned int expires;
+	struct cred_entry *next;
+} cred_entry_t;
+
+typedef struct cred_bucket {
+	cred_entry_t *entries;
+	gen_lock_t lock;
+} cred_bucket_t;
+
+extern int cred_cache_ttl;
+extern int cred_cache_negative_ttl;
+
+int cred_cache_init(unsigned int size, unsigned int max_entries);
+void cred_cache_destroy(void);
+
+/* looks up the credentials of a user
+ * \return	a pkg copy of the entry (to be freed with pkg_free),
+ *			NULL if not cached */
+cred_entry_t* cred_cache_get(str *user, str *domain, str *table, int flags);
+
+/* stores the credentials of a user - if pass is NULL, the user is
+ * stored as unknown (negative entry) */
+void cred_cache_put(str *user, str *domain, str *table, int flags,
+		str *pass, db_type_t *types, db_val_t *vals, int n);
+
+void cred_cache_clean(unsigned int ticks, void *param);
+
+struct mi_root* mi_cache_invalidate(struct mi_root *cmd, void *param);
+struct mi_root* mi_cache_flush(struct mi_root *cmd, void *param);
+
+#endif
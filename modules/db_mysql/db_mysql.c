@@ -110,6 +110,7 @@ int db_mysql_bind_api(const str* mod, db_func_t *dbb)
 	dbb->replace          = db_mysql_replace;
 	dbb->last_inserted_id = db_last_inserted_id;
 	dbb->insert_update    = db_insert_update;
+	dbb->insert_multi     = db_mysql_insert_multi;
 
 	return 0;
 }
@@ -971,6 +971,24 @@ int db_mysql_insert(const db_con_t* _h, const db_key_t* _k, const db_val_t* _v,
 }
 
 
+/**
+ * Insert several rows into a specified table, with multi-row statements.
+ * \param _h structure representing database connection
+ * \param _k key names
+ * \param _v values of the keys, row after row
+ * \param _n number of key=value pairs of a row
+ * \param _nr number of rows
+ * \return zero on success, negative value on failure
+ */
+int db_mysql_insert_multi(const db_con_t* _h, const db_key_t* _k,
+		const db_val_t* _v, const int _n, const int _nr)
+{
+	CON_RESET_CURR_PS(_h); /* no prepared statements support */
+	return db_do_insert_multi(_h, _k, _v, _n, _nr, db_mysql_val2str,
+		db_mysql_submit_query);
+}
+
+
 /**
  * Delete a row from the specified table
  * \param _h structure representing database connection
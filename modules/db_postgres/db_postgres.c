@@ -91,6 +91,7 @@ int db_postgres_bind_api(const str* mod, db_func_t *dbb)
 	dbb->insert           = db_postgres_insert;
 	dbb->delete           = db_postgres_delete; 
 	dbb->update           = db_postgres_update;
+	dbb->insert_multi     = db_postgres_insert_multi;
 
 	return 0;
 }
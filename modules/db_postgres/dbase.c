@@ -508,6 +508,44 @@ int db_postgres_insert(const db_con_t* _h, const db_key_t* _k,
 }
 
 
+/*
+ * Submit a query and finish it, as the multiple insert may need
+ * several queries on the same connection
+ */
+static int db_postgres_submit_insert(const db_con_t* _h, const str* _s)
+{
+	db_res_t* _r = NULL;
+
+	if (db_postgres_submit_query(_h, _s) < 0)
+		return -1;
+
+	if (db_postgres_store_result(_h, &_r) != 0)
+		LM_WARN("unexpected result returned");
+
+	if (_r)
+		db_free_result(_r);
+
+	return 0;
+}
+
+
+/*
+ * Insert several rows into a specified table
+ * _con: structure representing database connection
+ * _k: key names
+ * _v: values of the keys, row after row
+ * _n: number of key=value pairs of a row
+ * _nr: number of rows
+ */
+int db_postgres_insert_multi(const db_con_t* _h, const db_key_t* _k,
+		const db_val_t* _v, const int _n, const int _nr)
+{
+	CON_RESET_CURR_PS(_h); /* no prepared statements support */
+	return db_do_insert_multi(_h, _k, _v, _n, _nr, db_postgres_val2str,
+		db_postgres_submit_insert);
+}
+
+
 /*
  * Delete a row from the specified table
  * _con: structure representing database connection
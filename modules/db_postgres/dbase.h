@@ -84,6 +84,13 @@ int db_postgres_insert(const db_con_t* _h, const db_key_t* _k, const db_val_t* _
 		const int _n);
 
 
+/**
+ * Insert several rows into table
+ */
+int db_postgres_insert_multi(const db_con_t* _h, const db_key_t* _k,
+		const db_val_t* _v, const int _n, const int _nr);
+
+
 /**
  * Delete a row from table
  */
@@ -172,6 +172,7 @@ int dbt_query(db_con_t* _h, db_key_t* _k, db_op_t* _op, db_val_t* _v,
 	dbt_table_p _tbc = NULL;
 	dbt_row_p _drp = NULL;
 	dbt_result_p _dres = NULL;
+	dbt_index_cursor_t _cur;
 	
 	int *lkey=NULL, *lres=NULL;
 	
@@ -216,7 +217,7 @@ int dbt_query(db_con_t* _h, db_key_t* _k, db_op_t* _op, db_val_t* _v,
 	if(!_dres)
 		goto error;
 	
-	_drp = _tbc->rows;
+	_drp = dbt_index_cursor_first(_tbc, lkey, _op, _v, _n, &_cur);
 	while(_drp)
 	{
 		if(dbt_row_match(_tbc, _drp, lkey, _op, _v, _n))
@@ -227,7 +228,7 @@ int dbt_query(db_con_t* _h, db_key_t* _k, db_op_t* _op, db_val_t* _v,
 				goto clean;
 			}
 		}
-		_drp = _drp->next;
+		_drp = dbt_index_cursor_next(&_cur);
 	}
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_ZERO, DBT_FL_IGN, 1);
@@ -287,6 +288,7 @@ int dbt_insert(db_con_t* _h, db_key_t* _k, db_val_t* _v, int _n)
 {
 	dbt_table_p _tbc = NULL;
 	dbt_row_p _drp = NULL;
+	FILE *_jf = NULL;
 	
 	int *lkey=NULL, i, j;
 	
@@ -351,6 +353,8 @@ int dbt_insert(db_con_t* _h, db_key_t* _k, db_val_t* _v, int _n)
 		LM_ERR("cannot insert the new row!!\n");
 		goto clean;
 	}
+	dbt_journal_row(_tbc, _drp, DBT_JOURNAL_ADD, &_jf);
+	dbt_journal_close(&_jf);
 
 	/* dbt_print_table(_tbc, NULL); */
 	
@@ -389,6 +393,8 @@ int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 {
 	dbt_table_p _tbc = NULL;
 	dbt_row_p _drp = NULL, _drp0 = NULL;
+	dbt_index_cursor_t _cur;
+	FILE *_jf = NULL;
 	int *lkey = NULL;
 
 	if (!_h || !CON_TABLE(_h))
@@ -410,6 +416,8 @@ int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 	{
 		LM_DBG("deleting all records\n");
 		dbt_table_free_rows(_tbc);
+		dbt_journal_row(_tbc, NULL, DBT_JOURNAL_CLEAR, &_jf);
+		dbt_journal_close(&_jf);
 		/* unlock databse */
 
 		dbt_release_table(DBT_CON_CONNECTION(_h), CON_TABLE(_h));
@@ -420,25 +428,19 @@ int dbt_delete(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v, int _n)
 	if(!lkey)
 		goto error;
 	
-	_drp = _tbc->rows;
+	_drp = dbt_index_cursor_first(_tbc, lkey, _o, _v, _n, &_cur);
 	while(_drp)
 	{
-		_drp0 = _drp->next;
-		if(dbt_row_match(_tbc, _drp, lkey, _o, _v, _n))
+		_drp0 = _drp;
+		/* move the cursor before the row is gone */
+		_drp = dbt_index_cursor_next(&_cur);
+		if(dbt_row_match(_tbc, _drp0, lkey, _o, _v, _n))
 		{
-			// delete row
-			if(_drp->prev)
-				(_drp->prev)->next = _drp->next;
-			else
-				_tbc->rows = _drp->next;
-			if(_drp->next)
-				(_drp->next)->prev = _drp->prev;
-			_tbc->nrrows--;
-			// free row
-			dbt_row_free(_tbc, _drp);
+			dbt_journal_row(_tbc, _drp0, DBT_JOURNAL_DEL, &_jf);
+			dbt_table_del_row(_tbc, _drp0);
 		}
-		_drp = _drp0;
 	}
+	dbt_journal_close(&_jf);
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_MODI, DBT_FL_SET, 1);
 	
@@ -467,7 +469,9 @@ int dbt_update(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v,
 	      db_key_t* _uk, db_val_t* _uv, int _n, int _un)
 {
 	dbt_table_p _tbc = NULL;
-	dbt_row_p _drp = NULL;
+	dbt_row_p _drp = NULL, _drp0 = NULL;
+	dbt_index_cursor_t _cur;
+	FILE *_jf = NULL;
 	int i;
 	int *lkey=NULL, *lres=NULL;
 
@@ -494,30 +498,50 @@ int dbt_update(db_con_t* _h, db_key_t* _k, db_op_t* _o, db_val_t* _v,
 	lres = dbt_get_refs(_tbc, _uk, _un);
 	if(!lres)
 		goto error;
-	_drp = _tbc->rows;
+	for(i=0; i<_un; i++)
+	{
+		if(dbt_is_neq_type(_tbc->colv[lres[i]]->type, _uv[i].type))
+		{
+			LM_ERR("incompatible types!\n");
+			goto error;
+		}
+	}
+	_drp = dbt_index_cursor_first(_tbc, lkey, _o, _v, _n, &_cur);
 	while(_drp)
 	{
-		if(dbt_row_match(_tbc, _drp, lkey, _o, _v, _n))
+		_drp0 = _drp;
+		/* the row may move in the index being walked */
+		_drp = dbt_index_cursor_next(&_cur);
+		if(dbt_row_match(_tbc, _drp0, lkey, _o, _v, _n))
 		{ // update fields
+			/* the 'key' columns must stay unique */
+			if(dbt_table_index_dup_vals(_tbc, _drp0, lres, _uv, _un))
+			{
+				LM_ERR("duplicate value for a key column\n");
+				dbt_journal_close(&_jf);
+				goto error;
+			}
+			dbt_journal_row(_tbc, _drp0, DBT_JOURNAL_DEL, &_jf);
+			dbt_table_unindex_row(_tbc, _drp0);
 			for(i=0; i<_un; i++)
 			{
-				if(dbt_is_neq_type(_tbc->colv[lres[i]]->type, _uv[i].type))
-				{
-					LM_ERR("incompatible types!\n");
-					goto error;
-				}
-				
-				if(dbt_row_update_val(_drp, &(_uv[i]),
+				if(dbt_row_update_val(_drp0, &(_uv[i]),
 							_tbc->colv[lres[i]]->type, lres[i]))
 				{
 					LM_ERR("cannot set v[%d] in c[%d]!\n",
 							i, lres[i]);
+					dbt_table_index_row(_tbc, _drp0);
+					dbt_journal_row(_tbc, _drp0, DBT_JOURNAL_ADD, &_jf);
+					dbt_journal_close(&_jf);
 					goto error;
 				}
 			}
+			if(dbt_table_index_row(_tbc, _drp0))
+				LM_ERR("the updated row is not indexed\n");
+			dbt_journal_row(_tbc, _drp0, DBT_JOURNAL_ADD, &_jf);
 		}
-		_drp = _drp->next;
 	}
+	dbt_journal_close(&_jf);
 
 	dbt_table_update_flags(_tbc, DBT_TBFL_MODI, DBT_FL_SET, 1);
 	
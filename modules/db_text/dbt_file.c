@@ -29,6 +29,8 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -84,6 +86,262 @@ int dbt_check_mtime(const str *tbn, const str *dbn, time_t *mt)
 	return ret;
 }
 
+/**
+ * parse the values of a row, up to the end of the line
+ */
+static int dbt_parse_row(FILE *fin, int *cp, dbt_table_p dtp, dbt_row_p rowp,
+		char *buf, int *max_auto)
+{
+	int c, ccol, bp, sign;
+	dbt_val_t dtval;
+
+	c = *cp;
+	for(ccol=0; ; ccol++)
+	{
+		if(ccol == dtp->nrcols && (c==DBT_DELIM_R || c==EOF))
+			break;
+		if(ccol>= dtp->nrcols)
+			goto clean;
+		
+		switch(dtp->colv[ccol]->type)
+		{
+			case DB_INT:
+			case DB_DATETIME:
+				//LM_DBG("INT value!\n");
+				dtval.val.int_val = 0;
+				dtval.type = dtp->colv[ccol]->type;
+
+				if(c==DBT_DELIM || 
+						(ccol==dtp->nrcols-1
+						 && (c==DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					sign = 1;
+					if(c=='-')
+					{
+						sign = -1;
+						c = fgetc(fin);
+					}
+					if(c<'0' || c>'9')
+						goto clean;
+					while(c>='0' && c<='9')
+					{
+						dtval.val.int_val=dtval.val.int_val*10+c-'0';
+						c = fgetc(fin);
+					}
+					dtval.val.int_val *= sign;
+					//LM_DBG("data[%d,%d]=%d\n", crow,
+					//	ccol, dtval.val.int_val);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto clean;
+				if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
+							ccol))
+					goto clean;
+				if(ccol == dtp->auto_col)
+					*max_auto = (*max_auto<dtval.val.int_val)?
+							dtval.val.int_val:*max_auto;
+			break;
+			
+			case DB_DOUBLE:
+				//LM_DBG("DOUBLE value!\n");
+				dtval.val.double_val = 0.0;
+				dtval.type = DB_DOUBLE;
+
+				if(c==DBT_DELIM || 
+						(ccol==dtp->nrcols-1
+						 && (c==DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					sign = 1;
+					if(c=='-')
+					{
+						sign = -1;
+						c = fgetc(fin);
+					}
+					if(c<'0' || c>'9')
+						goto clean;
+					while(c>='0' && c<='9')
+					{
+						dtval.val.double_val = dtval.val.double_val*10
+								+ c - '0';
+						c = fgetc(fin);
+					}
+					if(c=='.')
+					{
+						c = fgetc(fin);
+						bp = 1;
+						while(c>='0' && c<='9')
+						{
+							bp *= 10;
+							dtval.val.double_val+=((double)(c-'0'))/bp;
+							c = fgetc(fin);
+						}
+					}
+					dtval.val.double_val *= sign;
+					//LM_DBG("data[%d,%d]=%10.2f\n",
+					//	crow, ccol, dtval.val.double_val);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto clean;
+				if(dbt_row_set_val(rowp,&dtval,DB_DOUBLE,ccol))
+					goto clean;
+			break;
+			
+			case DB_STR:
+			case DB_STRING:
+			case DB_BLOB:
+				//LM_DBG("STR value!\n");
+				
+				dtval.val.str_val.s = NULL;
+				dtval.val.str_val.len = 0;
+				dtval.type = dtp->colv[ccol]->type;
+				
+				bp = 0;
+				if(c==DBT_DELIM || 
+						(ccol == dtp->nrcols-1
+						 && (c == DBT_DELIM_R || c==EOF)))
+					dtval.nul = 1;
+				else
+				{
+					dtval.nul = 0;
+					while(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					{
+						if(c=='\\')
+						{
+							c = fgetc(fin);
+							switch(c)
+							{
+								case 'n':
+									c = '\n';	
+								break;
+								case 'r':
+									c = '\r';
+								break;
+								case 't':
+									c = '\t';
+								break;
+								case '\\':
+									c = '\\';
+								break;
+								case DBT_DELIM:
+									c = DBT_DELIM;
+								break;
+								case '0':
+									c = 0;
+								break;
+								default:
+									goto clean;
+							}
+						}
+						buf[bp++] = c;
+						c = fgetc(fin);
+					}
+					dtval.val.str_val.s = buf;
+					dtval.val.str_val.len = bp;
+					//LM_DBG("data[%d,%d]=%.*s\n",
+					///	crow, ccol, bp, buf);
+				}
+				if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
+					goto clean;
+				if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
+							ccol))
+					goto clean;
+			break;
+			default:
+				goto clean;
+		}
+		if(c==DBT_DELIM)
+			c = fgetc(fin);
+	}
+
+	*cp = c;
+	return 0;
+clean:
+	LM_DBG("error at col=%d c=%c\n", ccol+1, c);
+	*cp = c;
+	return -1;
+}
+
+/**
+ * apply the changes logged in the journal of a table being loaded
+ * - returns the number of records
+ */
+static int dbt_replay_journal(dbt_table_p dtp, const char *path, char *buf,
+		int *max_auto)
+{
+	char jpath[512];
+	FILE *fin;
+	dbt_row_p rowp, rowp0;
+	int c, op, n;
+
+	if(snprintf(jpath, sizeof(jpath), "%s%s", path, DBT_JOURNAL_SUFFIX)
+			>= sizeof(jpath))
+		return 0;
+	fin = fopen(jpath, "rt");
+	if(!fin)
+		return 0;
+
+	LM_DBG("replaying journal [%s]\n", jpath);
+	n = 0;
+	c = fgetc(fin);
+	while(c!=EOF)
+	{
+		op = c;
+		c = fgetc(fin);
+		if(op==DBT_JOURNAL_CLEAR && c==DBT_DELIM_R)
+		{
+			if(dtp->rows)
+				dbt_table_free_rows(dtp);
+			goto next;
+		}
+		if((op!=DBT_JOURNAL_ADD && op!=DBT_JOURNAL_DEL) || c!=DBT_DELIM)
+			goto error;
+		c = fgetc(fin);
+		rowp = dbt_row_new(dtp->nrcols);
+		if(!rowp)
+			goto error;
+		/* the last record may be incomplete, if the writing was interrupted */
+		if(dbt_parse_row(fin, &c, dtp, rowp, buf, max_auto)
+				|| c!=DBT_DELIM_R)
+		{
+			dbt_row_free(dtp, rowp);
+			goto error;
+		}
+		if(op==DBT_JOURNAL_ADD)
+		{
+			if(dbt_table_add_row(dtp, rowp))
+			{
+				LM_WARN("record %d of the journal of table [%.*s] "
+					"rejected, row dropped\n", n+1,
+					dtp->name.len, dtp->name.s);
+				dbt_row_free(dtp, rowp);
+			}
+		} else {
+			rowp0 = dbt_table_find_row(dtp, rowp);
+			if(rowp0)
+				dbt_table_del_row(dtp, rowp0);
+			dbt_row_free(dtp, rowp);
+		}
+next:
+		n++;
+		c = fgetc(fin);
+	}
+
+	fclose(fin);
+	return n;
+error:
+	LM_WARN("journal [%s] is broken after %d records, the rest is ignored\n",
+			jpath, n);
+	fclose(fin);
+	/* count the broken record too, so the journal gets compacted */
+	return n+1;
+}
+
 /**
  *
  */
@@ -91,8 +349,7 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 {
 	FILE *fin=NULL;
 	char path[512], buf[4096];
-	int c, crow, ccol, bp, sign, max_auto;
-	dbt_val_t dtval;
+	int c, crow, ccol, bp, max_auto;
 	dbt_table_p dtp = NULL;
 	dbt_column_p colp, colp0 = NULL;
 	dbt_row_p rowp, rowp0 = NULL;
@@ -224,7 +481,7 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 					}
 					c = fgetc(fin);
 				}
-				if(c==',')
+				while(c==',')
 				{
 					//LM_DBG("c=%c!\n", c);
 					c = fgetc(fin);
@@ -242,9 +499,13 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 						colp->flag |= DBT_FLAG_AUTO;
 						dtp->auto_col = ccol+1;
 					}
+					else if(c=='K' || c=='k')
+						colp->flag |= DBT_FLAG_KEY;
+					else if(c=='I' || c=='i')
+						colp->flag |= DBT_FLAG_INDEX;
 					else
 						goto clean;
-					while(c!=')' && c!=DBT_DELIM_R && c!=EOF)
+					while(c!=')' && c!=',' && c!=DBT_DELIM_R && c!=EOF)
 						c = fgetc(fin);
 				}
 				if(c == ')')
@@ -297,176 +558,21 @@ dbt_table_p dbt_load_file(const str *tbn, const str *dbn)
 			break;
 			
 			case DBT_DATA_ST:
-				//LM_DBG("state DATA!\n");
-				//while(c==DBT_DELIM)
-				//	c = fgetc(fin);
-				if(ccol == dtp->nrcols && (c==DBT_DELIM_R || c==EOF))
-				{
-					state = DBT_NLINE_ST;
-					break;
-				}
-				if(ccol>= dtp->nrcols)
+				if(dbt_parse_row(fin, &c, dtp, rowp, buf, &max_auto))
 					goto clean;
-				
-				switch(dtp->colv[ccol]->type)
-				{
-					case DB_INT:
-					case DB_DATETIME:
-						//LM_DBG("INT value!\n");
-						dtval.val.int_val = 0;
-						dtval.type = dtp->colv[ccol]->type;
-
-						if(c==DBT_DELIM || 
-								(ccol==dtp->nrcols-1
-								 && (c==DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							sign = 1;
-							if(c=='-')
-							{
-								sign = -1;
-								c = fgetc(fin);
-							}
-							if(c<'0' || c>'9')
-								goto clean;
-							while(c>='0' && c<='9')
-							{
-								dtval.val.int_val=dtval.val.int_val*10+c-'0';
-								c = fgetc(fin);
-							}
-							dtval.val.int_val *= sign;
-							//LM_DBG("data[%d,%d]=%d\n", crow,
-							//	ccol, dtval.val.int_val);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
-									ccol))
-							goto clean;
-						if(ccol == dtp->auto_col)
-							max_auto = (max_auto<dtval.val.int_val)?
-									dtval.val.int_val:max_auto;
-					break;
-					
-					case DB_DOUBLE:
-						//LM_DBG("DOUBLE value!\n");
-						dtval.val.double_val = 0.0;
-						dtval.type = DB_DOUBLE;
-
-						if(c==DBT_DELIM || 
-								(ccol==dtp->nrcols-1
-								 && (c==DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							sign = 1;
-							if(c=='-')
-							{
-								sign = -1;
-								c = fgetc(fin);
-							}
-							if(c<'0' || c>'9')
-								goto clean;
-							while(c>='0' && c<='9')
-							{
-								dtval.val.double_val = dtval.val.double_val*10
-										+ c - '0';
-								c = fgetc(fin);
-							}
-							if(c=='.')
-							{
-								c = fgetc(fin);
-								bp = 1;
-								while(c>='0' && c<='9')
-								{
-									bp *= 10;
-									dtval.val.double_val+=((double)(c-'0'))/bp;
-									c = fgetc(fin);
-								}
-							}
-							dtval.val.double_val *= sign;
-							//LM_DBG("data[%d,%d]=%10.2f\n",
-							//	crow, ccol, dtval.val.double_val);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,DB_DOUBLE,ccol))
-							goto clean;
-					break;
-					
-					case DB_STR:
-					case DB_STRING:
-					case DB_BLOB:
-						//LM_DBG("STR value!\n");
-						
-						dtval.val.str_val.s = NULL;
-						dtval.val.str_val.len = 0;
-						dtval.type = dtp->colv[ccol]->type;
-						
-						bp = 0;
-						if(c==DBT_DELIM || 
-								(ccol == dtp->nrcols-1
-								 && (c == DBT_DELIM_R || c==EOF)))
-							dtval.nul = 1;
-						else
-						{
-							dtval.nul = 0;
-							while(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							{
-								if(c=='\\')
-								{
-									c = fgetc(fin);
-									switch(c)
-									{
-										case 'n':
-											c = '\n';	
-										break;
-										case 'r':
-											c = '\r';
-										break;
-										case 't':
-											c = '\t';
-										break;
-										case '\\':
-											c = '\\';
-										break;
-										case DBT_DELIM:
-											c = DBT_DELIM;
-										break;
-										case '0':
-											c = 0;
-										break;
-										default:
-											goto clean;
-									}
-								}
-								buf[bp++] = c;
-								c = fgetc(fin);
-							}
-							dtval.val.str_val.s = buf;
-							dtval.val.str_val.len = bp;
-							//LM_DBG("data[%d,%d]=%.*s\n",
-							///	crow, ccol, bp, buf);
-						}
-						if(c!=DBT_DELIM && c!=DBT_DELIM_R && c!=EOF)
-							goto clean;
-						if(dbt_row_set_val(rowp,&dtval,dtp->colv[ccol]->type,
-									ccol))
-							goto clean;
-					break;
-					default:
-						goto clean;
-				}
-				if(c==DBT_DELIM)
-					c = fgetc(fin);
-				ccol++;
-			break; // state DBT_DATA_ST
+				state = DBT_NLINE_ST;
+			break;
 		}
 	}
 
+	fclose(fin);
+	fin = NULL;
+
+	if(dbt_table_index_new(dtp))
+		goto clean;
+	if(db_journal)
+		dtp->jrecs = dbt_replay_journal(dtp, path, buf, &max_auto);
+
 	if(max_auto)
 		dtp->auto_val = max_auto;
 
@@ -478,12 +584,83 @@ clean:
 	/// ????? FILL IT IN - incomplete row/column
 	// memory leak?!?! with last incomplete row
 	LM_DBG("error at row=%d col=%d c=%c\n", crow+1, ccol+1, c);
+	if(fin)
+		fclose(fin);
 	if(dtp)
 		dbt_table_free(dtp);
 	return NULL;
 }
 
 
+/**
+ * print the values of a row, without the end of line
+ */
+static int dbt_print_row(FILE *fout, dbt_table_p _dtp, dbt_row_p rowp)
+{
+	int ccol;
+	char *p;
+
+	for(ccol=0; ccol<_dtp->nrcols; ccol++)
+	{
+		switch(_dtp->colv[ccol]->type)
+		{
+			case DB_DATETIME:
+			case DB_INT:
+				if(!rowp->fields[ccol].nul)
+					fprintf(fout,"%d",
+							rowp->fields[ccol].val.int_val);
+			break;
+			case DB_DOUBLE:
+				if(!rowp->fields[ccol].nul)
+					fprintf(fout, "%.2f",
+							rowp->fields[ccol].val.double_val);
+			break;
+			case DB_STR:
+			case DB_STRING:
+			case DB_BLOB:
+				if(!rowp->fields[ccol].nul)
+				{
+					p = rowp->fields[ccol].val.str_val.s;
+					while(p < rowp->fields[ccol].val.str_val.s
+							+ rowp->fields[ccol].val.str_val.len)
+					{
+						switch(*p)
+						{
+							case '\n':
+								fprintf(fout, "\\n");
+							break;
+							case '\r':
+								fprintf(fout, "\\r");
+							break;
+							case '\t':
+								fprintf(fout, "\\t");
+							break;
+							case '\\':
+								fprintf(fout, "\\\\");
+							break;
+							case DBT_DELIM:
+								fprintf(fout, "\\%c", DBT_DELIM);
+							break;
+							case '\0':
+								fprintf(fout, "\\0");
+							break;
+							default:
+								fprintf(fout, "%c", *p);
+						}
+						p++;
+					}
+				}
+			break;
+			default:
+				return -1;
+		}
+		if(ccol<_dtp->nrcols-1)
+			fprintf(fout, "%c",DBT_DELIM);
+	}
+
+	return 0;
+}
+
 /**
  *
  */
@@ -492,8 +669,7 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 	dbt_column_p colp = NULL;
 	dbt_row_p rowp = NULL;
 	FILE *fout = NULL;
-	int ccol;
-	char *p, path[512];
+	char path[512], tmp[520];
 	
 	if(!_dtp || !_dtp->name.s || _dtp->name.len <= 0)
 		return -1;
@@ -513,7 +689,9 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 		path[_dbn->len] = '/';
 		strncpy(path+_dbn->len+1, _dtp->name.s, _dtp->name.len);
 		path[_dbn->len+_dtp->name.len+1] = 0;
-		fout = fopen(path, "wt");
+		/* replace the file only once completely written */
+		sprintf(tmp, "%s.tmp", path);
+		fout = fopen(tmp, "wt");
 		if(!fout)
 			return -1;	
 	}
@@ -542,15 +720,17 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 				fprintf(fout, "%.*s(time", colp->name.len, colp->name.s);
 			break;
 			default:
-				if(fout!=stdout)
-					fclose(fout);
-				return -1;
+				goto error;
 		}
 		
 		if(colp->flag & DBT_FLAG_NULL)
 				fprintf(fout,",null");
 		else if(colp->type==DB_INT && colp->flag & DBT_FLAG_AUTO)
 					fprintf(fout,",auto");
+		if(colp->flag & DBT_FLAG_KEY)
+				fprintf(fout,",key");
+		else if(colp->flag & DBT_FLAG_INDEX)
+				fprintf(fout,",index");
 		fprintf(fout,")");
 		
 		colp = colp->next;
@@ -561,72 +741,107 @@ int dbt_print_table(dbt_table_p _dtp, str *_dbn)
 	rowp = _dtp->rows;
 	while(rowp)
 	{
-		for(ccol=0; ccol<_dtp->nrcols; ccol++)
-		{
-			switch(_dtp->colv[ccol]->type)
-			{
-				case DB_DATETIME:
-				case DB_INT:
-					if(!rowp->fields[ccol].nul)
-						fprintf(fout,"%d",
-								rowp->fields[ccol].val.int_val);
-				break;
-				case DB_DOUBLE:
-					if(!rowp->fields[ccol].nul)
-						fprintf(fout, "%.2f",
-								rowp->fields[ccol].val.double_val);
-				break;
-				case DB_STR:
-				case DB_STRING:
-				case DB_BLOB:
-					if(!rowp->fields[ccol].nul)
-					{
-						p = rowp->fields[ccol].val.str_val.s;
-						while(p < rowp->fields[ccol].val.str_val.s
-								+ rowp->fields[ccol].val.str_val.len)
-						{
-							switch(*p)
-							{
-								case '\n':
-									fprintf(fout, "\\n");
-								break;
-								case '\r':
-									fprintf(fout, "\\r");
-								break;
-								case '\t':
-									fprintf(fout, "\\t");
-								break;
-								case '\\':
-									fprintf(fout, "\\\\");
-								break;
-								case DBT_DELIM:
-									fprintf(fout, "\\%c", DBT_DELIM);
-								break;
-								case '\0':
-									fprintf(fout, "\\0");
-								break;
-								default:
-									fprintf(fout, "%c", *p);
-							}
-							p++;
-						}
-					}
-				break;
-				default:
-					if(fout!=stdout)
-						fclose(fout);
-					return -1;
-			}
-			if(ccol<_dtp->nrcols-1)
-				fprintf(fout, "%c",DBT_DELIM);
-		}
+		if(dbt_print_row(fout, _dtp, rowp))
+			goto error;
 		fprintf(fout, "%c", DBT_DELIM_R);
 		rowp = rowp->next;
 	}
 	
 	if(fout!=stdout)
-		fclose(fout);
+	{
+		if(fclose(fout) || rename(tmp, path)<0)
+		{
+			LM_ERR("failed to write [%s]\n", path);
+			unlink(tmp);
+			return -1;
+		}
+	}
 	
+	return 0;
+error:
+	if(fout!=stdout)
+	{
+		fclose(fout);
+		unlink(tmp);
+	}
+	return -1;
+}
+
+
+static int dbt_journal_path(dbt_table_p _dtp, char *path, int len)
+{
+	int n;
+
+	n = snprintf(path, len, "%.*s/%.*s%s", _dtp->dbname.len, _dtp->dbname.s,
+			_dtp->name.len, _dtp->name.s, DBT_JOURNAL_SUFFIX);
+	return (n<0 || n>=len)?-1:0;
+}
+
+/**
+ * append a change to the journal of the table (nothing if the journal
+ * is disabled); the file is opened at the first record, to be closed
+ * with dbt_journal_close()
+ */
+int dbt_journal_row(dbt_table_p _dtp, dbt_row_p _drp, int _op, FILE **_f)
+{
+	char path[512];
+
+	if(!db_journal)
+		return 0;
+	if(!*_f)
+	{
+		if(dbt_journal_path(_dtp, path, sizeof(path))<0)
+			return -1;
+		*_f = fopen(path, "a");
+		if(!*_f)
+		{
+			LM_ERR("cannot open the journal [%s]: %s\n", path,
+					strerror(errno));
+			return -1;
+		}
+	}
+
+	fputc(_op, *_f);
+	if(_drp)
+	{
+		fputc(DBT_DELIM, *_f);
+		if(dbt_print_row(*_f, _dtp, _drp))
+			return -1;
+	}
+	fputc(DBT_DELIM_R, *_f);
+	_dtp->jrecs++;
+
+	return 0;
+}
+
+/**
+ *
+ */
+void dbt_journal_close(FILE **_f)
+{
+	if(!*_f)
+		return;
+	if(fclose(*_f))
+		LM_ERR("failed to write the journal: %s\n", strerror(errno));
+	*_f = NULL;
+}
+
+/**
+ * drop the journal, after the table was written
+ */
+int dbt_journal_reset(dbt_table_p _dtp)
+{
+	char path[512];
+
+	_dtp->jrecs = 0;
+	if(dbt_journal_path(_dtp, path, sizeof(path))<0)
+		return -1;
+	if(unlink(path)<0 && errno!=ENOENT)
+	{
+		LM_ERR("cannot remove the journal [%s]: %s\n", path,
+				strerror(errno));
+		return -1;
+	}
 	return 0;
 }
 
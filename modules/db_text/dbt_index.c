@@ -0,0 +1,514 @@
+/*
+ * $Id$
+ *
+ * DBText library
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * --------
+ * 2011-06-20 hash indexes for the 'key' and 'index' columns
+ *
+ */
+
+/*
+ * Each column flagged as 'key' or 'index' in the table header has a hash
+ * table of the rows, by the value of the column. The strings are hashed
+ * case insensitive, as they are compared by dbt_cmp_val(). The NULL
+ * values are not indexed. The indexes are protected by the table lock.
+ */
+
+#include <string.h>
+
+#include "../../mem/shm_mem.h"
+#include "../../dprint.h"
+#include "../../hash_func.h"
+
+#include "dbt_lib.h"
+#include "dbt_res.h"
+
+
+static inline unsigned int dbt_int_hash(int _i)
+{
+	return (unsigned int)_i * 2654435761u;
+}
+
+/**
+ * hash of a field of a row
+ */
+static int dbt_index_field_hash(int _t, dbt_val_p _vp, unsigned int *_h)
+{
+	if(_vp->nul)
+		return -1;
+	switch(_t)
+	{
+		case DB_INT:
+		case DB_DATETIME:
+			*_h = dbt_int_hash(_vp->val.int_val);
+			return 0;
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			*_h = core_case_hash(&_vp->val.str_val, 0, 0);
+			return 0;
+	}
+	return -1;
+}
+
+/**
+ * hash of a value compared with a column of type _t
+ */
+static int dbt_index_val_hash(int _t, db_val_t *_v, unsigned int *_h)
+{
+	str s;
+
+	if(_v->nul)
+		return -1;
+	switch(_t)
+	{
+		case DB_INT:
+		case DB_DATETIME:
+			switch(VAL_TYPE(_v))
+			{
+				case DB_INT:
+					*_h = dbt_int_hash(_v->val.int_val);
+					return 0;
+				case DB_DATETIME:
+					*_h = dbt_int_hash((int)_v->val.time_val);
+					return 0;
+				case DB_BITMAP:
+					*_h = dbt_int_hash((int)_v->val.bitmap_val);
+					return 0;
+				default:
+					return -1;
+			}
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			switch(VAL_TYPE(_v))
+			{
+				case DB_STRING:
+					s.s = (char*)_v->val.string_val;
+					s.len = strlen(s.s);
+				break;
+				case DB_STR:
+					s = _v->val.str_val;
+				break;
+				case DB_BLOB:
+					s = _v->val.blob_val;
+				break;
+				default:
+					return -1;
+			}
+			*_h = core_case_hash(&s, 0, 0);
+			return 0;
+	}
+	return -1;
+}
+
+/**
+ * equal values, as per dbt_cmp_val()
+ */
+static int dbt_index_field_eq(int _t, dbt_val_p _a, dbt_val_p _b)
+{
+	switch(_t)
+	{
+		case DB_INT:
+		case DB_DATETIME:
+			return _a->val.int_val==_b->val.int_val;
+		case DB_STR:
+		case DB_STRING:
+		case DB_BLOB:
+			return _a->val.str_val.len==_b->val.str_val.len
+				&& !strncasecmp(_a->val.str_val.s, _b->val.str_val.s,
+						_a->val.str_val.len);
+	}
+	return 0;
+}
+
+/**
+ * identical rows
+ */
+static int dbt_row_equal(dbt_table_p _dtp, dbt_row_p _a, dbt_row_p _b)
+{
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		if(_a->fields[i].nul != _b->fields[i].nul)
+			return 0;
+		if(_a->fields[i].nul)
+			continue;
+		switch(_dtp->colv[i]->type)
+		{
+			case DB_INT:
+			case DB_DATETIME:
+				if(_a->fields[i].val.int_val!=_b->fields[i].val.int_val)
+					return 0;
+			break;
+			case DB_DOUBLE:
+				if(_a->fields[i].val.double_val!=_b->fields[i].val.double_val)
+					return 0;
+			break;
+			default:
+				if(_a->fields[i].val.str_val.len!=_b->fields[i].val.str_val.len
+					|| memcmp(_a->fields[i].val.str_val.s,
+							_b->fields[i].val.str_val.s,
+							_a->fields[i].val.str_val.len))
+					return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ *
+ */
+static int dbt_index_grow(dbt_index_p _idx)
+{
+	dbt_index_node_p *buckets, _n, _n0;
+	unsigned int i, size;
+
+	size = _idx->size<<1;
+	buckets = (dbt_index_node_p*)shm_malloc(size*sizeof(dbt_index_node_p));
+	if(!buckets)
+		return -1;
+	memset(buckets, 0, size*sizeof(dbt_index_node_p));
+
+	for(i=0; i<_idx->size; i++)
+	{
+		_n = _idx->buckets[i];
+		while(_n)
+		{
+			_n0 = _n->next;
+			_n->next = buckets[_n->hash & (size-1)];
+			buckets[_n->hash & (size-1)] = _n;
+			_n = _n0;
+		}
+	}
+	shm_free(_idx->buckets);
+	_idx->buckets = buckets;
+	_idx->size = size;
+
+	return 0;
+}
+
+/**
+ *
+ */
+int dbt_table_index_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	dbt_index_p idx;
+	dbt_index_node_p _n;
+	unsigned int h;
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		idx = _dtp->colv[i]->idx;
+		if(!idx || dbt_index_field_hash(_dtp->colv[i]->type,
+					&_drp->fields[i], &h))
+			continue;
+		_n = (dbt_index_node_p)shm_malloc(sizeof(dbt_index_node_t));
+		if(!_n)
+		{
+			LM_ERR("no shm memory for the index of [%.*s]\n",
+					_dtp->name.len, _dtp->name.s);
+			dbt_table_unindex_row(_dtp, _drp);
+			return -1;
+		}
+		_n->row = _drp;
+		_n->hash = h;
+		_n->next = idx->buckets[h & (idx->size-1)];
+		idx->buckets[h & (idx->size-1)] = _n;
+		idx->nr++;
+		/* a slower index is still good, if it cannot grow */
+		if(idx->nr > 2*idx->size)
+			dbt_index_grow(idx);
+	}
+
+	return 0;
+}
+
+/**
+ *
+ */
+void dbt_table_unindex_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	dbt_index_p idx;
+	dbt_index_node_p *_np, _n;
+	unsigned int h;
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		idx = _dtp->colv[i]->idx;
+		if(!idx || dbt_index_field_hash(_dtp->colv[i]->type,
+					&_drp->fields[i], &h))
+			continue;
+		for(_np=&idx->buckets[h & (idx->size-1)]; *_np; _np=&(*_np)->next)
+		{
+			if((*_np)->row==_drp)
+			{
+				_n = *_np;
+				*_np = _n->next;
+				shm_free(_n);
+				idx->nr--;
+				break;
+			}
+		}
+	}
+}
+
+/**
+ *
+ */
+int dbt_table_index_new(dbt_table_p _dtp)
+{
+	dbt_column_p colp;
+	dbt_row_p _drp;
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		colp = _dtp->colv[i];
+		if(!(colp->flag & (DBT_FLAG_KEY|DBT_FLAG_INDEX)) || colp->idx)
+			continue;
+		if(colp->type==DB_DOUBLE)
+		{
+			LM_WARN("double column [%.*s] of [%.*s] cannot be indexed\n",
+					colp->name.len, colp->name.s,
+					_dtp->name.len, _dtp->name.s);
+			continue;
+		}
+		colp->idx = (dbt_index_p)shm_malloc(sizeof(dbt_index_t));
+		if(!colp->idx)
+			goto error;
+		colp->idx->buckets = (dbt_index_node_p*)shm_malloc(
+				DBT_INDEX_SIZE*sizeof(dbt_index_node_p));
+		if(!colp->idx->buckets)
+		{
+			shm_free(colp->idx);
+			colp->idx = NULL;
+			goto error;
+		}
+		memset(colp->idx->buckets, 0,
+				DBT_INDEX_SIZE*sizeof(dbt_index_node_p));
+		colp->idx->size = DBT_INDEX_SIZE;
+		colp->idx->nr = 0;
+	}
+
+	for(_drp=_dtp->rows; _drp; _drp=_drp->next)
+		if(dbt_table_index_row(_dtp, _drp))
+			return -1;
+
+	return 0;
+error:
+	LM_ERR("no shm memory for the indexes of [%.*s]\n",
+			_dtp->name.len, _dtp->name.s);
+	return -1;
+}
+
+/**
+ *
+ */
+void dbt_table_index_reset(dbt_table_p _dtp)
+{
+	dbt_index_p idx;
+	dbt_index_node_p _n, _n0;
+	unsigned int i;
+	dbt_column_p colp;
+
+	for(colp=_dtp->cols; colp; colp=colp->next)
+	{
+		idx = colp->idx;
+		if(!idx)
+			continue;
+		for(i=0; i<idx->size; i++)
+		{
+			_n = idx->buckets[i];
+			while(_n)
+			{
+				_n0 = _n;
+				_n = _n->next;
+				shm_free(_n0);
+			}
+			idx->buckets[i] = NULL;
+		}
+		idx->nr = 0;
+	}
+}
+
+/**
+ *
+ */
+void dbt_table_index_free(dbt_table_p _dtp)
+{
+	dbt_column_p colp;
+
+	dbt_table_index_reset(_dtp);
+	for(colp=_dtp->cols; colp; colp=colp->next)
+	{
+		if(!colp->idx)
+			continue;
+		shm_free(colp->idx->buckets);
+		shm_free(colp->idx);
+		colp->idx = NULL;
+	}
+}
+
+/**
+ * row with the same value in a 'key' column
+ */
+dbt_row_p dbt_table_index_dup(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	dbt_index_p idx;
+	dbt_index_node_p _n;
+	unsigned int h;
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		idx = _dtp->colv[i]->idx;
+		if(!idx || !(_dtp->colv[i]->flag & DBT_FLAG_KEY)
+				|| dbt_index_field_hash(_dtp->colv[i]->type,
+					&_drp->fields[i], &h))
+			continue;
+		for(_n=idx->buckets[h & (idx->size-1)]; _n; _n=_n->next)
+			if(_n->hash==h && _n->row!=_drp && !_n->row->fields[i].nul
+					&& dbt_index_field_eq(_dtp->colv[i]->type,
+						&_n->row->fields[i], &_drp->fields[i]))
+				return _n->row;
+	}
+
+	return NULL;
+}
+
+/**
+ * row, other than _drp, with the same value in a 'key' column as _drp
+ * would get by setting the columns _lres to _uv
+ */
+dbt_row_p dbt_table_index_dup_vals(dbt_table_p _dtp, dbt_row_p _drp,
+		int *_lres, db_val_t *_uv, int _un)
+{
+	dbt_index_p idx;
+	dbt_index_node_p _n;
+	unsigned int h;
+	int i, j;
+
+	for(j=0; j<_un; j++)
+	{
+		i = _lres[j];
+		idx = _dtp->colv[i]->idx;
+		if(!idx || !(_dtp->colv[i]->flag & DBT_FLAG_KEY)
+				|| dbt_index_val_hash(_dtp->colv[i]->type, &_uv[j], &h))
+			continue;
+		for(_n=idx->buckets[h & (idx->size-1)]; _n; _n=_n->next)
+			if(_n->hash==h && _n->row!=_drp && !_n->row->fields[i].nul
+					&& dbt_cmp_val(&_n->row->fields[i], &_uv[j])==0)
+				return _n->row;
+	}
+
+	return NULL;
+}
+
+/**
+ * row identical with the given one (not part of the table)
+ */
+dbt_row_p dbt_table_find_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	dbt_index_p idx;
+	dbt_index_node_p _n;
+	dbt_row_p _rp;
+	unsigned int h;
+	int i;
+
+	for(i=0; i<_dtp->nrcols; i++)
+	{
+		idx = _dtp->colv[i]->idx;
+		if(!idx || dbt_index_field_hash(_dtp->colv[i]->type,
+					&_drp->fields[i], &h))
+			continue;
+		for(_n=idx->buckets[h & (idx->size-1)]; _n; _n=_n->next)
+			if(_n->hash==h && dbt_row_equal(_dtp, _n->row, _drp))
+				return _n->row;
+		return NULL;
+	}
+
+	for(_rp=_dtp->rows; _rp; _rp=_rp->next)
+		if(dbt_row_equal(_dtp, _rp, _drp))
+			return _rp;
+
+	return NULL;
+}
+
+/**
+ * first row which may match the keys - through an index if one of the
+ * keys is compared for equality with an indexed column, otherwise the
+ * first row of the table
+ */
+dbt_row_p dbt_index_cursor_first(dbt_table_p _dtp, int *_lkey, db_op_t *_op,
+		db_val_t *_v, int _n, dbt_index_cursor_p _c)
+{
+	dbt_column_p colp;
+	unsigned int h;
+	int i;
+
+	_c->indexed = 0;
+	_c->node = NULL;
+	_c->row = NULL;
+
+	for(i=0; _lkey && i<_n; i++)
+	{
+		colp = _dtp->colv[_lkey[i]];
+		if(!colp->idx || (_op && strcmp(_op[i], OP_EQ))
+				|| dbt_index_val_hash(colp->type, &_v[i], &h))
+			continue;
+		_c->indexed = 1;
+		_c->hash = h;
+		_c->node = colp->idx->buckets[h & (colp->idx->size-1)];
+		while(_c->node && _c->node->hash!=h)
+			_c->node = _c->node->next;
+		return _c->node?_c->node->row:NULL;
+	}
+
+	_c->row = _dtp->rows;
+	return _c->row;
+}
+
+/**
+ * next row which may match the keys; the current row may be removed
+ * from the table after the cursor moved past it
+ */
+dbt_row_p dbt_index_cursor_next(dbt_index_cursor_p _c)
+{
+	if(_c->indexed)
+	{
+		if(!_c->node)
+			return NULL;
+		do {
+			_c->node = _c->node->next;
+		} while(_c->node && _c->node->hash!=_c->hash);
+		return _c->node?_c->node->row:NULL;
+	}
+
+	if(_c->row)
+		_c->row = _c->row->next;
+	return _c->row;
+}
@@ -45,6 +45,8 @@ static gen_lock_t *_dbt_cachesem = NULL;
 
 static dbt_tbl_cachel_p _dbt_cachetbl = NULL;
 
+static int dbt_table_save(dbt_table_p _tbc);
+
 #define DBT_CACHETBL_SIZE	16
 
 /**
@@ -409,10 +411,7 @@ int dbt_cache_print(int _f)
 				dbt_print_table(_tbc, NULL);
 			} else {
 				if(_tbc->flag & DBT_TBFL_MODI)
-				{
-					dbt_print_table(_tbc, &(_tbc->dbname));
-					dbt_table_update_flags(_tbc,DBT_TBFL_MODI, DBT_FL_UNSET, 0);
-				}
+					dbt_table_save(_tbc);
 			}
 			_tbc = _tbc->next;
 		}
@@ -422,6 +421,48 @@ int dbt_cache_print(int _f)
 	return 0;
 }
 
+/**
+ * write the table over its file and drop the journal
+ */
+static int dbt_table_save(dbt_table_p _tbc)
+{
+	if(dbt_print_table(_tbc, &(_tbc->dbname)))
+	{
+		LM_ERR("failed to write table [%.*s]\n",
+				_tbc->name.len, _tbc->name.s);
+		return -1;
+	}
+	dbt_table_update_flags(_tbc,DBT_TBFL_MODI, DBT_FL_UNSET, 0);
+	/* not a change to be reloaded */
+	dbt_check_mtime(&_tbc->name, &_tbc->dbname, &_tbc->mt);
+	if(db_journal)
+		dbt_journal_reset(_tbc);
+	return 0;
+}
+
+/**
+ * write the tables with journaled changes
+ */
+int dbt_cache_compact(void)
+{
+	int i;
+	dbt_table_p _tbc;
+
+	if(!_dbt_cachetbl)
+		return -1;
+
+	for(i=0; i< DBT_CACHETBL_SIZE; i++)
+	{
+		lock_get(&_dbt_cachetbl[i].sem);
+		for(_tbc = _dbt_cachetbl[i].dtp; _tbc; _tbc = _tbc->next)
+			if(_tbc->jrecs>0)
+				dbt_table_save(_tbc);
+		lock_release(&_dbt_cachetbl[i].sem);
+	}
+
+	return 0;
+}
+
 int dbt_is_neq_type(db_type_t _t0, db_type_t _t1)
 {
 	// LM_DBG("t0=%d t1=%d!\n", _t0, _t1);
@@ -31,13 +31,18 @@
 #ifndef _DBT_LIB_H_
 #define _DBT_LIB_H_
 
+#include <stdio.h>
+
 #include "../../str.h"
 #include "../../db/db_val.h"
+#include "../../db/db_op.h"
 #include "../../locking.h"
 
 #define DBT_FLAG_UNSET  0
 #define DBT_FLAG_NULL   1
 #define DBT_FLAG_AUTO   2
+#define DBT_FLAG_KEY    4
+#define DBT_FLAG_INDEX  8
 
 #define DBT_TBFL_ZERO	0
 #define DBT_TBFL_MODI	1
@@ -50,10 +55,18 @@
 #define DBT_DELIM_C	' '
 #define DBT_DELIM_R	'\n'
 
+#define DBT_JOURNAL_ADD		'+'
+#define DBT_JOURNAL_DEL		'-'
+#define DBT_JOURNAL_CLEAR	'*'
+#define DBT_JOURNAL_SUFFIX	".journal"
+
+#define DBT_INDEX_SIZE	64
+
 /*
  *  * Module parameters variables
  *   */
 extern int db_mode; /* Database usage mode: 0 = no cache, 1 = cache */
+extern int db_journal; /* Log the changes in an append-only journal */
 
 typedef db_val_t dbt_val_t, *dbt_val_p;
 
@@ -65,11 +78,34 @@ typedef struct _dbt_row
 	
 } dbt_row_t, *dbt_row_p;
 
+typedef struct _dbt_index_node
+{
+	dbt_row_p row;
+	unsigned int hash;
+	struct _dbt_index_node *next;
+} dbt_index_node_t, *dbt_index_node_p;
+
+typedef struct _dbt_index
+{
+	unsigned int size;
+	unsigned int nr;
+	dbt_index_node_p *buckets;
+} dbt_index_t, *dbt_index_p;
+
+typedef struct _dbt_index_cursor
+{
+	int indexed;
+	unsigned int hash;
+	dbt_row_p row;
+	dbt_index_node_p node;
+} dbt_index_cursor_t, *dbt_index_cursor_p;
+
 typedef struct _dbt_column
 {
 	str name;
 	int type;
 	int flag;
+	dbt_index_p idx;
 	struct _dbt_column *prev;
 	struct _dbt_column *next;
 	
@@ -90,6 +126,7 @@ typedef struct _dbt_table
 	dbt_column_p *colv;
 	int nrrows;
 	dbt_row_p rows;
+	int jrecs;
 	time_t mt;
 	struct _dbt_table *next;
 	struct _dbt_table *prev;
@@ -113,6 +150,7 @@ typedef struct _dbt_cache
 int dbt_init_cache();
 int dbt_cache_destroy();
 int dbt_cache_print(int);
+int dbt_cache_compact(void);
 
 dbt_cache_p dbt_cache_get_db(str*);
 int dbt_cache_check_db(str*);
@@ -135,6 +173,8 @@ int dbt_table_free(dbt_table_p);
 int dbt_row_set_val(dbt_row_p, dbt_val_p, int, int);
 int dbt_row_update_val(dbt_row_p, dbt_val_p, int, int);
 int dbt_table_add_row(dbt_table_p, dbt_row_p);
+int dbt_table_del_row(dbt_table_p, dbt_row_p);
+dbt_row_p dbt_table_find_row(dbt_table_p, dbt_row_p);
 int dbt_table_check_row(dbt_table_p, dbt_row_p);
 int dbt_table_update_flags(dbt_table_p, int, int, int);
 
@@ -143,5 +183,21 @@ dbt_table_p dbt_load_file(const str *, const str *);
 int dbt_print_table(dbt_table_p, str *);
 int dbt_is_neq_type(db_type_t _t0, db_type_t _t1);
 
+int dbt_journal_row(dbt_table_p, dbt_row_p, int, FILE **);
+void dbt_journal_close(FILE **);
+int dbt_journal_reset(dbt_table_p);
+
+int dbt_table_index_new(dbt_table_p);
+void dbt_table_index_free(dbt_table_p);
+void dbt_table_index_reset(dbt_table_p);
+int dbt_table_index_row(dbt_table_p, dbt_row_p);
+void dbt_table_unindex_row(dbt_table_p, dbt_row_p);
+dbt_row_p dbt_table_index_dup(dbt_table_p, dbt_row_p);
+dbt_row_p dbt_table_index_dup_vals(dbt_table_p, dbt_row_p, int*, db_val_t*,
+		int);
+dbt_row_p dbt_index_cursor_first(dbt_table_p, int*, db_op_t*, db_val_t*, int,
+		dbt_index_cursor_p);
+dbt_row_p dbt_index_cursor_next(dbt_index_cursor_p);
+
 #endif
 
@@ -66,6 +66,7 @@ dbt_column_p dbt_column_new(char *_s, int _l)
 	dcp->next = dcp->prev = NULL;
 	dcp->type = 0;
 	dcp->flag = DBT_FLAG_UNSET;
+	dcp->idx = NULL;
 
 	return dcp;
 }
@@ -178,6 +179,7 @@ dbt_table_p dbt_table_new(const str *_tbname, const str *_dbname, const char *pa
 	dtp->mark = (int)time(NULL);
 	dtp->flag = DBT_TBFL_ZERO;
 	dtp->nrrows = dtp->nrcols = dtp->auto_val = 0;
+	dtp->jrecs = 0;
 	dtp->auto_col = -1;
 	dtp->mt = 0;
 	if(stat(path, &s) == 0)
@@ -199,6 +201,7 @@ int dbt_table_free_rows(dbt_table_p _dtp)
 	
 	if(!_dtp || !_dtp->rows || !_dtp->colv)
 		return -1;
+	dbt_table_index_reset(_dtp);
 	_rp = _dtp->rows;
 	while(_rp)
 	{
@@ -226,6 +229,15 @@ int dbt_table_add_row(dbt_table_p _dtp, dbt_row_p _drp)
 	if(dbt_table_check_row(_dtp, _drp))
 		return -1;
 	
+	if(dbt_table_index_dup(_dtp, _drp))
+	{
+		LM_ERR("duplicate key in table [%.*s]\n",
+				_dtp->name.len, _dtp->name.s);
+		return -1;
+	}
+	if(dbt_table_index_row(_dtp, _drp))
+		return -1;
+	
 	dbt_table_update_flags(_dtp, DBT_TBFL_MODI, DBT_FL_SET, 1);
 	
 	if(_dtp->rows)
@@ -237,6 +249,29 @@ int dbt_table_add_row(dbt_table_p _dtp, dbt_row_p _drp)
 	return 0;
 }
 
+/**
+ *
+ */
+int dbt_table_del_row(dbt_table_p _dtp, dbt_row_p _drp)
+{
+	if(!_dtp || !_drp)
+		return -1;
+
+	dbt_table_unindex_row(_dtp, _drp);
+
+	if(_drp->prev)
+		(_drp->prev)->next = _drp->next;
+	else
+		_dtp->rows = _drp->next;
+	if(_drp->next)
+		(_drp->next)->prev = _drp->prev;
+	_dtp->nrrows--;
+
+	dbt_table_update_flags(_dtp, DBT_TBFL_MODI, DBT_FL_SET, 1);
+
+	return dbt_row_free(_dtp, _drp);
+}
+
 /**
  *
  */
@@ -254,6 +289,7 @@ int dbt_table_free(dbt_table_p _dtp)
 	
 	if(_dtp->rows && _dtp->nrrows>0)
 		dbt_table_free_rows(_dtp);
+	dbt_table_index_free(_dtp);
 	
 	_cp = _dtp->cols;
 	while(_cp)
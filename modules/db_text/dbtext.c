@@ -33,6 +33,7 @@
 #include <unistd.h>
 
 #include "../../sr_module.h"
+#include "../../timer.h"
 #include "../../db/db.h"
 #include "dbtext.h"
 #include "dbt_lib.h"
@@ -42,11 +43,14 @@
 
 static int mod_init(void);
 static void destroy(void);
+static void dbt_compact_timer(unsigned int ticks, void *param);
 
 /*
  * Module parameter variables
  */
 int db_mode = 0;  /* Database usage mode: 0 = cache, 1 = no cache */
+int db_journal = 0;  /* log the changes in a journal, compacted by timer */
+static int compact_interval = 60;  /* seconds */
 
 int dbt_bind_api(const str* mod, db_func_t *dbb);
 
@@ -64,6 +68,8 @@ static cmd_export_t cmds[] = {
  */
 static param_export_t params[] = {
 	{"db_mode", INT_PARAM, &db_mode},
+	{"journal", INT_PARAM, &db_journal},
+	{"compact_interval", INT_PARAM, &compact_interval},
 	{0, 0, 0}
 };
 
@@ -89,6 +95,13 @@ static int mod_init(void)
 {
 	if(dbt_init_cache())
 		return -1;
+
+	if(db_journal && compact_interval>0
+			&& register_timer(dbt_compact_timer, 0, compact_interval)<0)
+	{
+		LM_ERR("failed to register the compaction timer\n");
+		return -1;
+	}
 	/* return make_demo(); */
 	
 	return 0;
@@ -101,6 +114,11 @@ static void destroy(void)
 	dbt_cache_destroy();
 }
 
+static void dbt_compact_timer(unsigned int ticks, void *param)
+{
+	dbt_cache_compact();
+}
+
 
 
 int dbt_bind_api(const str* mod, db_func_t *dbb)
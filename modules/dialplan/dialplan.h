@@ -23,6 +23,7 @@
  * History:
  * --------
  *  2007-08-01 initial version (ancuta onofrei)
+ *  2011-07-12 rules matcher compiled at load time, per index
  */
 
 #ifndef _DP_DIALPLAN_H
@@ -37,6 +38,8 @@
 #define REGEX_OP	1
 #define EQUAL_OP	0
 
+#define MAX_MATCHES (100 * 3)
+
 typedef struct dpl_node{
 	int dpid;
 	int pr;
@@ -55,6 +58,7 @@ typedef struct dpl_index{
 	int len;
 	dpl_node_t * first_rule;
 	dpl_node_t * last_rule;
+	struct dp_matcher * matcher; /*built from the rules, at load time*/
 
 	struct dpl_index * next; 
 }dpl_index_t, *dpl_index_p;
@@ -22,6 +22,7 @@
  * History:
  * --------
  *  2007-08-01 initial version (ancuta onofrei)
+ *  2011-07-12 the matchers of the indexes are built after loading
  */
 
 #include <stdlib.h>
@@ -32,6 +33,7 @@
 #include "../../db/db.h"
 #include "dp_db.h"
 #include "dialplan.h"
+#include "dp_match.h"
 
 str dp_db_url       =   {NULL, 0};
 str dp_table_name   =   str_init(DP_TABLE_NAME);
@@ -62,6 +64,7 @@ void destroy_hash(int);
 
 dpl_node_t * build_rule(db_val_t * values);
 int add_rule2hash(dpl_node_t *, int);
+void build_matchers(int h_index);
 
 void list_rule(dpl_node_t * );
 void list_hash(int h_index);
@@ -262,7 +265,8 @@ int dp_load_db(void)
 			break;
 		}
 	}  while(RES_ROW_N(res)>0);
-	
+
+	build_matchers(*next_idx);
 
 end:
 	destroy_hash(*crt_idx);
@@ -516,6 +520,21 @@ err:
 }
 
 
+/* if a matcher cannot be built, the rules of that index are tested
+ * one by one */
+void build_matchers(int h_index)
+{
+	dpl_id_p crt_idp;
+	dpl_index_p indexp;
+
+	for(crt_idp=rules_hash[h_index]; crt_idp!=NULL; crt_idp = crt_idp->next)
+		for(indexp=crt_idp->first_index; indexp!=NULL;indexp= indexp->next)
+			if(dp_build_matcher(indexp)!=0)
+				LM_WARN("failed to build the matcher of dpid %i, len %i\n",
+					crt_idp->dp_id, indexp->len);
+}
+
+
 void destroy_hash(int index)
 {
 	dpl_id_p crt_idp;
@@ -538,6 +557,7 @@ void destroy_hash(int index)
 				rulep=0;
 				rulep= indexp->first_rule;
 			}
+			dp_free_matcher(indexp->matcher);
 			crt_idp->first_index= indexp->next;
 			shm_free(indexp);
 			indexp=0;
@@ -0,0 +1,324 @@
+/*
+ * $Id$
+ *
+ * dialplan module - rules matcher compiled at load time
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-12  first version
+ */
+
+/*
+ * For every index, the rules are split at load time in:
+ *  - the EQUAL_OP rules, kept in a hash by their match_exp;
+ *  - the regexps starting with a literal prefix ("^\+4021..."), kept in a
+ *    trie by that prefix;
+ *  - the rest of the regexps, at the root of the trie.
+ * A lookup walks the trie along the input and runs pcre only for the
+ * regexps found on the way, merged in the order of the rules, so the
+ * first matching rule is the same one the plain list would give.
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "../../dprint.h"
+#include "../../hash_func.h"
+#include "../../mem/shm_mem.h"
+#include "dp_match.h"
+
+static int dp_ovector[MAX_MATCHES];
+
+
+/* extracts the literal prefix of an anchored regexp, "^\+40(21|31)" gives
+ * "+40"; returns its length, 0 if the regexp has none */
+static int dp_regex_prefix(str *exp, char *buf)
+{
+	char *p, *end;
+	int len, depth;
+	char c;
+
+	if (exp->len < 2 || exp->s[0] != '^')
+		return 0;
+	end = exp->s + exp->len;
+
+	/* "^12|34" - a top level alternative is not anchored */
+	depth = 0;
+	for (p = exp->s + 1; p < end; p++) {
+		switch (*p) {
+			case '\\':
+				p++;
+				break;
+			case '[':
+				/* "[]...]" and "[^]...]" start with a literal ']' */
+				if (p + 1 < end && p[1] == '^')
+					p++;
+				if (p + 1 < end && p[1] == ']')
+					p++;
+				for (p++; p < end && *p != ']'; p++)
+					if (*p == '\\')
+						p++;
+				break;
+			case '(':
+				depth++;
+				break;
+			case ')':
+				depth--;
+				break;
+			case '|':
+				if (depth == 0)
+					return 0;
+		}
+	}
+
+	len = 0;
+	for (p = exp->s + 1; p < end && len < DP_MAX_PREFIX; p++) {
+		c = *p;
+		if (c == '\\') {
+			/* \d, \w, \1, \x41 ... are not literals */
+			if (p + 1 == end || isalnum((unsigned char)p[1]))
+				break;
+			c = *(++p);
+		} else if (strchr("^$.[]|()?*+{}", c)) {
+			break;
+		}
+		/* a quantifier may make the last literal optional */
+		if (p + 1 < end && (p[1] == '?' || p[1] == '*' || p[1] == '{'))
+			break;
+		buf[len++] = c;
+	}
+
+	return len;
+}
+
+static dp_ref_t* dp_new_ref(dpl_node_p rule, int pos)
+{
+	dp_ref_t *ref;
+
+	ref = (dp_ref_t*)shm_malloc(sizeof(dp_ref_t));
+	if (ref == NULL) {
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	ref->pos = pos;
+	ref->rule = rule;
+	ref->next = NULL;
+
+	return ref;
+}
+
+static int dp_add_equal(dp_matcher_t *m, dpl_node_p rule, int pos)
+{
+	dp_ref_t *ref, **bucket;
+
+	bucket = &m->eq_hash[core_hash(&rule->match_exp, NULL, m->eq_size)];
+
+	/* a rule with the same match_exp already comes first */
+	for (ref = *bucket; ref; ref = ref->next)
+		if (ref->rule->match_exp.len == rule->match_exp.len &&
+		strncmp(ref->rule->match_exp.s, rule->match_exp.s,
+		rule->match_exp.len) == 0)
+			return 0;
+
+	if ((ref = dp_new_ref(rule, pos)) == NULL)
+		return -1;
+	ref->next = *bucket;
+	*bucket = ref;
+
+	return 0;
+}
+
+static int dp_add_regex(dp_matcher_t *m, dpl_node_p rule, int pos)
+{
+	char prefix[DP_MAX_PREFIX];
+	dp_trie_t *node, *kid;
+	dp_ref_t *ref;
+	int i, len;
+
+	len = dp_regex_prefix(&rule->match_exp, prefix);
+
+	node = &m->root;
+	for (i = 0; i < len; i++) {
+		for (kid = node->kids; kid && kid->c != prefix[i]; kid = kid->next);
+		if (kid == NULL) {
+			kid = (dp_trie_t*)shm_malloc(sizeof(dp_trie_t));
+			if (kid == NULL) {
+				LM_ERR("no more shm memory\n");
+				return -1;
+			}
+			memset(kid, 0, sizeof(dp_trie_t));
+			kid->c = prefix[i];
+			kid->next = node->kids;
+			node->kids = kid;
+		}
+		node = kid;
+	}
+
+	if ((ref = dp_new_ref(rule, pos)) == NULL)
+		return -1;
+	/* keep the rules of a node in their order */
+	if (node->last)
+		node->last->next = ref;
+	else
+		node->rules = ref;
+	node->last = ref;
+
+	LM_DBG("rule %.*s added with prefix %.*s\n",
+		rule->match_exp.len, rule->match_exp.s, len, prefix);
+
+	return 0;
+}
+
+int dp_build_matcher(dpl_index_p indexp)
+{
+	dp_matcher_t *m;
+	dpl_node_p rule;
+	unsigned int n;
+	int pos;
+
+	n = 0;
+	for (rule = indexp->first_rule; rule; rule = rule->next)
+		if (rule->matchop == EQUAL_OP)
+			n++;
+
+	m = (dp_matcher_t*)shm_malloc(sizeof(dp_matcher_t));
+	if (m == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(m, 0, sizeof(dp_matcher_t));
+
+	if (n) {
+		for (m->eq_size = 1; m->eq_size < n; m->eq_size <<= 1);
+		m->eq_hash = (dp_ref_t**)shm_malloc(m->eq_size * sizeof(dp_ref_t*));
+		if (m->eq_hash == NULL) {
+			LM_ERR("no more shm memory\n");
+			goto error;
+		}
+		memset(m->eq_hash, 0, m->eq_size * sizeof(dp_ref_t*));
+	}
+
+	for (rule = indexp->first_rule, pos = 0; rule; rule = rule->next, pos++) {
+		switch (rule->matchop) {
+			case EQUAL_OP:
+				if (dp_add_equal(m, rule, pos) < 0)
+					goto error;
+				break;
+			case REGEX_OP:
+				if (dp_add_regex(m, rule, pos) < 0)
+					goto error;
+				break;
+			default:
+				LM_ERR("bogus match operator code %i\n", rule->matchop);
+				goto error;
+		}
+	}
+
+	indexp->matcher = m;
+	return 0;
+error:
+	dp_free_matcher(m);
+	return -1;
+}
+
+static void dp_free_refs(dp_ref_t *ref)
+{
+	dp_ref_t *next;
+
+	for (; ref; ref = next) {
+		next = ref->next;
+		shm_free(ref);
+	}
+}
+
+static void dp_free_trie(dp_trie_t *node)
+{
+	dp_trie_t *kid, *next;
+
+	for (kid = node->kids; kid; kid = next) {
+		next = kid->next;
+		dp_free_trie(kid);
+		shm_free(kid);
+	}
+	dp_free_refs(node->rules);
+}
+
+void dp_free_matcher(dp_matcher_t *m)
+{
+	unsigned int i;
+
+	if (m == NULL)
+		return;
+
+	if (m->eq_hash) {
+		for (i = 0; i < m->eq_size; i++)
+			dp_free_refs(m->eq_hash[i]);
+		shm_free(m->eq_hash);
+	}
+	dp_free_trie(&m->root);
+	shm_free(m);
+}
+
+dpl_node_p dp_match(dp_matcher_t *m, str *input)
+{
+	dp_ref_t *heads[DP_MAX_PREFIX + 1], **min, *eq;
+	dp_trie_t *node;
+	int i, n;
+
+	eq = NULL;
+	if (m->eq_hash)
+		for (eq = m->eq_hash[core_hash(input, NULL, m->eq_size)]; eq;
+		eq = eq->next)
+			if (eq->rule->match_exp.len == input->len &&
+			strncmp(eq->rule->match_exp.s, input->s, input->len) == 0)
+				break;
+
+	/* the regexps whose prefix matches the input */
+	n = 0;
+	node = &m->root;
+	for (i = 0; node; i++) {
+		if (node->rules)
+			heads[n++] = node->rules;
+		if (i == input->len)
+			break;
+		for (node = node->kids; node && node->c != input->s[i];
+		node = node->next);
+	}
+
+	for (;;) {
+		min = NULL;
+		for (i = 0; i < n; i++)
+			if (heads[i] && (min == NULL || heads[i]->pos < (*min)->pos))
+				min = &heads[i];
+
+		if (eq && (min == NULL || eq->pos < (*min)->pos))
+			return eq->rule;
+		if (min == NULL)
+			return NULL;
+
+		LM_DBG("regex operator testing %.*s\n",
+			(*min)->rule->match_exp.len, (*min)->rule->match_exp.s);
+		if (test_match(*input, (*min)->rule->match_comp, dp_ovector,
+		MAX_MATCHES) > 0)
+			return (*min)->rule;
+		*min = (*min)->next;
+	}
+}
@@ -0,0 +1,66 @@
+/*
+ * $Id$
+ *
+ * dialplan module - rules matcher compiled at load time
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-12  first version
+ */
+
+#ifndef _DP_MATCH_H
+#define _DP_MATCH_H
+
+#include "dialplan.h"
+
+/* longest literal prefix taken from a regexp */
+#define DP_MAX_PREFIX	32
+
+/* rule of an index, with its position in the list (priority order) */
+typedef struct dp_ref {
+	int pos;
+	dpl_node_p rule;
+	struct dp_ref *next;
+} dp_ref_t;
+
+/* trie of the literal prefixes of the anchored regexps */
+typedef struct dp_trie {
+	char c;
+	dp_ref_t *rules;             /* regexps whose prefix ends here */
+	dp_ref_t *last;
+	struct dp_trie *kids;
+	struct dp_trie *next;
+} dp_trie_t;
+
+typedef struct dp_matcher {
+	unsigned int eq_size;        /* power of 2 */
+	dp_ref_t **eq_hash;          /* the EQUAL_OP rules, by match_exp */
+	dp_trie_t root;              /* regexps without a prefix are at root */
+} dp_matcher_t;
+
+int dp_build_matcher(dpl_index_p indexp);
+void dp_free_matcher(dp_matcher_t *m);
+
+/* looks for the first rule (in priority order) matching the input
+ * \return	the rule or NULL if none matches */
+dpl_node_p dp_match(dp_matcher_t *m, str *input);
+
+#endif
@@ -22,10 +22,12 @@
  * History:
  * --------
  *  2007-08-01 initial version (ancuta onofrei)
+ *  2011-07-12 the rules are looked up via the compiled matcher
  */
 
 #include "../../re.h"
 #include "dialplan.h"
+#include "dp_match.h"
 
 #define MAX_REPLACE_WITH	10
 
@@ -102,7 +104,6 @@ error:
 
 
 #define MAX_PHONE_NB_DIGITS		127
-#define MAX_MATCHES (100 * 3)
 
 static char dp_output_buf[MAX_PHONE_NB_DIGITS+1];
 static int matches[MAX_MATCHES];
@@ -301,7 +302,10 @@ int translate(struct sip_msg *msg, str input, str * output, dpl_id_p idp,
 	}
 
 search_rule:
-	for(rulep=indexp->first_rule; rulep!=NULL; rulep= rulep->next){
+	if(indexp->matcher){
+		if((rulep = dp_match(indexp->matcher, &input))!=NULL)
+			goto repl;
+	} else for(rulep=indexp->first_rule; rulep!=NULL; rulep= rulep->next){
 		switch(rulep->matchop){
 
 			case REGEX_OP:
@@ -64,6 +64,8 @@
 #include "../../db/db.h"
 #include "../../db/db_res.h"
 #include "../../str.h"
+#include "../../pt.h"
+#include "../../locking.h"
 
 #include "dispatch.h"
 
@@ -82,6 +84,7 @@ typedef struct _ds_dest
 	struct ip_addr ip_address; /* IP-Address of the entry */
 	unsigned short int port; /* Port of the request URI */
 	int failure_count;
+	volatile unsigned int hits; /* times it was selected */
 	struct _ds_dest *next;
 } ds_dest_t, *ds_dest_p;
 
@@ -95,50 +98,190 @@ typedef struct _ds_set
 	struct _ds_set *next;
 } ds_set_t, *ds_set_p;
 
+/* a version of the destination sets; once published it is not changed
+ * anymore (except for the state of the destinations) */
+typedef struct _ds_data
+{
+	ds_set_p sets;
+	int sets_no;
+	unsigned int epoch;	/* epoch when it was replaced */
+	struct _ds_data *next;	/* in the retired list */
+} ds_data_t, *ds_data_p;
+
+/* The readers do not lock the sets: they record (per process) the epoch
+ * they entered the sets with and a reload only publishes a new version.
+ * A replaced version is freed when all the processes are either outside
+ * the sets or entered them after it was replaced. */
+typedef struct _ds_rcu
+{
+	ds_data_p volatile crt;		/* published version */
+	ds_data_p retired;			/* replaced, maybe still in use */
+	volatile unsigned int epoch;
+	volatile unsigned int *readers;	/* per process epoch, 0 if outside */
+} ds_rcu_t;
+
 extern int ds_force_dst;
 
 static db_func_t ds_dbf;
 static db_con_t* ds_db_handle=0;
-ds_set_p *ds_lists=NULL;
-int *ds_list_nr = NULL;
-int *crt_idx    = NULL;
-int *next_idx   = NULL;
+static ds_rcu_t *ds_rcu = NULL;
+/* serializes the writers (reload, reclaim) */
+static gen_lock_t *ds_lock = NULL;
+/* nesting level of the read sections in this process */
+static int ds_read_depth = 0;
 
-#define _ds_list 	(ds_lists[*crt_idx])
-#define _ds_list_nr (*ds_list_nr)
+#define ds_membar()	__sync_synchronize()
 
-void destroy_list(int);
+static void free_ds_data(ds_data_p data);
 
-int init_data(void)
+static inline ds_data_p ds_read_start(void)
+{
+	if (ds_read_depth++==0 && ds_rcu->readers) {
+		ds_rcu->readers[process_no] = ds_rcu->epoch;
+		/* publish the epoch before reading the sets */
+		ds_membar();
+	}
+	return ds_rcu->crt;
+}
+
+static inline void ds_read_end(void)
 {
-	int * p;
+	if (--ds_read_depth==0 && ds_rcu->readers) {
+		ds_membar();
+		ds_rcu->readers[process_no] = 0;
+	}
+}
 
-	ds_lists = (ds_set_p*)shm_malloc(2*sizeof(ds_set_p));
-	if(!ds_lists)
+int init_data(void)
+{
+	ds_rcu = (ds_rcu_t*)shm_malloc(sizeof(ds_rcu_t));
+	if(!ds_rcu)
 	{
 		LM_ERR("Out of memory\n");
 		return -1;
 	}
-	ds_lists[0] = ds_lists[1] = 0;
+	memset(ds_rcu, 0, sizeof(ds_rcu_t));
+	ds_rcu->epoch = 1;
 
-	
-	p = (int*)shm_malloc(3*sizeof(int));
-	if(!p)
+	ds_lock = lock_alloc();
+	if(!ds_lock || !lock_init(ds_lock))
 	{
-		LM_ERR("Out of memory\n");
+		LM_ERR("failed to create lock\n");
 		return -1;
 	}
 
-	crt_idx = p;
-	next_idx = p+1;
-	ds_list_nr = p+2;
-	*crt_idx= *next_idx = 0;
+	return 0;
+}
+
+/* called in each process, before it gets to use the sets */
+int init_ds_readers(void)
+{
+	unsigned int *readers;
+
+	if (ds_rcu->readers)
+		return 0;
+
+	lock_get(ds_lock);
+	if (ds_rcu->readers==NULL) {
+		readers = (unsigned int*)shm_malloc
+			(counted_processes*sizeof(unsigned int));
+		if (readers==NULL) {
+			lock_release(ds_lock);
+			LM_ERR("no more shm memory\n");
+			return -1;
+		}
+		memset(readers, 0, counted_processes*sizeof(unsigned int));
+		ds_rcu->readers = readers;
+	}
+	lock_release(ds_lock);
 
 	return 0;
 }
 
+/* frees the retired versions not used anymore; ds_lock must be held */
+static void ds_reclaim(void)
+{
+	ds_data_p data, *prev;
+	unsigned int r;
+	unsigned int i;
+
+	prev = &ds_rcu->retired;
+	while ( (data=*prev)!=NULL ) {
+		for (i=0 ; ds_rcu->readers && i<counted_processes ; i++) {
+			r = ds_rcu->readers[i];
+			if (r && (int)(r - data->epoch)<0)
+				break;
+		}
+		if (ds_rcu->readers && i<counted_processes) {
+			prev = &data->next;
+			continue;
+		}
+		*prev = data->next;
+		free_ds_data(data);
+	}
+}
+
+/* keep the hit counters of the destinations found in the old sets */
+static void ds_copy_hits(ds_data_p data, ds_data_p old)
+{
+	ds_set_p sp, osp;
+	int i, j;
+
+	for (sp=data->sets ; sp ; sp=sp->next) {
+		for (osp=old->sets ; osp && osp->id!=sp->id ; osp=osp->next);
+		if (osp==NULL)
+			continue;
+		for (i=0 ; i<sp->nr ; i++)
+			for (j=0 ; j<osp->nr ; j++)
+				if (sp->dlist[i].uri.len==osp->dlist[j].uri.len &&
+				memcmp(sp->dlist[i].uri.s, osp->dlist[j].uri.s,
+				sp->dlist[i].uri.len)==0) {
+					sp->dlist[i].hits = osp->dlist[j].hits;
+					break;
+				}
+	}
+}
+
+/* replaces the current sets with data; ds_lock must be held */
+static void ds_publish(ds_data_p data)
+{
+	ds_data_p old;
+
+	old = ds_rcu->crt;
+	if (old)
+		ds_copy_hits(data, old);
+
+	ds_rcu->crt = data;
+	ds_membar();
+	if (++ds_rcu->epoch==0)
+		ds_rcu->epoch = 1;
+	ds_membar();
+
+	if (old) {
+		old->epoch = ds_rcu->epoch;
+		old->next = ds_rcu->retired;
+		ds_rcu->retired = old;
+	}
+	ds_reclaim();
+}
+
+static ds_data_p new_ds_data(void)
+{
+	ds_data_p data;
+
+	data = (ds_data_p)shm_malloc(sizeof(ds_data_t));
+	if(data==NULL)
+	{
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	memset(data, 0, sizeof(ds_data_t));
+
+	return data;
+}
+
 int add_dest2list(int id, str uri, int flags, int weight, str attrs,
-													int list_idx, int * setn)
+													ds_data_p data)
 {
 	ds_dest_p dp = NULL;
 	ds_set_p  sp = NULL;
@@ -156,7 +299,7 @@ int add_dest2list(int id, str uri, int flags, int weight, str attrs,
 	}
 
 	/* get dest set */
-	sp = ds_lists[list_idx];
+	sp = data->sets;
 	while(sp)
 	{
 		if(sp->id == id)
@@ -174,9 +317,9 @@ int add_dest2list(int id, str uri, int flags, int weight, str attrs,
 		}
 		
 		memset(sp, 0, sizeof(ds_set_t));
-		sp->next = ds_lists[list_idx];
-		ds_lists[list_idx] = sp;
-		*setn = *setn+1;
+		sp->next = data->sets;
+		data->sets = sp;
+		data->sets_no++;
 	}
 	sp->id = id;
 	sp->nr++;
@@ -246,14 +389,14 @@ err:
 }
 
 /* compact destinations from sets for fast access */
-int reindex_dests(int list_idx, int setn)
+int reindex_dests(ds_data_p data)
 {
 	int j;
 	int weight;
 	ds_set_p  sp = NULL;
 	ds_dest_p dp = NULL, dp0= NULL;
 
-	for( sp=ds_lists[list_idx] ; sp!= NULL ; sp->dlist=dp0, sp=sp->next )
+	for( sp=data->sets ; sp!= NULL ; sp->dlist=dp0, sp=sp->next )
 	{
 		dp0 = (ds_dest_p)shm_malloc(sp->nr*sizeof(ds_dest_t));
 		if(dp0==NULL)
@@ -291,7 +434,7 @@ int reindex_dests(int list_idx, int setn)
 
 	}
 
-	LM_DBG("found [%d] dest sets\n", setn);
+	LM_DBG("found [%d] dest sets\n", data->sets_no);
 	return 0;
 
 err1:
@@ -303,14 +446,10 @@ int ds_load_list(char *lfile)
 {
 	char line[512], *p;
 	FILE *f = NULL;
-	int id, setn, flags, weight;
+	int id, flags, weight;
 	str uri;
 	str attrs;
-
-	if( (*crt_idx) != (*next_idx)) {
-		LM_WARN("load command already generated, aborting reload...\n");
-		return 0;
-	}
+	ds_data_p data = NULL;
 
 	if(lfile==NULL || strlen(lfile)<=0)
 	{
@@ -326,10 +465,11 @@ int ds_load_list(char *lfile)
 		
 	}
 
-	id = setn = flags = 0;
+	id = flags = 0;
 
-	*next_idx = (*crt_idx + 1)%2;
-	destroy_list(*next_idx);
+	data = new_ds_data();
+	if(data==NULL)
+		goto error;
 
 	p = fgets(line, 512, f);
 	while(p)
@@ -412,7 +552,7 @@ int ds_load_list(char *lfile)
 			attrs.s = NULL;
 
 add_destination:
-		if(add_dest2list(id, uri, flags, weight, attrs, *next_idx, &setn) != 0)
+		if(add_dest2list(id, uri, flags, weight, attrs, data) != 0)
 			goto error;
 					
 		
@@ -420,7 +560,7 @@ next_line:
 		p = fgets(line, 512, f);
 	}
 
-	if(reindex_dests(*next_idx, setn)!=0){
+	if(reindex_dests(data)!=0){
 		LM_ERR("error on reindex\n");
 		goto error;
 	}
@@ -428,15 +568,16 @@ next_line:
 	fclose(f);
 	f = NULL;
 	/* Update list */
-	_ds_list_nr = setn;
-	*crt_idx = *next_idx;
+	lock_get(ds_lock);
+	ds_publish(data);
+	lock_release(ds_lock);
 	return 0;
 
 error:
 	if(f!=NULL)
 		fclose(f);
-	destroy_list(*next_idx);
-	*next_idx = *crt_idx; 
+	if(data!=NULL)
+		free_ds_data(data);
 	return -1;
 }
 
@@ -514,7 +655,7 @@ int init_ds_db(void)
 /*load groups of destinations from DB*/
 int ds_load_db(void)
 {
-	int i, id, nr_rows, setn;
+	int i, id, nr_rows;
 	int flags;
 	int weight;
 	int nrcols;
@@ -523,6 +664,7 @@ int ds_load_db(void)
 	db_res_t * res;
 	db_val_t * values;
 	db_row_t * rows;
+	ds_data_p data;
 
 	db_key_t query_cols[5] = {&ds_set_id_col, &ds_dest_uri_col,
 			&ds_dest_flags_col, &ds_dest_weight_col, &ds_dest_attrs_col};
@@ -531,12 +673,6 @@ int ds_load_db(void)
 	if(_ds_table_version == DS_TABLE_VERSION_NEW)
 		nrcols = 5;
 
-	if( (*crt_idx) != (*next_idx))
-	{
-		LM_WARN("load command already generated, aborting reload...\n");
-		return 0;
-	}
-
 	if(ds_db_handle == NULL){
 			LM_ERR("invalid DB handler\n");
 			return -1;
@@ -564,9 +700,12 @@ int ds_load_db(void)
 		return 0;
 	}
 
-	setn = 0;
-	*next_idx = (*crt_idx + 1)%2;
-	destroy_list(*next_idx);
+	data = new_ds_data();
+	if(data==NULL)
+	{
+		ds_dbf.free_result(ds_db_handle, res);
+		return -1;
+	}
 
 	for(i=0; i<nr_rows; i++)
 	{
@@ -616,28 +755,28 @@ int ds_load_db(void)
 			attrs.len = 0;
 		}
 
-		if(add_dest2list(id, uri, flags, weight, attrs, *next_idx, &setn) != 0)
+		if(add_dest2list(id, uri, flags, weight, attrs, data) != 0)
 			goto err2;
 
 	}
 
-	if(reindex_dests(*next_idx, setn)!=0)
+	if(reindex_dests(data)!=0)
 	{
 		LM_ERR("error on reindex\n");
 		goto err2;
 	}
 
 	/*update data*/
-	_ds_list_nr = setn;
-	*crt_idx = *next_idx;
+	lock_get(ds_lock);
+	ds_publish(data);
+	lock_release(ds_lock);
 	ds_dbf.free_result(ds_db_handle, res);
 
 	return 0;
 
 err2:
-	destroy_list(*next_idx);
+	free_ds_data(data);
 	ds_dbf.free_result(ds_db_handle, res);
-	*next_idx = *crt_idx; 
 
 	return -1;
 }
@@ -645,25 +784,37 @@ err2:
 /*called from dispatcher.c: free all*/
 int ds_destroy_list(void)
 {
-	if (ds_lists) {
-		destroy_list(0);
-		destroy_list(1);
-		shm_free(ds_lists);
+	ds_data_p data;
+
+	if (ds_rcu) {
+		if (ds_rcu->crt)
+			free_ds_data(ds_rcu->crt);
+		while ( (data=ds_rcu->retired)!=NULL ) {
+			ds_rcu->retired = data->next;
+			free_ds_data(data);
+		}
+		if (ds_rcu->readers)
+			shm_free((void*)ds_rcu->readers);
+		shm_free(ds_rcu);
+		ds_rcu = NULL;
 	}
 
-	if (crt_idx)
-		shm_free(crt_idx);
+	if (ds_lock) {
+		lock_destroy(ds_lock);
+		lock_dealloc(ds_lock);
+		ds_lock = NULL;
+	}
 
 	return 0;
 }
 
-void destroy_list(int list_id)
+static void free_ds_data(ds_data_p data)
 {
 	ds_set_p  sp;
 	ds_set_p  sp_curr;
 	ds_dest_p dest;
 
-	sp = ds_lists[list_id];
+	sp = data->sets;
 
 	while(sp) {
 		sp_curr = sp;
@@ -680,8 +831,8 @@ void destroy_list(int list_id)
 		}
 		shm_free(sp_curr);
 	}
-	
-	ds_lists[list_id]  = NULL;
+
+	shm_free(data);
 }
 
 /**
@@ -1022,15 +1173,15 @@ int ds_hash_pvar(struct sip_msg *msg, unsigned int *hash)
 	return 0;
 }
 
-static inline int ds_get_index(int group, ds_set_p *index)
+static inline int ds_get_index(ds_data_p data, int group, ds_set_p *index)
 {
 	ds_set_p si = NULL;
 	
-	if(index==NULL || group<0 || _ds_list==NULL)
+	if(index==NULL || group<0 || data==NULL || data->sets==NULL)
 		return -1;
 	
 	/* get the index of the set */
-	si = _ds_list;
+	si = data->sets;
 	while(si)
 	{
 		if(si->id == group)
@@ -1099,7 +1250,8 @@ static int count_inactive_destinations(ds_set_p idx) {
 /**
  *
  */
-int ds_select_dst(struct sip_msg *msg, int set, int alg, int mode, int max_results)
+static int _ds_select_dst(ds_data_p data, struct sip_msg *msg, int set,
+											int alg, int mode, int max_results)
 {
 	int i, cnt, i_unwrapped;
 	unsigned int ds_hash;
@@ -1115,7 +1267,7 @@ int ds_select_dst(struct sip_msg *msg, int set, int alg, int mode, int max_resul
 		return -1;
 	}
 	
-	if(_ds_list==NULL || _ds_list_nr<=0)
+	if(data==NULL || data->sets_no<=0)
 	{
 		LM_ERR("no destination sets\n");
 		return -1;
@@ -1131,7 +1283,7 @@ int ds_select_dst(struct sip_msg *msg, int set, int alg, int mode, int max_resul
 	
 
 	/* get the index of the set */
-	if(ds_get_index(set, &idx)!=0)
+	if(ds_get_index(data, set, &idx)!=0)
 	{
 		LM_ERR("destination set [%d] not found\n", set);
 		return -1;
@@ -1254,6 +1406,7 @@ int ds_select_dst(struct sip_msg *msg, int set, int alg, int mode, int max_resul
 		LM_ERR("cannot set dst addr\n");
 		return -1;
 	}
+	__sync_fetch_and_add(&idx->dlist[ds_id].hits, 1);
 	/* if alg is round-robin then update the shortcut to next to be used */
 	if(alg==4)
 		idx->last = (ds_id+1) % idx->nr;
@@ -1341,6 +1494,18 @@ done:
 	return 1;
 }
 
+int ds_select_dst(struct sip_msg *msg, int set, int alg, int mode, int max_results)
+{
+	ds_data_p data;
+	int ret;
+
+	data = ds_read_start();
+	ret = _ds_select_dst(data, msg, set, alg, mode, max_results);
+	ds_read_end();
+
+	return ret;
+}
+
 int ds_next_dst(struct sip_msg *msg, int mode)
 {
 	struct usr_avp *avp;
@@ -1423,19 +1588,20 @@ int ds_mark_dst(struct sip_msg *msg, int mode)
 	return (ret==0)?1:-1;
 }
 
-int ds_set_state(int group, str *address, int state, int type)
+static int _ds_set_state(ds_data_p data, int group, str *address,
+															int state, int type)
 {
 	int i=0;
 	ds_set_p idx = NULL;
 
-	if(_ds_list==NULL || _ds_list_nr<=0)
+	if(data==NULL || data->sets_no<=0)
 	{
 		LM_ERR("the list is null\n");
 		return -1;
 	}
 	
 	/* get the index of the set */
-	if(ds_get_index(group, &idx)!=0)
+	if(ds_get_index(data, group, &idx)!=0)
 	{
 		LM_ERR("destination set [%d] not found\n", group);
 		return -1;
@@ -1486,20 +1652,30 @@ int ds_set_state(int group, str *address, int state, int type)
 	return -1;
 }
 
-int ds_print_list(FILE *fout)
+int ds_set_state(int group, str *address, int state, int type)
+{
+	int ret;
+
+	ret = _ds_set_state(ds_read_start(), group, address, state, type);
+	ds_read_end();
+
+	return ret;
+}
+
+static int _ds_print_list(ds_data_p data, FILE *fout)
 {
 	int j;
 	ds_set_p list;
 		
-	if(_ds_list==NULL || _ds_list_nr<=0)
+	if(data==NULL || data->sets_no<=0)
 	{
 		LM_ERR("no destination sets\n");
 		return -1;
 	}
 	
-	fprintf(fout, "\nnumber of destination sets: %d\n", _ds_list_nr);
+	fprintf(fout, "\nnumber of destination sets: %d\n", data->sets_no);
 	
-	for(list = _ds_list; list!= NULL; list= list->next)
+	for(list = data->sets; list!= NULL; list= list->next)
 	{
 		for(j=0; j<list->nr; j++)
 		{
@@ -1528,12 +1704,22 @@ int ds_print_list(FILE *fout)
 	return 0;
 }
 
+int ds_print_list(FILE *fout)
+{
+	int ret;
+
+	ret = _ds_print_list(ds_read_start(), fout);
+	ds_read_end();
+
+	return ret;
+}
+
 
 /* Checks, if the request (sip_msg *_m) comes from a host in a set
  * (set-id or -1 for all sets)
  */
-int ds_is_in_list(struct sip_msg *_m, pv_spec_t *pv_ip, pv_spec_t *pv_port,
-													int set, int active_only)
+static int _ds_is_in_list(ds_data_p data, struct sip_msg *_m,
+		pv_spec_t *pv_ip, pv_spec_t *pv_port, int set, int active_only)
 {
 	pv_value_t val;
 	ds_set_p list;
@@ -1573,7 +1759,10 @@ int ds_is_in_list(struct sip_msg *_m, pv_spec_t *pv_ip, pv_spec_t *pv_port,
 	memset(&val, 0, sizeof(pv_value_t));
 	val.flags = PV_VAL_INT|PV_TYPE_INT;
 
-	for(list = _ds_list; list!= NULL; list= list->next) {
+	if(data==NULL)
+		return -1;
+
+	for(list = data->sets; list!= NULL; list= list->next) {
 		if ((set == -1) || (set == list->id)) {
 			for(j=0; j<list->nr; j++) {
 				if ( (list->dlist[j].port==0 || port==0
@@ -1600,8 +1789,20 @@ int ds_is_in_list(struct sip_msg *_m, pv_spec_t *pv_ip, pv_spec_t *pv_port,
 	return -1;
 }
 
+int ds_is_in_list(struct sip_msg *_m, pv_spec_t *pv_ip, pv_spec_t *pv_port,
+													int set, int active_only)
+{
+	int ret;
 
-int ds_print_mi_list(struct mi_node* rpl)
+	ret = _ds_is_in_list(ds_read_start(), _m, pv_ip, pv_port, set,
+		active_only);
+	ds_read_end();
+
+	return ret;
+}
+
+
+static int _ds_print_mi_list(ds_data_p data, struct mi_node* rpl)
 {
 	int len, j;
 	char* p;
@@ -1611,18 +1812,18 @@ int ds_print_mi_list(struct mi_node* rpl)
 	struct mi_node* set_node = NULL;
 	struct mi_attr* attr = NULL;
 	
-	if(_ds_list==NULL || _ds_list_nr<=0)
+	if(data==NULL || data->sets_no<=0)
 	{
 		LM_ERR("no destination sets\n");
 		return  0;
 	}
 
-	p= int2str(_ds_list_nr, &len); 
+	p= int2str(data->sets_no, &len); 
 	node = add_mi_node_child(rpl, MI_DUP_VALUE, "SET_NO",6, p, len);
 	if(node== NULL)
 		return -1;
 
-	for(list = _ds_list; list!= NULL; list= list->next)
+	for(list = data->sets; list!= NULL; list= list->next)
 	{
 		p = int2str(list->id, &len);
 		set_node= add_mi_node_child(rpl, MI_DUP_VALUE,"SET", 3, p, len);
@@ -1643,13 +1844,27 @@ int ds_print_mi_list(struct mi_node* rpl)
   			attr = add_mi_attr (node, MI_DUP_VALUE, "flag",4, &c, 1);
   			if(attr == 0)
   				return -1;
-  
+
+			p = int2str((unsigned long)list->dlist[j].hits, &len);
+			attr = add_mi_attr (node, MI_DUP_VALUE, "hits",4, p, len);
+			if(attr == 0)
+				return -1;
  		}
 	}
 
 	return 0;
 }
 
+int ds_print_mi_list(struct mi_node* rpl)
+{
+	int ret;
+
+	ret = _ds_print_mi_list(ds_read_start(), rpl);
+	ds_read_end();
+
+	return ret;
+}
+
 /**
  * Callback-Function for the OPTIONS-Request
  * This Function is called, as soon as the Transaction is finished
@@ -1715,14 +1930,17 @@ void ds_check_timer(unsigned int ticks, void* param)
 {
 	dlg_t *dlg;
 	ds_set_p list;
+	ds_data_p data;
 	int j;
 
+	data = ds_read_start();
+
 	/* Check for the list. */
-	if(_ds_list==NULL || _ds_list_nr<=0)
-		return;
+	if(data==NULL || data->sets_no<=0)
+		goto done;
 
 	/* Iterate over the groups and the entries of each group: */
-	for(list = _ds_list; list!= NULL; list= list->next)
+	for(list = data->sets; list!= NULL; list= list->next)
 	{
 		for(j=0; j<list->nr; j++) 
 		{
@@ -1756,4 +1974,6 @@ void ds_check_timer(unsigned int ticks, void* param)
 			}
 		}
 	}
+done:
+	ds_read_end();
 }
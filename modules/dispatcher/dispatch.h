@@ -84,6 +84,7 @@ extern int probing_threshhold; /* number of failed requests,
 extern int ds_probing_mode;
 
 int init_data();
+int init_ds_readers();
 int init_ds_db();
 int ds_load_list(char *lfile);
 int ds_connect_db();
@@ -436,7 +436,7 @@ static int child_init(int rank)
 
 	srand((11+rank)*getpid()*7);
 
-	return 0;
+	return init_ds_readers();
 }
 
 static int mi_child_init(void)
@@ -627,6 +627,9 @@ rt_data_t* dr_load_routing_info( db_func_t *dr_dbf, db_con_t* db_hdl,
 	if (n==0) {
 		LM_WARN("no valid routing rules -> discarding all destinations\n");
 		free_rt_data( rdata, 0 );
+	} else if (compact_rt_data( rdata )!=0) {
+		/* still usable as it is */
+		LM_WARN("using the prefix tree not compacted\n");
 	}
 
 	return rdata;
@@ -960,7 +960,11 @@ static int do_routing(struct sip_msg* msg, dr_group_t *drg, int sort_order)
 	lock_start_read( ref_lock );
 
 	/* search a prefix */
-	rt_info = get_prefix( (*rdata)->pt, &uri.user , (unsigned int)grp_id);
+	if ((*rdata)->fpt)
+		rt_info = get_flat_prefix( (*rdata)->fpt, &uri.user ,
+			(unsigned int)grp_id);
+	else
+		rt_info = get_prefix( (*rdata)->pt, &uri.user , (unsigned int)grp_id);
 	if (rt_info==0) {
 		LM_DBG("no matching for prefix \"%.*s\"\n",
 			uri.user.len, uri.user.s);
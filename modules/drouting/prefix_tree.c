@@ -27,6 +27,7 @@
  * ---------
  *  2005-02-20  first version (cristian)
  *  2005-02-27  ported to 0.9.0 (bogdan)
+ *  2011-07-04  compacted (flat) form of the tree for lookups
  */
 
 
@@ -35,6 +36,7 @@
 
 #include "../../str.h"
 #include "../../mem/shm_mem.h"
+#include "../../mem/mem.h"
 #include "../../time_rec.h"
 
 #include "prefix_tree.h"
@@ -175,6 +177,275 @@ err_exit:
 }
 
 
+/* a node of the pointer tree is used if it has rules or children */
+#define PTN_EMPTY(_pn) ((_pn)->rg_pos==0 && (_pn)->next==NULL)
+
+struct flat_count {
+	unsigned int nodes;
+	unsigned int labels;
+	unsigned int rgs;
+	unsigned int rts;
+};
+
+
+/* returns the only child of a node without rules, -1 if none */
+static inline int
+single_child(
+		ptree_node_t *pn
+		)
+{
+	int i, d=-1;
+
+	if (pn->rg_pos || pn->next==NULL)
+		return -1;
+	for(i=0; i<PTREE_CHILDREN; i++) {
+		if (PTN_EMPTY(&pn->next->ptnode[i]))
+			continue;
+		if (d>=0)
+			return -1;
+		d = i;
+	}
+	return d;
+}
+
+
+static void
+count_flat_tree(
+		ptree_node_t *pn,
+		struct flat_count *cnt
+		)
+{
+	rt_info_wrp_t *rtlw;
+	ptree_node_t *cur;
+	int i, d;
+
+	for(i=0; i<pn->rg_pos; i++) {
+		cnt->rgs++;
+		for(rtlw=pn->rg[i].rtlw; rtlw; rtlw=rtlw->next)
+			cnt->rts++;
+	}
+	if (pn->next==NULL)
+		return;
+	for(d=0; d<PTREE_CHILDREN; d++) {
+		cur = &pn->next->ptnode[d];
+		if (PTN_EMPTY(cur))
+			continue;
+		/* collapse the chain of single child nodes */
+		cnt->labels++;
+		while ( (i=single_child(cur))>=0 ) {
+			cur = &cur->next->ptnode[i];
+			cnt->labels++;
+		}
+		cnt->nodes++;
+		count_flat_tree(cur, cnt);
+	}
+}
+
+
+/* builds the compacted form of a prefix tree; the rules are shared
+ * (referenced) with the tree, which may be freed afterwards */
+pflat_tree_t*
+build_flat_tree(
+		ptree_t *ptree
+		)
+{
+	struct flat_count cnt;
+	ptree_node_t root;
+	ptree_node_t **src=NULL;
+	ptree_node_t *pn, *cur;
+	pflat_tree_t *ft;
+	pflat_node_t *fn;
+	pflat_rg_t *frg;
+	rt_info_t **frt;
+	rt_info_wrp_t *rtlw;
+	char *lbl;
+	unsigned int i, n;
+	int j, d;
+
+	memset( &root, 0, sizeof(root));
+	root.next = ptree;
+	memset( &cnt, 0, sizeof(cnt));
+	cnt.nodes = 1;
+	count_flat_tree( &root, &cnt);
+
+	/* everything in one chunk */
+	n = sizeof(pflat_tree_t) + cnt.nodes*sizeof(pflat_node_t) +
+		cnt.rgs*sizeof(pflat_rg_t) + cnt.rts*sizeof(rt_info_t*) + cnt.labels;
+	ft = (pflat_tree_t*)shm_malloc(n);
+	if (ft==NULL) {
+		LM_ERR("no more shm mem (%u needed)\n", n);
+		goto err_exit;
+	}
+	memset( ft, 0, n);
+	ft->size = n;
+	ft->nodes_no = cnt.nodes;
+	ft->nodes = (pflat_node_t*)(ft+1);
+	frg = (pflat_rg_t*)(ft->nodes+cnt.nodes);
+	ft->rt = frt = (rt_info_t**)(frg+cnt.rgs);
+	ft->labels = lbl = (char*)(frt+cnt.rts);
+
+	/* the pointer tree nodes matching the flat ones */
+	src = (ptree_node_t**)pkg_malloc(cnt.nodes*sizeof(ptree_node_t*));
+	if (src==NULL) {
+		LM_ERR("no more pkg mem\n");
+		goto err_exit;
+	}
+
+	/* breadth first, so the children of a node are consecutive */
+	src[0] = &root;
+	for( i=0,n=1 ; i<n ; i++ ) {
+		pn = src[i];
+		fn = &ft->nodes[i];
+
+		fn->rg = frg;
+		fn->rg_no = pn->rg_pos;
+		for(j=0; j<pn->rg_pos; j++,frg++) {
+			frg->rgid = pn->rg[j].rgid;
+			frg->rt = frt;
+			for(rtlw=pn->rg[j].rtlw; rtlw; rtlw=rtlw->next) {
+				rtlw->rtl->ref_cnt++;
+				*(frt++) = rtlw->rtl;
+				frg->rt_no++;
+			}
+			ft->rt_no += frg->rt_no;
+		}
+
+		fn->first_child = n;
+		if (pn->next==NULL)
+			continue;
+		for(d=0; d<PTREE_CHILDREN; d++) {
+			cur = &pn->next->ptnode[d];
+			if (PTN_EMPTY(cur))
+				continue;
+			ft->nodes[n].parent = i;
+			ft->nodes[n].label = lbl - ft->labels;
+			*(lbl++) = '0' + d;
+			while ( (j=single_child(cur))>=0 ) {
+				cur = &cur->next->ptnode[j];
+				*(lbl++) = '0' + j;
+			}
+			ft->nodes[n].label_len = (lbl - ft->labels) - ft->nodes[n].label;
+			fn->children |= 1<<d;
+			src[n++] = cur;
+		}
+	}
+
+	pkg_free(src);
+	return ft;
+err_exit:
+	if (ft)
+		del_flat_tree(ft);
+	return NULL;
+}
+
+
+void
+del_flat_tree(
+		pflat_tree_t *ft
+		)
+{
+	unsigned int i;
+
+	if (ft==NULL)
+		return;
+	for(i=0; i<ft->rt_no; i++)
+		if ( (--ft->rt[i]->ref_cnt)==0 )
+			free_rt_info(ft->rt[i]);
+	shm_free(ft);
+}
+
+
+static inline rt_info_t*
+check_flat_rt(
+		pflat_node_t *fn,
+		unsigned int rgid
+		)
+{
+	unsigned int i, j;
+
+	for(i=0; i<fn->rg_no; i++) {
+		if (fn->rg[i].rgid!=rgid)
+			continue;
+		LM_DBG("found rgid %d (%d rules)\n", rgid, fn->rg[i].rt_no);
+		for(j=0; j<fn->rg[i].rt_no; j++)
+			if (check_time(fn->rg[i].rt[j]->time_rec))
+				return fn->rg[i].rt[j];
+		break;
+	}
+	return NULL;
+}
+
+
+/* index of a child, among the children of a node */
+static inline unsigned int
+child_pos(
+		unsigned short children,
+		int d
+		)
+{
+	unsigned int n;
+
+	children &= (1<<d) - 1;
+	for(n=0; children; n++)
+		children &= children - 1;
+	return n;
+}
+
+
+/* same as get_prefix(), but on the compacted tree */
+rt_info_t*
+get_flat_prefix(
+	pflat_tree_t *ft,
+	str* prefix,
+	unsigned int rgid
+	)
+{
+	rt_info_t *rt;
+	pflat_node_t *fn, *child;
+	char *tmp, *end, *lbl;
+	int d, i;
+
+	if(NULL == ft || NULL == prefix)
+		return NULL;
+
+	/* go the tree down as long as the prefix string matches
+	 * (or down to a leaf) */
+	fn = ft->nodes;
+	tmp = prefix->s;
+	end = prefix->s + prefix->len;
+	while(tmp < end && fn->children) {
+		if( !IS_DECIMAL_DIGIT(*tmp) ) {
+			/* unknown character in the prefix string */
+			return NULL;
+		}
+		d = *tmp - '0';
+		if ( (fn->children & (1<<d))==0 )
+			break;
+		child = &ft->nodes[fn->first_child + child_pos(fn->children, d)];
+		lbl = ft->labels + child->label;
+		for(i=1; i<child->label_len; i++) {
+			if (tmp+i==end)
+				goto match;
+			if( !IS_DECIMAL_DIGIT(tmp[i]) )
+				return NULL;
+			if (tmp[i]!=lbl[i])
+				goto match;
+		}
+		tmp += child->label_len;
+		fn = child;
+	}
+
+match:
+	/* go in the tree up to the root trying to match the prefix */
+	while( fn!=ft->nodes ) {
+		if ( fn->rg_no && (rt=check_flat_rt( fn, rgid))!=NULL )
+			return rt;
+		fn = &ft->nodes[fn->parent];
+	}
+	return NULL;
+}
+
+
 pgw_t* 
 get_pgw(
 		pgw_t* pgw_l,
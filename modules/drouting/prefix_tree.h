@@ -126,6 +126,41 @@ typedef struct ptree_ {
 	ptree_node_t ptnode[PTREE_CHILDREN];
 } ptree_t;
 
+/* compacted (read only) form of the prefix tree, built at load time:
+ * all the nodes, digits, groups and rules are kept in one contiguous
+ * chunk and the chains of single child nodes are collapsed */
+
+/* rules of a routing group, in order of priority */
+typedef struct pflat_rg_ {
+	unsigned int rgid;
+	unsigned int rt_no;
+	rt_info_t **rt;
+} pflat_rg_t;
+
+typedef struct pflat_node_ {
+	/* routing groups of the prefix ending in this node */
+	pflat_rg_t *rg;
+	unsigned int rg_no;
+	/* index of the parent node */
+	unsigned int parent;
+	/* index of the first child, the others follow */
+	unsigned int first_child;
+	/* offset of the digits leading (from parent) to this node */
+	unsigned int label;
+	unsigned short label_len;
+	/* bitmap of the digits having a child */
+	unsigned short children;
+} pflat_node_t;
+
+typedef struct pflat_tree_ {
+	unsigned int size;
+	unsigned int nodes_no;
+	pflat_node_t *nodes;
+	char *labels;
+	unsigned int rt_no;
+	rt_info_t **rt;
+} pflat_tree_t;
+
 void 
 print_interim(
 		int,
@@ -154,6 +189,23 @@ get_prefix(
 	unsigned int rgid
 	);
 
+pflat_tree_t*
+build_flat_tree(
+	ptree_t *ptree
+	);
+
+void
+del_flat_tree(
+	pflat_tree_t *ft
+	);
+
+rt_info_t*
+get_flat_prefix(
+	pflat_tree_t *ft,
+	str* prefix,
+	unsigned int rgid
+	);
+
 int
 add_rt_info(
 	ptree_node_t*, 
@@ -59,6 +59,8 @@ build_rt_data( void )
 	}
 	memset(rdata, 0, sizeof(rt_data_t));
 
+	/* size of the tree being built */
+	tree_size = 0;
 	INIT_PTREE_NODE(NULL, rdata->pt);
 
 	return rdata;
@@ -454,6 +456,8 @@ free_rt_data(
 		/* del prefix tree */
 		del_tree(rt_data->pt);
 		rt_data->pt = 0 ;
+		del_flat_tree(rt_data->fpt);
+		rt_data->fpt = 0 ;
 		/* del prefixless rules */
 		if(NULL!=rt_data->noprefix.rg) {
 			for(j=0;j<rt_data->noprefix.rg_pos;j++) {
@@ -469,3 +473,32 @@ free_rt_data(
 		if (all) shm_free(rt_data);
 	}
 }
+
+
+int
+compact_rt_data(
+		rt_data_t* rt_data
+		)
+{
+	pflat_tree_t *ft;
+
+	if(NULL==rt_data || NULL==rt_data->pt)
+		return 0;
+
+	ft = build_flat_tree(rt_data->pt);
+	if(NULL==ft) {
+		LM_ERR("failed to compact the prefix tree\n");
+		return -1;
+	}
+
+	LM_INFO("prefix tree compacted from %d to %u bytes (%u nodes)\n",
+		tree_size, ft->size, ft->nodes_no);
+
+	/* the rules are kept referenced by the flat tree */
+	del_tree(rt_data->pt);
+	rt_data->pt = 0;
+	rt_data->fpt = ft;
+	tree_size = ft->size;
+
+	return 0;
+}
@@ -60,6 +60,8 @@ typedef struct rt_data_ {
 	ptree_node_t noprefix;
 	/* hash table with routing prefixes */
 	ptree_t *pt;
+	/* compacted prefix tree (replaces pt once built) */
+	pflat_tree_t *fpt;
 }rt_data_t;
 
 typedef struct _dr_group {
@@ -123,4 +125,9 @@ free_rt_data(
 		rt_data_t*,
 		int
 		);
+
+int
+compact_rt_data(
+		rt_data_t*
+		);
 #endif
@@ -24,6 +24,16 @@
  * History:
  * --------
  *  2009-01-29  initial version (Anca Vamanu)
+ *  2011-06-22  expiry wheel and LRU eviction
+ */
+
+/*
+ * Each bucket keeps its entries in most recently used order (stores and
+ * fetches move an entry first) and its expiring entries in a small wheel,
+ * with a slot per cache_clean_period, so the cleaning only visits the
+ * slots of the elapsed periods. Entries expiring further than the wheel
+ * turn are skipped when their slot is visited. Everything in a bucket is
+ * protected by the bucket lock.
  */
 
 #include <stdlib.h>
@@ -31,22 +41,41 @@
 
 #include "../../dprint.h"
 #include "../../timer.h"
+#include "../../ut.h"
 #include "../../mem/mem.h"
 #include "../../mem/shm_mem.h"
 #include "localcache.h"
 #include "hash.h"
 
 
-void lcache_htable_remove_safe(str attr, lcache_entry_t** it);
+static unsigned int lcache_clean_pos = 0;  /* timer process only */
+
+
+#define lcache_slot(_exp) \
+	(((_exp)/cache_clean_period) & (LCACHE_WHEEL_SIZE-1))
+
+#define lcache_entry_size(_me) \
+	(sizeof(lcache_entry_t) + (_me)->attr.len + (_me)->value.len)
+
 
 int lcache_htable_init(int size)
 {
 	int i = 0, j;
 
+	cache_memory = (unsigned long*)shm_malloc(sizeof(unsigned long));
+	if(cache_memory == NULL)
+	{
+		LM_ERR("no more shared memory\n");
+		return -1;
+	}
+	*cache_memory = 0;
+
 	cache_htable = (lcache_t*)shm_malloc(size * sizeof(lcache_t));
 	if(cache_htable == NULL)
 	{
 		LM_ERR("no more shared memory\n");
+		shm_free(cache_memory);
+		cache_memory = NULL;
 		return -1;
 	}
 	memset(cache_htable, 0, size * sizeof(lcache_t));
@@ -60,6 +89,8 @@ int lcache_htable_init(int size)
 		}
 	}
 
+	lcache_clean_pos = get_ticks()/cache_clean_period;
+
 	return 0;
 
 error:
@@ -69,6 +100,8 @@ error:
 	}
 	shm_free(cache_htable);
 	cache_htable = NULL;
+	shm_free(cache_memory);
+	cache_memory = NULL;
 	return -1;
 }
 
@@ -93,12 +126,73 @@ void lcache_htable_destroy(void)
 	}
 	shm_free(cache_htable);
 	cache_htable = NULL;
+	shm_free(cache_memory);
+	cache_memory = NULL;
 }
 
-int lcache_htable_insert(str* attr, str* value, unsigned int expires, void* data)
+/*
+ * unlink an entry from its bucket and free it - bucket lock held
+ */
+static void lcache_entry_free(lcache_t* b, lcache_entry_t* me)
 {
-	lcache_entry_t* me, *it;
-	int hash_code;
+	if(me->prev)
+		me->prev->next = me->next;
+	else
+		b->entries = me->next;
+	if(me->next)
+		me->next->prev = me->prev;
+	else
+		b->last = me->prev;
+
+	if(me->expires)
+	{
+		if(me->wprev)
+			me->wprev->wnext = me->wnext;
+		else
+			b->wheel[lcache_slot(me->expires)] = me->wnext;
+		if(me->wnext)
+			me->wnext->wprev = me->wprev;
+	}
+
+	__sync_fetch_and_sub(cache_memory, lcache_entry_size(me));
+	shm_free(me);
+}
+
+/*
+ * move an entry first in its bucket - bucket lock held
+ */
+static inline void lcache_entry_touch(lcache_t* b, lcache_entry_t* me)
+{
+	if(me->prev == NULL)
+		return;
+
+	me->prev->next = me->next;
+	if(me->next)
+		me->next->prev = me->prev;
+	else
+		b->last = me->prev;
+
+	me->prev = NULL;
+	me->next = b->entries;
+	b->entries->prev = me;
+	b->entries = me;
+}
+
+static lcache_entry_t* lcache_entry_find(lcache_t* b, str* attr)
+{
+	lcache_entry_t* it;
+
+	for(it = b->entries; it; it = it->next)
+		if(it->attr.len == attr->len &&
+				(strncmp(it->attr.s, attr->s, attr->len) == 0))
+			return it;
+	return NULL;
+}
+
+static lcache_entry_t* lcache_entry_new(str* attr, str* value,
+		unsigned int expires)
+{
+	lcache_entry_t* me;
 	int size;
 
 	size= sizeof(lcache_entry_t) + attr->len + value->len;
@@ -107,7 +201,7 @@ int lcache_htable_insert(str* attr, str* value, unsigned int expires, void* data
 	if(me == NULL)
 	{
 		LM_ERR("no more shared memory\n");
-		return -1;
+		return NULL;
 	}
 	memset(me, 0, size);
 
@@ -118,60 +212,155 @@ int lcache_htable_insert(str* attr, str* value, unsigned int expires, void* data
 	me->value.s = (char*)me + (sizeof(lcache_entry_t)) + attr->len;
 	memcpy(me->value.s, value->s, value->len);
 	me->value.len = value->len;
-	if( expires != 0)
-		me->expires = get_ticks() + expires;
+	me->expires = expires;
 
-	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	return me;
+}
+
+/*
+ * link a new entry first in its bucket - bucket lock held
+ */
+static void lcache_entry_link(lcache_t* b, lcache_entry_t* me)
+{
+	me->next = b->entries;
+	if(b->entries)
+		b->entries->prev = me;
+	else
+		b->last = me;
+	b->entries = me;
+
+	if(me->expires)
+	{
+		me->wnext = b->wheel[lcache_slot(me->expires)];
+		if(me->wnext)
+			me->wnext->wprev = me;
+		b->wheel[lcache_slot(me->expires)] = me;
+	}
+
+	__sync_fetch_and_add(cache_memory, lcache_entry_size(me));
+}
+
+int lcache_htable_insert(str* attr, str* value, unsigned int expires, void* data)
+{
+	lcache_entry_t* me, *it;
+	lcache_t* b;
+	int hash_code;
 
-	it = cache_htable[hash_code].entries;
+	me = lcache_entry_new(attr, value, expires ? get_ticks() + expires : 0);
+	if(me == NULL)
+		return -1;
+
+	hash_code= core_hash( attr, 0, cache_htable_size);
+	b = &cache_htable[hash_code];
+	lock_get(&b->lock);
 
 	/* if a previous record for the same attr delete it */
-	lcache_htable_remove_safe( *attr, &it);
+	it = lcache_entry_find(b, attr);
+	if(it)
+		lcache_entry_free(b, it);
 
-	me->next = it;
-	cache_htable[hash_code].entries = me;
+	lcache_entry_link(b, me);
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&b->lock);
+
+	if(cache_max_memory && *cache_memory > cache_max_memory)
+		lcache_htable_evict();
 
 	return 1;
 }
 
-void lcache_htable_remove_safe(str attr, lcache_entry_t** it_p)
+/*
+ *	the expiration time is set only when the counter is created
+ *	return :
+ *		1  - on success
+ *		-1 - if error (also if the value is not an integer)
+ * */
+int lcache_htable_add(str* attr, int val, unsigned int expires,
+		int* new_val, void* data)
 {
-	lcache_entry_t* me = NULL, *it= *it_p;
+	lcache_entry_t* me, *it;
+	lcache_t* b;
+	int hash_code;
+	unsigned int now;
+	int n;
+	str s;
+
+	now = get_ticks();
+	hash_code= core_hash( attr, 0, cache_htable_size);
+	b = &cache_htable[hash_code];
+	lock_get(&b->lock);
 
-	while(it)
+	it = lcache_entry_find(b, attr);
+	if(it && it->expires != 0 && it->expires < now)
 	{
-		if(it->attr.len == attr.len && 
-				(strncmp(it->attr.s, attr.s, attr.len) == 0))
-		{
-			
-			if(me)
-				me->next = it->next;
-			else
-				*it_p = it->next;
+		lcache_entry_free(b, it);
+		it = NULL;
+	}
 
-			shm_free(it);
+	n = 0;
+	if(it && str2sint(&it->value, &n) < 0)
+	{
+		LM_ERR("value of [%.*s] is not an integer\n", attr->len, attr->s);
+		lock_release(&b->lock);
+		return -1;
+	}
+	n += val;
 
-			return;
-		}
-		me = it;
-		it = it->next;
+	s.s = sint2str(n, &s.len);
+	if(it && it->value.len == s.len)
+	{
+		/* most of the updates keep the length - no reallocation */
+		memcpy(it->value.s, s.s, s.len);
+		lcache_entry_touch(b, it);
+		goto done;
 	}
-	LM_DBG("entry not found\n");
+
+	me = lcache_entry_new(attr, &s,
+			it ? it->expires : (expires ? now + expires : 0));
+	if(me == NULL)
+	{
+		lock_release(&b->lock);
+		return -1;
+	}
+	if(it)
+		lcache_entry_free(b, it);
+	lcache_entry_link(b, me);
+
+done:
+	lock_release(&b->lock);
+
+	if(new_val)
+		*new_val = n;
+
+	if(cache_max_memory && *cache_memory > cache_max_memory)
+		lcache_htable_evict();
+
+	return 1;
+}
+
+int lcache_htable_sub(str* attr, int val, unsigned int expires,
+		int* new_val, void* data)
+{
+	return lcache_htable_add(attr, -val, expires, new_val, data);
 }
 
 void lcache_htable_remove(str* attr,void * data)
 {
+	lcache_entry_t* it;
+	lcache_t* b;
 	int hash_code;
 
 	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	b = &cache_htable[hash_code];
+	lock_get(&b->lock);
 
-	lcache_htable_remove_safe( *attr, &cache_htable[hash_code].entries);
+	it = lcache_entry_find(b, attr);
+	if(it)
+		lcache_entry_free(b, it);
+	else
+		LM_DBG("entry not found\n");
 
-	lock_release(&cache_htable[hash_code].lock);
+	lock_release(&b->lock);
 
 }
 /*
@@ -183,50 +372,110 @@ void lcache_htable_remove(str* attr,void * data)
 int lcache_htable_fetch(str* attr, str* res,void * data)
 {
 	int hash_code;
-	lcache_entry_t* it = NULL, *it_aux = NULL;
+	lcache_entry_t* it = NULL;
+	lcache_t* b;
 	char* value;
 
 	hash_code= core_hash( attr, 0, cache_htable_size);
-	lock_get(&cache_htable[hash_code].lock);
+	b = &cache_htable[hash_code];
+	lock_get(&b->lock);
 
-	it = cache_htable[hash_code].entries;
+	it = lcache_entry_find(b, attr);
+	if(it == NULL)
+	{
+		lock_release(&b->lock);
+		return -2;
+	}
 
-	while(it)
+	if( it->expires != 0 && it->expires < get_ticks())
 	{
-		if(it->attr.len == attr->len && 
-				(strncmp(it->attr.s, attr->s, attr->len) == 0))
+		/* found an expired entry  -> delete it */
+		lcache_entry_free(b, it);
+		lock_release(&b->lock);
+		return -2;
+	}
+	value = (char*)pkg_malloc(it->value.len);
+	if(value == NULL)
+	{
+		LM_ERR("no more memory\n");
+		lock_release(&b->lock);
+		return -1;
+	}
+	memcpy(value, it->value.s, it->value.len);
+	res->len = it->value.len;
+	res->s = value;
+	lcache_entry_touch(b, it);
+	lock_release(&b->lock);
+	return 1;
+}
+
+/*
+ * delete the expired entries from the wheel slots of the periods
+ * elapsed since the last run
+ */
+void lcache_htable_clean(unsigned int ticks)
+{
+	lcache_entry_t* me1, *me2;
+	unsigned int pos, slot, n;
+	int i;
+
+	pos = ticks/cache_clean_period;
+	/* each slot once, if more than a turn elapsed */
+	if(pos - lcache_clean_pos > LCACHE_WHEEL_SIZE)
+		lcache_clean_pos = pos - LCACHE_WHEEL_SIZE;
+
+	LM_DBG("cleaning periods %u to %u\n", lcache_clean_pos, pos);
+	for(n = 0; lcache_clean_pos < pos; lcache_clean_pos++)
+	{
+		slot = lcache_clean_pos & (LCACHE_WHEEL_SIZE-1);
+		for(i = 0; i< cache_htable_size; i++)
 		{
-			if( it->expires != 0 && it->expires < get_ticks())
+			lock_get(&cache_htable[i].lock);
+			me1 = cache_htable[i].wheel[slot];
+			while(me1)
 			{
-				/* found an expired entry  -> delete it */
-				if(it_aux)
-					it_aux->next = it->next;
-				else
-					cache_htable[hash_code].entries = it->next;
-				
-				shm_free(it);
-
-				lock_release(&cache_htable[hash_code].lock);
-				return -2;
+				me2 = me1->wnext;
+				/* the ones of the next turns stay */
+				if(me1->expires < ticks)
+				{
+					LM_DBG("deleted entry attr= [%.*s]\n",
+							me1->attr.len, me1->attr.s);
+					lcache_entry_free(&cache_htable[i], me1);
+					n++;
+				}
+				me1 = me2;
 			}
-			value = (char*)pkg_malloc(it->value.len);
-			if(value == NULL)
-			{
-				LM_ERR("no more memory\n");
-				lock_release(&cache_htable[hash_code].lock);
-				return -1;
-			}
-			memcpy(value, it->value.s, it->value.len);
-			res->len = it->value.len;
-			res->s = value;
-			lock_release(&cache_htable[hash_code].lock);
-			return 1;
+			lock_release(&cache_htable[i].lock);
 		}
+	}
+	LM_DBG("deleted %u expired entries\n", n);
+}
 
-		it_aux = it;
-		it = it->next;
+/*
+ * drop least recently used entries, a bucket after the other, until the
+ * used memory goes under the limit
+ */
+void lcache_htable_evict(void)
+{
+	static unsigned int cursor = 0;
+	lcache_t* b;
+	int empty;
+
+	/* stop if a whole round finds nothing to drop */
+	for(empty = 0; empty < cache_htable_size &&
+			*cache_memory > cache_max_memory; )
+	{
+		b = &cache_htable[(cursor++) & (cache_htable_size-1)];
+		lock_get(&b->lock);
+		if(b->last)
+		{
+			LM_DBG("evicted entry attr= [%.*s]\n",
+					b->last->attr.len, b->last->attr.s);
+			lcache_entry_free(b, b->last);
+			empty = 0;
+		}
+		else
+			empty++;
+		lock_release(&b->lock);
 	}
-	
-	lock_release(&cache_htable[hash_code].lock);
-	return -2;
 }
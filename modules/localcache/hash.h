@@ -33,18 +33,26 @@
 #include "../../str.h"
 #include "../../lock_ops.h"
 
+/* slots of the expiry wheel of a bucket */
+#define LCACHE_WHEEL_SIZE  16
+
 typedef struct lcache_entry
 {
 	str attr;
 	str value;
 	unsigned int expires;
-	struct lcache_entry* next;
+	struct lcache_entry* next;   /* bucket list, most recently used first */
+	struct lcache_entry* prev;
+	struct lcache_entry* wnext;  /* expiry wheel slot */
+	struct lcache_entry* wprev;
 }lcache_entry_t;
 
 
 typedef struct lcache
 {
 	lcache_entry_t* entries;
+	lcache_entry_t* last;        /* least recently used */
+	lcache_entry_t* wheel[LCACHE_WHEEL_SIZE];
 	gen_lock_t lock;
 }lcache_t;
 
@@ -54,6 +62,12 @@ void lcache_htable_destroy();
 int lcache_htable_insert(str* attr, str* value, unsigned int expires,void *data);
 void lcache_htable_remove(str* attr,void* data);
 int lcache_htable_fetch(str* attr, str* val,void * data);
+int lcache_htable_add(str* attr, int val, unsigned int expires,
+		int* new_val, void* data);
+int lcache_htable_sub(str* attr, int val, unsigned int expires,
+		int* new_val, void* data);
+void lcache_htable_clean(unsigned int ticks);
+void lcache_htable_evict(void);
 
 
 #endif
@@ -51,12 +51,16 @@ static void destroy(void);
 lcache_t* cache_htable = NULL;
 int cache_htable_size = 9;
 int cache_clean_period = 600;
+static int cache_max_memory_kb = 0;
+unsigned long cache_max_memory = 0;
+unsigned long *cache_memory = NULL;
 
 void localcache_clean(unsigned int ticks,void *param);
 
 static param_export_t params[]={
 	{ "cache_table_size",   INT_PARAM, &cache_htable_size },
 	{ "cache_clean_period", INT_PARAM, &cache_clean_period},
+	{ "cache_max_memory",   INT_PARAM, &cache_max_memory_kb},
 	{0,0,0}
 };
 
@@ -90,6 +94,15 @@ static int mod_init(void)
 	else
 		cache_htable_size= 1<< cache_htable_size;
 
+	if(cache_clean_period <= 0 )
+	{
+		LM_ERR("Worng parameter cache_clean_period - need a postive value\n");
+		return -1;
+	}
+
+	if(cache_max_memory_kb > 0)
+		cache_max_memory = (unsigned long)cache_max_memory_kb * 1024;
+
 	if(lcache_htable_init(cache_htable_size) < 0)
 	{
 		LM_ERR("failed to initialize cache hash table\n");
@@ -102,6 +115,8 @@ static int mod_init(void)
         ms.store = lcache_htable_insert;
 	ms.remove = lcache_htable_remove;
 	ms.fetch = lcache_htable_fetch;
+	ms.add = lcache_htable_add;
+	ms.sub = lcache_htable_sub;
 	ms.data = NULL;
 
 	if( register_memcache(&ms)< 0)
@@ -110,12 +125,6 @@ static int mod_init(void)
 		return -1;
 	}
 
-	if(cache_clean_period <= 0 )
-	{
-		LM_ERR("Worng parameter cache_clean_period - need a postive value\n");
-		return -1;
-	}
-
 	/* register timer to delete the expired entries */
 	register_timer(localcache_clean, 0, cache_clean_period);
 
@@ -140,43 +149,5 @@ static void destroy(void)
 
 void localcache_clean(unsigned int ticks,void *param)
 {
-	int i;
-	lcache_entry_t* me1, *me2;
-
-	LM_DBG("start\n");
-	for(i = 0; i< cache_htable_size; i++)
-	{
-		lock_get(&cache_htable[i].lock);
-		me1 = cache_htable[i].entries;
-		me2 = NULL;
-
-		while(me1)
-		{
-			if((me1->expires > 0) && (me1->expires < get_ticks()))
-			{
-				LM_DBG("deleted entry attr= [%.*s]\n", 
-						me1->attr.len, me1->attr.s);
-
-				if(me2)
-				{
-					me2->next = me1->next;
-					shm_free(me1);
-					me1 = me2->next;
-				}
-				else
-				{
-					cache_htable[i].entries = me1->next;
-					shm_free(me1);
-					me1 = cache_htable[i].entries;
-				}
-			}
-			else
-			{
-				me2 = me1;
-				me1 = me1->next;
-			}
-		}
-
-		lock_release(&cache_htable[i].lock);
-	}
+	lcache_htable_clean(ticks);
 }
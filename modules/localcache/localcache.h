@@ -34,5 +34,8 @@
 
 extern lcache_t* cache_htable;
 extern int cache_htable_size;
+extern int cache_clean_period;
+extern unsigned long cache_max_memory;
+extern unsigned long *cache_memory;
 
 #endif
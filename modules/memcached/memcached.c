@@ -24,6 +24,7 @@
  * History:
  * ---------
  *  2009-07-15  first version (andreidragus)
+ *  2011-06-24  counters, with incr/decr
  */
 
 #include <stdio.h>
@@ -169,6 +170,70 @@ int wrap_memcached_get(str* attr, str* res,void * memc)
 }
 
 
+/*
+ * memcached counters are unsigned - a decrement stops at 0
+ * the expiration time is set only when the counter is created
+ */
+static int wrap_memcached_counter(str* attr, int val, unsigned int expires,
+				int* new_val, memcached_st* memc)
+{
+	memcached_return  rc;
+	uint64_t ret;
+	int i;
+	str init;
+
+	/* if missing, try to create it - then retry if somebody else did */
+	for(i = 0; i < 2; i++)
+	{
+		if(val >= 0)
+			rc = memcached_increment(memc, attr->s, attr->len,
+					(uint32_t)val, &ret);
+		else
+			rc = memcached_decrement(memc, attr->s, attr->len,
+					(uint32_t)(-val), &ret);
+
+		if(rc == MEMCACHED_SUCCESS)
+		{
+			if(new_val)
+				*new_val = (int)ret;
+			return 1;
+		}
+		if(rc != MEMCACHED_NOTFOUND)
+			goto error;
+
+		init.s = int2str((unsigned long)(val >= 0 ? val : 0), &init.len);
+		rc = memcached_add(memc, attr->s, attr->len, init.s, init.len,
+				(time_t)expires, (uint32_t)0);
+		if(rc == MEMCACHED_SUCCESS)
+		{
+			if(new_val)
+				*new_val = (val >= 0 ? val : 0);
+			return 1;
+		}
+		if(rc != MEMCACHED_NOTSTORED)
+			goto error;
+	}
+
+error:
+	LM_ERR("Failed to update counter: %s\n",memcached_strerror(memc,rc));
+	return -1;
+}
+
+int wrap_memcached_add(str* attr, int val, unsigned int expires,
+				int* new_val, void * memc)
+{
+	return wrap_memcached_counter(attr, val, expires, new_val,
+			(memcached_st*)memc);
+}
+
+int wrap_memcached_sub(str* attr, int val, unsigned int expires,
+				int* new_val, void * memc)
+{
+	return wrap_memcached_counter(attr, -val, expires, new_val,
+			(memcached_st*)memc);
+}
+
+
 /*
  * Parse method for parameters.
  * Parameters should be in the form:
@@ -331,6 +396,8 @@ static int mod_init(void)
 		ms.store = wrap_memcached_insert;
 		ms.remove = wrap_memcached_remove;
 		ms.fetch = wrap_memcached_get;
+		ms.add = wrap_memcached_add;
+		ms.sub = wrap_memcached_sub;
 		ms.data = cur->memc;
 
 		if( register_memcache(&ms)< 0)
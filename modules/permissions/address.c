@@ -273,6 +273,10 @@ int reload_address_table(void)
 
 	perm_dbf.free_result(db_handle, res);
 
+	/* index the subnets; if it fails, they are still usable (scanned) */
+	if (subnet_trie && subnet_table_index(new_subnet_table) < 0)
+		LM_WARN("subnet lookups will scan the whole table\n");
+
 	*hash_table = new_hash_table;
 	*subnet_table = new_subnet_table;
 	LM_DBG("address table reloaded successfully.\n");
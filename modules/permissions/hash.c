@@ -281,6 +281,7 @@ struct subnet* new_subnet_table(void)
     }
 
     ptr[PERM_MAX_SUBNETS].grp = 0;
+    ptr[PERM_MAX_SUBNETS].trie = 0;
     return ptr;
 }
 
@@ -356,6 +357,87 @@ int subnet_table_insert(struct subnet* table, unsigned int grp,
 }
 
 
+/*
+ * Build the longest prefix match index of the subnet table
+ */
+int subnet_table_index(struct subnet* table)
+{
+	table[PERM_MAX_SUBNETS].trie = build_subnet_trie(table,
+		table[PERM_MAX_SUBNETS].grp);
+
+	if (!table[PERM_MAX_SUBNETS].trie) {
+		LM_ERR("failed to build subnet trie\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * Set the info pvar, if any, to the info of a matching record
+ */
+static inline int set_subnet_info(struct sip_msg *msg, struct subnet *rec,
+			char *info)
+{
+	pv_value_t pvt;
+	pv_spec_t *pvs;
+
+	if (info) {
+		pvs = (pv_spec_t *)info;
+		memset(&pvt, 0, sizeof(pv_value_t));
+		pvt.flags = PV_VAL_STR;
+		pvt.rs.s = rec->info;
+		pvt.rs.len = rec->info ? strlen(rec->info) : 0;
+
+		if (pv_set_value(msg, pvs, (int)EQ_T, &pvt) < 0) {
+			LM_ERR("setting of avp failed\n");
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+
+/*
+ * Lookup in the trie: records of longer prefixes first, and in table
+ * (group) order for the same prefix
+ */
+static int match_subnet_trie(struct sip_msg *msg, struct subnet* table,
+			unsigned int grp, struct ip_addr *ip, unsigned int port, int proto,
+			char *pattern, char *info)
+{
+	struct subnet_node *path[SUBNET_TRIE_MAX_PATH];
+	struct subnet_entry *entry;
+	struct subnet *rec;
+	int n;
+
+	n = subnet_trie_path(table[PERM_MAX_SUBNETS].trie, ip, path);
+
+	while (n-- > 0) {
+		for (entry = path[n]->entries; entry; entry = entry->next) {
+			rec = &table[entry->idx];
+
+			if ((rec->grp == grp || rec->grp == GROUP_ANY
+					|| grp == GROUP_ANY) &&
+				(rec->port == port || rec->port == PORT_ANY
+					|| port == PORT_ANY) &&
+				(rec->proto == proto || rec->proto == PROTO_NONE
+					|| proto == PROTO_NONE) &&
+				!(rec->pattern && pattern &&
+					fnmatch(rec->pattern, pattern, FNM_PERIOD))) {
+
+				LM_DBG("match found in the subnet trie\n");
+				return set_subnet_info(msg, rec, info);
+			}
+		}
+	}
+
+	LM_DBG("no match in the subnet trie\n");
+	return -1;
+}
+
+
 /*
  * Check if an entry exists in subnet table that matches given group, ip_addr,
  * and port.  Port 0 in subnet table matches any port.
@@ -365,8 +447,6 @@ int match_subnet_table(struct sip_msg *msg, struct subnet* table, unsigned int g
 			char *pattern, char *info)
 {
    unsigned int count, i;
-	pv_value_t pvt;
-	pv_spec_t *pvs;
 	int match_res;
 
     count = table[PERM_MAX_SUBNETS].grp;
@@ -376,6 +456,10 @@ int match_subnet_table(struct sip_msg *msg, struct subnet* table, unsigned int g
 		return -1;
 	}
 
+	if (table[PERM_MAX_SUBNETS].trie)
+		return match_subnet_trie(msg, table, grp, ip, port, proto,
+			pattern, info);
+
 	i = 0;
 	do {
 		if ((table[i].grp == grp || table[i].grp == GROUP_ANY
@@ -402,21 +486,8 @@ int match_subnet_table(struct sip_msg *msg, struct subnet* table, unsigned int g
 					}
 				}
 
-				if (info) {
-					pvs = (pv_spec_t *)info;
-					memset(&pvt, 0, sizeof(pv_value_t));
-					pvt.flags = PV_VAL_STR;
-					pvt.rs.s = table[i].info;
-					pvt.rs.len = table[i].info ? strlen(table[i].info) : 0;
-
-					if (pv_set_value(msg, pvs, (int)EQ_T, &pvt) < 0) {
-						LM_ERR("setting of avp failed\n");
-						return -1;
-	    			}
-				}
-
 				LM_DBG("match found in the subnet table\n");
-				return 1;
+				return set_subnet_info(msg, &table[i], info);
 			}
 
 		if (table[i].grp > grp && grp != GROUP_ANY)
@@ -460,10 +531,24 @@ int subnet_table_mi_print(struct subnet* table, struct mi_node* rpl)
 int find_group_in_subnet_table(struct subnet* table,
 		                   struct ip_addr *ip, unsigned int port)
 {
+	struct subnet_node *path[SUBNET_TRIE_MAX_PATH];
+	struct subnet_entry *entry;
 	unsigned int count, i, match_res;
+	int n;
 
 	count = table[PERM_MAX_SUBNETS].grp;
 
+	if (table[PERM_MAX_SUBNETS].trie) {
+		/* group of the longest matching prefix */
+		n = subnet_trie_path(table[PERM_MAX_SUBNETS].trie, ip, path);
+		while (n-- > 0)
+			for (entry = path[n]->entries; entry; entry = entry->next)
+				if (table[entry->idx].port == port
+						|| table[entry->idx].port == 0)
+					return table[entry->idx].grp;
+		return -1;
+	}
+
 	i = 0;
 	while (i < count) {
 		if	(table[i].port == port || table[i].port == 0) {
@@ -497,6 +582,8 @@ void empty_subnet_table(struct subnet *table)
 		shm_free(table[i].subnet);
 	}
 
+	free_subnet_trie(table[PERM_MAX_SUBNETS].trie);
+	table[PERM_MAX_SUBNETS].trie = 0;
 	table[PERM_MAX_SUBNETS].grp = 0;
 }
 
@@ -34,6 +34,7 @@
 #include "../../parser/msg_parser.h"
 #include "../../parser/parse_from.h"
 #include "../../usr_avp.h"
+#include "subnet_trie.h"
 
 #define PERM_HASH_SIZE 128
 
@@ -102,7 +103,7 @@ int find_group_in_hash_table(struct address_list** table,
 
 
 
-#define PERM_MAX_SUBNETS 128 
+#define PERM_MAX_SUBNETS 1024
 
 /*
  * Structure used to store a subnet
@@ -114,6 +115,7 @@ struct subnet {
 	char *pattern;              /* Pattern matching From header field */
 	unsigned int port;       /* port or 0 */
 	char *info;				 /* extra information */
+	struct subnet_trie *trie;	 /* lookup index, in last record */
 };
 
 
@@ -140,6 +142,12 @@ int match_subnet_table(struct sip_msg *msg, struct subnet* table,
 int find_group_in_subnet_table(struct subnet* table,
 		struct ip_addr *ip, unsigned int port);
 
+/*
+ * Build the longest prefix match index of the subnet table; without it,
+ * the lookups scan the whole table
+ */
+int subnet_table_index(struct subnet* table);
+
 /* 
  * Empty contents of subnet table
  */
@@ -78,6 +78,11 @@ str id_col = str_init("id");				/* Name of id column */
  */
 static int check_all_branches = 1;
 
+/*
+ * By default the subnets are looked up via the prefix trie
+ */
+int subnet_trie = 1;
+
 /*
  * Convert the name of the files into table index
  */
@@ -172,6 +177,7 @@ static param_export_t params[] = {
 	{"grp_col",            STR_PARAM, &grp_col.s         },
 	{"mask_col",           STR_PARAM, &mask_col.s        },
 	{"port_col",           STR_PARAM, &port_col.s        },
+	{"subnet_trie",        INT_PARAM, &subnet_trie       },
 	{0, 0, 0}
 };
 
@@ -59,6 +59,7 @@ extern str grp_col;       /* Name of address group column */
 extern str mask_col;      /* Name of mask column */
 extern str port_col;      /* Name of port column */
 extern str id_col;        /* Name of id column */
+extern int subnet_trie;   /* Look subnets up via the prefix trie */
 
 typedef struct int_or_pvar {
     unsigned int i;
@@ -0,0 +1,260 @@
+/*
+ * $Id: $
+ *
+ * Longest prefix match index for the subnet table
+ *
+ * Copyright (C) 2011 Voice System
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The subnets are kept in a path compressed binary trie (one per address
+ * family), so a lookup visits at most one node per prefix length instead
+ * of checking all the records of the table. The trie is built once, when
+ * the table is loaded, and it is read-only afterwards.
+ */
+
+#include <string.h>
+
+#include "../../mem/shm_mem.h"
+#include "../../dprint.h"
+#include "hash.h"
+#include "subnet_trie.h"
+
+#define key_bit(_key, _bit) \
+	(((_key)[(_bit)>>3] >> (7 - ((_bit)&7))) & 1)
+
+
+/*
+ * Number of leading bits (up to max) which are the same in a and b
+ */
+static inline unsigned int common_bits(unsigned char *a, unsigned char *b,
+		unsigned int max)
+{
+	unsigned int n;
+	unsigned char x;
+
+	for (n = 0; n < max; n += 8) {
+		x = a[n>>3] ^ b[n>>3];
+		if (x) {
+			while (!(x & 0x80)) {
+				x <<= 1;
+				n++;
+			}
+			return (n < max) ? n : max;
+		}
+	}
+
+	return max;
+}
+
+
+static struct subnet_node* new_subnet_node(unsigned char *key,
+		unsigned int bitlen)
+{
+	struct subnet_node *node;
+
+	node = (struct subnet_node*)shm_malloc(sizeof(struct subnet_node));
+	if (!node) {
+		LM_ERR("no shm memory for subnet trie node\n");
+		return 0;
+	}
+	memset(node, 0, sizeof(struct subnet_node));
+
+	memcpy(node->key, key, (bitlen + 7) / 8);
+	if (bitlen % 8)
+		node->key[bitlen/8] &= ~((1 << (8 - bitlen%8)) - 1);
+	node->bitlen = bitlen;
+
+	return node;
+}
+
+
+/*
+ * Return the node for the <key, bitlen> prefix, adding it if needed
+ */
+static struct subnet_node* subnet_trie_insert(struct subnet_node **p,
+		unsigned char *key, unsigned int bitlen)
+{
+	struct subnet_node *node, *new_node, *fork;
+	unsigned int common;
+
+	for (;;) {
+		node = *p;
+		if (!node)
+			return (*p = new_subnet_node(key, bitlen));
+
+		common = common_bits(key, node->key,
+			(bitlen < node->bitlen) ? bitlen : node->bitlen);
+
+		if (common == node->bitlen) {
+			if (common == bitlen)
+				return node;
+			/* node is a prefix of key -> go down */
+			p = &node->child[key_bit(key, node->bitlen)];
+			continue;
+		}
+
+		new_node = new_subnet_node(key, bitlen);
+		if (!new_node)
+			return 0;
+
+		if (common == bitlen) {
+			/* key is a prefix of node -> insert above */
+			new_node->child[key_bit(node->key, bitlen)] = node;
+			*p = new_node;
+			return new_node;
+		}
+
+		/* key and node diverge -> fork them */
+		fork = new_subnet_node(key, common);
+		if (!fork) {
+			shm_free(new_node);
+			return 0;
+		}
+		fork->child[key_bit(key, common)] = new_node;
+		fork->child[key_bit(node->key, common)] = node;
+		*p = fork;
+		return new_node;
+	}
+}
+
+
+static void free_subnet_node(struct subnet_node *node)
+{
+	struct subnet_entry *entry;
+
+	if (!node)
+		return;
+
+	free_subnet_node(node->child[0]);
+	free_subnet_node(node->child[1]);
+
+	while (node->entries) {
+		entry = node->entries;
+		node->entries = entry->next;
+		shm_free(entry);
+	}
+	shm_free(node);
+}
+
+
+/*
+ * Build the trie indexing the records of a subnet table
+ */
+struct subnet_trie* build_subnet_trie(struct subnet *table,
+		unsigned int count)
+{
+	struct subnet_trie *trie;
+	struct subnet_node *node;
+	struct subnet_entry *entry, **last;
+	struct net *net;
+	unsigned char key[16];
+	unsigned char m;
+	unsigned int i, j, bitlen;
+
+	trie = (struct subnet_trie*)shm_malloc(sizeof(struct subnet_trie));
+	if (!trie) {
+		LM_ERR("no shm memory for subnet trie\n");
+		return 0;
+	}
+	memset(trie, 0, sizeof(struct subnet_trie));
+
+	for (i = 0; i < count; i++) {
+		net = table[i].subnet;
+		if (!net)
+			continue;
+
+		/* prefix length and masked address */
+		bitlen = 0;
+		for (j = 0; j < net->mask.len; j++) {
+			key[j] = net->ip.u.addr[j] & net->mask.u.addr[j];
+			/* leading ones of the mask */
+			if (bitlen == j*8)
+				for (m = net->mask.u.addr[j]; m & 0x80; m <<= 1)
+					bitlen++;
+		}
+
+		node = subnet_trie_insert(
+			&trie->root[(net->ip.af == AF_INET6) ? 1 : 0], key, bitlen);
+		if (!node)
+			goto error;
+
+		entry = (struct subnet_entry*)shm_malloc(sizeof(struct subnet_entry));
+		if (!entry) {
+			LM_ERR("no shm memory for subnet trie entry\n");
+			goto error;
+		}
+		entry->idx = i;
+		entry->next = 0;
+
+		/* keep the table order */
+		for (last = &node->entries; *last; last = &(*last)->next);
+		*last = entry;
+	}
+
+	return trie;
+error:
+	free_subnet_trie(trie);
+	return 0;
+}
+
+
+/*
+ * Release memory allocated for a trie
+ */
+void free_subnet_trie(struct subnet_trie *trie)
+{
+	if (!trie)
+		return;
+
+	free_subnet_node(trie->root[0]);
+	free_subnet_node(trie->root[1]);
+	shm_free(trie);
+}
+
+
+/*
+ * Fill path with the nodes having entries whose prefix covers ip, from
+ * the shortest prefix to the longest one; returns the number of nodes
+ */
+int subnet_trie_path(struct subnet_trie *trie, struct ip_addr *ip,
+		struct subnet_node **path)
+{
+	struct subnet_node *node;
+	unsigned int bits;
+	int n;
+
+	n = 0;
+	bits = ip->len * 8;
+
+	for (node = trie->root[(ip->af == AF_INET6) ? 1 : 0]; node; ) {
+		if (node->bitlen > bits ||
+				common_bits(ip->u.addr, node->key, node->bitlen) < node->bitlen)
+			break;
+
+		if (node->entries)
+			path[n++] = node;
+
+		if (node->bitlen == bits)
+			break;
+		node = node->child[key_bit(ip->u.addr, node->bitlen)];
+	}
+
+	return n;
+}
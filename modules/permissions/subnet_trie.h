@@ -0,0 +1,80 @@
+/*
+ * $Id: $
+ *
+ * Longest prefix match index for the subnet table
+ *
+ * Copyright (C) 2011 Voice System
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef PERM_SUBNET_TRIE_H
+#define PERM_SUBNET_TRIE_H
+
+#include "../../ip_addr.h"
+
+/* max depth of a lookup: one node per prefix length (IPv6) plus root */
+#define SUBNET_TRIE_MAX_PATH 129
+
+struct subnet;
+
+/*
+ * Subnet table records having the same prefix, in table order
+ */
+struct subnet_entry {
+	unsigned int idx;            /* index in the subnet table */
+	struct subnet_entry *next;
+};
+
+/*
+ * Node of a path compressed binary trie; nodes without entries
+ * are only forks of the trie
+ */
+struct subnet_node {
+	unsigned char key[16];       /* prefix, bits after bitlen are 0 */
+	unsigned int bitlen;         /* prefix length */
+	struct subnet_entry *entries;
+	struct subnet_node *child[2];
+};
+
+struct subnet_trie {
+	struct subnet_node *root[2]; /* IPv4 and IPv6 */
+};
+
+
+/*
+ * Build the trie indexing the records of a subnet table
+ */
+struct subnet_trie* build_subnet_trie(struct subnet *table,
+		unsigned int count);
+
+
+/*
+ * Release memory allocated for a trie
+ */
+void free_subnet_trie(struct subnet_trie *trie);
+
+
+/*
+ * Fill path with the nodes having entries whose prefix covers ip, from
+ * the shortest prefix to the longest one; returns the number of nodes
+ */
+int subnet_trie_path(struct subnet_trie *trie, struct ip_addr *ip,
+		struct subnet_node **path);
+
+
+#endif /* PERM_SUBNET_TRIE_H */
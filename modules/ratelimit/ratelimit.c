@@ -27,6 +27,7 @@
  *
  * 2008-01-10 ported from SER project (osas)
  * 2008-01-16 ported enhancements from openims project (osas) 
+ * 2011-06-27 pipes created on demand, by key
  */
 
 #include <stdio.h>
@@ -47,6 +48,7 @@
 #include "../../data_lump_rpl.h"
 #include "../../socket_info.h"
 #include "../signaling/signaling.h"
+#include "rl_pipe.h"
 
 
 
@@ -76,19 +78,6 @@ typedef struct str_map {
 static int str_map_str(const str_map_t * map, const str * key, int * ret);
 static int str_map_int(const str_map_t * map, int key, str * ret);
 
-/* PIPE_ALGO_FEEDBACK holds cpu usage to a fixed value using 
- * negative feedback according to the PID controller model
- *
- * <http://en.wikipedia.org/wiki/PID_controller>
- */
-enum {
-	PIPE_ALGO_NOP = 0,
-	PIPE_ALGO_RED,
-	PIPE_ALGO_TAILDROP,
-	PIPE_ALGO_FEEDBACK,
-	PIPE_ALGO_NETWORK
-};
-
 str_map_t algo_names[] = {
 	{str_init("NOP"),	PIPE_ALGO_NOP},
 	{str_init("RED"),	PIPE_ALGO_RED},
@@ -173,6 +162,8 @@ static  str * rl_dbg_str = NULL;
 
 /* these only change in the mod_init() process -- no locking needed */
 static int timer_interval = RL_TIMER_INTERVAL;
+static int key_hash_size = 4096;
+static int key_expire = 300;
 static int cfg_setpoint;        /* desired load, used when reading modparams */
 /* === */
 
@@ -207,6 +198,8 @@ static int w_rl_check_forced_pipe(struct sip_msg*, char *, char *);
 static int w_rl_drop_default(struct sip_msg*, char *, char *);
 static int w_rl_drop_forced(struct sip_msg*, char *, char *);
 static int w_rl_drop(struct sip_msg*, char *, char *);
+static int w_rl_check_key(struct sip_msg*, char *, char *, char *);
+static int fixup_rl_check_key(void **, int);
 static int add_queue_params(modparam_t, void *);
 static int add_pipe_params(modparam_t, void *);
 static void set_check_network_load(void);
@@ -223,6 +216,8 @@ static cmd_export_t cmds[]={
 	{"rl_drop",       (cmd_function)w_rl_drop_default,      0, 0,               0,               REQUEST_ROUTE|LOCAL_ROUTE},
 	{"rl_drop",       (cmd_function)w_rl_drop_forced,       1, fixup_uint_null, 0,               REQUEST_ROUTE|LOCAL_ROUTE},
 	{"rl_drop",       (cmd_function)w_rl_drop,              2, fixup_uint_uint, 0,               REQUEST_ROUTE|LOCAL_ROUTE},
+	{"rl_check_key",  (cmd_function)w_rl_check_key,         2, fixup_rl_check_key, 0,            REQUEST_ROUTE|LOCAL_ROUTE},
+	{"rl_check_key",  (cmd_function)w_rl_check_key,         3, fixup_rl_check_key, 0,            REQUEST_ROUTE|LOCAL_ROUTE},
 	{0,0,0,0,0,0}
 };
 static param_export_t params[]={
@@ -231,6 +226,8 @@ static param_export_t params[]={
 	{"pipe",           STR_PARAM|USE_FUNC_PARAM, (void *)add_pipe_params},
 	{"reply_code",     INT_PARAM,                &rl_drop_code},
 	{"reply_reason",   STR_PARAM,                &rl_drop_reason.s},
+	{"key_hash_size",  INT_PARAM,                &key_hash_size},
+	{"key_expire",     INT_PARAM,                &key_expire},
 	/* RESERVED for future use
 	{"load_source",    STR_PARAM|USE_FUNC_PARAM, (void *)set_load_source},
 	*/
@@ -246,6 +243,7 @@ struct mi_root* mi_set_pid(struct mi_root* cmd_tree, void* param);
 struct mi_root* mi_get_pid(struct mi_root* cmd_tree, void* param);
 struct mi_root* mi_push_load(struct mi_root* cmd_tree, void* param);
 struct mi_root* mi_set_dbg(struct mi_root* cmd_tree, void* param);
+struct mi_root* mi_get_keys(struct mi_root* cmd_tree, void* param);
 
 static mi_export_t mi_cmds [] = {
 	{"rl_stats",      mi_stats,      MI_NO_INPUT_FLAG, 0, 0},
@@ -257,6 +255,7 @@ static mi_export_t mi_cmds [] = {
 	{"rl_get_pid",    mi_get_pid,    MI_NO_INPUT_FLAG, 0, 0},
 	{"rl_push_load",  mi_push_load,  0,                0, 0},
 	{"rl_set_dbg",    mi_set_dbg,    0,                0, 0},
+	{"rl_get_keys",   mi_get_keys,   0,                0, 0},
 	{0,0,0,0,0}
 };
 
@@ -591,6 +590,15 @@ static int mod_init(void)
 
 	rl_drop_reason.len = strlen(rl_drop_reason.s);
 
+	if (key_hash_size <= 0 || key_expire <= 0) {
+		LM_ERR("key_hash_size and key_expire must be positive\n");
+		return -1;
+	}
+	if (rl_htable_init(key_hash_size, key_expire, timer_interval) < 0) {
+		LM_ERR("failed to init the hash table of the key pipes\n");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -705,6 +713,8 @@ void destroy(void)
 		lock_destroy(rl_lock);
 		lock_dealloc((void *)rl_lock);
 	}
+
+	rl_htable_destroy();
 }
 
 
@@ -960,6 +970,59 @@ static int w_rl_check_default(struct sip_msg* msg, char *p1, char *p2)
 	return rl_check(msg, -1);
 }
 
+/**
+ * key, limit and, optional, algorithm (TAILDROP by default)
+ */
+static int fixup_rl_check_key(void ** param, int param_no)
+{
+	str algo_str;
+	int algo;
+
+	switch (param_no) {
+		case 1:
+			return fixup_spve(param);
+		case 2:
+			return fixup_igp(param);
+		case 3:
+			algo_str.s = (char *)*param;
+			algo_str.len = strlen(algo_str.s);
+			if (str_map_str(algo_names, &algo_str, &algo)) {
+				LM_ERR("unknown algorithm: %s\n", algo_str.s);
+				return E_CFG;
+			}
+			if (algo != PIPE_ALGO_TAILDROP && algo != PIPE_ALGO_RED &&
+			algo != PIPE_ALGO_NETWORK) {
+				LM_ERR("algorithm %s not supported for key pipes\n",
+					algo_str.s);
+				return E_CFG;
+			}
+			pkg_free(*param);
+			*param = (void *)(long)algo;
+			return 0;
+	}
+
+	return 0;
+}
+
+static int w_rl_check_key(struct sip_msg* msg, char *p1, char *p2, char *p3)
+{
+	str key;
+	int limit;
+
+	if (fixup_get_svalue(msg, (gparam_p)p1, &key) != 0 || key.len == 0) {
+		LM_ERR("invalid key => accepting the request\n");
+		return 1;
+	}
+	if (fixup_get_ivalue(msg, (gparam_p)p2, &limit) != 0 || limit < 0) {
+		LM_ERR("invalid limit for key %.*s => accepting the request\n",
+			key.len, key.s);
+		return 1;
+	}
+
+	return rl_htable_push(&key,
+		p3 ? (int)(long)p3 : PIPE_ALGO_TAILDROP, limit);
+}
+
 /* RESERVED for future use
 static int set_load_source(modparam_t type, void * val)
 {
@@ -1156,6 +1219,7 @@ static void set_check_network_load(void) {
 /* timer housekeeping, invoked each timer interval to reset counters */
 static void rl_timer(unsigned int ticks, void *param)
 {
+	static int key_network_pipes = 0;
 	int i, len;
 	char *c, *p;
 
@@ -1166,7 +1230,7 @@ static void rl_timer(unsigned int ticks, void *param)
 			break;
 	}
 
-	if (*check_network_load) {
+	if (*check_network_load || key_network_pipes) {
 		*network_load_value = get_total_bytes_waiting(PROTO_NONE);
 	}
 
@@ -1197,6 +1261,9 @@ static void rl_timer(unsigned int ticks, void *param)
 		*pipes[i].counter = 0;
 	}
 	LOCK_RELEASE(rl_lock);
+
+	/* the key pipes have their own locks */
+	key_network_pipes = rl_htable_timer(ticks, *network_load_value);
 }
 
 
@@ -1587,3 +1654,73 @@ bad_syntax:
 	return init_mi_tree( 400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
 }
 
+#define RL_MAX_TOP_KEYS 1000
+
+struct mi_root* mi_get_keys(struct mi_root* cmd_tree, void* param)
+{
+	struct mi_root *rpl_tree;
+	struct mi_node *node=NULL, *rpl=NULL;
+	struct mi_attr* attr;
+	rl_key_stat_t* top;
+	unsigned int n = 10;
+	str algo;
+	char* p;
+	int i, nr, len;
+
+	node = cmd_tree->node.kids;
+	if (node) {
+		if ( !node->value.s || !node->value.len ||
+		strno2int(&node->value,&n)<0 || n == 0 || n > RL_MAX_TOP_KEYS)
+			return init_mi_tree( 400, MI_BAD_PARM_S, MI_BAD_PARM_LEN);
+	}
+
+	top = (rl_key_stat_t*)pkg_malloc(n * sizeof(rl_key_stat_t));
+	if (top == NULL) {
+		LM_ERR("no more pkg memory\n");
+		return 0;
+	}
+	nr = rl_htable_top(top, n);
+	if (nr < 0) {
+		pkg_free(top);
+		return 0;
+	}
+
+	rpl_tree = init_mi_tree( 200, MI_OK_S, MI_OK_LEN);
+	if (rpl_tree==0)
+		goto done;
+	rpl = &rpl_tree->node;
+
+	for (i=0; i<nr; i++) {
+		node = add_mi_node_child(rpl, MI_DUP_VALUE, "KEY", 3,
+			top[i].key.s, top[i].key.len);
+		if(node == NULL)
+			goto error;
+
+		if (str_map_int(algo_names, top[i].algo, &algo))
+			goto error;
+		attr = add_mi_attr(node, 0, "algorithm", 9, algo.s, algo.len);
+		if(attr == NULL)
+			goto error;
+
+		p = int2str((unsigned long)(top[i].limit), &len);
+		attr = add_mi_attr(node, MI_DUP_VALUE, "limit", 5, p, len);
+		if(attr == NULL)
+			goto error;
+
+		p = int2str((unsigned long)(top[i].counter), &len);
+		attr = add_mi_attr(node, MI_DUP_VALUE, "counter", 7, p, len);
+		if(attr == NULL)
+			goto error;
+	}
+	goto done;
+
+error:
+	LM_ERR("Unable to create reply\n");
+	free_mi_tree(rpl_tree);
+	rpl_tree = 0;
+done:
+	for (i=0; i<nr; i++)
+		pkg_free(top[i].key.s);
+	pkg_free(top);
+	return rpl_tree;
+}
@@ -0,0 +1,278 @@
+/*
+ * $Id$
+ *
+ * ratelimit module - pipes created on demand, by key
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-06-27  first version
+ */
+
+/*
+ * The pipes of the keys are kept in a shm hash table, each bucket with
+ * its own lock, so the checks of different keys do not wait for each
+ * other (nor for the static pipes, behind rl_lock). A pipe is created by
+ * the first check of its key and deleted by the timer after it was not
+ * used for rl_key_expire seconds.
+ */
+
+#include <string.h>
+
+#include "../../dprint.h"
+#include "../../hash_func.h"
+#include "../../timer.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "rl_pipe.h"
+
+
+static rl_key_bucket_t* rl_htable = NULL;
+static unsigned int rl_htable_size = 0;
+static unsigned int rl_key_expire = 0;
+static int rl_interval = 0;
+
+
+int rl_htable_init(unsigned int size, unsigned int expire, int interval)
+{
+	unsigned int i;
+
+	/* power of 2, for masking */
+	for (rl_htable_size = 1; rl_htable_size < size; rl_htable_size <<= 1);
+
+	rl_htable = (rl_key_bucket_t*)shm_malloc(rl_htable_size *
+		sizeof(rl_key_bucket_t));
+	if (rl_htable == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(rl_htable, 0, rl_htable_size * sizeof(rl_key_bucket_t));
+
+	for (i = 0; i < rl_htable_size; i++) {
+		if (lock_init(&rl_htable[i].lock) == 0) {
+			LM_ERR("failed to init lock %u\n", i);
+			for (; i > 0; i--)
+				lock_destroy(&rl_htable[i-1].lock);
+			shm_free(rl_htable);
+			rl_htable = NULL;
+			return -1;
+		}
+	}
+
+	rl_key_expire = expire;
+	rl_interval = interval;
+
+	return 0;
+}
+
+void rl_htable_destroy(void)
+{
+	rl_key_pipe_t *p, *next;
+	unsigned int i;
+
+	if (rl_htable == NULL)
+		return;
+
+	for (i = 0; i < rl_htable_size; i++) {
+		for (p = rl_htable[i].pipes; p; p = next) {
+			next = p->next;
+			shm_free(p);
+		}
+		lock_destroy(&rl_htable[i].lock);
+	}
+	shm_free(rl_htable);
+	rl_htable = NULL;
+}
+
+static rl_key_pipe_t* rl_key_pipe_new(str* key, int algo, int limit)
+{
+	rl_key_pipe_t* p;
+
+	p = (rl_key_pipe_t*)shm_malloc(sizeof(rl_key_pipe_t) + key->len);
+	if (p == NULL) {
+		LM_ERR("no more shm memory\n");
+		return NULL;
+	}
+	memset(p, 0, sizeof(rl_key_pipe_t));
+
+	p->key.s = (char*)(p + 1);
+	memcpy(p->key.s, key->s, key->len);
+	p->key.len = key->len;
+	p->algo = algo;
+	p->limit = limit;
+	/* accept until the network load is first checked */
+	p->load = (algo == PIPE_ALGO_NETWORK) ? -1 : 0;
+
+	return p;
+}
+
+int rl_htable_push(str* key, int algo, int limit)
+{
+	rl_key_bucket_t* b;
+	rl_key_pipe_t* p;
+	int ret;
+
+	b = &rl_htable[core_hash(key, NULL, rl_htable_size)];
+
+	lock_get(&b->lock);
+
+	for (p = b->pipes; p; p = p->next)
+		if (p->key.len == key->len && memcmp(p->key.s, key->s, key->len) == 0)
+			break;
+
+	if (p == NULL) {
+		p = rl_key_pipe_new(key, algo, limit);
+		if (p == NULL) {
+			lock_release(&b->lock);
+			/* do not drop because of a local problem */
+			return 1;
+		}
+		p->next = b->pipes;
+		b->pipes = p;
+	} else if (p->algo != algo) {
+		p->algo = algo;
+		p->load = (algo == PIPE_ALGO_NETWORK) ? -1 : 0;
+	}
+	/* the limit may come from a per account setting that changed */
+	p->limit = limit;
+
+	p->counter++;
+	p->last_used = get_ticks();
+
+	switch (p->algo) {
+		case PIPE_ALGO_TAILDROP:
+			ret = (p->counter <= p->limit * rl_interval) ? 1 : -1;
+			break;
+		case PIPE_ALGO_RED:
+			if (p->load == 0)
+				ret = 1;
+			else
+				ret = (! (p->counter % p->load)) ? 1 : -1;
+			break;
+		case PIPE_ALGO_NETWORK:
+			ret = -1 * p->load;
+			break;
+		default:
+			LM_ERR("unsupported algorithm %d for key pipes\n", p->algo);
+			ret = 1;
+	}
+
+	LM_DBG("key=%.*s algo=%d limit=%d load=%d counter=%d => %s\n",
+		key->len, key->s, p->algo, p->limit, p->load, p->counter,
+		(ret == 1) ? "ACCEPT" : "DROP");
+
+	lock_release(&b->lock);
+
+	return ret;
+}
+
+int rl_htable_timer(unsigned int ticks, int network_load)
+{
+	rl_key_bucket_t* b;
+	rl_key_pipe_t *p, **prev;
+	unsigned int i;
+	int network;
+
+	if (rl_htable == NULL)
+		return 0;
+
+	network = 0;
+	for (i = 0; i < rl_htable_size; i++) {
+		b = &rl_htable[i];
+		/* nothing to do and nothing to wait for */
+		if (b->pipes == NULL)
+			continue;
+
+		lock_get(&b->lock);
+		for (prev = &b->pipes; (p = *prev) != NULL; ) {
+			if (p->counter == 0 && p->last_used + rl_key_expire < ticks) {
+				LM_DBG("pipe of key %.*s expired\n", p->key.len, p->key.s);
+				*prev = p->next;
+				shm_free(p);
+				continue;
+			}
+
+			if (p->algo == PIPE_ALGO_NETWORK) {
+				p->load = (network_load > p->limit) ? 1 : -1;
+				network++;
+			} else if (p->limit && rl_interval) {
+				p->load = p->counter / (p->limit * rl_interval);
+			}
+			p->last_counter = p->counter;
+			p->counter = 0;
+
+			prev = &p->next;
+		}
+		lock_release(&b->lock);
+	}
+
+	return network;
+}
+
+int rl_htable_top(rl_key_stat_t* top, unsigned int n)
+{
+	rl_key_bucket_t* b;
+	rl_key_pipe_t* p;
+	unsigned int i, j, nr;
+	char* s;
+
+	if (rl_htable == NULL || n == 0)
+		return 0;
+
+	/* sorted by counter, highest first */
+	nr = 0;
+	for (i = 0; i < rl_htable_size; i++) {
+		b = &rl_htable[i];
+		if (b->pipes == NULL)
+			continue;
+
+		lock_get(&b->lock);
+		for (p = b->pipes; p; p = p->next) {
+			if (nr == n && p->last_counter <= top[n-1].counter)
+				continue;
+
+			s = (char*)pkg_malloc(p->key.len);
+			if (s == NULL) {
+				LM_ERR("no more pkg memory\n");
+				lock_release(&b->lock);
+				goto error;
+			}
+			memcpy(s, p->key.s, p->key.len);
+
+			if (nr == n)
+				pkg_free(top[--nr].key.s);
+			for (j = nr; j > 0 && top[j-1].counter < p->last_counter; j--)
+				top[j] = top[j-1];
+			top[j].key.s = s;
+			top[j].key.len = p->key.len;
+			top[j].algo = p->algo;
+			top[j].limit = p->limit;
+			top[j].counter = p->last_counter;
+			nr++;
+		}
+		lock_release(&b->lock);
+	}
+
+	return nr;
+error:
+	for (j = 0; j < nr; j++)
+		pkg_free(top[j].key.s);
+	return -1;
+}
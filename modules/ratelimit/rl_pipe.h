@@ -0,0 +1,88 @@
+/*
+ * $Id$
+ *
+ * ratelimit module - pipes created on demand, by key
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-06-27  first version
+ */
+
+#ifndef _RL_PIPE_H_
+#define _RL_PIPE_H_
+
+#include "../../str.h"
+#include "../../locking.h"
+
+/* PIPE_ALGO_FEEDBACK holds cpu usage to a fixed value using
+ * negative feedback according to the PID controller model
+ *
+ * <http://en.wikipedia.org/wiki/PID_controller>
+ */
+enum {
+	PIPE_ALGO_NOP = 0,
+	PIPE_ALGO_RED,
+	PIPE_ALGO_TAILDROP,
+	PIPE_ALGO_FEEDBACK,
+	PIPE_ALGO_NETWORK
+};
+
+typedef struct rl_key_pipe {
+	str key;
+	int algo;
+	int limit;
+	int counter;
+	int last_counter;
+	int load;
+	unsigned int last_used;      /* ticks of the last check */
+	struct rl_key_pipe* next;
+} rl_key_pipe_t;
+
+/* copy of a pipe, for reporting */
+typedef struct rl_key_stat {
+	str key;                     /* pkg allocated */
+	int algo;
+	int limit;
+	int counter;
+} rl_key_stat_t;
+
+typedef struct rl_key_bucket {
+	rl_key_pipe_t* pipes;
+	gen_lock_t lock;
+} rl_key_bucket_t;
+
+int rl_htable_init(unsigned int size, unsigned int expire, int interval);
+void rl_htable_destroy(void);
+
+/* runs a check through the pipe of the key (created if missing)
+ * \return	-1 if drop needed, 1 if allowed */
+int rl_htable_push(str* key, int algo, int limit);
+
+/* resets the counters, updates the loads and deletes the idle pipes
+ * \return	the number of NETWORK pipes */
+int rl_htable_timer(unsigned int ticks, int network_load);
+
+/* copies the n pipes with the highest counters of the last interval,
+ * highest first
+ * \return	the number of copied pipes, -1 on error */
+int rl_htable_top(rl_key_stat_t* top, unsigned int n);
+
+#endif
@@ -138,6 +138,11 @@
  *             session in the RTP proxy (Carsten Bock - ported from SER)
  *             - obsolete by rtpproxy_offer/rtpproxy_answer
  *            (osas)
+ * 2011-07-04 Commands whose reply is not used may be sent by a separate
+ *            process, pipelined; limit for the processes waiting for the
+ *            reply of a proxy
+ * 2011-07-06 Proxy selection by consistent hashing of the Call-ID, so
+ *            disabling a proxy moves only the calls of that proxy
  */
 
 #include <sys/types.h>
@@ -177,6 +182,7 @@
 #include "nhelpr_funcs.h"
 #include "rtpproxy_stream.h"
 #include "rtpproxy_callbacks.h"
+#include "rtpproxy_async.h"
 
 #define NH_TABLE_VERSION  0
 
@@ -189,6 +195,8 @@
 
 
 #define DEFAULT_RTPP_SET_ID		0
+/* points on the hashing ring for each unit of weight of a proxy */
+#define RTPP_RING_POINTS		128
 
 #define MI_ENABLE_RTP_PROXY			"nh_enable_rtpp"
 #define MI_MIN_RECHECK_TICKS		0
@@ -299,6 +307,9 @@ static int rtpproxy_retr = 5;
 static int rtpproxy_tout = -1;
 static char *rtpproxy_timeout = 0;
 static int rtpproxy_autobridge = 0;
+static int rtpproxy_max_waiting = 0;
+static int async_commands = 0;
+static int async_queue_size = 10000;
 static pid_t mypid;
 static unsigned int myseqn = 0;
 static str nortpproxy_str = str_init("a=nortpproxy:yes");
@@ -397,6 +408,9 @@ static param_export_t params[] = {
 	{"rtpp_socket_col",       STR_PARAM, &rtpp_sock_col.s       },
 	{"set_id_col",            STR_PARAM, &set_id_col.s          },
 	{"rtpp_notify_socket",    STR_PARAM, &rtpp_notify_socket.s  },
+	{"rtpproxy_max_waiting",  INT_PARAM, &rtpproxy_max_waiting  },
+	{"async_commands",        INT_PARAM, &async_commands        },
+	{"async_queue_size",      INT_PARAM, &async_queue_size      },
 	{0, 0, 0}
 };
 
@@ -410,6 +424,7 @@ static mi_export_t mi_cmds[] = {
 
 static proc_export_t procs[] = {
 	{"RTPP timeout receiver",  0,  0, timeout_listener_process, 1, 0},
+	{"RTPP command dispatcher",0,  0, rtpp_async_process,       1, 0},
 	{0,0,0,0,0,0}
 };
 
@@ -546,11 +561,90 @@ static int add_rtpproxy_socks(struct rtpp_set * rtpp_list,
 
 		rtpp_list->rn_last = pnode;
 		rtpp_list->rtpp_node_count++;
+		rtpp_list->weight_sum += weight;
 	}
 	return 0;
 }
 
 
+/* FNV-1a, with a final mix - core_hash() does not spread similar
+ * strings (URLs differing in a digit) over the whole range */
+static inline unsigned int rtpp_hash(str *s1, str *s2)
+{
+	unsigned int h;
+	int i;
+
+	h = 2166136261u;
+	for (i = 0; i < s1->len; i++)
+		h = (h ^ (unsigned char)s1->s[i]) * 16777619;
+	if (s2) {
+		for (i = 0; i < s2->len; i++)
+			h = (h ^ (unsigned char)s2->s[i]) * 16777619;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static int rtpp_ring_cmp(const void *a, const void *b)
+{
+	unsigned int h1 = ((struct rtpp_ring_point*)a)->hash;
+	unsigned int h2 = ((struct rtpp_ring_point*)b)->hash;
+
+	return (h1 < h2) ? -1 : (h1 > h2);
+}
+
+/*
+ * Each proxy gets RTPP_RING_POINTS points for each unit of weight, hashed
+ * from its URL - so the points of a proxy do not depend on the other
+ * proxies of the set, nor on their order.
+ */
+static int build_rtpp_ring(struct rtpp_set *rtpp_list)
+{
+	struct rtpp_ring_point *ring;
+	struct rtpp_node *pnode;
+	unsigned int i, n, size;
+	str point;
+
+	size = rtpp_list->weight_sum * RTPP_RING_POINTS;
+	if (size == 0) {
+		ring = NULL;
+		goto done;
+	}
+
+	ring = (struct rtpp_ring_point*)shm_malloc(size *
+		sizeof(struct rtpp_ring_point));
+	if (ring == NULL) {
+		LM_ERR("no shm memory left\n");
+		return -1;
+	}
+
+	n = 0;
+	for (pnode = rtpp_list->rn_first; pnode; pnode = pnode->rn_next) {
+		for (i = 0; i < pnode->rn_weight * RTPP_RING_POINTS; i++) {
+			point.s = int2str(i, &point.len);
+			ring[n].hash = rtpp_hash(&pnode->rn_url, &point);
+			ring[n].node = pnode;
+			n++;
+		}
+	}
+	qsort(ring, size, sizeof(struct rtpp_ring_point), rtpp_ring_cmp);
+
+done:
+	if (rtpp_list->ring)
+		shm_free(rtpp_list->ring);
+	rtpp_list->ring = ring;
+	rtpp_list->ring_size = size;
+
+	return 0;
+}
+
+
 /*	0-succes
  *  -1 - erorr
  * */
@@ -633,6 +727,9 @@ static int rtpproxy_add_rtpproxy_set( char * rtp_proxies, int set_id)
 		goto error;
 	}
 
+	if(build_rtpp_ring(rtpp_list) != 0)
+		goto error;
+
 	if (new_list) {
 		if(!rtpp_set_list){/*initialize the list of set -
 							 executed only on the first call*/
@@ -1076,9 +1173,20 @@ mod_init(void)
     }
     else
     {
-        exports.procs = 0;
+        procs[0].no = 0;
     }
 
+	/* no proxy to send to - no dispatcher */
+	if (async_commands && rtpp_set_list) {
+		if (rtpp_async_init(async_queue_size < 0 ? 0 : async_queue_size,
+		rtpproxy_tout, rtpproxy_retr) < 0) {
+			LM_ERR("failed to init the async command queue\n");
+			return -1;
+		}
+	} else {
+		procs[1].no = 0;
+	}
+
 	return 0;
 }
 
@@ -1294,6 +1402,62 @@ int update_rtpp_proxies(void) {
 	return connect_rtpproxies();
 }
 
+/*
+ * helpers for the command dispatcher process (rtpproxy_async.c)
+ */
+int init_rtpp_process(void)
+{
+	mypid = getpid();
+
+	return connect_rtpproxies();
+}
+
+/* takes the proxies list for reading, updated to its last version */
+unsigned int rtpp_list_lock(void)
+{
+	if (nh_lock)
+		lock_start_read( nh_lock );
+
+	if (my_version != *list_version && update_rtpp_proxies() < 0)
+		LM_ERR("cannot update rtpp proxies list\n");
+
+	return my_version;
+}
+
+void rtpp_list_unlock(void)
+{
+	if (nh_lock)
+		lock_stop_read( nh_lock );
+}
+
+struct rtpp_node *get_rtpp_node(unsigned int idx, int *fd)
+{
+	struct rtpp_set *rtpp_list;
+	struct rtpp_node *pnode;
+
+	if (rtpp_set_list == NULL || idx >= rtpp_number)
+		return NULL;
+
+	for(rtpp_list = rtpp_set_list->rset_first; rtpp_list != 0;
+		rtpp_list = rtpp_list->rset_next) {
+		for (pnode=rtpp_list->rn_first; pnode!=0; pnode = pnode->rn_next) {
+			if (pnode->idx == idx) {
+				*fd = rtpp_socks[idx];
+				return pnode;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void disable_rtpp_node(struct rtpp_node *node)
+{
+	LM_ERR("proxy <%s> does not respond, disable it\n", node->rn_url.s);
+	node->rn_disabled = 1;
+	node->rn_recheck_ticks = get_ticks() + rtpproxy_disable_tout;
+}
+
 
 void free_rtpp_sets(void)
 {	
@@ -1312,6 +1476,9 @@ void free_rtpp_sets(void)
 			shm_free(last_rtpp);
 		}
 
+		if(crt_list->ring)
+			shm_free(crt_list->ring);
+
 		last_list = crt_list;
 		crt_list = last_list->rset_next;
 		shm_free(last_list);
@@ -1330,6 +1497,8 @@ static void mod_destroy(void)
 	if(rtpp_set_list == NULL)
 		return;
 
+	rtpp_async_destroy();
+
 	free_rtpp_sets();
 	shm_free(rtpp_set_list);
 
@@ -1845,6 +2014,15 @@ send_rtpp_command(struct rtpp_node *node, struct iovec *v, int vcnt)
 	static char buf[256];
 	struct pollfd fds[1];
 
+	/* do not let a slow proxy block all the processes */
+	if (rtpproxy_max_waiting &&
+	__sync_fetch_and_add(&node->rn_waiting, 1) >= rtpproxy_max_waiting) {
+		__sync_fetch_and_sub(&node->rn_waiting, 1);
+		LM_ERR("too many processes waiting for proxy <%s>, giving up\n",
+			node->rn_url.s);
+		return NULL;
+	}
+
 	len = 0;
 	cp = buf;
 	if (node->rn_umode == 0) {
@@ -1933,13 +2111,15 @@ send_rtpp_command(struct rtpp_node *node, struct iovec *v, int vcnt)
 	}
 
 out:
+	if (rtpproxy_max_waiting)
+		__sync_fetch_and_sub(&node->rn_waiting, 1);
 	cp[len] = '\0';
 	return cp;
 badproxy:
-	LM_ERR("proxy <%s> does not respond, disable it\n", node->rn_url.s);
-	node->rn_disabled = 1;
-	node->rn_recheck_ticks = get_ticks() + rtpproxy_disable_tout;
-	
+	if (rtpproxy_max_waiting)
+		__sync_fetch_and_sub(&node->rn_waiting, 1);
+	disable_rtpp_node(node);
+
 	return NULL;
 }
 
@@ -1966,17 +2146,18 @@ static struct rtpp_set * select_rtpp_set(int id_set ){
 	return rtpp_list;
 }
 /*
- * Main balancing routine. This does not try to keep the same proxy for
- * the call if some proxies were disabled or enabled; proxy death considered
- * too rare. Otherwise we should implement "mature" HA clustering, which is
- * too expensive here.
+ * Main balancing routine. The Call-ID is hashed on the ring of the set and
+ * the first enabled proxy following it is used - when a proxy is disabled
+ * or enabled, only its calls move to (or back from) the next proxies on
+ * the ring, the other calls keep their proxy.
  */
 struct rtpp_node *
 select_rtpp_node(str callid, int do_test)
 {
-	unsigned sum, weight_sum;
+	struct rtpp_ring_point *ring;
 	struct rtpp_node* node;
-	int was_forced, sumcut, found;
+	unsigned int h, lo, hi, mid, i, size;
+	int was_forced;
 
 	/* check last list version */
 	if (my_version != *list_version && update_rtpp_proxies() < 0) {
@@ -1996,57 +2177,62 @@ select_rtpp_node(str callid, int do_test)
 		return node->rn_disabled ? NULL : node;
 	}
 
-	/* XXX Use quick-and-dirty hashing algo */
-	for(sum = 0; callid.len > 0; callid.len--)
-		sum += callid.s[callid.len - 1];
-	sum &= 0xff;
+	ring = selected_rtpp_set->ring;
+	size = selected_rtpp_set->ring_size;
 
-	was_forced = 0;
-retry:
-	weight_sum = 0;
-	found = 0;
-	for (node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
+	/* first point not lower than the hash of the call */
+	h = rtpp_hash(&callid, NULL);
+	for (lo = 0, hi = size; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (ring[mid].hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-		if (node->rn_disabled && node->rn_recheck_ticks <= get_ticks()){
-			/* Try to enable if it's time to try. */
+	/* Try to enable the proxies if it's time to try - once per proxy, a
+	 * proxy has many points on the ring */
+	for(node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
+		if (node->rn_disabled && node->rn_recheck_ticks <= get_ticks())
 			node->rn_disabled = rtpp_test(node, 1, 0);
-		}
-		if (!node->rn_disabled) {
-			weight_sum += node->rn_weight;
-			found = 1;
-		}
 	}
-	if (found == 0) {
-		/* No proxies? Force all to be redetected, if not yet */
-		if (was_forced)
-			return NULL;
-		was_forced = 1;
-		for(node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
-			node->rn_disabled = rtpp_test(node, 1, 1);
+
+	was_forced = 0;
+retry:
+	for (i = 0; i < size; i++) {
+		node = ring[(lo + i) % size].node;
+
+		if (node->rn_disabled)
+			continue;
+		if (do_test) {
+			node->rn_disabled = rtpp_test(node, 0, 0);
+			if (node->rn_disabled)
+				continue;
 		}
-		goto retry;
+		return node;
 	}
-	sumcut = weight_sum ? sum % weight_sum : -1;
-	/*
-	 * sumcut here lays from 0 to weight_sum-1.
-	 * Scan proxy list and decrease until appropriate proxy is found.
-	 */
-	for (node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
-		if (node->rn_disabled)
+
+	/* the proxies with weight 0 are not on the ring - used only when
+	 * all the others are disabled */
+	for(node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
+		if (node->rn_weight != 0 || node->rn_disabled)
 			continue;
-		if (sumcut < (int)node->rn_weight)
-			goto found;
-		sumcut -= node->rn_weight;
+		if (do_test) {
+			node->rn_disabled = rtpp_test(node, 0, 0);
+			if (node->rn_disabled)
+				continue;
+		}
+		return node;
 	}
-	/* No node list */
-	return NULL;
-found:
-	if (do_test) {
-		node->rn_disabled = rtpp_test(node, node->rn_disabled, 0);
-		if (node->rn_disabled)
-			goto retry;
+
+	/* No proxies? Force all to be redetected, if not yet */
+	if (was_forced)
+		return NULL;
+	was_forced = 1;
+	for(node=selected_rtpp_set->rn_first; node!=NULL; node=node->rn_next) {
+		node->rn_disabled = rtpp_test(node, 1, 1);
 	}
-	return node;
+	goto retry;
 }
 
 static int
@@ -2087,7 +2273,7 @@ unforce_rtp_proxy_f(struct sip_msg* msg, char* str1, char* str2)
 		LM_ERR("no available proxies\n");
 		goto error;
 	}
-	send_rtpp_command(node, v, (to_tag.len > 0) ? 8 : 6);
+	send_rtpp_command_async(node, v, (to_tag.len > 0) ? 8 : 6);
 
 	if(nh_lock)
 	{
@@ -3191,7 +3377,7 @@ static int start_recording_f(struct sip_msg* msg, char *foo, char *bar)
 		if (to_tag.len <= 0)
 			nitems = 6;
 	}
-	send_rtpp_command(node, v, nitems);
+	send_rtpp_command_async(node, v, nitems);
 
 	if(nh_lock)
 	{
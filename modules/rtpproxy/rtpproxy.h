@@ -46,10 +46,18 @@ struct rtpp_node {
 	int			rn_rep_supported;
 	int			rn_ptl_supported;
 	int			abr_supported;
+	int			rn_waiting;		/* processes waiting for a reply */
 	struct rtpp_node	*rn_next;
 };
 
 
+/* point of a node on the consistent hashing ring of a set */
+struct rtpp_ring_point {
+	unsigned int		hash;
+	struct rtpp_node	*node;
+};
+
+
 struct rtpp_set{
 	unsigned int 		id_set;
 	unsigned			weight_sum;
@@ -58,6 +66,8 @@ struct rtpp_set{
 	unsigned int		set_recheck_ticks;
 	struct rtpp_node	*rn_first;
 	struct rtpp_node	*rn_last;
+	struct rtpp_ring_point	*ring;		/* sorted by hash */
+	unsigned int		ring_size;
 	struct rtpp_set     *rset_next;
 };
 
@@ -117,6 +127,11 @@ void timeout_listener_process(int rank);
 /* Functions from nathelper */
 struct rtpp_node *select_rtpp_node(str, int);
 char *send_rtpp_command(struct rtpp_node *, struct iovec *, int);
+int init_rtpp_process(void);
+unsigned int rtpp_list_lock(void);
+void rtpp_list_unlock(void);
+struct rtpp_node *get_rtpp_node(unsigned int, int *);
+void disable_rtpp_node(struct rtpp_node *);
 int force_rtp_proxy_body(struct sip_msg *, struct force_rtpp_args *);
 
 #endif
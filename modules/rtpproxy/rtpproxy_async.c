@@ -0,0 +1,445 @@
+/* $Id$
+ *
+ * rtpproxy module - asynchronous command dispatcher
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-04  first version
+ */
+
+/*
+ * The commands whose reply is not used by the script (delete, record,
+ * play, stop playing) do not need to keep a SIP worker blocked until
+ * the RTP proxy answers. The workers only queue them in shm and a
+ * dedicated process sends them, without waiting between them: each
+ * command gets its own cookie and all of them are in flight at once,
+ * the replies being matched back by cookie. The retransmission and
+ * the disabling of a proxy that does not answer are the same as for
+ * the blocking send.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "../../dprint.h"
+#include "../../locking.h"
+#include "../../mem/mem.h"
+#include "../../mem/shm_mem.h"
+#include "rtpproxy_async.h"
+
+#define RTPP_ASYNC_IDLE		10		/* ms to wait for new commands */
+#define RTPP_ASYNC_BUF		256
+
+struct rtpp_async_queue {
+	gen_lock_t lock;
+	unsigned int len;
+	struct rtpp_async_cmd *first;
+	struct rtpp_async_cmd *last;
+};
+
+/* command sent, waiting for its reply (dispatcher only, pkg) */
+struct rtpp_async_req {
+	struct rtpp_async_cmd *cmd;
+	int fd;
+	char cookie[24];
+	int cookie_len;
+	int retr;
+	unsigned long long sent;     /* ms */
+	struct rtpp_async_req *next;
+};
+
+static struct rtpp_async_queue *rtpp_queue = NULL;
+static unsigned int rtpp_queue_size = 0;
+static int rtpp_async_tout = 0;
+static int rtpp_async_retr = 0;
+
+/* dispatcher state */
+static struct rtpp_async_req *pending = NULL;
+static pid_t my_pid;
+static unsigned int my_seqn = 0;
+static struct pollfd *pfds = NULL;
+static int pfds_size = 0;
+
+
+int rtpp_async_init(unsigned int queue_size, int tout, int retr)
+{
+	rtpp_queue = (struct rtpp_async_queue*)shm_malloc(
+		sizeof(struct rtpp_async_queue));
+	if (rtpp_queue == NULL) {
+		LM_ERR("no more shm memory\n");
+		return -1;
+	}
+	memset(rtpp_queue, 0, sizeof(struct rtpp_async_queue));
+
+	if (lock_init(&rtpp_queue->lock) == 0) {
+		LM_ERR("failed to init lock\n");
+		shm_free(rtpp_queue);
+		rtpp_queue = NULL;
+		return -1;
+	}
+
+	rtpp_queue_size = queue_size;
+	rtpp_async_tout = tout;
+	rtpp_async_retr = retr;
+
+	return 0;
+}
+
+void rtpp_async_destroy(void)
+{
+	struct rtpp_async_cmd *c, *next;
+
+	if (rtpp_queue == NULL)
+		return;
+
+	for (c = rtpp_queue->first; c; c = next) {
+		next = c->next;
+		shm_free(c);
+	}
+	lock_destroy(&rtpp_queue->lock);
+	shm_free(rtpp_queue);
+	rtpp_queue = NULL;
+}
+
+int send_rtpp_command_async(struct rtpp_node *node, struct iovec *v, int vcnt)
+{
+	struct rtpp_async_cmd *c;
+	char *p;
+	int i, len;
+
+	if (rtpp_queue == NULL)
+		goto sync;
+
+	/* dirty read - the limit does not need to be exact */
+	if (rtpp_queue_size && rtpp_queue->len >= rtpp_queue_size) {
+		LM_DBG("command queue full, sending it directly\n");
+		goto sync;
+	}
+
+	/* v[0] is the cookie, set by the dispatcher */
+	for (len = 0, i = 1; i < vcnt; i++)
+		len += v[i].iov_len;
+
+	c = (struct rtpp_async_cmd*)shm_malloc(sizeof(struct rtpp_async_cmd) + len);
+	if (c == NULL) {
+		LM_ERR("no more shm memory\n");
+		goto sync;
+	}
+	c->node_idx = node->idx;
+	c->cmd.s = (char*)(c + 1);
+	c->cmd.len = len;
+	c->next = NULL;
+	for (p = c->cmd.s, i = 1; i < vcnt; i++) {
+		memcpy(p, v[i].iov_base, v[i].iov_len);
+		p += v[i].iov_len;
+	}
+
+	lock_get(&rtpp_queue->lock);
+	if (rtpp_queue->last)
+		rtpp_queue->last->next = c;
+	else
+		rtpp_queue->first = c;
+	rtpp_queue->last = c;
+	rtpp_queue->len++;
+	lock_release(&rtpp_queue->lock);
+
+	return 0;
+sync:
+	return send_rtpp_command(node, v, vcnt) ? 0 : -1;
+}
+
+
+static unsigned long long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static void free_req(struct rtpp_async_req *r)
+{
+	shm_free(r->cmd);
+	pkg_free(r);
+}
+
+static int send_req(struct rtpp_async_req *r)
+{
+	struct iovec v[2];
+	int len;
+
+	v[0].iov_base = r->cookie;
+	v[0].iov_len = r->cookie_len;
+	v[1].iov_base = r->cmd->cmd.s;
+	v[1].iov_len = r->cmd->cmd.len;
+
+	do {
+		len = writev(r->fd, v, 2);
+	} while (len == -1 && (errno == EINTR || errno == ENOBUFS));
+	if (len <= 0) {
+		LM_ERR("can't send command to a RTP proxy %s\n", strerror(errno));
+		return -1;
+	}
+
+	r->sent = now_ms();
+	return 0;
+}
+
+static void dispatch_cmd(struct rtpp_async_cmd *c)
+{
+	struct rtpp_async_req *r;
+	struct rtpp_node *node;
+	struct iovec v[2];
+	int fd;
+
+	node = get_rtpp_node(c->node_idx, &fd);
+	if (node == NULL || node->rn_disabled) {
+		LM_DBG("RTP proxy %u is gone or disabled, dropping command\n",
+			c->node_idx);
+		goto drop;
+	}
+
+	if (node->rn_umode == 0) {
+		/* local stream socket - no cookies, no pipelining */
+		v[0].iov_base = NULL;
+		v[0].iov_len = 0;
+		v[1].iov_base = c->cmd.s;
+		v[1].iov_len = c->cmd.len;
+		send_rtpp_command(node, v, 2);
+		goto drop;
+	}
+
+	r = (struct rtpp_async_req*)pkg_malloc(sizeof(struct rtpp_async_req));
+	if (r == NULL) {
+		LM_ERR("no more pkg memory\n");
+		goto drop;
+	}
+	r->cmd = c;
+	r->fd = fd;
+	r->retr = 0;
+	/* different from the cookies of the blocking commands */
+	r->cookie_len = sprintf(r->cookie, "%d_a%u ", (int)my_pid, my_seqn++);
+
+	if (send_req(r) < 0) {
+		disable_rtpp_node(node);
+		pkg_free(r);
+		goto drop;
+	}
+
+	r->next = pending;
+	pending = r;
+	return;
+drop:
+	shm_free(c);
+}
+
+static void check_timeouts(unsigned long long now)
+{
+	struct rtpp_async_req *r, **prev;
+	struct rtpp_node *node;
+	int fd;
+
+	for (prev = &pending; (r = *prev) != NULL; ) {
+		if (now < r->sent + rtpp_async_tout) {
+			prev = &r->next;
+			continue;
+		}
+
+		node = get_rtpp_node(r->cmd->node_idx, &fd);
+		if (node && !node->rn_disabled) {
+			if (++r->retr < rtpp_async_retr) {
+				if (send_req(r) == 0) {
+					prev = &r->next;
+					continue;
+				}
+			} else {
+				LM_ERR("timeout waiting reply from a RTP proxy\n");
+			}
+			disable_rtpp_node(node);
+		}
+
+		*prev = r->next;
+		free_req(r);
+	}
+}
+
+static void drop_pending(void)
+{
+	struct rtpp_async_req *r;
+
+	while ((r = pending) != NULL) {
+		pending = r->next;
+		free_req(r);
+	}
+}
+
+static int build_pfds(void)
+{
+	struct rtpp_async_req *r;
+	struct pollfd *p;
+	int i, n;
+
+	n = 0;
+	for (r = pending; r; r = r->next) {
+		for (i = 0; i < n && pfds[i].fd != r->fd; i++);
+		if (i < n)
+			continue;
+
+		if (n == pfds_size) {
+			p = (struct pollfd*)pkg_realloc(pfds,
+				(pfds_size ? 2 * pfds_size : 8) * sizeof(struct pollfd));
+			if (p == NULL) {
+				LM_ERR("no more pkg memory\n");
+				break;
+			}
+			pfds = p;
+			pfds_size = pfds_size ? 2 * pfds_size : 8;
+		}
+		pfds[n].fd = r->fd;
+		pfds[n].events = POLLIN;
+		pfds[n].revents = 0;
+		n++;
+	}
+
+	return n;
+}
+
+static void handle_reply(int fd, char *buf, int len)
+{
+	struct rtpp_async_req *r, **prev;
+	char *cp;
+
+	/* the whole cookie, "PID_a1" must not match the reply of "PID_a10"
+	 * (buf is null terminated) */
+	for (prev = &pending; (r = *prev) != NULL; prev = &r->next) {
+		if (r->fd == fd && len >= r->cookie_len - 1 &&
+		memcmp(buf, r->cookie, r->cookie_len - 1) == 0 &&
+		(buf[r->cookie_len - 1] == ' ' || buf[r->cookie_len - 1] == '\n' ||
+		buf[r->cookie_len - 1] == '\0'))
+			break;
+	}
+	if (r == NULL) {
+		LM_DBG("reply for an unknown or dropped command\n");
+		return;
+	}
+
+	cp = buf + r->cookie_len - 1;
+	while (*cp == ' ')
+		cp++;
+	if (*cp == 'E')
+		LM_ERR("RTP proxy returned error <%s> for command <%.*s>\n",
+			cp, r->cmd->cmd.len, r->cmd->cmd.s);
+
+	*prev = r->next;
+	free_req(r);
+}
+
+static void read_replies(int timeout)
+{
+	char buf[RTPP_ASYNC_BUF];
+	int i, n, len;
+
+	n = build_pfds();
+	if (n == 0) {
+		usleep(timeout * 1000);
+		return;
+	}
+
+	if (poll(pfds, n, timeout) <= 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		if ((pfds[i].revents & POLLIN) == 0)
+			continue;
+		for (;;) {
+			do {
+				len = recv(pfds[i].fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+			} while (len == -1 && errno == EINTR);
+			if (len <= 0)
+				break;
+			buf[len] = '\0';
+			handle_reply(pfds[i].fd, buf, len);
+		}
+	}
+}
+
+void rtpp_async_process(int rank)
+{
+	struct rtpp_async_cmd *c, *next;
+	struct rtpp_async_req *r;
+	unsigned int version, my_version;
+	unsigned long long now;
+	int timeout;
+
+	my_pid = getpid();
+
+	if (init_rtpp_process() < 0) {
+		LM_ERR("failed to connect to the RTP proxies\n");
+		return;
+	}
+	my_version = rtpp_list_lock();
+	rtpp_list_unlock();
+
+	for (;;) {
+		/* take all the queued commands at once */
+		lock_get(&rtpp_queue->lock);
+		c = rtpp_queue->first;
+		rtpp_queue->first = rtpp_queue->last = NULL;
+		rtpp_queue->len = 0;
+		lock_release(&rtpp_queue->lock);
+
+		if (c || pending) {
+			version = rtpp_list_lock();
+			if (version != my_version) {
+				/* reloaded - the sockets and the indexes changed */
+				LM_DBG("proxies reloaded, dropping the pending commands\n");
+				drop_pending();
+				my_version = version;
+			}
+			for (; c; c = next) {
+				next = c->next;
+				dispatch_cmd(c);
+			}
+			check_timeouts(now_ms());
+			rtpp_list_unlock();
+		}
+
+		/* wake up for the first retransmission due */
+		timeout = RTPP_ASYNC_IDLE;
+		now = now_ms();
+		for (r = pending; r; r = r->next) {
+			if (r->sent + rtpp_async_tout <= now) {
+				timeout = 0;
+				break;
+			}
+			if (r->sent + rtpp_async_tout - now < timeout)
+				timeout = r->sent + rtpp_async_tout - now;
+		}
+
+		read_replies(timeout);
+	}
+}
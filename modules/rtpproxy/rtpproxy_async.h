@@ -0,0 +1,53 @@
+/* $Id$
+ *
+ * rtpproxy module - asynchronous command dispatcher
+ *
+ * Copyright (C) 2011 Voice Sistem SRL
+ *
+ * This file is part of opensips, a free SIP server.
+ *
+ * opensips is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version
+ *
+ * opensips is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * History:
+ * ---------
+ *  2011-07-04  first version
+ */
+
+#ifndef _RTPPROXY_ASYNC_H
+#define _RTPPROXY_ASYNC_H
+
+#include <sys/uio.h>
+
+#include "rtpproxy.h"
+
+/* command waiting to be sent by the dispatcher process (shm) */
+struct rtpp_async_cmd {
+	unsigned int node_idx;
+	str cmd;                     /* without cookie */
+	struct rtpp_async_cmd *next;
+};
+
+int rtpp_async_init(unsigned int queue_size, int tout, int retr);
+void rtpp_async_destroy(void);
+
+/* queues a command whose reply is not needed - same arguments as
+ * send_rtpp_command(); falls back to a blocking send if the
+ * dispatcher is not running or it is overloaded
+ * \return	0 if queued or sent, -1 on error */
+int send_rtpp_command_async(struct rtpp_node *node, struct iovec *v, int vcnt);
+
+void rtpp_async_process(int rank);
+
+#endif
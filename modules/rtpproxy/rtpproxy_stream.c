@@ -36,6 +36,7 @@
 #include "../../ut.h"
 #include "rtpproxy.h"
 #include "nhelpr_funcs.h"
+#include "rtpproxy_async.h"
 
 int
 fixup_var_str_int(void **param, int param_no)
@@ -130,7 +131,7 @@ rtpproxy_stream(struct sip_msg* msg, str *pname, int count, int stream2uac)
         if (to_tag.len <= 0)
             nitems -= 2;
     }
-    send_rtpp_command(node, v, nitems);
+    send_rtpp_command_async(node, v, nitems);
 
     return 1;
 }
@@ -213,7 +214,7 @@ rtpproxy_stop_stream(struct sip_msg* msg, int stream2uac)
         if (to_tag.len <= 0)
             nitems -= 2;
     }
-    send_rtpp_command(node, v, nitems);
+    send_rtpp_command_async(node, v, nitems);
 
     return 1;
 }
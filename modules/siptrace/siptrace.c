@@ -36,6 +36,9 @@
 #include "../../mem/shm_mem.h"
 #include "../../mi/mi.h"
 #include "../../db/db.h"
+#include "../../db/db_insertq.h"
+#include "../../db/db_writeq.h"
+#include "../../timer.h"
 #include "../../parser/parse_content.h"
 #include "../../parser/parse_from.h"
 #include "../../pvar.h"
@@ -113,6 +116,19 @@ static unsigned int enable_ack_trace = 0;
 db_con_t *db_con = NULL;
 db_func_t db_funcs;      /* Database functions */
 
+/* buffered inserts: rows written at once (0 - disabled) and milliseconds
+ * a row may wait */
+static int db_insert_buffer = 0;
+static int db_flush_interval = 1000;
+static db_insert_queue_t *db_insq = NULL;
+/* or asynchronous inserts, by DB writer processes */
+static int db_writers = 0;
+static int db_queue_size = 10000;
+static char *db_queue_policy = "drop";
+static char *db_spill_file = NULL;
+static db_write_queue_t *db_wq = NULL;
+static db_key_t db_queue_keys[NR_KEYS];
+
 /* sl callback registration */
 register_slcb_t register_slcb_f=NULL;
 
@@ -151,9 +167,22 @@ static param_export_t params[] = {
 	{"duplicate_uri",      STR_PARAM, &dup_uri_str.s        },
 	{"trace_local_ip",     STR_PARAM, &trace_local_ip.s     },
 	{"enable_ack_trace",   INT_PARAM, &enable_ack_trace     },
+	{"db_insert_buffer",   INT_PARAM, &db_insert_buffer     },
+	{"db_flush_interval",  INT_PARAM, &db_flush_interval    },
+	{"db_writers",         INT_PARAM, &db_writers           },
+	{"db_queue_size",      INT_PARAM, &db_queue_size        },
+	{"db_queue_policy",    STR_PARAM, &db_queue_policy      },
+	{"db_spill_file",      STR_PARAM, &db_spill_file        },
 	{0, 0, 0}
 };
 
+static void db_writer(int rank);
+
+static proc_export_t procs[] = {
+	{"siptrace DB writer",  0,  0, db_writer, 0, PROC_FLAG_INITCHILD},
+	{0,0,0,0,0,0}
+};
+
 static mi_export_t mi_cmds[] = {
 	{ "sip_trace", sip_trace_mi,   0,  0,  0 },
 	{ 0, 0, 0, 0, 0}
@@ -166,9 +195,27 @@ static mi_export_t mi_cmds[] = {
 stat_var* siptrace_req;
 stat_var* siptrace_rpl;
 
+static unsigned long db_queue_depth(void)
+{
+	return db_write_queue_depth(db_wq);
+}
+
+static unsigned long db_queue_dropped(void)
+{
+	return db_write_queue_dropped(db_wq);
+}
+
+static unsigned long db_queue_spilled(void)
+{
+	return db_write_queue_spilled(db_wq);
+}
+
 static stat_export_t siptrace_stats[] = {
 	{"traced_requests" ,  0,  &siptrace_req  },
 	{"traced_replies"  ,  0,  &siptrace_rpl  },
+	{"db_queue_depth"  ,  STAT_IS_FUNC, (stat_var**)db_queue_depth   },
+	{"db_queue_dropped",  STAT_IS_FUNC, (stat_var**)db_queue_dropped },
+	{"db_queue_spilled",  STAT_IS_FUNC, (stat_var**)db_queue_spilled },
 	{0,0,0}
 };
 #endif
@@ -187,7 +234,7 @@ struct module_exports exports = {
 #endif
 	mi_cmds,    /* exported MI functions */
 	0,          /* exported pseudo-variables */
-	0,          /* extra processes */
+	procs,      /* extra processes */
 	mod_init,   /* module initialization function */
 	0,          /* response function */
 	destroy,    /* destroy function */
@@ -207,6 +254,100 @@ static int fixup_trace_dialog(void** param, int param_no)
 }
 
 
+static void flush_insert_queue(utime_t uticks, void *param)
+{
+	/* the timer process does not run child_init() */
+	if (db_con==NULL) {
+		db_con = db_funcs.init(&db_url);
+		if (db_con==NULL) {
+			LM_ERR("unable to connect to database, rows kept\n");
+			return;
+		}
+	}
+	db_insert_queue_flush(db_insq, &db_funcs, db_con, 0);
+}
+
+
+static void db_writer(int rank)
+{
+	db_write_queue_run(db_wq, &db_funcs, db_con);
+}
+
+
+static int init_db_queues(void)
+{
+	unsigned int interval;
+	int batch, policy;
+
+	batch = 1;
+	if (db_insert_buffer > 0) {
+		if (!DB_CAPABILITY(db_funcs, DB_CAP_MULTIPLE_INSERT))
+			LM_WARN("database module does not support multiple inserts, "
+				"db_insert_buffer ignored\n");
+		else
+			batch = db_insert_buffer;
+	}
+	if (db_writers == 0 && batch == 1)
+		return 0;
+
+	/* same columns, in the same order, as all the traced rows */
+	db_queue_keys[0] = &msg_column;
+	db_queue_keys[1] = &callid_column;
+	db_queue_keys[2] = &method_column;
+	db_queue_keys[3] = &status_column;
+	db_queue_keys[4] = &fromip_column;
+	db_queue_keys[5] = &toip_column;
+	db_queue_keys[6] = &date_column;
+	db_queue_keys[7] = &direction_column;
+	db_queue_keys[8] = &fromtag_column;
+	db_queue_keys[9] = &traced_user_column;
+
+	if (db_writers > 0) {
+		/* the writer processes do the batching */
+		if (db_queue_size <= 0) {
+			LM_ERR("invalid db_queue_size %d\n", db_queue_size);
+			return -1;
+		}
+		policy = db_write_queue_policy(db_queue_policy);
+		if (policy < 0) {
+			LM_ERR("unknown db_queue_policy <%s>\n", db_queue_policy);
+			return -1;
+		}
+		if (policy == DB_WQ_SPILL && db_spill_file == NULL) {
+			LM_ERR("db_spill_file is required by the spill policy\n");
+			return -1;
+		}
+		db_wq = db_write_queue_new(db_queue_keys, NR_KEYS, db_queue_size,
+			batch, policy, db_spill_file);
+		if (db_wq == NULL)
+			return -1;
+		procs[0].no = db_writers;
+		return 0;
+	}
+
+	if (db_flush_interval <= 0) {
+		LM_ERR("invalid db_flush_interval %d\n", db_flush_interval);
+		return -1;
+	}
+
+	db_insq = db_insert_queue_new(db_queue_keys, NR_KEYS, batch,
+		db_flush_interval);
+	if (db_insq==NULL)
+		return -1;
+
+	/* check twice per interval for the rows waiting too long */
+	interval = db_flush_interval*500;
+	if (interval < UTIMER_TICK)
+		interval = UTIMER_TICK;
+	if (register_utimer(flush_insert_queue, 0, interval) < 0) {
+		LM_ERR("failed to register the flush timer\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static int mod_init(void)
 {
 	pv_spec_t avp_spec;
@@ -249,6 +390,13 @@ static int mod_init(void)
 		return -1;
 	}
 
+	if (db_writers < 0) {
+		LM_ERR("invalid db_writers %d\n", db_writers);
+		return -1;
+	}
+	if (init_db_queues() < 0)
+		return -1;
+
 	trace_on_flag = (int*)shm_malloc(sizeof(int));
 	if(trace_on_flag==NULL)
 	{
@@ -368,6 +516,17 @@ static int child_init(int rank)
 
 static void destroy(void)
 {
+	if (db_insq || db_wq) {
+		/* write the buffered / queued rows */
+		if (db_con==NULL)
+			db_con = db_funcs.init(&db_url);
+		if (db_insq)
+			db_insert_queue_destroy(db_insq, &db_funcs, db_con);
+		if (db_wq)
+			db_write_queue_destroy(db_wq, &db_funcs, db_con);
+		db_insq = NULL;
+		db_wq = NULL;
+	}
 	if (db_con!=NULL)
 		db_funcs.close(db_con);
 	if (trace_on_flag)
@@ -513,6 +672,20 @@ static inline str* siptrace_get_table(void)
 static db_ps_t siptrace_ps = NULL;
 
 
+/* inserts a row into the current table of the connection */
+static inline int siptrace_db_insert(db_key_t *db_keys, db_val_t *db_vals)
+{
+	if (db_wq)
+		return db_write_queue_add(db_wq, CON_TABLE(db_con), db_vals);
+	if (db_insq)
+		return db_insert_queue_add(db_insq, &db_funcs, db_con,
+			CON_TABLE(db_con), db_vals);
+
+	CON_PS_REFERENCE(db_con) = &siptrace_ps;
+	return db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS);
+}
+
+
 /* trace is completly disabled */
 #define trace_is_off() \
 	(trace_on_flag==NULL || *trace_on_flag==0)
@@ -650,8 +823,7 @@ static int sip_trace(struct sip_msg *msg)
 		db_vals[9].val.str_val.len = 0;
 	
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -668,8 +840,7 @@ static int sip_trace(struct sip_msg *msg)
 	db_vals[9].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+	if(siptrace_db_insert(db_keys, db_vals) < 0)
 	{
 		LM_ERR("error storing trace\n");
 		goto error;
@@ -682,8 +853,7 @@ static int sip_trace(struct sip_msg *msg)
 		db_vals[9].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -941,8 +1111,7 @@ static void trace_msg_out(struct sip_msg* msg, str  *sbuf,
 		db_vals[9].val.str_val.len = 0;
 	
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -959,8 +1128,7 @@ static void trace_msg_out(struct sip_msg* msg, str  *sbuf,
 	db_vals[9].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+	if(siptrace_db_insert(db_keys, db_vals) < 0)
 	{
 		LM_ERR("error storing trace\n");
 		goto error;
@@ -973,8 +1141,7 @@ static void trace_msg_out(struct sip_msg* msg, str  *sbuf,
 		db_vals[9].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1121,8 +1288,7 @@ static void trace_onreply_in(struct cell* t, int type, struct tmcb_params *ps)
 		db_vals[9].val.str_val.len = 0;
 	
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1139,8 +1305,7 @@ static void trace_onreply_in(struct cell* t, int type, struct tmcb_params *ps)
 	db_vals[9].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+	if(siptrace_db_insert(db_keys, db_vals) < 0)
 	{
 		LM_ERR("error storing trace\n");
 		goto error;
@@ -1153,8 +1318,7 @@ static void trace_onreply_in(struct cell* t, int type, struct tmcb_params *ps)
 		db_vals[9].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("storing info ...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1337,8 +1501,7 @@ static void trace_onreply_out(struct cell* t, int type, struct tmcb_params *ps)
 		db_vals[9].val.str_val.len = 0;
 	
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1355,8 +1518,7 @@ static void trace_onreply_out(struct cell* t, int type, struct tmcb_params *ps)
 	db_vals[9].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+	if(siptrace_db_insert(db_keys, db_vals) < 0)
 	{
 		LM_ERR("error storing trace\n");
 		goto error;
@@ -1369,8 +1531,7 @@ static void trace_onreply_out(struct cell* t, int type, struct tmcb_params *ps)
 		db_vals[9].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("### - storing info (%d) ...\n", faked);
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1538,8 +1699,7 @@ static void trace_sl_onreply_out( unsigned int types, struct sip_msg* req,
 		db_vals[9].val.str_val.len = 0;
 	
 		LM_DBG("storing info...\n");
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
@@ -1556,8 +1716,7 @@ static void trace_sl_onreply_out( unsigned int types, struct sip_msg* req,
 	db_vals[9].val.str_val.len = avp_value.s.len;
 
 	LM_DBG("storing info...\n");
-	CON_PS_REFERENCE(db_con) = &siptrace_ps;
-	if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+	if(siptrace_db_insert(db_keys, db_vals) < 0)
 	{
 		LM_ERR("error storing trace\n");
 		goto error;
@@ -1570,8 +1729,7 @@ static void trace_sl_onreply_out( unsigned int types, struct sip_msg* req,
 		db_vals[9].val.str_val.len = avp_value.s.len;
 
 		LM_DBG("### - storing info (%d) ...\n", faked);
-		CON_PS_REFERENCE(db_con) = &siptrace_ps;
-		if(db_funcs.insert(db_con, db_keys, db_vals, NR_KEYS) < 0)
+		if(siptrace_db_insert(db_keys, db_vals) < 0)
 		{
 			LM_ERR("error storing trace\n");
 			goto error;
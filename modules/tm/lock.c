@@ -75,6 +75,12 @@ static ser_lock_t* timer_group_lock=0; /* pointer to a TG_NR lock array,
 								    it's safer if we alloc this in shared mem 
 									( required for fast lock ) */
 
+/* timing wheel slot locks (only if the wheel timer engine is used) */
+static ser_lock_t* timer_wheel_lock=0;
+#ifndef GEN_LOCK_T_PREFERED
+gen_lock_set_t* wheel_semaphore=0;
+#endif
+
 /* initialize the locks; return 0 on success, -1 otherwise
 */
 int lock_initialize(void)
@@ -190,6 +196,7 @@ void lock_cleanup(void)
 {
 	/* must check if someone uses them, for now just leave them allocated*/
 	if (timer_group_lock) shm_free((void*)timer_group_lock);
+	if (timer_wheel_lock) shm_free((void*)timer_wheel_lock);
 }
 
 #else
@@ -216,8 +223,14 @@ void lock_cleanup()
 		lock_set_destroy(reply_semaphore);
 		lock_set_dealloc(reply_semaphore);
 	};
+	if (wheel_semaphore !=0) {
+		lock_set_destroy(wheel_semaphore);
+		lock_set_dealloc(wheel_semaphore);
+	};
 	entry_semaphore = timer_semaphore = reply_semaphore = 0;
+	wheel_semaphore = 0;
 	if (timer_group_lock) shm_free(timer_group_lock);
+	if (timer_wheel_lock) shm_free(timer_wheel_lock);
 
 }
 #endif /*GEN_LOCK_T_PREFERED*/
@@ -288,3 +301,44 @@ int init_timerlist_lock( enum lists timerlist_id)
 		&(timer_group_lock[ timer_group[timerlist_id] ]);
 	return 0;
 }
+
+
+/* gives each slot of the timing wheels its own lock; the slots of a
+   wheel may be locked in a nested way (while cascading), so two slots
+   of the same wheel must never share a lock */
+int init_timerwheel_locks( struct timer_wheel *wheels )
+{
+	int i, n;
+
+	timer_wheel_lock=shm_malloc(NR_OF_TIMER_LISTS*TW_SLOTS*sizeof(ser_lock_t));
+	if (timer_wheel_lock==0){
+		LM_CRIT("no more share mem\n");
+		return -1;
+	}
+#ifdef GEN_LOCK_T_PREFERED
+	for(i=0;i<NR_OF_TIMER_LISTS*TW_SLOTS;i++) lock_init(&timer_wheel_lock[i]);
+#else
+	/* semaphores are expensive, so the wheels share one set, indexed
+	   by the slot position */
+	if (((wheel_semaphore= lock_set_alloc( TW_SLOTS ) ) == 0)||
+			(lock_set_init(wheel_semaphore)==0)){
+		if (wheel_semaphore) {
+			lock_set_dealloc(wheel_semaphore);
+			wheel_semaphore = 0;
+		}
+		LM_CRIT("timer wheel semaphore initialization failure: %s\n",
+				strerror(errno));
+		return -1;
+	}
+	for (i=0; i<NR_OF_TIMER_LISTS*TW_SLOTS; i++) {
+		timer_wheel_lock[i].semaphore_set = wheel_semaphore;
+		timer_wheel_lock[i].semaphore_index = i % TW_SLOTS;
+	}
+#endif
+
+	for (n=0; n<NR_OF_TIMER_LISTS; n++)
+		for (i=0; i<TW_SLOTS; i++)
+			wheels[n].slots[i/TW_LEVEL_SIZE][i%TW_LEVEL_SIZE].mutex =
+				&timer_wheel_lock[n*TW_SLOTS+i];
+	return 0;
+}
@@ -125,6 +125,7 @@ static inline void _unlock( ser_lock_t* s )
 }
 
 int init_timerlist_lock(  enum lists timerlist_id);
+int init_timerwheel_locks( struct timer_wheel *wheels );
 
 
 #endif
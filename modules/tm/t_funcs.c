@@ -158,7 +158,7 @@ void put_on_wait(  struct cell  *Trans  )
 
 
 
-static int kill_transaction( struct cell *trans )
+int kill_transaction( struct cell *trans )
 {
 	char err_buffer[128];
 	int sip_err;
@@ -246,6 +246,13 @@ int t_relay_to( struct sip_msg  *p_msg , struct proxy_l *proxy, int flags)
 	!(flags&(TM_T_REPLY_no100_FLAG|TM_T_REPLY_repl_FLAG)) )
 		t_reply( t, p_msg , 100 , &relay_reason_100);
 
+	/* if the destination needs a DNS query, let the DNS processes do it
+	 * and forward later, from there */
+	if (proxy==0 && tm_async_dns && t_forward_async( t, p_msg, flags)==1) {
+		ret = 1;
+		goto done;
+	}
+
 	/* now go ahead and forward ... */
 	ret=t_forward_nonack( t, p_msg, proxy);
 	if (ret<=0) {
@@ -189,6 +189,8 @@ void cleanup_localcancel_timers( struct cell *t );
 
 int t_relay_to( struct sip_msg  *p_msg, struct proxy_l *proxy, int replicate);
 
+int kill_transaction( struct cell *trans );
+
 
 #endif
 
@@ -36,6 +36,7 @@
  *              (bogdan)
  *  2004-02-13: t->is_invite and t->local replaced with flags (bogdan)
  *  2007-01-25  DNS failover at transaction level added (bogdan)
+ *  2011-06-20  forwarding may be suspended for async DNS lookups
  */
 
 #include "../../dprint.h"
@@ -58,9 +59,14 @@
 #include "t_cancel.h"
 #include "t_lookup.h"
 #include "t_fwd.h"
+#include "t_reply.h"
 #include "fix_lumps.h"
 #include "config.h"
 #include "../../msg_callbacks.h"
+#include "../../dns_async.h"
+
+/* suspend the forwarding while the destination is resolved */
+int tm_async_dns = 0;
 
 /* route to execute for the branches */
 static int goto_on_branch;
@@ -752,6 +758,81 @@ int t_forward_nonack( struct cell *t, struct sip_msg* p_msg ,
 }
 
 
+/* if the destination of the request is not in the DNS cache, passes the
+ * resolving to the DNS processes and suspends the forwarding until the
+ * answer is available (see t_forward_resume()); only the simple case of
+ * a new request relayed to its RURI/DST URI is handled.
+ * Returns 1 if the forwarding was suspended, 0 if it must be done now */
+int t_forward_async( struct cell *t, struct sip_msg* p_msg, int flags)
+{
+	struct t_async_fwd *af;
+	struct sip_uri uri;
+	str *next_hop;
+	char *p;
+
+	if (route_type!=REQUEST_ROUTE || p_msg->REQ_METHOD==METHOD_CANCEL ||
+	nr_branches!=0 || (flags&(TM_T_REPLY_repl_FLAG|TM_T_REPLY_noerr_FLAG)) ||
+	was_cancelled(t) || no_new_branches(t))
+		return 0;
+
+	next_hop = GET_NEXT_HOP(p_msg);
+	if (parse_uri( next_hop->s, next_hop->len, &uri)<0)
+		return 0;
+
+	if ( !dns_async_needed( uri.maddr_val.len?&uri.maddr_val:&uri.host,
+	uri.port_no, get_proto(PROTO_NONE, uri.proto),
+	(uri.type==SIPS_URI_T)?1:0 ) )
+		return 0;
+
+	af = (struct t_async_fwd*)shm_malloc( sizeof(struct t_async_fwd) +
+		p_msg->new_uri.len + 1 + p_msg->dst_uri.len + 1 +
+		p_msg->path_vec.len + 1 );
+	if (af==NULL) {
+		LM_ERR("no more shm memory\n");
+		return 0;
+	}
+	memset( af, 0, sizeof(struct t_async_fwd));
+	p = (char*)(af+1);
+
+	af->t = t;
+	af->ruri.s = p;
+	af->ruri.len = p_msg->new_uri.len;
+	memcpy( p, p_msg->new_uri.s, p_msg->new_uri.len);
+	p += p_msg->new_uri.len;
+	*(p++) = 0;
+	af->duri.s = p;
+	af->duri.len = p_msg->dst_uri.len;
+	memcpy( p, p_msg->dst_uri.s, p_msg->dst_uri.len);
+	p += p_msg->dst_uri.len;
+	*(p++) = 0;
+	af->path.s = p;
+	af->path.len = p_msg->path_vec.len;
+	memcpy( p, p_msg->path_vec.s, p_msg->path_vec.len);
+	p += p_msg->path_vec.len;
+	*(p++) = 0;
+	af->sock = p_msg->force_send_socket;
+	af->br_flags = getb0flags();
+
+	/* the forwarding will be done from the shm clone of the request */
+	t->uas.request->flags = p_msg->flags;
+
+	/* keep the transaction until resumed */
+	REF(t);
+
+	if ( dns_async_resolve( uri.maddr_val.len?&uri.maddr_val:&uri.host,
+	uri.port_no, get_proto(PROTO_NONE, uri.proto),
+	(uri.type==SIPS_URI_T)?1:0, t_forward_resume, af)!=0 ) {
+		UNREF(t);
+		shm_free(af);
+		return 0;
+	}
+
+	LM_DBG("forwarding of transaction %p suspended for DNS\n", t);
+	set_kr(REQ_FWDED);
+	return 1;
+}
+
+
 int t_replicate(struct sip_msg *p_msg, str *dst, int flags)
 {
 	/* this is a quite horrible hack -- we just take the message
@@ -31,8 +31,20 @@
 #include "../../proxy.h"
 #include "../../str.h"
 
+extern int tm_async_dns;
+
 typedef int (*taddblind_f)( /*struct cell *t */ );
 
+/* forwarding of a request suspended until its destination is resolved */
+struct t_async_fwd {
+	struct cell *t;
+	str ruri;
+	str duri;
+	str path;
+	struct socket_info *sock;
+	unsigned int br_flags;
+};
+
 void e2e_cancel( struct sip_msg *cancel_msg, struct cell *t_cancel,
 		struct cell *t_invite );
 
@@ -46,6 +58,8 @@ int t_replicate(struct sip_msg *p_msg, str *dst, int flags);
 int t_forward_nonack( struct cell *t, struct sip_msg* p_msg,
 		struct proxy_l * p);
 
+int t_forward_async( struct cell *t, struct sip_msg* p_msg, int flags);
+
 int t_forward_ack( struct sip_msg* p_msg );
 
 void t_on_branch( unsigned int go_to );
@@ -106,6 +106,7 @@ int minor_branch_flag = -1;
 /* private place where we create to-tags for replies */
 char tm_tags[TOTAG_VALUE_LEN];
 static str  tm_tag = {tm_tags,TOTAG_VALUE_LEN};
+static str  relay_reason_487 = str_init("Request Terminated");
 char *tm_tag_suffix;
 
 static int picked_branch=-1;
@@ -708,6 +709,57 @@ done:
 }
 
 
+/* resumes (in a DNS resolver process) the forwarding suspended by
+ * t_forward_async(); the destination is now in the DNS cache */
+void t_forward_resume(void *param)
+{
+	static struct sip_msg faked_req;
+	struct t_async_fwd *af;
+	struct ua_client uac;
+	struct cell *t;
+	int ret;
+
+	af = (struct t_async_fwd*)param;
+	t = af->t;
+
+	memset( &uac, 0, sizeof(struct ua_client));
+	uac.uri = af->ruri;
+	uac.br_flags = af->br_flags;
+
+	if (!fake_req(&faked_req, t->uas.request, &t->uas, &uac)) {
+		LM_ERR("fake_req failed\n");
+		ser_error = E_OUT_OF_MEM;
+		ret = -1;
+	} else {
+		faked_env( t, &faked_req);
+
+		/* the shm copies live until the forwarding is done; add_uac()
+		 * makes its own copies if the branch route needs them */
+		faked_req.dst_uri = af->duri;
+		faked_req.path_vec = af->path;
+		faked_req.force_send_socket = af->sock;
+
+		ret = t_forward_nonack( t, &faked_req, NULL);
+
+		faked_req.dst_uri.s = 0; faked_req.dst_uri.len = 0;
+		faked_req.path_vec.s = 0; faked_req.path_vec.len = 0;
+		faked_env( t, 0);
+		free_faked_req(&faked_req,t);
+	}
+
+	if (ret<=0 && t->uas.status<200) {
+		LM_DBG("resumed forwarding failed\n");
+		if (was_cancelled(t))
+			t_reply( t, t->uas.request, 487, &relay_reason_487);
+		else
+			kill_transaction( t );
+	}
+
+	UNREF(t);
+	shm_free(af);
+}
+
+
 static inline int branch_prio( short ret_code, unsigned int is_cancelled)
 {
 	int first_digit;
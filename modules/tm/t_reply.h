@@ -78,6 +78,9 @@ typedef int (*treply_wb_f)( struct cell* trans, unsigned int code, str *text,
  */
 int reply_received( struct sip_msg  *p_msg ) ;
 
+/* continues a forwarding suspended by t_forward_async() */
+void t_forward_resume(void *param);
+
 
 /* send a UAS reply
  * Warning: 'buf' and 'len' should already have been build.
@@ -95,6 +95,15 @@
 	hit. Thats why our reply retransmission procedure is enclosed in 
 	a REPLY_LOCK.
 
+	As alternative to the sorted lists (when the timeouts are not fixed,
+	as with the fr_inv_timer_avp, the insertion has to search for the
+	right place), a hierarchical timing wheel may be used per timer list
+	(timer_engine modparam). The timers are appended in O(1) to the slot
+	covering their expire time and each slot has its own lock; the timer
+	process cascades the timers from the upper levels into the lower ones
+	as the wheel advances and detaches the expired slots, exactly as the
+	lists are split. The same race considerations apply.
+
 */
 
 
@@ -109,6 +118,7 @@
 #include "../../config.h"
 #include "../../parser/parser_f.h"
 #include "../../ut.h"
+#include "../../udp_server.h"
 #include "t_funcs.h"
 #include "t_reply.h"
 #include "t_cancel.h"
@@ -117,6 +127,12 @@
 static struct timer_table *timertable=0;
 static struct timer detached_timer; /* just to have a value to compare with*/
 
+/* which timer engine to use - TM_TIMER_LISTS or TM_TIMER_WHEEL */
+int tm_timer_engine = TM_TIMER_LISTS;
+
+/* send the UDP retransmissions of a timer run in batches */
+int tm_retr_batch = 0;
+
 #define DETACHED_LIST (&detached_timer)
 
 #define is_in_timer_list2(_tl) ( (_tl)->timer_list &&  \
@@ -442,18 +458,54 @@ inline static void delete_handler( struct timer_link *dele_tl )
 
 /***********************************************************/
 
+static inline void reset_slot( struct timer *slot )
+{
+	slot->first_tl.next_tl = &slot->last_tl;
+	slot->last_tl.prev_tl = &slot->first_tl;
+	slot->first_tl.prev_tl = slot->last_tl.next_tl = NULL;
+	slot->last_tl.time_out = -1;
+}
+
+
 struct timer_table *get_timertable(void)
 {
 	return timertable;
 }
 
 
+static void unlink_timer_wheels(void)
+{
+	struct timer_wheel *tw;
+	struct timer_link  *tl, *tmp;
+	struct timer *slot;
+	int i;
+
+	tw = &timertable->wheels[DELETE_LIST];
+	/* deletes all cells from DELETE_LIST wheel
+	   (they are no more accessible from entrys) */
+	for( i=0 ; i<TW_SLOTS ; i++ ) {
+		slot = &tw->slots[i/TW_LEVEL_SIZE][i%TW_LEVEL_SIZE];
+		tl = slot->first_tl.next_tl;
+		while (tl!=&slot->last_tl) {
+			tmp=tl->next_tl;
+			free_cell( get_dele_timer_payload(tl) );
+			tl=tmp;
+		}
+	}
+	for( i=0 ; i<NR_OF_TIMER_LISTS*TW_SLOTS ; i++ ) {
+		tw = &timertable->wheels[i/TW_SLOTS];
+		reset_slot( &tw->slots[(i%TW_SLOTS)/TW_LEVEL_SIZE][i%TW_LEVEL_SIZE] );
+	}
+}
+
+
 void unlink_timer_lists(void)
 {
 	struct timer_link  *tl, *end, *tmp;
 	enum lists i;
 
 	if (timertable==0) return; /* nothing to do */
+	if (timertable->wheels) unlink_timer_wheels();
 	/* remember the DELETE LIST */
 	tl = timertable->timers[DELETE_LIST].first_tl.next_tl;
 	end = & timertable->timers[DELETE_LIST].last_tl;
@@ -473,6 +525,47 @@ void unlink_timer_lists(void)
 
 
 
+static int init_timer_wheels(void)
+{
+	struct timer_wheel *tw;
+	enum lists id;
+	int i;
+
+	timertable->wheels = (struct timer_wheel*)
+		shm_malloc(NR_OF_TIMER_LISTS*sizeof(struct timer_wheel));
+	if (timertable->wheels==NULL) {
+		LM_ERR("no more share memory\n");
+		return -1;
+	}
+	memset(timertable->wheels, 0, NR_OF_TIMER_LISTS*sizeof(struct timer_wheel));
+
+	for( id=0 ; id<NR_OF_TIMER_LISTS ; id++ ) {
+		tw = &timertable->wheels[id];
+		/* second based lists advance with each tick, the retransmission
+		   ones with each run of the utimer routine */
+		if (timer_id2type[id]==UTIME_TYPE) {
+			tw->granularity = TM_UTIMER_INTERVAL;
+			tw->current = (unsigned int)(get_uticks()/TM_UTIMER_INTERVAL);
+		} else {
+			tw->granularity = 1;
+			tw->current = get_ticks();
+		}
+		for( i=0 ; i<TW_SLOTS ; i++ ) {
+			reset_slot( &tw->slots[i/TW_LEVEL_SIZE][i%TW_LEVEL_SIZE] );
+			tw->slots[i/TW_LEVEL_SIZE][i%TW_LEVEL_SIZE].id = id;
+		}
+	}
+
+	if (init_timerwheel_locks(timertable->wheels)<0) {
+		shm_free(timertable->wheels);
+		timertable->wheels = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
 struct timer_table *tm_init_timers(void)
 {
 	enum lists i;
@@ -543,6 +636,11 @@ struct timer_table *tm_init_timers(void)
 	timertable->timers[WT_TIMER_LIST].id     = WT_TIMER_LIST;
 	timertable->timers[DELETE_LIST].id       = DELETE_LIST;
 
+	if (tm_timer_engine==TM_TIMER_WHEEL && init_timer_wheels()<0) {
+		LM_ERR("failed to init the timer wheels\n");
+		goto error0;
+	}
+
 	return timertable;
 
 error0:
@@ -557,6 +655,8 @@ void free_timer_table(void)
 		/* the mutexs for sync the lists are released*/
 		for ( i=0 ; i<NR_OF_TIMER_LISTS ; i++ )
 			release_timerlist_lock( &timertable->timers[i] );
+		if (timertable->wheels)
+			shm_free(timertable->wheels);
 		shm_free(timertable);
 	}
 		
@@ -564,13 +664,7 @@ void free_timer_table(void)
 
 void reset_timer_list( enum lists list_id)
 {
-	timertable->timers[list_id].first_tl.next_tl =
-		&(timertable->timers[list_id].last_tl );
-	timertable->timers[list_id].last_tl.prev_tl =
-		&(timertable->timers[list_id].first_tl );
-	timertable->timers[list_id].first_tl.prev_tl =
-		timertable->timers[list_id].last_tl.next_tl = NULL;
-	timertable->timers[list_id].last_tl.time_out = -1;
+	reset_slot( &timertable->timers[list_id] );
 }
 
 
@@ -800,6 +894,186 @@ static struct timer_link  *check_and_split_time_list( struct timer *timer_list,
 
 
 
+/******************** timing wheels ************************/
+
+/* returns the slot of the wheel where a timer expiring at "time_out"
+ * must be placed, as seen from wheel tick "current" */
+static inline struct timer* tw_get_slot( struct timer_wheel *tw,
+										utime_t time_out, unsigned int current)
+{
+	unsigned int expires, delta;
+	int lvl;
+
+	/* round up - a timer must never fire earlier than requested */
+	expires = (unsigned int)
+		((time_out + tw->granularity - 1) / tw->granularity);
+	/* already expired timers go into the next processed slot */
+	if ( (int)(expires - current) < 0 )
+		expires = current;
+	delta = expires - current;
+	/* too far in the future - park it in the last slot of the wheel; it
+	 * will be re-placed each time that slot is cascaded */
+	if (delta >= TW_HORIZON) {
+		delta = TW_HORIZON - 1;
+		expires = current + delta;
+	}
+
+	for( lvl=0 ; lvl<TW_LEVELS-1 ; lvl++ )
+		if ( delta < (1U<<((lvl+1)*TW_LEVEL_BITS)) )
+			break;
+
+	return &tw->slots[lvl][(expires>>(lvl*TW_LEVEL_BITS)) & TW_LEVEL_MASK];
+}
+
+
+/* append the timer to a slot; the slot must be locked */
+static inline void tw_append_unsafe( struct timer *slot,
+									struct timer_link *tl)
+{
+	tl->timer_list = slot;
+	tl->prev_tl = slot->last_tl.prev_tl;
+	tl->next_tl = &slot->last_tl;
+	tl->prev_tl->next_tl = tl;
+	slot->last_tl.prev_tl = tl;
+	/* no ordering inside a slot - each timer is its own group */
+	tl->ld_tl = tl;
+}
+
+
+/* puts a timer into the wheel; if "once" is set, the timer is inserted
+ * only if it was never set before (see set_1timer) */
+static void tw_insert_timer( struct timer_wheel *tw, struct timer_link *tl,
+										utime_t time_out, int once)
+{
+	struct timer *slot;
+	unsigned int current;
+
+	do {
+		current = tw->current;
+		slot = tw_get_slot( tw, time_out, current);
+		lock(slot->mutex);
+		/* if the wheel moved meanwhile, the slot may have been already
+		 * processed or cascaded - compute it again */
+		if (current==tw->current)
+			break;
+		unlock(slot->mutex);
+	} while(1);
+
+	if (!once || !tl->time_out) {
+		tl->time_out = time_out;
+		tl->deleted = 0;
+		tw_append_unsafe( slot, tl);
+		LM_DBG("[%d]: %p (%lld)\n",slot->id, tl, tl->time_out);
+	}
+
+	unlock(slot->mutex);
+}
+
+
+/* takes a timer out of its wheel slot; returns -1 if the timer is on a
+ * detached list (being fired), 0 otherwise */
+static int tw_remove_timer( struct timer_link *tl )
+{
+	struct timer *slot;
+
+	/* the timer may be moved by cascading while we are trying to lock
+	 * its slot, so check it again once the lock is taken */
+	while ( (slot=tl->timer_list)!=NULL ) {
+		if (slot==DETACHED_LIST)
+			return -1;
+		lock(slot->mutex);
+		if (tl->timer_list==slot) {
+			remove_timer_unsafe( tl );
+			unlock(slot->mutex);
+			return 0;
+		}
+		unlock(slot->mutex);
+	}
+	return 0;
+}
+
+
+/* re-distributes the timers of a slot from an upper level into the
+ * lower levels; the upper slot is locked during the whole operation,
+ * the lower ones are locked one by one (always upper before lower) */
+static void tw_cascade( struct timer_wheel *tw, struct timer *slot )
+{
+	struct timer_link *tl, *tmp_tl;
+	struct timer *dst;
+
+	/* quick check whether it is worth entering the lock */
+	if (slot->first_tl.next_tl==&slot->last_tl)
+		return;
+
+	lock(slot->mutex);
+	tl = slot->first_tl.next_tl;
+	while (tl!=&slot->last_tl) {
+		tmp_tl = tl->next_tl;
+		dst = tw_get_slot( tw, tl->time_out, tw->current);
+		/* timers beyond the horizon may stay in place */
+		if (dst!=slot) {
+			tl->prev_tl->next_tl = tl->next_tl;
+			tl->next_tl->prev_tl = tl->prev_tl;
+			lock(dst->mutex);
+			tw_append_unsafe( dst, tl);
+			unlock(dst->mutex);
+		}
+		tl = tmp_tl;
+	}
+	unlock(slot->mutex);
+}
+
+
+/* advances the wheel up to "time" and detaches all the expired timers */
+static struct timer_link *tw_expire( struct timer_wheel *tw, utime_t time )
+{
+	struct timer_link *ret, *last, *tl;
+	struct timer *slot;
+	unsigned int now, t;
+	int lvl;
+
+	ret = last = NULL;
+	now = (unsigned int)(time / tw->granularity);
+
+	while ( (int)(now - tw->current) >= 0 ) {
+		t = tw->current;
+		/* when a level wraps around, pull down the next slot
+		 * of the upper level */
+		for( lvl=1 ; lvl<TW_LEVELS ; lvl++ ) {
+			if ( t & ((1U<<(lvl*TW_LEVEL_BITS))-1) )
+				break;
+			tw_cascade( tw,
+				&tw->slots[lvl][(t>>(lvl*TW_LEVEL_BITS)) & TW_LEVEL_MASK]);
+		}
+
+		slot = &tw->slots[0][t & TW_LEVEL_MASK];
+		lock(slot->mutex);
+		if (slot->first_tl.next_tl!=&slot->last_tl) {
+			for( tl=slot->first_tl.next_tl ; tl!=&slot->last_tl ;
+			tl=tl->next_tl )
+				tl->timer_list = DETACHED_LIST;
+			/* chain the slot at the end of the detached list */
+			if (last) {
+				last->next_tl = slot->first_tl.next_tl;
+				slot->first_tl.next_tl->prev_tl = last;
+			} else {
+				ret = slot->first_tl.next_tl;
+			}
+			last = slot->last_tl.prev_tl;
+			last->next_tl = NULL;
+			reset_slot( slot );
+		}
+		/* move the wheel while holding the lock of the processed slot,
+		 * so that no insert can land in it anymore */
+		tw->current = t + 1;
+		unlock(slot->mutex);
+	}
+
+	return ret;
+}
+
+
+
 /* stop timer
  * WARNING: a reset'ed timer will be lost forever
  *  (successive set_timer won't work unless you're lucky
@@ -851,6 +1125,20 @@ void set_timer( struct timer_link *new_tl, enum lists list_id,
 	}
 	LM_DBG("relative timeout is %lld\n",timeout);
 
+	timeout += (timer_id2type[list_id]==UTIME_TYPE)?get_uticks():get_ticks();
+
+	if (timertable->wheels) {
+		/* remove from the previous slot first; if detached, do nothing,
+		 * the timer is not valid anymore (same as below) */
+		if (tw_remove_timer( new_tl )<0) {
+			LM_CRIT("set_timer for %d list called on a \"detached\" "
+				"timer -- ignoring: %p\n", list_id, new_tl);
+			return;
+		}
+		tw_insert_timer( &timertable->wheels[list_id], new_tl, timeout, 0);
+		return;
+	}
+
 	list= &(timertable->timers[ list_id ]);
 
 	lock(list->mutex);
@@ -866,8 +1154,7 @@ void set_timer( struct timer_link *new_tl, enum lists list_id,
 	/* make sure I'm not already on a list */
 	remove_timer_unsafe( new_tl );
 
-	insert_timer_unsafe( list, new_tl, timeout +
-			((timer_id2type[list_id]==UTIME_TYPE)?get_uticks():get_ticks()));
+	insert_timer_unsafe( list, new_tl, timeout );
 end:
 	unlock(list->mutex);
 }
@@ -897,12 +1184,18 @@ void set_1timer( struct timer_link *new_tl, enum lists list_id,
 		timeout = *ext_timeout;
 	}
 
+	timeout += (timer_id2type[list_id]==UTIME_TYPE)?get_uticks():get_ticks();
+
+	if (timertable->wheels) {
+		tw_insert_timer( &timertable->wheels[list_id], new_tl, timeout, 1);
+		return;
+	}
+
 	list= &(timertable->timers[ list_id ]);
 
 	lock(list->mutex);
 	if (!new_tl->time_out) {
-		insert_timer_unsafe( list, new_tl, timeout +
-			((timer_id2type[list_id]==UTIME_TYPE)?get_uticks():get_ticks()));
+		insert_timer_unsafe( list, new_tl, timeout );
 	}
 	unlock(list->mutex);
 }
@@ -943,6 +1236,24 @@ static void unlink_timers( struct cell *t )
 		}
 
 	/* do what we have to do....*/
+	if (timertable->wheels) {
+		/* each wheel slot has its own lock */
+		if (remove_retr) {
+			tw_remove_timer(&t->uas.response.retr_timer);
+			for (i=0; i<t->nr_of_outgoings; i++) {
+				tw_remove_timer(&t->uac[i].request.retr_timer);
+				tw_remove_timer(&t->uac[i].local_cancel.retr_timer);
+			}
+		}
+		if (remove_fr) {
+			tw_remove_timer(&t->uas.response.fr_timer);
+			for (i=0; i<t->nr_of_outgoings; i++) {
+				tw_remove_timer(&t->uac[i].request.fr_timer);
+				tw_remove_timer(&t->uac[i].local_cancel.fr_timer);
+			}
+		}
+		return;
+	}
 	if (remove_retr) {
 		/* RT_T1 lock is shared by all other RT timer
 		   lists -- we can safely lock just one
@@ -972,6 +1283,16 @@ static void unlink_timers( struct cell *t )
 
 
 
+static inline struct timer_link *get_expired_timers( enum lists id,
+																utime_t time)
+{
+	if (timertable->wheels)
+		return tw_expire( &timertable->wheels[id], time);
+	return check_and_split_time_list( &timertable->timers[id], time);
+}
+
+
+
 #define run_handler_for_each( _tl , _handler ) \
 	while ((_tl))\
 	{\
@@ -997,7 +1318,7 @@ void timer_routine(unsigned int ticks , void * attr)
 	{
 		/* to waste as little time in lock as possible, detach list
 		   with expired items and process them after leaving the lock */
-		tl=check_and_split_time_list( &timertable->timers[ id ], ticks);
+		tl=get_expired_timers( id, ticks);
 		/* process items now */
 		switch (id)
 		{
@@ -1020,13 +1341,17 @@ void timer_routine(unsigned int ticks , void * attr)
 void utimer_routine(utime_t uticks , void * attr)
 {
 	struct timer_link *tl, *tmp_tl;
-	int                id;
+	int                id, batch;
+
+	/* queue all the retransmissions of this run and push them out
+	   with as few syscalls as possible */
+	batch = tm_retr_batch && udp_batch_start()==0;
 
 	for( id=RT_T1_TO_1 ; id<NR_OF_TIMER_LISTS ; id++ )
 	{
 		/* to waste as little time in lock as possible, detach list
 		   with expired items and process them after leaving the lock */
-		tl=check_and_split_time_list( &timertable->timers[ id ], uticks);
+		tl=get_expired_timers( id, uticks);
 		/* process items now */
 		switch (id)
 		{
@@ -1038,5 +1363,8 @@ void utimer_routine(utime_t uticks , void * attr)
 				break;
 		}
 	}
+
+	if (batch)
+		udp_batch_flush();
 }
 
@@ -35,6 +35,22 @@
 
 #define MIN_TIMER_VALUE  2
 
+/* interval (in microseconds) of the retransmission timer routine */
+#define TM_UTIMER_INTERVAL  (100*1000)
+
+/* timer engines */
+#define TM_TIMER_LISTS  0  /* sorted timer lists (default) */
+#define TM_TIMER_WHEEL  1  /* hierarchical timing wheels */
+
+/* timing wheel geometry: TW_LEVELS levels of TW_LEVEL_SIZE slots each */
+#define TW_LEVEL_BITS   6
+#define TW_LEVEL_SIZE   (1<<TW_LEVEL_BITS)
+#define TW_LEVEL_MASK   (TW_LEVEL_SIZE-1)
+#define TW_LEVELS       4
+#define TW_SLOTS        (TW_LEVELS*TW_LEVEL_SIZE)
+/* farthest expire (in wheel ticks) a wheel can hold without clamping */
+#define TW_HORIZON      (1U<<(TW_LEVELS*TW_LEVEL_BITS))
+
 /* identifiers of timer lists;*/
 /* fixed-timer retransmission lists (benefit: fixed timer$
    length allows for appending new items to the list as$
@@ -76,11 +92,27 @@ typedef struct  timer
 } timer_type;
 
 
+/* hierarchical timing wheel - each slot is an unsorted timer list
+   with its own lock; a timer is inserted in O(1) in the slot of the
+   level that covers its expire time and it is cascaded into the lower
+   levels as the wheel advances */
+struct timer_wheel
+{
+	struct timer          slots[ TW_LEVELS ][ TW_LEVEL_SIZE ];
+	/* next wheel tick to be processed */
+	volatile unsigned int current;
+	/* how many time units (ticks or uticks) a wheel tick lasts */
+	unsigned int          granularity;
+};
+
+
 /* transaction table */
 struct timer_table
 {
 	/* table of timer lists */
 	struct timer   timers[ NR_OF_TIMER_LISTS ];
+	/* one wheel per timer list, if the wheel engine is used */
+	struct timer_wheel *wheels;
 };
 
 
@@ -89,6 +121,8 @@ struct timer_table
 
 extern int timer_group[NR_OF_TIMER_LISTS];
 extern unsigned int timer_id2timeout[NR_OF_TIMER_LISTS];
+extern int tm_timer_engine;
+extern int tm_retr_batch;
 
 
 
@@ -249,6 +249,12 @@ static param_export_t params[]={
 		&disable_6xx_block },
 	{ "minor_branch_flag",        INT_PARAM,
 		&minor_branch_flag },
+	{ "timer_engine",             INT_PARAM,
+		&tm_timer_engine },
+	{ "retr_send_batch",          INT_PARAM,
+		&tm_retr_batch },
+	{ "async_dns",                INT_PARAM,
+		&tm_async_dns },
 	{0,0,0}
 };
 
@@ -689,6 +695,11 @@ static int mod_init(void)
 		return -1;
 	}
 
+	if (tm_timer_engine!=TM_TIMER_LISTS && tm_timer_engine!=TM_TIMER_WHEEL) {
+		LM_ERR("unknown timer engine %d\n", tm_timer_engine);
+		return -1;
+	}
+
 	/* building the hash table*/
 	if (!init_hash_table()) {
 		LM_ERR("initializing hash_table failed\n");
@@ -708,7 +719,7 @@ static int mod_init(void)
 		LM_ERR("failed to register timer\n");
 		return -1;
 	}
-	if (register_utimer( utimer_routine , 0, 100*1000 )<0) {
+	if (register_utimer( utimer_routine , 0, TM_UTIMER_INTERVAL )<0) {
 		LM_ERR("failed to register utimer\n");
 		return -1;
 	}
@@ -37,6 +37,9 @@
 #include "dprint.h"
 #include "timer.h"
 #include "pt.h"
+#include "dns_async.h"
+#include "log_async.h"
+#include "statistics.h"
 
 
 /* array with children pids, 0= main proc,
@@ -82,6 +85,12 @@ int init_multi_proc_support(void)
 	/* count the processes requested by modules */
 	proc_no += count_module_procs();
 
+	/* DNS resolver processes */
+	proc_no += count_dns_async_procs();
+
+	/* logger process */
+	proc_no += count_log_async_procs();
+
 	/* allocate the PID table */
 	pt = shm_malloc(sizeof(struct process_table)*proc_no);
 	if (pt==0){
@@ -167,6 +176,10 @@ pid_t internal_fork(char *proc_desc)
 		seed_child(seed);
 		/* set attributes */
 		set_proc_attrs(proc_desc);
+		#ifdef STATISTICS
+		/* update own statistics counters */
+		stat_shard = pt[process_no].stats;
+		#endif
 		/* set TCP communication */
 		#ifdef USE_TCP
 		if (!tcp_disable){
@@ -37,6 +37,9 @@
 #include "timer.h"
 #include "socket_info.h"
 #include "atomic.h"
+#ifdef SHM_CACHE
+#include "mem/shm_mem.h"
+#endif
 
 #define MAX_PT_DESC	128
 
@@ -48,6 +51,12 @@ struct process_table {
 #endif
 	char desc[MAX_PT_DESC];
 	atomic_t *load;
+	/* per-process counters of the statistics */
+	long *stats;
+#ifdef SHM_CACHE
+	/* stats of the process' shm cache */
+	struct shm_cache_stats shm_cache;
+#endif
 };
 
 typedef void(*forked_proc_func)(int i);
@@ -25,6 +25,7 @@
  *  2003-07-03  default port value set according to proto (andrei)
  *  2007-01-25  support for DNS failover added (bogdan)
  *  2008-07-25  support for SRV load-balancing added (bogdan)
+ *  2011-03-02  get_record() answers may be cached in shm (dns_cache.c)
  */ 
 
 
@@ -544,12 +545,26 @@ struct rdata* get_record(char* name, int type)
 	struct srv_rdata* srv_rd;
 	struct srv_rdata* crt_srv;
 	struct timeval start;
+	int found;
+
+	if (dns_use_cache) {
+		head = dns_cache_get(name, type, &found);
+		if (found)
+			return head;
+		if (dns_cache_only) {
+			dns_cache_missed = 1;
+			return 0;
+		}
+	}
 
 	start_expire_timer(start,execdnsthreshold);
 	size=res_search(name, C_IN, type, buff.buff, sizeof(buff));
 	stop_expire_timer(start,execdnsthreshold,"dns",name,strlen(name),0);
 	if (size<0) {
 		LM_DBG("lookup(%s, %d) failed\n", name, type);
+		/* negative caching only for definite answers */
+		if (dns_use_cache && (h_errno==HOST_NOT_FOUND || h_errno==NO_DATA))
+			dns_cache_put(name, type, 0);
 		goto not_found;
 	}
 	else if ((unsigned int)size > sizeof(buff)) size=sizeof(buff);
@@ -696,6 +711,8 @@ struct rdata* get_record(char* name, int type)
 		p+=rdlength;
 		
 	}
+	if (dns_use_cache)
+		dns_cache_put(name, type, head);
 	return head;
 error_boundary:
 		LM_ERR("end of query buff reached\n");
@@ -46,6 +46,7 @@
 
 #include "ip_addr.h"
 #include "proxy.h"
+#include "dns_cache.h"
 
 
 #define MAX_QUERY_SIZE 8192
@@ -317,33 +318,14 @@ struct hostent* sip_resolvehost(str* name, unsigned short* port,
 
 
 
-/*! \brief gethostbyname wrappers
- * use this, someday they will use a local cache */
-
-static inline struct hostent* resolvehost(char* name, int no_ip_test)
+/*! \brief gethostbyname wrapper, asking the system resolver */
+static inline struct hostent* sys_resolvehost(char* name)
 {
 	static struct hostent* he=0;
 #ifdef HAVE_GETIPNODEBYNAME 
 	int err;
 	static struct hostent* he2=0;
 #endif
-	struct ip_addr* ip;
-	str s;
-
-	if (!no_ip_test) {
-		s.s = (char*)name;
-		s.len = strlen(name);
-
-		/* check if it's an ip address */
-		if ( ((ip=str2ip(&s))!=0)
-#ifdef USE_IPV6
-			|| ((ip=str2ip6(&s))!=0)
-#endif
-		){
-			/* we are lucky, this is an ip address */
-			return ip_addr2he(&s, ip);
-		}
-	}
 
 	/* ipv4 */
 	he=gethostbyname(name);
@@ -367,6 +349,35 @@ static inline struct hostent* resolvehost(char* name, int no_ip_test)
 }
 
 
+/*! \brief gethostbyname wrappers
+ * if enabled, the lookups go via the DNS cache */
+
+static inline struct hostent* resolvehost(char* name, int no_ip_test)
+{
+	struct ip_addr* ip;
+	str s;
+
+	if (!no_ip_test) {
+		s.s = (char*)name;
+		s.len = strlen(name);
+
+		/* check if it's an ip address */
+		if ( ((ip=str2ip(&s))!=0)
+#ifdef USE_IPV6
+			|| ((ip=str2ip6(&s))!=0)
+#endif
+		){
+			/* we are lucky, this is an ip address */
+			return ip_addr2he(&s, ip);
+		}
+	}
+
+	if (dns_use_cache)
+		return dns_cache_resolvehost(name);
+	return sys_resolvehost(name);
+}
+
+
 /*! \brief free the DNS resolver state machine */
 void free_dns_res( struct proxy_l *p );
 
@@ -531,6 +531,8 @@ static int fix_actions(struct action* a)
 			case CACHE_STORE_T:
 			case CACHE_FETCH_T:
 			case CACHE_REMOVE_T:
+			case CACHE_ADD_T:
+			case CACHE_SUB_T:
 				/* attr name */
 				s.s = (char*)t->elem[1].u.data;
 				s.len = strlen(s.s);
@@ -574,6 +576,16 @@ static int fix_actions(struct action* a)
 					t->elem[2].u.data = (void*)model;
 				}
 
+				/* result of the counter operations */
+				if ((t->type==CACHE_ADD_T || t->type==CACHE_SUB_T) &&
+				t->elem[4].type==SCRIPTVAR_ST &&
+				((pv_spec_p)t->elem[4].u.data)->type!= PVT_AVP) {
+					LM_ERR("Wrong type for the fifth argument - "
+						"must be an AVP\n");
+					ret=E_BUG;
+					goto error;
+				}
+
 				break;
 			case XDBG_T:
 			case XLOG_T:
@@ -88,7 +88,7 @@ enum { FORWARD_T=1, SEND_T, DROP_T, LOG_T, ERROR_T, ROUTE_T, EXEC_T,
 		BANDEQ_T, BOREQ_T, BXOREQ_T, USE_BLACKLIST_T, UNUSE_BLACKLIST_T,
 		SET_TIME_STAMP_T,RESET_TIME_STAMP_T, DIFF_TIME_STAMP_T,
 		PV_PRINTF_T,
-		CACHE_STORE_T, CACHE_FETCH_T, CACHE_REMOVE_T,
+		CACHE_STORE_T, CACHE_FETCH_T, CACHE_REMOVE_T, CACHE_ADD_T, CACHE_SUB_T,
 		XDBG_T, XLOG_T,
 		CONSTRUCT_URI_T
 };
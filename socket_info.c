@@ -159,6 +159,7 @@ static void free_sock_info(struct socket_info* si)
 		if(si->port_no_str.s) pkg_free(si->port_no_str.s);
 		if(si->adv_name_str.s) pkg_free(si->adv_name_str.s);
 		if(si->adv_port_str.s) pkg_free(si->adv_port_str.s);
+		if(si->rcv_socks) pkg_free(si->rcv_socks);
 	}
 }
 
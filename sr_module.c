@@ -433,7 +433,16 @@ int init_child(int rank)
 			type = "UNKNOWN";
 	}
 
-	return init_mod_child(modules, rank, type);
+	if (init_mod_child(modules, rank, type)<0)
+		return -1;
+
+#ifdef SHM_CACHE
+	/* the process is fully initialized, it may start caching shm */
+	if (rank!=PROC_MAIN && !is_main)
+		shm_cache_enable();
+#endif
+
+	return 0;
 }
 
 
@@ -26,6 +26,7 @@
  *  2006-11-28  added get_stat_var_from_num_code() (Jeffrey Magder -
  *              SOMA Networks)
  *  2009-04-23  function var accepts a context parameter (bogdan)
+ *  2011-06-27  counters are kept per process and summed on read
  */
 
 /*!
@@ -69,6 +70,19 @@ gen_lock_t *stat_lock = 0;
 
 #define stat_hash(_s) core_hash( _s, 0, STATS_HASH_SIZE)
 
+/* size of a cache line - the counters of different processes are
+ * kept apart, so the updates do not bounce lines between CPUs */
+#define STAT_SHARD_ALIGN  64
+
+/* the per-process counters of the current process */
+long *stat_shard = 0;
+
+/* number of counters per process; stats registered after the counters
+ * are allocated (in the workers) use only the shared value */
+static int stat_shards_no = 0;
+static int stat_shards_procs = 0;
+static void *stat_shards_mem = 0;
+
 
 
 /*! \brief
@@ -158,6 +172,83 @@ int register_tcp_load_stat(atomic_t *ctx)
 	return 0;
 }
 
+/*! \brief allocates the per-process counters of the statistics
+ * registered so far; to be called once the number of processes is known
+ */
+int init_stats_shards(int procs_no)
+{
+	unsigned long size;
+	char *p;
+	int i;
+
+	if (stat_shards_mem)
+		return 0;
+
+	/* row size rounded up to the cache line */
+	size = (stat_shards_no*sizeof(long) + STAT_SHARD_ALIGN - 1) &
+		~(STAT_SHARD_ALIGN - 1);
+
+	stat_shards_mem = shm_malloc( procs_no*size + STAT_SHARD_ALIGN );
+	if (stat_shards_mem==0) {
+		LM_ERR("no more shm mem\n");
+		return -1;
+	}
+	memset( stat_shards_mem, 0, procs_no*size + STAT_SHARD_ALIGN);
+	stat_shards_procs = procs_no;
+
+	p = (char*)(((unsigned long)stat_shards_mem + STAT_SHARD_ALIGN - 1) &
+		~(STAT_SHARD_ALIGN - 1));
+	for( i=0 ; i<procs_no ; i++ )
+		pt[i].stats = (long*)(p + i*size);
+
+	/* the counters of a process are set when forking (internal_fork);
+	 * the main process keeps using the shared values, as it may fork
+	 * other processes on its own */
+	LM_DBG("%d counters per process for %d processes\n",
+		stat_shards_no, procs_no);
+
+	return 0;
+}
+
+
+unsigned long get_stat_shards_val( stat_var *var )
+{
+	long val;
+	int i;
+
+#ifdef NO_ATOMIC_OPS
+	val = (long)(int)*(var->u.val);
+#else
+	val = (long)var->u.val->counter;
+#endif
+	if (stat_shards_mem && var->shard<stat_shards_no)
+		for( i=0 ; i<stat_shards_procs ; i++ )
+			val += pt[i].stats[var->shard];
+
+	return (unsigned long)val;
+}
+
+
+void reset_stat_shards( stat_var *var )
+{
+	long val;
+	int i;
+
+	val = 0;
+	if (stat_shards_mem && var->shard<stat_shards_no)
+		for( i=0 ; i<stat_shards_procs ; i++ )
+			val += pt[i].stats[var->shard];
+
+#ifdef NO_ATOMIC_OPS
+	lock_get(stat_lock);
+	*(var->u.val) = (stat_val)(-val);
+	lock_release(stat_lock);
+#else
+	atomic_set( var->u.val, (int)(-val));
+#endif
+}
+
+
 int init_stats_collector(void)
 {
 	/* init the collector */
@@ -219,6 +310,11 @@ void destroy_stats_collector(void)
 		lock_destroy( stat_lock );
 #endif
 
+	if (stat_shards_mem) {
+		shm_free(stat_shards_mem);
+		stat_shards_mem = 0;
+	}
+
 	if (collector) {
 		/* destroy hash table */
 		for( i=0 ; i<STATS_HASH_SIZE ; i++ ) {
@@ -325,8 +421,11 @@ int register_stat2( char *module, char *name, stat_var **pvar,
 		atomic_set(stat->u.val,0);
 #endif
 		*pvar = stat;
+		/* per-process counter, if not too late for it */
+		stat->shard = stat_shards_mem ? -1 : stat_shards_no++;
 	} else {
 		stat->u.f = (stat_function)(pvar);
+		stat->shard = -1;
 	}
 
 	/* is the module already recorded? */
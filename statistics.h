@@ -25,6 +25,7 @@
  *  2006-11-28  added get_stat_var_from_num_code() (Jeffrey Magder -
  *              SOMA Networks)
  *  2009-04-23  function var accepts a context parameter (bogdan)
+ *  2011-06-27  counters are kept per process and summed on read
  */
 
 /*!
@@ -62,6 +63,7 @@ typedef struct stat_var_{
 	unsigned int mod_idx;
 	str name;
 	unsigned short flags;
+	int shard;      /* index of the per-process counter, -1 if none */
 	void * context;
 	union{
 		stat_val *val;
@@ -99,6 +101,8 @@ char *build_stat_name( str* prefix, char *var_name);
 
 int init_stats_collector();
 
+int init_stats_shards(int procs_no);
+
 int register_udp_load_stat(str *name,atomic_t *ctx);
 int register_tcp_load_stat(atomic_t *ctx);
 
@@ -127,6 +131,17 @@ unsigned int get_stat_val( stat_var *var );
  */
 stat_var *get_stat_var_from_num_code(unsigned int numerical_code, int in_codes);
 
+/*! \brief value of a sharded statistic: the shared value plus the
+ * counters of all the processes */
+unsigned long get_stat_shards_val( stat_var *var );
+
+/*! \brief resets a sharded statistic without writing into the per-process
+ * counters (the shared value is set to the negated sum) */
+void reset_stat_shards( stat_var *var );
+
+/*! \brief per-process counters of the current process, NULL if none */
+extern long *stat_shard;
+
 
 #ifdef NO_ATOMIC_OPS
 #include "locking.h"
@@ -135,6 +150,7 @@ extern gen_lock_t *stat_lock;
 
 #else
 	#define init_stats_collector()  0
+	#define init_stats_shards(_n)  0
 	#define destroy_stats_collector()
 	#define register_module_stats(_mod,_stats) 0
 	#define register_stat( _mod, _name, _pvar, _flags) 0
@@ -149,7 +165,9 @@ extern gen_lock_t *stat_lock;
 		#define update_stat( _var, _n) \
 			do { \
 				if ( !((_var)->flags&STAT_IS_FUNC) ) {\
-					if ((_var)->flags&STAT_NO_SYNC) {\
+					if ((_var)->shard>=0 && stat_shard) {\
+						stat_shard[(_var)->shard] += _n;\
+					} else if ((_var)->flags&STAT_NO_SYNC) {\
 						*((_var)->u.val) += _n;\
 					} else {\
 						lock_get(stat_lock);\
@@ -161,7 +179,9 @@ extern gen_lock_t *stat_lock;
 		#define reset_stat( _var) \
 			do { \
 				if ( ((_var)->flags&(STAT_NO_RESET|STAT_IS_FUNC))==0 ) {\
-					if ((_var)->flags&STAT_NO_SYNC) {\
+					if ((_var)->shard>=0) {\
+						reset_stat_shards(_var);\
+					} else if ((_var)->flags&STAT_NO_SYNC) {\
 						*((_var)->u.val) = 0;\
 					} else {\
 						lock_get(stat_lock);\
@@ -171,12 +191,15 @@ extern gen_lock_t *stat_lock;
 				}\
 			}while(0)
 		#define get_stat_val( _var ) ((unsigned long)\
-			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):*((_var)->u.val))
+			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):\
+			(((_var)->shard>=0)?get_stat_shards_val(_var):*((_var)->u.val)))
 	#else
 		#define update_stat( _var, _n) \
 			do { \
 				if ( !((_var)->flags&STAT_IS_FUNC) ) {\
-					if (_n>=0) \
+					if ((_var)->shard>=0 && stat_shard) \
+						stat_shard[(_var)->shard] += _n;\
+					else if (_n>=0) \
 						atomic_add( _n, (_var)->u.val);\
 					else \
 						atomic_sub( -(_n), (_var)->u.val);\
@@ -185,11 +208,15 @@ extern gen_lock_t *stat_lock;
 		#define reset_stat( _var) \
 			do { \
 				if ( ((_var)->flags&(STAT_NO_RESET|STAT_IS_FUNC))==0 ) {\
-					atomic_set( (_var)->u.val, 0);\
+					if ((_var)->shard>=0) \
+						reset_stat_shards(_var);\
+					else \
+						atomic_set( (_var)->u.val, 0);\
 				}\
 			}while(0)
 		#define get_stat_val( _var ) ((unsigned long)\
-			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):(_var)->u.val->counter)
+			((_var)->flags&STAT_IS_FUNC)?(_var)->u.f((_var)->context):\
+			(((_var)->shard>=0)?get_stat_shards_val(_var):(_var)->u.val->counter))
 	#endif /* NO_ATOMIC_OPS */
 
 	#define if_update_stat(_c, _var, _n) \
@@ -52,6 +52,7 @@
 							 the connection to the tcp master process */
 #define TCP_MAIN_SELECT_TIMEOUT 5		/*!< how often "tcp main" checks for timeout*/
 #define TCP_CHILD_SELECT_TIMEOUT 2		/*!< the same as above but for children */
+#define DEFAULT_TCP_ASYNC_MAX_QUEUE 65536	/*!< max bytes queued for async write on a connection */
 
 
 /* tcp connection flags */
@@ -75,9 +76,9 @@ enum tcp_conn_states { S_CONN_ERROR=-2, S_CONN_BAD=-1, S_CONN_OK=0,
 
 /* fd communication commands */
 enum conn_cmds { CONN_DESTROY=-3, CONN_ERROR=-2, CONN_EOF=-1, CONN_RELEASE, 
-		CONN_GET_FD, CONN_NEW };
+		CONN_GET_FD, CONN_NEW, CONN_ASYNC_WRITE };
 /* CONN_RELEASE, EOF, ERROR, DESTROY can be used by "reader" processes
- * CONN_GET_FD, NEW, ERROR only by writers */
+ * CONN_GET_FD, NEW, ERROR, ASYNC_WRITE only by writers */
 
 struct tcp_req{
 	struct tcp_req* next;
@@ -99,6 +100,14 @@ struct tcp_req{
 
 struct tcp_connection;
 
+/*! \brief data queued for writing on a connection (async mode) */
+struct tcp_wq_chunk{
+	struct tcp_wq_chunk* next;
+	unsigned int len;			/*!< bytes in buf */
+	unsigned int pos;			/*!< bytes already written */
+	char buf[1];
+};
+
 /*! \brief TCP port alias structure */
 struct tcp_conn_alias{
 	struct tcp_connection* parent;
@@ -130,8 +139,19 @@ struct tcp_connection{
 	struct tcp_connection* id_prev;		/*!< prev in id hash table */
 	struct tcp_connection* c_next;		/*!< Child next (use locally) */
 	struct tcp_connection* c_prev;		/*!< Child prev (use locally */
+	unsigned int c_timeout;			/*!< Child list timeout (use locally) */
 	struct tcp_conn_alias con_aliases[TCP_CON_MAX_ALIASES];	/*!< Aliases for this connection */
 	int aliases;				/*!< Number of aliases, at least 1 */
+	struct tcp_wq_chunk* wq_first;		/*!< async write queue, under write_lock */
+	struct tcp_wq_chunk* wq_last;
+	unsigned int wq_size;			/*!< bytes in the write queue */
+	unsigned int wq_timeout;		/*!< write timeout of the queue head */
+	int wfd;				/*!< "tcp main" only: fd watched for writing */
+	struct tcp_connection* w_next;		/*!< "tcp main" only: in the list of */
+	struct tcp_connection* w_prev;		/*!<  connections waiting to write */
+	struct tcp_connection* t_next;		/*!< "tcp main" only: in the expiry */
+	struct tcp_connection* t_prev;		/*!<  wheel slot t_slot */
+	unsigned int t_slot;
 };
 
 
@@ -166,11 +186,26 @@ struct tcp_connection{
 	}while(0)
 
 
-#define TCPCONN_LOCK lock_get(tcpconn_lock);
-#define TCPCONN_UNLOCK lock_release(tcpconn_lock);
-
+#define TCP_PARTITION_SIZE 32	/*!< number of locks splitting the id hash */
 #define TCP_ALIAS_HASH_SIZE 1024
+#define TCP_ALIAS_LOCKS 64	/*!< number of locks splitting the alias hash */
 #define TCP_ID_HASH_SIZE 1024
+#define TCP_WHEEL_SIZE 1024	/*!< slots (ticks) of the expiry wheel */
+#define TCP_WHEEL_NONE ((unsigned int)-1)
+
+/*! \brief a connection belongs to the partition of its id; an id hash
+ * entry belongs to a single partition */
+#define tcp_part(id) ((id)&(TCP_PARTITION_SIZE-1))
+
+#define TCPCONN_LOCK(id) lock_set_get(tcpconn_locks, tcp_part(id));
+#define TCPCONN_UNLOCK(id) lock_set_release(tcpconn_locks, tcp_part(id));
+
+/*! \brief the aliases are protected by the lock of their address hash
+ * bucket; when both are needed, the partition lock is taken first */
+#define TCP_ALIAS_LOCK(hash) \
+	lock_set_get(tcpconn_alias_locks, (hash)&(TCP_ALIAS_LOCKS-1));
+#define TCP_ALIAS_UNLOCK(hash) \
+	lock_set_release(tcpconn_alias_locks, (hash)&(TCP_ALIAS_LOCKS-1));
 
 static inline unsigned tcp_addr_hash(struct ip_addr* ip, unsigned short port)
 {
@@ -107,6 +107,7 @@
 #include "tcp_init.h"
 #include "tsend.h"
 #include "ut.h"
+#include "core_stats.h"
 #ifdef USE_TLS
 #include "tls/tls_server.h"
 #endif 
@@ -120,7 +121,8 @@
 
 
 enum fd_types { F_NONE, F_SOCKINFO /* a tcp_listen fd */,
-				F_TCPCONN, F_TCPCHILD, F_PROC };
+				F_TCPCONN, F_TCPCHILD, F_PROC,
+				F_TCPWRITE /* a tcpconn with queued data (dup of its fd) */ };
 
 struct tcp_child {
 	pid_t pid;
@@ -138,6 +140,9 @@ int tcp_con_lifetime=DEFAULT_TCP_CONNECTION_LIFETIME;
 enum poll_types tcp_poll_method=0; 	/*!< by default choose the best method */
 int tcp_max_connections=DEFAULT_TCP_MAX_CONNECTIONS;
 int tcp_max_fd_no=0;
+int tcp_async=0;	/*!< writes done by "tcp main" from per connection queues */
+int tcp_async_max_queue=DEFAULT_TCP_ASYNC_MAX_QUEUE;
+int tcp_fd_cache_size=0;	/*!< fds kept by each process, 0 = disabled */
 
 static int tcp_connections_no=0;	/*!< current number of open connections */
 
@@ -145,17 +150,53 @@ static int tcp_connections_no=0;	/*!< current number of open connections */
 struct tcp_conn_alias** tcpconn_aliases_hash=0;
 /*! \brief connection hash table (after connection id) */
 struct tcp_connection** tcpconn_id_hash=0;
-gen_lock_t* tcpconn_lock=0;
+/*! \brief one lock per partition of the id hash, protecting also the
+ * refcnt, timeout and aliases number of the connections in the partition */
+gen_lock_set_t* tcpconn_locks=0;
+/*! \brief locks of the alias hash buckets */
+gen_lock_set_t* tcpconn_alias_locks=0;
 
 struct tcp_child *tcp_children=0;
 static int* connection_id=0; /*!< unique for each connection, used for 
 				quickly finding the corresponding connection for a reply */
+static unsigned int* tcpconn_gen=0; /*!< incremented each time a connection
+				is removed, tells the processes to check their fd cache */
 int unix_tcp_sock = -1;
 
 static int tcp_proto_no=-1; /*!< tcp protocol number as returned by getprotobyname */
 
 static io_wait_h io_h;
 
+/*! \brief connections watched for writing ("tcp main" only) */
+static struct tcp_connection* tcp_async_list=0;
+
+/*! \brief expiry wheel ("tcp main" only): a connection is kept in the slot
+ * of the tick at which it was due to expire; its timeout is checked (and
+ * the connection moved further) only when that slot is reached */
+static struct tcp_connection* tcp_wheel[TCP_WHEEL_SIZE];
+static unsigned int tcp_wheel_ticks=0; /*!< next tick to be processed */
+
+/*! \brief fd of a connection, received from "tcp main" and kept by the
+ * process for the next sends on the same connection */
+struct tcp_fd_cache_entry {
+	int id;			/*!< connection id */
+	struct tcp_connection* c;	/*!< only compared, never dereferenced */
+	int fd;
+	struct tcp_fd_cache_entry* h_next;	/*!< id hash bucket */
+	struct tcp_fd_cache_entry* lru_prev;
+	struct tcp_fd_cache_entry* lru_next;
+};
+
+/*! \brief per process fd cache (pkg mem) */
+static struct tcp_fd_cache_entry* fd_cache=0;
+static struct tcp_fd_cache_entry** fd_cache_hash=0;
+static struct tcp_fd_cache_entry* fd_cache_free=0;
+static struct tcp_fd_cache_entry* fd_cache_lru=0; /*!< most recently used */
+static struct tcp_fd_cache_entry* fd_cache_lru_last=0;
+static unsigned int fd_cache_hash_mask=0;
+static unsigned int fd_cache_gen=0;	/*!< last seen *tcpconn_gen */
+static unsigned int fd_cache_sweep_ticks=0;
+
 
 
 /*! \brief Set all socket/fd options:  disable nagle, tos lowdelay, non-blocking
@@ -381,6 +422,8 @@ struct tcp_connection* tcpconn_new(int sock, union sockaddr_union* su,
 	memset(c, 0, sizeof(struct tcp_connection)); /* zero init */
 	c->s=sock;
 	c->fd=-1; /* not initialized */
+	c->wfd=-1;
+	c->t_slot=TCP_WHEEL_NONE;
 	if (lock_init(&c->write_lock)==0){
 		LM_ERR("init lock failed\n");
 		goto error;
@@ -469,12 +512,48 @@ error:
 
 
 
+/*! \brief adds c to the expiry wheel, in the slot of the tick at which
+ * it expires, but not before tick min ("tcp main" only) */
+static inline void tcpconn_wheel_add(struct tcp_connection* c,
+														unsigned int min)
+{
+	unsigned int t;
+
+	t=c->timeout+1; /* expired if ticks>timeout */
+	if ((int)(t-min)<0)
+		t=min;
+	c->t_slot=t&(TCP_WHEEL_SIZE-1);
+	tcpconn_listadd(tcp_wheel[c->t_slot], c, t_next, t_prev);
+}
+
+
+
+static inline void tcpconn_wheel_rm(struct tcp_connection* c)
+{
+	if (c->t_slot!=TCP_WHEEL_NONE){
+		tcpconn_listrm(tcp_wheel[c->t_slot], c, t_next, t_prev);
+		c->t_slot=TCP_WHEEL_NONE;
+	}
+}
+
+
+
+/*! \brief moves c in the wheel after its timeout was shortened */
+static inline void tcpconn_wheel_update(struct tcp_connection* c)
+{
+	tcpconn_wheel_rm(c);
+	tcpconn_wheel_add(c, tcp_wheel_ticks);
+}
+
+
+
+/*! \brief makes c visible to the other processes ("tcp main" only) */
 struct tcp_connection*  tcpconn_add(struct tcp_connection *c)
 {
 	unsigned hash;
 
 	if (c){
-		TCPCONN_LOCK;
+		TCPCONN_LOCK(c->id);
 		/* add it at the begining of the list*/
 		hash=tcp_id_hash(c->id);
 		c->id_hash=hash;
@@ -485,10 +564,13 @@ struct tcp_connection*  tcpconn_add(struct tcp_connection *c)
 		c->con_aliases[0].port=c->rcv.src_port;
 		c->con_aliases[0].hash=hash;
 		c->con_aliases[0].parent=c;
+		TCP_ALIAS_LOCK(hash);
 		tcpconn_listadd(tcpconn_aliases_hash[hash], &c->con_aliases[0],
 						next, prev);
+		TCP_ALIAS_UNLOCK(hash);
 		c->aliases++;
-		TCPCONN_UNLOCK;
+		tcpconn_wheel_add(c, tcp_wheel_ticks);
+		TCPCONN_UNLOCK(c->id);
 		LM_DBG("hashes: %d, %d\n", hash, c->id_hash);
 		return c;
 	}else{
@@ -498,15 +580,41 @@ struct tcp_connection*  tcpconn_add(struct tcp_connection *c)
 }
 
 
-/*! \brief unsafe tcpconn_rm version (nolocks) */
+/*! \brief frees the data queued for writing on c
+ * (write_lock must be held if the connection is in use) */
+static void tcpconn_wq_drop(struct tcp_connection* c)
+{
+	struct tcp_wq_chunk* ch;
+
+	while( (ch=c->wq_first)!=0 ){
+		c->wq_first=ch->next;
+		shm_free(ch);
+	}
+	c->wq_last=0;
+	if (c->wq_size){
+		update_stat(tcp_async_queued, -(long)c->wq_size);
+		c->wq_size=0;
+	}
+}
+
+
+
+/*! \brief unsafe tcpconn_rm version (the lock of the partition of c must
+ * be held), "tcp main" only */
 void _tcpconn_rm(struct tcp_connection* c)
 {
 	int r;
 	tcpconn_listrm(tcpconn_id_hash[c->id_hash], c, id_next, id_prev);
 	/* remove all the aliases */
-	for (r=0; r<c->aliases; r++)
-		tcpconn_listrm(tcpconn_aliases_hash[c->con_aliases[r].hash], 
-						&c->con_aliases[r], next, prev);
+	for (r=0; r<c->aliases; r++){
+		TCP_ALIAS_LOCK(c->con_aliases[r].hash);
+		tcpconn_listrm(tcpconn_aliases_hash[c->con_aliases[r].hash],
+			&c->con_aliases[r], next, prev);
+		TCP_ALIAS_UNLOCK(c->con_aliases[r].hash);
+	}
+	tcpconn_wheel_rm(c);
+	(*tcpconn_gen)++;
+	tcpconn_wq_drop(c);
 	lock_destroy(&c->write_lock);
 #ifdef USE_TLS
 	if (c->type==PROTO_TLS) tls_tcpconn_clean(c);
@@ -516,16 +624,23 @@ void _tcpconn_rm(struct tcp_connection* c)
 
 
 
+/*! \brief "tcp main" only */
 void tcpconn_rm(struct tcp_connection* c)
 {
 	int r;
-	TCPCONN_LOCK;
+	TCPCONN_LOCK(c->id);
 	tcpconn_listrm(tcpconn_id_hash[c->id_hash], c, id_next, id_prev);
 	/* remove all the aliases */
-	for (r=0; r<c->aliases; r++)
-		tcpconn_listrm(tcpconn_aliases_hash[c->con_aliases[r].hash], 
-						&c->con_aliases[r], next, prev);
-	TCPCONN_UNLOCK;
+	for (r=0; r<c->aliases; r++){
+		TCP_ALIAS_LOCK(c->con_aliases[r].hash);
+		tcpconn_listrm(tcpconn_aliases_hash[c->con_aliases[r].hash],
+			&c->con_aliases[r], next, prev);
+		TCP_ALIAS_UNLOCK(c->con_aliases[r].hash);
+	}
+	tcpconn_wheel_rm(c);
+	(*tcpconn_gen)++;
+	TCPCONN_UNLOCK(c->id);
+	tcpconn_wq_drop(c);
 	lock_destroy(&c->write_lock);
 #ifdef USE_TLS
 	if ((c->type==PROTO_TLS)&&(c->extra_data)) tls_tcpconn_clean(c);
@@ -534,59 +649,84 @@ void tcpconn_rm(struct tcp_connection* c)
 }
 
 
-/*! \brief finds a connection, if id=0 uses the ip addr & port (host byte order)
- * \note WARNING: unprotected (locks) use tcpconn_get unless you really
- * know what you are doing */
-struct tcp_connection* _tcpconn_find(int id, struct ip_addr* ip, int port)
+/*! \brief finds a connection by id
+ * \note WARNING: unprotected (locks), the lock of the partition of id must
+ * be held; use tcpconn_get unless you really know what you are doing */
+static struct tcp_connection* _tcpconn_find_id(int id)
 {
-
 	struct tcp_connection *c;
-	struct tcp_conn_alias* a;
 	unsigned hash;
-	
-#ifdef EXTRA_DEBUG
-	LM_DBG("%d  port %d\n",id, port);
-	if (ip) print_ip("tcpconn_find: ip ", ip, "\n");
-#endif
-	if (id){
-		hash=tcp_id_hash(id);
-		for (c=tcpconn_id_hash[hash]; c; c=c->id_next){
+
+	hash=tcp_id_hash(id);
+	for (c=tcpconn_id_hash[hash]; c; c=c->id_next){
 #ifdef EXTRA_DEBUG
-			LM_DBG("c=%p, c->id=%d, port=%d\n",c, c->id, c->rcv.src_port);
-			print_ip("ip=", &c->rcv.src_ip, "\n");
+		LM_DBG("c=%p, c->id=%d, port=%d\n",c, c->id, c->rcv.src_port);
+		print_ip("ip=", &c->rcv.src_ip, "\n");
 #endif
-			if ((id==c->id)&&(c->state!=S_CONN_BAD)) return c;
-		}
-	}else if (ip){
-		hash=tcp_addr_hash(ip, port);
-		for (a=tcpconn_aliases_hash[hash]; a; a=a->next){
+		if ((id==c->id)&&(c->state!=S_CONN_BAD)) return c;
+	}
+	return 0;
+}
+
+
+
+/*! \brief finds a connection by the ip addr & port (host byte order)
+ * \note WARNING: unprotected (locks), the lock of the alias hash bucket
+ * must be held */
+static struct tcp_connection* _tcpconn_find_addr(struct ip_addr* ip, int port)
+{
+	struct tcp_conn_alias* a;
+	unsigned hash;
+
+	hash=tcp_addr_hash(ip, port);
+	for (a=tcpconn_aliases_hash[hash]; a; a=a->next){
 #ifdef EXTRA_DEBUG
-			LM_DBG("a=%p, c=%p, c->id=%d, alias port= %d port=%d\n", 
-				a, a->parent, a->parent->id, a->port, a->parent->rcv.src_port);
-			print_ip("ip=",&a->parent->rcv.src_ip,"\n");
+		LM_DBG("a=%p, c=%p, c->id=%d, alias port= %d port=%d\n", 
+			a, a->parent, a->parent->id, a->port, a->parent->rcv.src_port);
+		print_ip("ip=",&a->parent->rcv.src_ip,"\n");
 #endif
-			if ( (a->parent->state!=S_CONN_BAD) && (port==a->port) &&
-					(ip_addr_cmp(ip, &a->parent->rcv.src_ip)) )
-				return a->parent;
-		}
+		if ( (a->parent->state!=S_CONN_BAD) && (port==a->port) &&
+				(ip_addr_cmp(ip, &a->parent->rcv.src_ip)) )
+			return a->parent;
 	}
 	return 0;
 }
 
 
 
-/*! \brief _tcpconn_find with locks and timeout */
+/*! \brief finds a connection, if id=0 uses the ip addr & port (host byte
+ * order), with locks and timeout */
 struct tcp_connection* tcpconn_get(int id, struct ip_addr* ip, int port,
 									int timeout)
 {
 	struct tcp_connection* c;
-	TCPCONN_LOCK;
-	c=_tcpconn_find(id, ip, port);
+	unsigned hash;
+
+#ifdef EXTRA_DEBUG
+	LM_DBG("%d  port %d\n",id, port);
+	if (ip) print_ip("tcpconn_get: ip ", ip, "\n");
+#endif
+	if (id==0){
+		if (ip==0)
+			return 0;
+		/* the refcnt is protected by the partition lock, taken after the
+		 * alias one - look for the id only, the connection is looked up
+		 * again by id (the ids are not reused) */
+		hash=tcp_addr_hash(ip, port);
+		TCP_ALIAS_LOCK(hash);
+		c=_tcpconn_find_addr(ip, port);
+		if (c) id=c->id;
+		TCP_ALIAS_UNLOCK(hash);
+		if (id==0)
+			return 0;
+	}
+	TCPCONN_LOCK(id);
+	c=_tcpconn_find_id(id);
 	if (c) {
-			c->refcnt++;
-			c->timeout=get_ticks()+timeout;
+		c->refcnt++;
+		c->timeout=get_ticks()+timeout;
 	}
-	TCPCONN_UNLOCK;
+	TCPCONN_UNLOCK(id);
 	return c;
 }
 
@@ -597,54 +737,60 @@ struct tcp_connection* tcpconn_get(int id, struct ip_addr* ip, int port,
 int tcpconn_add_alias(int id, int port, int proto)
 {
 	struct tcp_connection* c;
-	unsigned hash;
 	struct tcp_conn_alias* a;
+	struct tcp_connection* p;
+	unsigned hash;
+	int a_id;
 	
-	a=0;
 	/* fix the port */
 	port=port?port:((proto==PROTO_TLS)?SIPS_PORT:SIP_PORT);
-	TCPCONN_LOCK;
-	/* check if alias already exists */
-	c=_tcpconn_find(id, 0, 0);
-	if (c){
-		hash=tcp_addr_hash(&c->rcv.src_ip, port);
-		/* search the aliases for an already existing one */
-		for (a=tcpconn_aliases_hash[hash]; a; a=a->next){
-			if ( (a->parent->state!=S_CONN_BAD) && (port==a->port) &&
-					(ip_addr_cmp(&c->rcv.src_ip, &a->parent->rcv.src_ip)) ){
-				/* found */
-				if (a->parent!=c) goto error_sec;
-				else goto ok;
-			}
-		}
-		if (c->aliases>=TCP_CON_MAX_ALIASES) goto error_aliases;
-		c->con_aliases[c->aliases].parent=c;
-		c->con_aliases[c->aliases].port=port;
-		c->con_aliases[c->aliases].hash=hash;
-		tcpconn_listadd(tcpconn_aliases_hash[hash], 
-								&c->con_aliases[c->aliases], next, prev);
-		c->aliases++;
-	}else goto error_not_found;
-ok:
-	TCPCONN_UNLOCK;
+	TCPCONN_LOCK(id);
+	c=_tcpconn_find_id(id);
+	if (c==0) {
+		TCPCONN_UNLOCK(id);
+		goto error_not_found;
+	}
+	hash=tcp_addr_hash(&c->rcv.src_ip, port);
+	/* check if alias already exists and add it under the same lock */
+	TCP_ALIAS_LOCK(hash);
+	p=_tcpconn_find_addr(&c->rcv.src_ip, port);
+	if (p){
+		a_id=p->id;
+		TCP_ALIAS_UNLOCK(hash);
+		TCPCONN_UNLOCK(id);
+		if (a_id!=id) goto error_sec;
+#ifdef EXTRA_DEBUG
+		LM_DBG("alias already present\n");
+#endif
+		return 0;
+	}
+	if (c->aliases>=TCP_CON_MAX_ALIASES) {
+		TCP_ALIAS_UNLOCK(hash);
+		TCPCONN_UNLOCK(id);
+		goto error_aliases;
+	}
+	a=&c->con_aliases[c->aliases];
+	a->parent=c;
+	a->port=port;
+	a->hash=hash;
+	tcpconn_listadd(tcpconn_aliases_hash[hash], a, next, prev);
+	c->aliases++;
+	TCP_ALIAS_UNLOCK(hash);
+	TCPCONN_UNLOCK(id);
 #ifdef EXTRA_DEBUG
-	if (a) LM_DBG("alias already present\n");
-	else   LM_DBG("alias port %d for hash %d, id %d\n", port, hash, c->id);
+	LM_DBG("alias port %d for hash %d, id %d\n", port, hash, id);
 #endif
 	return 0;
 error_aliases:
-	TCPCONN_UNLOCK;
-	LM_ERR("too many aliases for connection %p (%d)\n", c, c->id);
+	LM_ERR("too many aliases for connection %d\n", id);
 	return -1;
 error_not_found:
-	TCPCONN_UNLOCK;
 	LM_ERR("no connection found for id %d\n",id);
 	return -1;
 error_sec:
-	TCPCONN_UNLOCK;
 	LM_ERR("possible port hijack attempt\n");
 	LM_ERR("alias already present and points to another connection "
-			"(%d : %d and %d : %d)\n", a->parent->id,  port, c->id, port);
+			"(%d : %d and %d : %d)\n", a_id,  port, id, port);
 	return -1;
 }
 
@@ -652,18 +798,249 @@ error_sec:
 
 void tcpconn_ref(struct tcp_connection* c)
 {
-	TCPCONN_LOCK;
+	TCPCONN_LOCK(c->id);
 	c->refcnt++; /* FIXME: atomic_dec */
-	TCPCONN_UNLOCK;
+	TCPCONN_UNLOCK(c->id);
 }
 
 
 
 void tcpconn_put(struct tcp_connection* c)
 {
-	TCPCONN_LOCK;
+	TCPCONN_LOCK(c->id);
 	c->refcnt--; /* FIXME: atomic_dec */
-	TCPCONN_UNLOCK;
+	TCPCONN_UNLOCK(c->id);
+}
+
+
+
+/*! \brief queues the data on c, to be written by "tcp main" (async mode)
+ * \note it consumes the reference held by the caller on c
+ * \return len on success, -1 on error */
+static int tcpconn_async_write(struct tcp_connection* c, char* buf,
+																unsigned len)
+{
+	struct tcp_wq_chunk* ch;
+	long response[2];
+	int notify;
+
+	ch=(struct tcp_wq_chunk*)shm_malloc(sizeof(struct tcp_wq_chunk)+len);
+	if (ch==0){
+		LM_ERR("no more shm memory\n");
+		goto error;
+	}
+	memcpy(ch->buf, buf, len);
+	ch->len=len;
+	ch->pos=0;
+	ch->next=0;
+
+	lock_get(&c->write_lock);
+	if (c->state==S_CONN_BAD){
+		lock_release(&c->write_lock);
+		LM_ERR("connection %p (id %d) is bad\n", c, c->id);
+		goto error;
+	}
+	if (c->wq_size+len > (unsigned int)tcp_async_max_queue){
+		lock_release(&c->write_lock);
+		LM_ERR("write queue of connection %p (id %d) is full (%u bytes), "
+			"dropping %u bytes\n", c, c->id, c->wq_size, len);
+		update_stat(tcp_async_drops, 1);
+		goto error;
+	}
+	/* if the queue is not empty, "tcp main" already knows about it */
+	notify=(c->wq_first==0);
+	if (notify){
+		c->wq_first=ch;
+		c->wq_timeout=get_ticks()+tcp_send_timeout;
+	}else{
+		c->wq_last->next=ch;
+	}
+	c->wq_last=ch;
+	c->wq_size+=len;
+	lock_release(&c->write_lock);
+	update_stat(tcp_async_queued, len);
+
+	if (!notify){
+		tcpconn_put(c);
+		return len;
+	}
+
+	/* wake up "tcp main"; our reference is passed to it and kept
+	 * until the queue is empty */
+	response[0]=(long)c;
+	response[1]=CONN_ASYNC_WRITE;
+	if (send_all(unix_tcp_sock, response, sizeof(response))<=0){
+		LM_ERR("failed to notify tcp main: %s (%d)\n",
+				strerror(errno), errno);
+		/* nobody will write the queue -> give up on the connection */
+		lock_get(&c->write_lock);
+		tcpconn_wq_drop(c);
+		c->state=S_CONN_BAD;
+		c->timeout=0;
+		lock_release(&c->write_lock);
+		tcpconn_put(c);
+		return -1;
+	}
+	return len;
+error:
+	if (ch) shm_free(ch);
+	tcpconn_put(c);
+	return -1;
+}
+
+
+
+/*! \brief allocates the fd cache, before forking (each process gets
+ * its own copy)
+ * \return 0 on success, -1 on error */
+static int tcp_fd_cache_init(void)
+{
+	unsigned int size;
+	int i;
+
+	for (size=1; size<(unsigned int)tcp_fd_cache_size; size<<=1);
+	fd_cache=(struct tcp_fd_cache_entry*)pkg_malloc(
+			tcp_fd_cache_size*sizeof(struct tcp_fd_cache_entry));
+	fd_cache_hash=(struct tcp_fd_cache_entry**)pkg_malloc(
+			size*sizeof(struct tcp_fd_cache_entry*));
+	if (fd_cache==0 || fd_cache_hash==0){
+		LM_CRIT("could not alloc the fd cache in pkg memory\n");
+		return -1;
+	}
+	memset(fd_cache_hash, 0, size*sizeof(struct tcp_fd_cache_entry*));
+	fd_cache_hash_mask=size-1;
+	for (i=0; i<tcp_fd_cache_size; i++){
+		fd_cache[i].id=0;
+		fd_cache[i].fd=-1;
+		fd_cache[i].h_next=(i+1<tcp_fd_cache_size)?&fd_cache[i+1]:0;
+	}
+	fd_cache_free=fd_cache;
+	fd_cache_gen=*tcpconn_gen;
+	return 0;
+}
+
+
+
+/*! \brief unlinks a cache entry, closes its fd and puts it on the free list */
+static void tcp_fd_cache_release(struct tcp_fd_cache_entry* e)
+{
+	struct tcp_fd_cache_entry** p;
+
+	for (p=&fd_cache_hash[e->id & fd_cache_hash_mask]; *p; p=&(*p)->h_next)
+		if (*p==e){
+			*p=e->h_next;
+			break;
+		}
+	if (e->lru_prev) e->lru_prev->lru_next=e->lru_next;
+	else fd_cache_lru=e->lru_next;
+	if (e->lru_next) e->lru_next->lru_prev=e->lru_prev;
+	else fd_cache_lru_last=e->lru_prev;
+
+	close(e->fd);
+	e->id=0;
+	e->fd=-1;
+	e->h_next=fd_cache_free;
+	fd_cache_free=e;
+}
+
+
+
+/*! \brief closes the cached fds of the connections removed by "tcp main"
+ * (at most once per tick, only if some connection was removed since the
+ * last check) */
+static void tcp_fd_cache_sweep(void)
+{
+	struct tcp_fd_cache_entry *e, *next;
+	struct tcp_connection* c;
+	unsigned int ticks;
+
+	if (fd_cache_gen==*tcpconn_gen)
+		return;
+	ticks=get_ticks();
+	if (ticks==fd_cache_sweep_ticks)
+		return;
+	fd_cache_sweep_ticks=ticks;
+
+	fd_cache_gen=*tcpconn_gen;
+	for (e=fd_cache_lru; e; e=next){
+		next=e->lru_next;
+		TCPCONN_LOCK(e->id);
+		c=_tcpconn_find_id(e->id);
+		TCPCONN_UNLOCK(e->id);
+		if (c!=e->c)
+			tcp_fd_cache_release(e);
+	}
+}
+
+
+
+/*! \brief looks up the cached fd of c (which must be referenced)
+ * \return the fd or -1 if not cached */
+static int tcp_fd_cache_get(struct tcp_connection* c)
+{
+	struct tcp_fd_cache_entry* e;
+
+	tcp_fd_cache_sweep();
+	for (e=fd_cache_hash[c->id & fd_cache_hash_mask]; e; e=e->h_next)
+		if (e->id==c->id)
+			break;
+	if (e==0)
+		return -1;
+	if (e->c!=c){
+		/* the id was reused */
+		tcp_fd_cache_release(e);
+		return -1;
+	}
+	/* move in front of the lru list */
+	if (e->lru_prev){
+		e->lru_prev->lru_next=e->lru_next;
+		if (e->lru_next) e->lru_next->lru_prev=e->lru_prev;
+		else fd_cache_lru_last=e->lru_prev;
+		e->lru_prev=0;
+		e->lru_next=fd_cache_lru;
+		fd_cache_lru->lru_prev=e;
+		fd_cache_lru=e;
+	}
+	return e->fd;
+}
+
+
+
+/*! \brief keeps fd for the next sends on c, closing the least recently
+ * used fd if the cache is full */
+static void tcp_fd_cache_add(struct tcp_connection* c, int fd)
+{
+	struct tcp_fd_cache_entry* e;
+
+	if (fd_cache_free==0)
+		tcp_fd_cache_release(fd_cache_lru_last);
+	e=fd_cache_free;
+	fd_cache_free=e->h_next;
+
+	e->id=c->id;
+	e->c=c;
+	e->fd=fd;
+	e->h_next=fd_cache_hash[c->id & fd_cache_hash_mask];
+	fd_cache_hash[c->id & fd_cache_hash_mask]=e;
+	e->lru_prev=0;
+	e->lru_next=fd_cache_lru;
+	if (fd_cache_lru) fd_cache_lru->lru_prev=e;
+	else fd_cache_lru_last=e;
+	fd_cache_lru=e;
+}
+
+
+
+/*! \brief drops the cached fd of c (closing it), if any */
+static void tcp_fd_cache_del(struct tcp_connection* c)
+{
+	struct tcp_fd_cache_entry* e;
+
+	for (e=fd_cache_hash[c->id & fd_cache_hash_mask]; e; e=e->h_next)
+		if (e->id==c->id && e->c==c){
+			tcp_fd_cache_release(e);
+			return;
+		}
 }
 
 
@@ -677,11 +1054,13 @@ int tcp_send(struct socket_info* send_sock, int type, char* buf, unsigned len,
 	struct ip_addr ip;
 	int port;
 	int fd;
+	int cached;
 	long response[2];
 	int n;
 	struct timeval get,rcv,snd;
 	
 	port=0;
+	cached=0;
 
 	reset_tcp_vars(tcpthreshold);
 	start_expire_timer(get,tcpthreshold);
@@ -734,10 +1113,24 @@ no_id:
 				n=-1;
 				goto end;
 			}	
+			if (tcp_fd_cache_size){
+				tcp_fd_cache_add(c, fd);
+				cached=1;
+			}
 			goto send_it;
 		}
 get_fd:
 		get_time_difference(get,tcpthreshold,tcp_timeout_con_get);
+		if (tcp_async && c->type==PROTO_TCP){
+			/* no fd needed, "tcp main" does the writing */
+			LM_DBG("tcp connection found (%p), queuing data\n", c);
+			return tcpconn_async_write(c, buf, len);
+		}
+		if (tcp_fd_cache_size && (fd=tcp_fd_cache_get(c))!=-1){
+			LM_DBG("tcp connection found (%p), using cached fd %d\n", c, fd);
+			cached=1;
+			goto send_it;
+		}
 			/* todo: see if this is not the same process holding
 			 *  c  and if so send directly on c->fd */
 			LM_DBG("tcp connection found (%p), acquiring fd\n", c);
@@ -774,6 +1167,10 @@ get_fd:
 				goto end;
 			}
 			LM_DBG("after receive_fd: c= %p n=%d fd=%d\n",c, n, fd);
+			if (tcp_fd_cache_size){
+				tcp_fd_cache_add(c, fd);
+				cached=1;
+			}
 		
 	
 	
@@ -808,11 +1205,12 @@ send_it:
 			LM_ERR("return failed (write):%s (%d)\n",
 					strerror(errno), errno);
 		}
-		close(fd);
+		if (cached) tcp_fd_cache_del(c);
+		else close(fd);
 		return -1; /* error return, no tcpconn_put */
 	}
 end:
-	close(fd);
+	if (!cached) close(fd);
 release_c:
 	tcpconn_put(c); /* release c (lock; dec refcnt; unlock) */
 	return n;
@@ -972,6 +1370,7 @@ static inline int handle_new_connect(struct socket_info* si)
 	struct tcp_connection* tcpconn;
 	socklen_t su_len;
 	int new_sock;
+	int id;
 	
 	/* got a connection on r */
 	su_len=sizeof(su);
@@ -1005,13 +1404,17 @@ static inline int handle_new_connect(struct socket_info* si)
 		/* pass it to a child */
 		if(send2child(tcpconn)<0){
 			LM_ERR("no children available\n");
-			TCPCONN_LOCK;
+			id=tcpconn->id;
+			TCPCONN_LOCK(id);
 			tcpconn->refcnt--;
 			if (tcpconn->refcnt==0){
 				close(tcpconn->s);
 				_tcpconn_rm(tcpconn);
-			}else tcpconn->timeout=0; /* force expire */
-			TCPCONN_UNLOCK;
+			}else{
+				tcpconn->timeout=0; /* force expire */
+				tcpconn_wheel_update(tcpconn);
+			}
+			TCPCONN_UNLOCK(id);
 		}
 	}else{ /*tcpconn==0 */
 		LM_ERR("tcpconn_new failed, closing socket\n");
@@ -1027,8 +1430,10 @@ static inline int handle_new_connect(struct socket_info* si)
 static void tcpconn_destroy(struct tcp_connection* tcpconn)
 {
 	int fd;
+	int id;
 
-	TCPCONN_LOCK; /*avoid races w/ tcp_send*/
+	id=tcpconn->id;
+	TCPCONN_LOCK(id); /*avoid races w/ tcp_send*/
 	tcpconn->refcnt--;
 	if (tcpconn->refcnt==0){ 
 		LM_DBG("destroying connection %p, flags %04x\n",
@@ -1040,17 +1445,164 @@ static void tcpconn_destroy(struct tcp_connection* tcpconn)
 			tls_close(tcpconn, fd);
 #endif
 		_tcpconn_rm(tcpconn);
+		/* other processes may still have the fd cached */
+		if (tcp_fd_cache_size) shutdown(fd, SHUT_RDWR);
 		close(fd);
 		tcp_connections_no--;
 	}else{
 		/* force timeout */
 		tcpconn->timeout=0;
 		tcpconn->state=S_CONN_BAD;
+		tcpconn_wheel_update(tcpconn);
 		LM_DBG("delaying (%p, flags %04x) ...\n",
 				tcpconn, tcpconn->flags);
 		
 	}
-	TCPCONN_UNLOCK;
+	TCPCONN_UNLOCK(id);
+}
+
+
+
+/*! \brief writes from the queue of c as much as the socket takes
+ * \return -1 on error, 0 if data is left in the queue, 1 if the
+ *          queue is empty */
+static int tcpconn_async_flush(struct tcp_connection* c)
+{
+	struct tcp_wq_chunk* ch;
+	int n;
+	int ret;
+
+	ret=1;
+	lock_get(&c->write_lock);
+	while( (ch=c->wq_first)!=0 ){
+		n=send(c->s, ch->buf+ch->pos, ch->len-ch->pos,
+#ifdef HAVE_MSG_NOSIGNAL
+				MSG_NOSIGNAL
+#else
+				0
+#endif
+			);
+		if (n<0){
+			if (errno==EINTR) continue;
+			if (errno==EAGAIN || errno==EWOULDBLOCK){
+				ret=0;
+				break;
+			}
+			LM_ERR("failed to send on %p (id %d): (%d) %s\n",
+					c, c->id, errno, strerror(errno));
+			ret=-1;
+			break;
+		}
+		ch->pos+=n;
+		c->wq_size-=n;
+		update_stat(tcp_async_queued, -n);
+		c->wq_timeout=get_ticks()+tcp_send_timeout;
+		if (ch->pos<ch->len)
+			continue;
+		c->wq_first=ch->next;
+		if (c->wq_first==0)
+			c->wq_last=0;
+		shm_free(ch);
+	}
+	if (ret<0){
+		tcpconn_wq_drop(c);
+		c->state=S_CONN_BAD;
+		c->timeout=0;
+	}
+	lock_release(&c->write_lock);
+	return ret;
+}
+
+
+
+/*! \brief stops watching c for writing */
+static void tcpconn_async_unwatch(struct tcp_connection* c)
+{
+	if (c->wfd==-1)
+		return;
+	io_watch_del(&io_h, c->wfd, -1, IO_FD_CLOSING);
+	close(c->wfd);
+	c->wfd=-1;
+	tcpconn_listrm(tcp_async_list, c, w_next, w_prev);
+}
+
+
+
+/*! \brief drops the write queue and the connection itself
+ * (releases the reference held for the queue) */
+static void tcpconn_async_close(struct tcp_connection* c)
+{
+	lock_get(&c->write_lock);
+	tcpconn_wq_drop(c);
+	c->state=S_CONN_BAD;
+	c->timeout=0;
+	lock_release(&c->write_lock);
+	tcpconn_async_unwatch(c);
+	if (!(c->flags & F_CONN_REMOVED) && (c->s!=-1)){
+		io_watch_del(&io_h, c->s, -1, IO_FD_CLOSING);
+		c->flags|=F_CONN_REMOVED;
+	}
+	tcpconn_destroy(c);
+}
+
+
+
+/*! \brief writes the queued data of c; if the socket is full, a dup of
+ * its fd is watched for writing. Once the queue is empty, the reference
+ * passed by the process which queued the first chunk is released.
+ * \return handle_* return convention (always 0 - no repeat)
+ */
+static int handle_tcpconn_write(struct tcp_connection* c)
+{
+	int ret;
+
+	ret=tcpconn_async_flush(c);
+	if (ret==0){
+		if (c->wfd!=-1)
+			return 0; /* already watched */
+		c->wfd=dup(c->s);
+		if (c->wfd==-1){
+			LM_ERR("dup failed: (%d) %s\n", errno, strerror(errno));
+			goto error;
+		}
+		if (io_watch_add_ev(&io_h, c->wfd, F_TCPWRITE, c, IO_WATCH_WRITE)<0){
+			LM_ERR("failed to watch connection %p (id %d) for writing\n",
+					c, c->id);
+			close(c->wfd);
+			c->wfd=-1;
+			goto error;
+		}
+		tcpconn_listadd(tcp_async_list, c, w_next, w_prev);
+		return 0;
+	}
+	if (ret<0)
+		goto error;
+	tcpconn_async_unwatch(c);
+	tcpconn_put(c);
+	return 0;
+error:
+	tcpconn_async_close(c);
+	return 0;
+}
+
+
+
+/*! \brief closes the connections which could not write anything from
+ * their queue for tcp_send_timeout */
+static inline void tcpconn_async_timeout(void)
+{
+	struct tcp_connection *c, *next;
+	unsigned int ticks;
+
+	ticks=get_ticks();
+	for(c=tcp_async_list; c; c=next){
+		next=c->w_next;
+		if (ticks>c->wq_timeout){
+			LM_ERR("async write timeout on %p (id %d), %u bytes pending\n",
+					c, c->id, c->wq_size);
+			tcpconn_async_close(c);
+		}
+	}
 }
 
 
@@ -1069,6 +1621,7 @@ static void tcpconn_destroy(struct tcp_connection* tcpconn)
 inline static int handle_tcpconn_ev(struct tcp_connection* tcpconn, int fd_i)
 {
 	int fd;
+	int id;
 	
 	/*  is refcnt!=0 really necessary? 
 	 *  No, in fact it's a bug: I can have the following situation: a send only
@@ -1093,14 +1646,18 @@ inline static int handle_tcpconn_ev(struct tcp_connection* tcpconn, int fd_i)
 	tcpconn_ref(tcpconn); /* refcnt ++ */
 	if (send2child(tcpconn)<0){
 		LM_ERR("no children available\n");
-		TCPCONN_LOCK;
+		id=tcpconn->id;
+		TCPCONN_LOCK(id);
 		tcpconn->refcnt--;
 		if (tcpconn->refcnt==0){
 			fd=tcpconn->s;
 			_tcpconn_rm(tcpconn);
 			close(fd);
-		}else tcpconn->timeout=0; /* force expire*/
-		TCPCONN_UNLOCK;
+		}else{
+			tcpconn->timeout=0; /* force expire*/
+			tcpconn_wheel_update(tcpconn);
+		}
+		TCPCONN_UNLOCK(id);
 	}
 	return 0; /* we are not interested in possibly queued io events, 
 				 the fd was either passed to a child, or closed */
@@ -1339,6 +1896,11 @@ inline static int handle_ser_child(struct process_table* p, int fd_i)
 			io_watch_add(&io_h, tcpconn->s, F_TCPCONN, tcpconn);
 			tcpconn->flags&=~F_CONN_REMOVED;
 			break;
+		case CONN_ASYNC_WRITE:
+			/* data queued on an idle queue; the reference of the
+			 * sender is kept until the queue is empty */
+			handle_tcpconn_write(tcpconn);
+			break;
 		default:
 			LM_CRIT("unknown cmd %d\n", cmd);
 	}
@@ -1380,6 +1942,9 @@ inline static int handle_io(struct fd_map* fm, int idx)
 		case F_PROC:
 			ret=handle_ser_child((struct process_table*)fm->data, idx);
 			break;
+		case F_TCPWRITE:
+			ret=handle_tcpconn_write((struct tcp_connection*)fm->data);
+			break;
 		case F_NONE:
 			LM_CRIT("empty fd map\n");
 			goto error;
@@ -1394,48 +1959,76 @@ error:
 
 
 
-/*! \brief very inefficient for now - FIXME
+/*! \brief removes the expired connections, visiting only the wheel slots
+ * of the ticks elapsed since the last call (force removes all of them)
  * keep in sync with tcpconn_destroy, the "delete" part should be
  * the same except for io_watch_del..
- * \todo FIXME (very inefficient for now)
  */
 static inline void tcpconn_timeout(int force)
 {
 	struct tcp_connection *c, *next;
 	unsigned int ticks;
+	unsigned int slot;
 	unsigned h;
 	int fd;
+	int id;
 	
 	
+	if (force){
+		for(h=0; h<TCP_ID_HASH_SIZE; h++){
+			TCPCONN_LOCK(h);
+			for(c=tcpconn_id_hash[h]; c; c=next){
+				next=c->id_next;
+#ifdef USE_TLS
+				if (c->type==PROTO_TLS)
+					tls_close(c, c->s);
+#endif
+				_tcpconn_rm(c);
+				tcp_connections_no--;
+			}
+			TCPCONN_UNLOCK(h);
+		}
+		return;
+	}
+
+	if (tcp_async_list)
+		tcpconn_async_timeout();
+
 	ticks=get_ticks();
-	TCPCONN_LOCK; /* fixme: we can lock only on delete IMO */
-	for(h=0; h<TCP_ID_HASH_SIZE; h++){
-		c=tcpconn_id_hash[h];
-		while(c){
-			next=c->id_next;
-			if (force ||((c->refcnt==0) && (ticks>c->timeout))) {
-				if (!force)
-					LM_DBG("timeout for hash=%d - %p"
-							" (%d > %d)\n", h, c, ticks, c->timeout);
+	for( ; (int)(ticks-tcp_wheel_ticks)>=0 ; tcp_wheel_ticks++){
+		slot=tcp_wheel_ticks&(TCP_WHEEL_SIZE-1);
+		c=tcp_wheel[slot];
+		tcp_wheel[slot]=0;
+		for( ; c ; c=next){
+			next=c->t_next;
+			c->t_slot=TCP_WHEEL_NONE;
+			id=c->id;
+			TCPCONN_LOCK(id);
+			if ((c->refcnt==0) && (ticks>c->timeout)) {
+				LM_DBG("timeout for id=%d - %p (%d > %d)\n",
+						id, c, ticks, c->timeout);
 				fd=c->s;
 #ifdef USE_TLS
 				if (c->type==PROTO_TLS)
 					tls_close(c, fd);
 #endif
+				if ((fd>0) && !(c->flags & F_CONN_REMOVED)){
+					io_watch_del(&io_h, fd, -1, IO_FD_CLOSING);
+					c->flags|=F_CONN_REMOVED;
+				}
 				_tcpconn_rm(c);
-				if ((!force)&&(fd>0)&&(c->refcnt==0)) {
-					if (!(c->flags & F_CONN_REMOVED)){
-						io_watch_del(&io_h, fd, -1, IO_FD_CLOSING);
-						c->flags|=F_CONN_REMOVED;
-					}
+				if (fd>0) {
+					if (tcp_fd_cache_size) shutdown(fd, SHUT_RDWR);
 					close(fd);
 				}
 				tcp_connections_no--;
+			}else{
+				/* still alive or in use, check it again later */
+				tcpconn_wheel_add(c, tcp_wheel_ticks+1);
 			}
-			c=next;
+			TCPCONN_UNLOCK(id);
 		}
 	}
-	TCPCONN_UNLOCK;
 }
 
 
@@ -1449,6 +2042,7 @@ void tcp_main_loop(void)
 
 	/* init io_wait (here because we want the memory allocated only in
 	 * the tcp_main process) */
+	tcp_wheel_ticks=get_ticks();
 
 	/*! \todo FIXME: TODO: make tcp_max_fd_no a config param */
 	if  (init_io_wait(&io_h, tcp_max_fd_no, tcp_poll_method)<0)
@@ -1584,14 +2178,23 @@ void destroy_tcp(void)
 			shm_free(connection_id);
 			connection_id=0;
 		}
+		if (tcpconn_gen){
+			shm_free(tcpconn_gen);
+			tcpconn_gen=0;
+		}
 		if (tcpconn_aliases_hash){
 			shm_free(tcpconn_aliases_hash);
 			tcpconn_aliases_hash=0;
 		}
-		if (tcpconn_lock){
-			lock_destroy(tcpconn_lock);
-			lock_dealloc((void*)tcpconn_lock);
-			tcpconn_lock=0;
+		if (tcpconn_locks){
+			lock_set_destroy(tcpconn_locks);
+			lock_set_dealloc(tcpconn_locks);
+			tcpconn_locks=0;
+		}
+		if (tcpconn_alias_locks){
+			lock_set_destroy(tcpconn_alias_locks);
+			lock_set_dealloc(tcpconn_alias_locks);
+			tcpconn_alias_locks=0;
 		}
 }
 
@@ -1601,16 +2204,27 @@ int init_tcp(void)
 {
 	char* poll_err;
 	
-	/* init lock */
-	tcpconn_lock=lock_alloc();
-	if (tcpconn_lock==0){
-		LM_CRIT("could not alloc lock\n");
+	/* init locks */
+	tcpconn_locks=lock_set_alloc(TCP_PARTITION_SIZE);
+	if (tcpconn_locks==0){
+		LM_CRIT("could not alloc lock set\n");
+		goto error;
+	}
+	if (lock_set_init(tcpconn_locks)==0){
+		LM_CRIT("could not init lock set\n");
+		lock_set_dealloc(tcpconn_locks);
+		tcpconn_locks=0;
 		goto error;
 	}
-	if (lock_init(tcpconn_lock)==0){
-		LM_CRIT("could not init lock\n");
-		lock_dealloc((void*)tcpconn_lock);
-		tcpconn_lock=0;
+	tcpconn_alias_locks=lock_set_alloc(TCP_ALIAS_LOCKS);
+	if (tcpconn_alias_locks==0){
+		LM_CRIT("could not alloc lock set\n");
+		goto error;
+	}
+	if (lock_set_init(tcpconn_alias_locks)==0){
+		LM_CRIT("could not init lock set\n");
+		lock_set_dealloc(tcpconn_alias_locks);
+		tcpconn_alias_locks=0;
 		goto error;
 	}
 	/* init tcp children array */
@@ -1628,9 +2242,19 @@ int init_tcp(void)
 		goto error;
 	}
 	*connection_id=1;
+	tcpconn_gen=(unsigned int*)shm_malloc(sizeof(unsigned int));
+	if (tcpconn_gen==0){
+		LM_CRIT("could not alloc globals in shm memory\n");
+		goto error;
+	}
+	*tcpconn_gen=0;
+	if (tcp_fd_cache_size<0)
+		tcp_fd_cache_size=0;
+	if (tcp_fd_cache_size && tcp_fd_cache_init()<0)
+		goto error;
 	/* alloc hashtables*/
 	tcpconn_aliases_hash=(struct tcp_conn_alias**)
-			shm_malloc(TCP_ALIAS_HASH_SIZE* sizeof(struct tcp_conn_alias*));
+			shm_malloc(TCP_ALIAS_HASH_SIZE*sizeof(struct tcp_conn_alias*));
 	if (tcpconn_aliases_hash==0){
 		LM_CRIT("could not alloc address hashtable in shm memory\n");
 		goto error;
@@ -1666,6 +2290,12 @@ int init_tcp(void)
 			LM_INFO("using %s as the TCP io watch method (config)\n",
 					poll_method_name(tcp_poll_method));
 	}
+	if (tcp_async && tcp_poll_method==POLL_SIGIO_RT){
+		/* the signal setup of the dup fds would change the original fds */
+		LM_WARN("async TCP writes not supported with %s, disabling them\n",
+				poll_method_name(tcp_poll_method));
+		tcp_async=0;
+	}
 	
 	return 0;
 error:
@@ -1698,6 +2328,9 @@ int tcp_init_children(int *chd_rank)
 	
 	tcp_max_fd_no=counted_processes*2 +r-1 /* timer */ +3; /* stdin/out/err*/
 	tcp_max_fd_no+=tcp_max_connections;
+	if (tcp_async)
+		/* dups of the connection fds, watched for writing */
+		tcp_max_fd_no+=tcp_max_connections;
 	
 	/* create the tcp sock_info structures */
 	/* copy the sockets --moved to main_loop*/
@@ -72,6 +72,7 @@
 enum fd_types { F_NONE, F_TCPMAIN, F_TCPCONN };		/*!< types used in io_wait* */
 
 static struct tcp_connection* tcp_conn_lst=0;		/*!< list of tcp connections handled by this process */
+static struct tcp_connection* tcp_conn_lst_last=0;
 static io_wait_h io_w; /* io_wait handler*/
 static int tcpmain_sock=-1;
 
@@ -743,6 +744,48 @@ skip:
 
 
 
+static inline void tcp_conn_lst_append(struct tcp_connection* con)
+{
+	con->c_next=0;
+	con->c_prev=tcp_conn_lst_last;
+	if (tcp_conn_lst_last) tcp_conn_lst_last->c_next=con;
+	else tcp_conn_lst=con;
+	tcp_conn_lst_last=con;
+}
+
+
+
+/*! \brief adds con to the list of connections handled by this process,
+ * with a new timeout; the list timeouts (c_timeout) are always set to
+ * ticks+TCP_CHILD_TIMEOUT, so appending keeps the list ordered by them */
+static inline void tcp_conn_lst_add(struct tcp_connection* con)
+{
+	con->timeout=get_ticks()+TCP_CHILD_TIMEOUT;
+	con->c_timeout=con->timeout;
+	tcp_conn_lst_append(con);
+}
+
+
+
+static inline void tcp_conn_lst_rm(struct tcp_connection* con)
+{
+	if (con->c_prev) con->c_prev->c_next=con->c_next;
+	else tcp_conn_lst=con->c_next;
+	if (con->c_next) con->c_next->c_prev=con->c_prev;
+	else tcp_conn_lst_last=con->c_prev;
+}
+
+
+
+/*! \brief updates the timeout of con, moving it at the end of the list */
+static inline void tcp_conn_lst_touch(struct tcp_connection* con)
+{
+	tcp_conn_lst_rm(con);
+	tcp_conn_lst_add(con);
+}
+
+
+
 /*! \brief
  *  handle io routine, based on the fd_map type
  * (it will be called from io_wait_loop* )
@@ -805,11 +848,10 @@ again:
 			 * already existing events => might call handle_io and
 			 * handle_io might decide to del. the new connection =>
 			 * must be in the list */
-			tcpconn_listadd(tcp_conn_lst, con, c_next, c_prev);
-			con->timeout=get_ticks()+TCP_CHILD_TIMEOUT;
+			tcp_conn_lst_add(con);
 			if (io_watch_add(&io_w, s, F_TCPCONN, con)<0){
 				LM_CRIT("failed to add new socket to the fd list\n");
-				tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
+				tcp_conn_lst_rm(con);
 				goto con_error;
 			}
 			break;
@@ -819,12 +861,12 @@ again:
 			if (resp<0){
 				ret=-1; /* some error occured */
 				io_watch_del(&io_w, con->fd, idx, IO_FD_CLOSING);
-				tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
+				tcp_conn_lst_rm(con);
 				con->state=S_CONN_BAD;
 				release_tcpconn(con, resp, tcpmain_sock);
 			}else{
 				/* update timeout */
-				con->timeout=get_ticks()+TCP_CHILD_TIMEOUT;
+				tcp_conn_lst_touch(con);
 			}
 			break;
 		case F_NONE:
@@ -860,7 +902,9 @@ void force_tcp_conn_lifetime(struct receive_info *rcv, unsigned int timeout)
 
 
 
-/*! \brief  releases expired connections and cleans up bad ones (state<0) */
+/*! \brief  releases expired connections and cleans up bad ones (state<0)
+ * \note only the head of the list (ordered by timeout) is visited, so the
+ * bad connections are found at the latest after TCP_CHILD_TIMEOUT */
 static inline void tcp_receive_timeout(void)
 {
 	struct tcp_connection* con;
@@ -868,18 +912,24 @@ static inline void tcp_receive_timeout(void)
 	unsigned int ticks;
 	
 	ticks=get_ticks();
-	for (con=tcp_conn_lst; con; con=next){
+	for (con=tcp_conn_lst; con && con->c_timeout<=ticks; con=next){
 		next=con->c_next; /* safe for removing */
 		if (con->state<0){   /* kill bad connections */ 
 			/* S_CONN_BAD or S_CONN_ERROR, remove it */
 			/* fd will be closed in release_tcpconn */
 			io_watch_del(&io_w, con->fd, -1, IO_FD_CLOSING);
-			tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
+			tcp_conn_lst_rm(con);
 			con->state=S_CONN_BAD;
 			release_tcpconn(con, CONN_ERROR, tcpmain_sock);
 			continue;
 		}
-		if (con->timeout<=ticks){
+		if (con->timeout>ticks){
+			/* timeout extended meanwhile by a sender (tcpconn_get),
+			 * check it again later */
+			tcp_conn_lst_rm(con);
+			con->c_timeout=ticks+TCP_CHILD_TIMEOUT;
+			tcp_conn_lst_append(con);
+		}else{
 			/* expired, return to "tcp main" */
 			if (c_tcp_con_id==con->id) {
 				con->lifetime = c_tcp_con_lifetime;
@@ -888,7 +938,7 @@ static inline void tcp_receive_timeout(void)
 					con, con->timeout, ticks,con->lifetime);
 			/* fd will be closed in release_tcpconn */
 			io_watch_del(&io_w, con->fd, -1, IO_FD_CLOSING);
-			tcpconn_listrm(tcp_conn_lst, con, c_next, c_prev);
+			tcp_conn_lst_rm(con);
 			release_tcpconn(con, CONN_RELEASE, tcpmain_sock);
 		}
 	}
@@ -0,0 +1,71 @@
+#!/bin/bash
+# benchmark permissions subnet lookups, table scan against prefix trie
+
+# Copyright (C) 2011 Voice System
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# run with "-v" to print the lookup times (see bm_poll_results)
+
+source include/require
+
+if ! (check_sipp && check_opensips && check_module "db_mysql" \
+		&& check_module "benchmark"); then
+	exit 0
+fi ;
+
+CFG=36.cfg
+SRV=5060
+UAC=5080
+SUBNETS=1000
+MYSQL="mysql --show-warnings -B -u opensips --password=opensipsrw -D opensips"
+
+# many subnets of the same group, the one matching the test traffic last
+SQL=""
+for ((i=0; i<$SUBNETS-1; i++)) ; do
+	SQL="$SQL INSERT INTO address (grp, ip_addr, mask, context_info) VALUES (1, '10.$((i/256)).$((i%256)).0', 24, 'bm36');"
+done
+$MYSQL -e "$SQL INSERT INTO address (grp, ip_addr, mask, context_info) VALUES (1, '127.0.0.0', 8, 'bm36');"
+
+ret=0
+for TRIE in 0 1 ; do
+	cp $CFG $CFG.bak
+	echo "modparam(\"permissions\", \"subnet_trie\", $TRIE)" >> $CFG
+
+	../opensips -w . -f $CFG &> /dev/null
+	sleep 1
+	sipp -sn uac 127.0.0.1:$SRV -i 127.0.0.1 -m 2000 -r 1000 -p $UAC &> /dev/null
+	ret=$?
+	if [ "$1" = "-v" ] ; then
+		echo "subnet_trie=$TRIE:"
+		../scripts/opensipsctl fifo bm_poll_results
+	fi ;
+
+	killall -9 sipp > /dev/null 2>&1
+	killall -9 opensips > /dev/null 2>&1
+	mv $CFG.bak $CFG
+	sleep 1
+
+	if [ ! "$ret" -eq 0 ] ; then
+		break
+	fi ;
+done ;
+
+# cleanup
+$MYSQL -e "DELETE FROM address WHERE context_info='bm36';"
+
+exit $ret;
@@ -0,0 +1,71 @@
+#!/bin/bash
+# benchmark tm timer engines, sorted timer lists against timing wheels
+
+# Copyright (C) 2011 Voice System
+#
+# This file is part of opensips, a free SIP server.
+#
+# opensips is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version
+#
+# opensips is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+# run with "-v" to print the relay times (see bm_poll_results) and the
+# CPU time used by opensips for each engine
+
+# every call sets and resets about ten transaction timers (retransmission,
+# FR, FR INV with a random value, WAIT, DELETE), so the default load gives
+# more than a million timer operations for each engine
+
+source include/require
+
+if ! (check_sipp && check_opensips && check_module "benchmark"); then
+	exit 0
+fi ;
+
+CFG=37.cfg
+SRV=5060
+UAS=5070
+UAC=5080
+CALLS=100000
+RATE=2000
+
+ret=0
+for ENGINE in 0 1 ; do
+	cp $CFG $CFG.bak
+	echo "modparam(\"tm\", \"timer_engine\", $ENGINE)" >> $CFG
+
+	../opensips -w . -f $CFG &> /dev/null
+	sleep 1
+	sipp -sf ringing_uas.xml -bg -i 127.0.0.1 -m $CALLS -p $UAS &> /dev/null
+	sipp -sn uac 127.0.0.1:$SRV -i 127.0.0.1 -m $CALLS -r $RATE -l $((RATE*10)) -p $UAC &> /dev/null
+	ret=$?
+	if [ "$1" = "-v" ] ; then
+		echo "timer_engine=$ENGINE:"
+		../scripts/opensipsctl fifo bm_poll_results
+		# utime + stime of all the processes, in clock ticks
+		for PID in `pgrep -x opensips` ; do
+			cat /proc/$PID/stat
+		done | awk '{ t += $14 + $15 } END { print "cpu ticks: " t }'
+	fi ;
+
+	killall -9 sipp > /dev/null 2>&1
+	killall -9 opensips > /dev/null 2>&1
+	mv $CFG.bak $CFG
+	sleep 1
+
+	if [ ! "$ret" -eq 0 ] ; then
+		break
+	fi ;
+done ;
+
+exit $ret;
@@ -33,6 +33,10 @@
  */
 
 
+#if defined(HAVE_MMSG) || defined(HAVE_SCHED_SETAFFINITY)
+#define _GNU_SOURCE /* recvmmsg, sendmmsg, sched_setaffinity */
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -41,7 +45,11 @@
 #include <netinet/in_systm.h>
 #include <netinet/ip.h>
 #include <errno.h>
+#include <unistd.h>
 #include <arpa/inet.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+	#include <sched.h>
+#endif
 #ifdef __linux__
 	#include <linux/types.h>
 	#include <linux/errqueue.h>
@@ -62,6 +70,9 @@
 
 static callback_list* cb_list = NULL;
 
+/* socket the process reads from, if other than bind_address->socket */
+static int udp_rcv_sock = -1;
+
 int register_udprecv_cb(callback_f* func, void* param, char a, char b){
     callback_list* new;
 
@@ -203,40 +214,44 @@ static int setup_mcast_rcvr(int sock, union sockaddr_union* addr)
 #endif /* USE_MCAST */
 
 /**
- * Initialize a UDP socket, supports multicast, IPv4 and IPv6.
+ * Creates and binds one UDP socket for the given address, supports
+ * multicast, IPv4 and IPv6.
  * \param sock_info socket that should be bind
- * \return zero on success, -1 otherwise
+ * \param reuse_port set SO_REUSEPORT, so more sockets may bind the address
+ * \return the socket, -1 on error
  */
-int udp_init(struct socket_info* sock_info)
+static int udp_open_socket(struct socket_info* sock_info, int reuse_port)
 {
 	union sockaddr_union* addr;
 	int optval;
+	int s;
 #ifdef USE_MCAST
 	unsigned char m_optval;
 #endif
 
 	addr=&sock_info->su;
-	sock_info->proto=PROTO_UDP;
-	if (init_su(addr, &sock_info->address, sock_info->port_no)<0){
-		LM_ERR("could not init sockaddr_union\n");
-		goto error;
-	}
-	
-	sock_info->socket = socket(AF2PF(addr->s.sa_family), SOCK_DGRAM, 0);
-	if (sock_info->socket==-1){
+	s = socket(AF2PF(addr->s.sa_family), SOCK_DGRAM, 0);
+	if (s==-1){
 		LM_ERR("socket: %s\n", strerror(errno));
-		goto error;
+		return -1;
 	}
 	/* set sock opts? */
 	optval=1;
-	if (setsockopt(sock_info->socket, SOL_SOCKET, SO_REUSEADDR ,
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR ,
 					(void*)&optval, sizeof(optval)) ==-1){
 		LM_ERR("setsockopt: %s\n", strerror(errno));
 		goto error;
 	}
+#ifdef SO_REUSEPORT
+	if (reuse_port && setsockopt(s, SOL_SOCKET, SO_REUSEPORT,
+					(void*)&optval, sizeof(optval)) ==-1){
+		LM_ERR("setsockopt(SO_REUSEPORT): %s\n", strerror(errno));
+		goto error;
+	}
+#endif
 	/* tos */
 	optval=tos;
-	if (setsockopt(sock_info->socket, IPPROTO_IP, IP_TOS, (void*)&optval, 
+	if (setsockopt(s, IPPROTO_IP, IP_TOS, (void*)&optval, 
 			sizeof(optval)) ==-1){
 		LM_WARN("setsockopt tos: %s\n", strerror(errno));
 		/* continue since this is not critical */
@@ -244,7 +259,7 @@ int udp_init(struct socket_info* sock_info)
 #if defined (__linux__) && defined(UDP_ERRORS)
 	optval=1;
 	/* enable error receiving on unconnected sockets */
-	if(setsockopt(sock_info->socket, SOL_IP, IP_RECVERR,
+	if(setsockopt(s, SOL_IP, IP_RECVERR,
 					(void*)&optval, sizeof(optval)) ==-1){
 		LM_ERR("setsockopt: %s\n", strerror(errno));
 		goto error;
@@ -253,13 +268,13 @@ int udp_init(struct socket_info* sock_info)
 
 #ifdef USE_MCAST
 	if ((sock_info->flags & SI_IS_MCAST) 
-	    && (setup_mcast_rcvr(sock_info->socket, addr)<0)){
+	    && (setup_mcast_rcvr(s, addr)<0)){
 			goto error;
 	}
 	/* set the multicast options */
 	if (addr->s.sa_family==AF_INET){
 		m_optval = mcast_loopback;
-		if (setsockopt(sock_info->socket, IPPROTO_IP, IP_MULTICAST_LOOP, 
+		if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, 
 						&m_optval, sizeof(m_optval))==-1){
 			LM_WARN("setsockopt(IP_MULTICAST_LOOP): %s\n", strerror(errno));
 			/* it's only a warning because we might get this error if the
@@ -267,7 +282,7 @@ int udp_init(struct socket_info* sock_info)
 		}
 		if (mcast_ttl>=0){
 			m_optval = mcast_ttl;
-			if (setsockopt(sock_info->socket, IPPROTO_IP, IP_MULTICAST_TTL,
+			if (setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL,
 						&m_optval, sizeof(m_optval))==-1){
 				LM_ERR("setsockopt (IP_MULTICAST_TTL): %s\n", strerror(errno));
 				goto error;
@@ -275,14 +290,14 @@ int udp_init(struct socket_info* sock_info)
 		}
 #ifdef USE_IPV6
 	} else if (addr->s.sa_family==AF_INET6){
-		if (setsockopt(sock_info->socket, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, 
+		if (setsockopt(s, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, 
 						&mcast_loopback, sizeof(mcast_loopback))==-1){
 			LM_WARN("setsockopt (IPV6_MULTICAST_LOOP): %s\n", strerror(errno));
 			/* it's only a warning because we might get this error if the
 			  network interface doesn't support multicasting */
 		}
 		if (mcast_ttl>=0){
-			if (setsockopt(sock_info->socket, IPPROTO_IP, IPV6_MULTICAST_HOPS,
+			if (setsockopt(s, IPPROTO_IP, IPV6_MULTICAST_HOPS,
 						&mcast_ttl, sizeof(mcast_ttl))==-1){
 				LM_ERR("setssckopt (IPV6_MULTICAST_HOPS): %s\n",
 						strerror(errno));
@@ -296,11 +311,11 @@ int udp_init(struct socket_info* sock_info)
 	}
 #endif /* USE_MCAST */
 
-	if (probe_max_sock_buff(sock_info->socket,0,MAX_RECV_BUFFER_SIZE,
+	if (probe_max_sock_buff(s,0,MAX_RECV_BUFFER_SIZE,
 				BUFFER_INCREMENT)==-1) goto error;
 	
-	if (bind(sock_info->socket,  &addr->s, sockaddru_len(*addr))==-1){
-		LM_ERR("bind(%x, %p, %d) on %s: %s\n", sock_info->socket, &addr->s, 
+	if (bind(s,  &addr->s, sockaddru_len(*addr))==-1){
+		LM_ERR("bind(%x, %p, %d) on %s: %s\n", s, &addr->s, 
 				(unsigned)sockaddru_len(*addr),	sock_info->address_str.s,
 				strerror(errno));
 	#ifdef USE_IPV6
@@ -310,11 +325,226 @@ int udp_init(struct socket_info* sock_info)
 	#endif
 		goto error;
 	}
-	return 0;
+	return s;
 
 error:
+	close(s);
+	return -1;
+}
+
+
+/**
+ * Initialize a UDP socket, supports multicast, IPv4 and IPv6.
+ * If udp_reuse_port is set, each UDP process of the interface also gets
+ * its own SO_REUSEPORT receive socket, the first one being the main
+ * socket (used by all the processes for sending). Multicast sockets
+ * are not split.
+ * \param sock_info socket that should be bind
+ * \return zero on success, -1 otherwise
+ */
+int udp_init(struct socket_info* sock_info)
+{
+	int reuse_port;
+	int i;
+
+	sock_info->proto=PROTO_UDP;
+	if (init_su(&sock_info->su, &sock_info->address, sock_info->port_no)<0){
+		LM_ERR("could not init sockaddr_union\n");
+		return -1;
+	}
+
+	/* each reuseport socket of a multicast group gets a copy of every
+	 * datagram, so there the processes keep sharing one socket */
+	reuse_port = (udp_reuse_port && !dont_fork && children_no>1 &&
+		!(sock_info->flags & SI_IS_MCAST));
+	sock_info->socket = udp_open_socket(sock_info, reuse_port);
+	if (sock_info->socket==-1)
+		return -1;
+	if (!reuse_port)
+		return 0;
+
+	sock_info->rcv_socks = (int*)pkg_malloc(children_no*sizeof(int));
+	if (sock_info->rcv_socks==0) {
+		LM_ERR("out of pkg memory\n");
+		return -1;
+	}
+	sock_info->rcv_socks[0] = sock_info->socket;
+	for( i=1 ; i<children_no ; i++ ) {
+		sock_info->rcv_socks[i] = udp_open_socket(sock_info, 1);
+		if (sock_info->rcv_socks[i]==-1) {
+			LM_ERR("failed to open receive socket %d for %.*s\n",
+				i, sock_info->sock_str.len, sock_info->sock_str.s);
+			return -1;
+		}
+	}
+	LM_DBG("%d SO_REUSEPORT sockets opened for %.*s\n", children_no,
+		sock_info->sock_str.len, sock_info->sock_str.s);
+	return 0;
+}
+
+
+/**
+ * Prepares a forked UDP process for listening on bind_address: picks its
+ * own receive socket, closes the ones of the other processes and, if
+ * required, pins the process on a CPU.
+ * \param idx index of the process among the ones of the interface
+ * \return zero on success, -1 otherwise
+ */
+int udp_init_worker(int idx)
+{
+	int i;
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t mask;
+	long ncpu;
+#endif
+
+	if (bind_address->rcv_socks) {
+		udp_rcv_sock = bind_address->rcv_socks[idx];
+		/* the main socket (index 0) is still needed for sending */
+		for( i=1 ; i<children_no ; i++ )
+			if (i!=idx)
+				close(bind_address->rcv_socks[i]);
+	}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (udp_workers_affinity) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		if (ncpu>0) {
+			CPU_ZERO(&mask);
+			CPU_SET(idx % ncpu, &mask);
+			if (sched_setaffinity(0, sizeof(mask), &mask)<0)
+				LM_WARN("failed to pin UDP process on cpu %ld: %s\n",
+					idx % ncpu, strerror(errno));
+		}
+	}
+#endif
+	return 0;
+}
+
+
+/**
+ * Processes one received datagram: stun callbacks, sanity checks and
+ * passing the message to receive_msg.
+ * \param buf datagram, with one extra byte for the 0-termination
+ * \param len datagram length
+ * \param from sender address
+ * \param ri receive info, the source fields are filled in here
+ */
+static inline void udp_handle_msg(char *buf, int len,
+						union sockaddr_union *from, struct receive_info *ri)
+{
+	char *tmp;
+	callback_list* p;
+
+#ifndef NO_ZERO_CHECKS
+	if (len<MIN_UDP_PACKET) {
+		LM_DBG("probing packet received len = %d\n", len);
+		return;
+	}
+#endif
+
+	if(buf[0] == 0){    /* stun specific */
+		for(p = cb_list; p; p = p->next){
+			if(p->b == buf[1]){
+				if(p->func(bind_address->socket, (struct sockaddr_in*)
+				&from->sin, buf, len, p->param) == 0){
+					/* buffer consumed by callback */
+					break;
+				}
+			}
+		}
+		if (p) return;
+	}
+
+	/* we must 0-term the messages, receive_msg expects it */
+	buf[len]=0; /* no need to save the previous char */
+
+	ri->src_su=*from;
+	su2ip_addr(&ri->src_ip, from);
+	ri->src_port=su_getport(from);
+
+#ifdef DBG_MSG_QA
+	if (!dbg_msg_qa(buf, len)) {
+		LM_WARN("an incoming message didn't pass test,"
+					"  drop it: %.*s\n", len, buf );
+		return;
+	}
+#endif
+	if (ri->src_port==0){
+		tmp=ip_addr2a(&ri->src_ip);
+		LM_INFO("dropping 0 port packet from %s\n", tmp);
+		return;
+	}
+
+	atomic_inc(pt[process_no].load);
+
+	/* receive_msg must free buf too!*/
+	receive_msg(buf, len, ri);
+
+	atomic_dec(pt[process_no].load);
+}
+
+
+#if defined(HAVE_MMSG) && !defined(DYN_BUF)
+/**
+ * UDP receiver loop reading up to udp_rcv_batch datagrams with one
+ * recvmmsg() call; the datagrams are processed one after the other, as
+ * the simple loop does.
+ * \param ri receive info of the listener
+ * \param sock socket to read from
+ * \see udp_rcv_loop
+ * \return -1 for errors
+ */
+static int udp_rcv_batch_loop(struct receive_info *ri, int sock)
+{
+	/* only the pages actually touched by datagrams get allocated */
+	static char bufs[UDP_RCV_BATCH_MAX][BUF_SIZE+1];
+	struct mmsghdr msgs[UDP_RCV_BATCH_MAX];
+	struct iovec iov[UDP_RCV_BATCH_MAX];
+	union sockaddr_union from[UDP_RCV_BATCH_MAX];
+	int batch;
+	int n, i;
+
+	batch = udp_rcv_batch;
+	if (batch>UDP_RCV_BATCH_MAX) {
+		LM_WARN("udp_rcv_batch %d too big, using %d\n",
+			batch, UDP_RCV_BATCH_MAX);
+		batch = UDP_RCV_BATCH_MAX;
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+	memset(from, 0, sizeof(from));
+	for( i=0 ; i<batch ; i++ ) {
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = BUF_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &from[i].s;
+	}
+
+	for(;;){
+		for( i=0 ; i<batch ; i++ )
+			msgs[i].msg_hdr.msg_namelen = sockaddru_len(bind_address->su);
+		/* block for the first datagram only, then take what is queued */
+		n=recvmmsg(sock, msgs, batch, MSG_WAITFORONE, 0);
+		if (n==-1){
+			if (errno==EAGAIN){
+				LM_DBG("packet with bad checksum received\n");
+				continue;
+			}
+			LM_ERR("recvmmsg:[%d] %s\n", errno, strerror(errno));
+			if ((errno==EINTR)||(errno==EWOULDBLOCK)|| (errno==ECONNREFUSED))
+				continue;
+			else return -1;
+		}
+
+		for( i=0 ; i<n ; i++ )
+			udp_handle_msg(bufs[i], msgs[i].msg_len, &from[i], ri);
+	}
+
 	return -1;
 }
+#endif
 
 
 /**
@@ -334,11 +564,23 @@ int udp_rcv_loop(void)
 #else
 	static char buf [BUF_SIZE+1];
 #endif
-	char *tmp;
 	union sockaddr_union* from;
 	unsigned int fromlen;
 	struct receive_info ri;
-	callback_list* p;
+	int sock;
+
+	sock = (udp_rcv_sock!=-1) ? udp_rcv_sock : bind_address->socket;
+
+	ri.bind_address=bind_address; /* this will not change, we do it only once */
+	ri.dst_port=bind_address->port_no;
+	ri.dst_ip=bind_address->address;
+	ri.proto=PROTO_UDP;
+	ri.proto_reserved1=ri.proto_reserved2=0;
+
+#if defined(HAVE_MMSG) && !defined(DYN_BUF)
+	if (udp_rcv_batch>1)
+		return udp_rcv_batch_loop(&ri, sock);
+#endif
 
 	from=(union sockaddr_union*) pkg_malloc(sizeof(union sockaddr_union));
 	if (from==0){
@@ -346,11 +588,6 @@ int udp_rcv_loop(void)
 		goto error;
 	}
 	memset(from, 0 , sizeof(union sockaddr_union));
-	ri.bind_address=bind_address; /* this will not change, we do it only once */
-	ri.dst_port=bind_address->port_no;
-	ri.dst_ip=bind_address->address;
-	ri.proto=PROTO_UDP;
-	ri.proto_reserved1=ri.proto_reserved2=0;
 	for(;;){
 #ifdef DYN_BUF
 		buf=pkg_malloc(BUF_SIZE+1);
@@ -360,7 +597,7 @@ int udp_rcv_loop(void)
 		}
 #endif
 		fromlen=sockaddru_len(bind_address->su);
-		len=recvfrom(bind_address->socket, buf, BUF_SIZE, 0, &from->s,
+		len=recvfrom(sock, buf, BUF_SIZE, 0, &from->s,
 											&fromlen);
 		if (len==-1){
 			if (errno==EAGAIN){
@@ -373,61 +610,135 @@ int udp_rcv_loop(void)
 			else goto error;
 		}
 
-#ifndef NO_ZERO_CHECKS
-		if (len<MIN_UDP_PACKET) {
-			LM_DBG("probing packet received len = %d\n", len);
-			continue;
-		}
-#endif
+		udp_handle_msg(buf, len, from, &ri);
+	/* skip: do other stuff */
+	}
+	
+error:
+	if (from) pkg_free(from);
+	return -1;
+}
 
-		if(buf[0] == 0){    /* stun specific */
-			for(p = cb_list; p; p = p->next){
-				if(p->b == buf[1]){
-					if(p->func(bind_address->socket, (struct sockaddr_in*)
-					&from->sin, buf, len, p->param) == 0){
-						/* buffer consumed by callback */
-						break;
-					}
-				}
-			}
-			if (p) continue;
-		}
 
-		/* we must 0-term the messages, receive_msg expects it */
-		buf[len]=0; /* no need to save the previous char */
+#ifdef HAVE_MMSG
+/* datagrams queued by udp_send() while a send batch is open */
+struct udp_snd_batch {
+	int active;
+	struct socket_info *source;
+	int n;
+	unsigned int used;
+	struct mmsghdr msgs[UDP_SND_BATCH_MAX];
+	struct iovec iov[UDP_SND_BATCH_MAX];
+	union sockaddr_union to[UDP_SND_BATCH_MAX];
+	char buf[UDP_SND_BATCH_SIZE];
+};
 
-		ri.src_su=*from;
-		su2ip_addr(&ri.src_ip, from);
-		ri.src_port=su_getport(from);
+static struct udp_snd_batch *snd_batch = 0;
 
-#ifdef DBG_MSG_QA
-		if (!dbg_msg_qa(buf, len)) {
-			LM_WARN("an incoming message didn't pass test,"
-						"  drop it: %.*s\n", len, buf );
+
+/* sends all the queued datagrams, keeping the batch open */
+static void udp_batch_send(void)
+{
+	int n, i;
+
+	i = 0;
+	while (i<snd_batch->n) {
+		n=sendmmsg(snd_batch->source->socket, snd_batch->msgs+i,
+			snd_batch->n-i, 0);
+		if (n==-1){
+			if (errno==EINTR) continue;
+			/* the datagram on top failed - report it and go on */
+			LM_ERR("sendmmsg(sock,%p,%d,0,%p): %s(%d)\n",
+				snd_batch->iov[i].iov_base, (int)snd_batch->iov[i].iov_len,
+				&snd_batch->to[i], strerror(errno),errno);
+			i++;
 			continue;
 		}
+		i += n;
+	}
+	snd_batch->n = 0;
+	snd_batch->used = 0;
+}
 #endif
-		if (ri.src_port==0){
-			tmp=ip_addr2a(&ri.src_ip);
-			LM_INFO("dropping 0 port packet from %s\n", tmp);
-			continue;
-		}
-		
-		atomic_inc(pt[process_no].load);
 
-		/* receive_msg must free buf too!*/
-		receive_msg(buf, len, &ri);
-		
-		atomic_dec(pt[process_no].load);
-	/* skip: do other stuff */
+
+/**
+ * Starts queuing the datagrams sent by this process via udp_send(); they
+ * are actually sent (with as few syscalls as possible) when the batch is
+ * full or by udp_batch_flush(). While queued, send errors are only
+ * logged, not reported to the udp_send() callers.
+ * \return 0 on success, -1 if batching is not possible
+ */
+int udp_batch_start(void)
+{
+#ifdef HAVE_MMSG
+	if (snd_batch==0) {
+		snd_batch = (struct udp_snd_batch*)
+			pkg_malloc(sizeof(struct udp_snd_batch));
+		if (snd_batch==0) {
+			LM_ERR("out of pkg memory\n");
+			return -1;
+		}
+		memset(snd_batch, 0, sizeof(struct udp_snd_batch));
 	}
-	
-error:
-	if (from) pkg_free(from);
+	snd_batch->active = 1;
+	return 0;
+#else
 	return -1;
+#endif
+}
+
+
+/**
+ * Sends the datagrams queued since udp_batch_start() and stops queuing.
+ */
+void udp_batch_flush(void)
+{
+#ifdef HAVE_MMSG
+	if (snd_batch==0 || !snd_batch->active)
+		return;
+	if (snd_batch->n)
+		udp_batch_send();
+	snd_batch->active = 0;
+#endif
 }
 
 
+#ifdef HAVE_MMSG
+/* queues a datagram into the open send batch */
+static int udp_batch_add(struct socket_info *source, char *buf, unsigned len,
+										union sockaddr_union*  to)
+{
+	struct msghdr *hdr;
+	int i;
+
+	/* a batch is sent over a single socket */
+	if ( snd_batch->n && (snd_batch->source!=source ||
+	snd_batch->n==UDP_SND_BATCH_MAX ||
+	snd_batch->used+len>UDP_SND_BATCH_SIZE) )
+		udp_batch_send();
+
+	i = snd_batch->n++;
+	snd_batch->source = source;
+	/* the buffer may be a temporary one, so copy it */
+	memcpy(snd_batch->buf+snd_batch->used, buf, len);
+	snd_batch->iov[i].iov_base = snd_batch->buf+snd_batch->used;
+	snd_batch->iov[i].iov_len = len;
+	snd_batch->used += len;
+	snd_batch->to[i] = *to;
+
+	hdr = &snd_batch->msgs[i].msg_hdr;
+	memset(hdr, 0, sizeof(struct msghdr));
+	hdr->msg_name = &snd_batch->to[i].s;
+	hdr->msg_namelen = sockaddru_len(*to);
+	hdr->msg_iov = &snd_batch->iov[i];
+	hdr->msg_iovlen = 1;
+
+	return len;
+}
+#endif
+
+
 /**
  * Main UDP send function, called from msg_send.
  * \see msg_send 
@@ -450,6 +761,11 @@ int udp_send(struct socket_info *source, char *buf, unsigned len,
 	}
 #endif
 
+#ifdef HAVE_MMSG
+	if (snd_batch && snd_batch->active && len<=UDP_SND_BATCH_SIZE)
+		return udp_batch_add(source, buf, len, to);
+#endif
+
 	tolen=sockaddru_len(*to);
 again:
 	n=sendto(source->socket, buf, len, 0, &to->s, tolen);
@@ -39,11 +39,23 @@ typedef struct cb_list{
     struct cb_list* next;   /* linked list */
 }callback_list;
 
+#ifdef HAVE_MMSG
+/* max datagrams read with one syscall (udp_rcv_batch) */
+#define UDP_RCV_BATCH_MAX   32
+/* max datagrams, and max bytes, held by a send batch */
+#define UDP_SND_BATCH_MAX   64
+#define UDP_SND_BATCH_SIZE  (64*1024)
+#endif
+
 int udp_init(struct socket_info* si);
 int udp_send(struct socket_info* source,char *buf, unsigned len,
 				union sockaddr_union*  to);
+int udp_init_worker(int idx);
 int udp_rcv_loop();
 
+int udp_batch_start(void);
+void udp_batch_flush(void);
+
 int register_udprecv_cb(callback_f func, void* param, char a, char b);
 
 #endif
@@ -119,6 +119,12 @@
 #define F_MALLOC_STR ""
 #endif
 
+#ifdef SHM_CACHE
+#define SHM_CACHE_STR ", SHM_CACHE"
+#else
+#define SHM_CACHE_STR ""
+#endif
+
 #ifdef USE_SHM_MEM
 #define USE_SHM_MEM_STR ", USE_SHM_MEM"
 #else
@@ -191,6 +197,7 @@
 	STATS_STR EXTRA_DEBUG_STR USE_IPV6_STR USE_TCP_STR USE_TLS_STR \
 	USE_SCTP_STR DISABLE_NAGLE_STR USE_MCAST_STR NO_DEBUG_STR NO_LOG_STR \
 	SHM_MEM_STR SHM_MMAP_STR PKG_MALLOC_STR VQ_MALLOC_STR F_MALLOC_STR \
+	SHM_CACHE_STR \
 	USE_SHM_MEM_STR DBG_QM_MALLOC_STR DBG_F_MALLOC_STR DEBUG_DMALLOC_STR \
 	QM_JOIN_FREE_STR FAST_LOCK_STR NOSMP_STR USE_PTHREAD_MUTEX_STR \
 	USE_POSIX_SEM_STR USE_SYSV_SEM_STR